@@ -0,0 +1,113 @@
+#include "AttachmentTransfer.h"
+#include "Protocol.h"
+#include <QDataStream>
+#include <QDebug>
+
+AttachmentTransfer::AttachmentTransfer(Direction direction, const QString& hash, const QString& filePath,
+                                       qint64 offset, qint64 size, QObject *parent)
+    : QObject(parent), m_direction(direction), m_hash(hash), m_filePath(filePath),
+      m_done(offset), m_size(size), m_socket(new QSslSocket(this)), m_file(filePath), m_finished(false) {
+    
+    connect(m_socket, &QSslSocket::bytesWritten, this, &AttachmentTransfer::onBytesWritten);
+    connect(m_socket, &QSslSocket::readyRead, this, &AttachmentTransfer::onReadyRead);
+    connect(m_socket, &QSslSocket::disconnected, this, &AttachmentTransfer::onDisconnected);
+    connect(m_socket, &QSslSocket::errorOccurred, this, [this]() {
+        qDebug() << "Attachment transfer error:" << m_socket->errorString();
+        finish(false);
+    });
+}
+
+void AttachmentTransfer::start(const QString& host, quint16 port, const QByteArray& token,
+                               const QSslConfiguration& tls) {
+    m_token = token;
+    
+    bool opened = m_direction == UPLOAD ? m_file.open(QIODevice::ReadOnly) && m_file.seek(m_done)
+                                        : m_file.open(QIODevice::Append);
+    if (!opened) {
+        finish(false);
+        return;
+    }
+    
+    if (tls.isNull()) {
+        connect(m_socket, &QSslSocket::connected, this, &AttachmentTransfer::onConnected);
+        m_socket->connectToHost(host, port);
+    } else {
+        connect(m_socket, &QSslSocket::encrypted, this, &AttachmentTransfer::onConnected);
+        m_socket->setSslConfiguration(tls);
+        m_socket->connectToHostEncrypted(host, port);
+    }
+}
+
+void AttachmentTransfer::onConnected() {
+    QByteArray header;
+    QDataStream headerOut(&header, QIODevice::WriteOnly);
+    headerOut << m_token << m_done;
+    
+    QByteArray block;
+    QDataStream out(&block, QIODevice::WriteOnly);
+    out << quint32(header.size());
+    block.append(header);
+    m_socket->write(block);
+    
+    if (m_direction == UPLOAD) {
+        fillSendBuffer();
+    }
+}
+
+void AttachmentTransfer::fillSendBuffer() {
+    // Keep a few chunks in flight instead of loading the whole file
+    while (m_done < m_size && m_socket->bytesToWrite() < 4 * ChatProtocol::ATTACHMENT_CHUNK_SIZE) {
+        QByteArray chunk = m_file.read(qMin(m_size - m_done, ChatProtocol::ATTACHMENT_CHUNK_SIZE));
+        if (chunk.isEmpty()) {
+            finish(false);
+            return;
+        }
+        m_socket->write(chunk);
+        m_done += chunk.size();
+    }
+}
+
+void AttachmentTransfer::onBytesWritten(qint64 bytes) {
+    Q_UNUSED(bytes);
+    if (m_direction != UPLOAD || m_finished) return;
+    
+    emit progress(m_hash, m_done - m_socket->bytesToWrite(), m_size);
+    fillSendBuffer();
+}
+
+void AttachmentTransfer::onReadyRead() {
+    if (m_direction == UPLOAD) {
+        // The server answers with a single status byte once the blob is verified
+        char status = 0;
+        if (m_socket->getChar(&status)) {
+            finish(status == 1);
+        }
+        return;
+    }
+    
+    QByteArray data = m_socket->read(m_size - m_done);
+    if (m_file.write(data) != data.size()) {
+        finish(false);
+        return;
+    }
+    
+    m_done += data.size();
+    emit progress(m_hash, m_done, m_size);
+    
+    if (m_done == m_size) {
+        finish(true);
+    }
+}
+
+void AttachmentTransfer::onDisconnected() {
+    finish(m_direction == DOWNLOAD && m_done == m_size);
+}
+
+void AttachmentTransfer::finish(bool ok) {
+    if (m_finished) return;
+    m_finished = true;
+    
+    m_file.close();
+    m_socket->abort();
+    emit finished(m_hash, ok);
+}
\ No newline at end of file
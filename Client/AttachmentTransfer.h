@@ -0,0 +1,54 @@
+#ifndef ATTACHMENTTRANSFER_H
+#define ATTACHMENTTRANSFER_H
+
+#include <QObject>
+#include <QSslSocket>
+#include <QSslConfiguration>
+#include <QFile>
+
+// One upload or download on the bulk channel. Runs on its own connection so
+// the chat socket is never blocked, and can resume from a byte offset.
+class AttachmentTransfer : public QObject {
+    Q_OBJECT
+    
+public:
+    enum Direction {
+        UPLOAD,
+        DOWNLOAD
+    };
+    
+    AttachmentTransfer(Direction direction, const QString& hash, const QString& filePath,
+                       qint64 offset, qint64 size, QObject *parent = nullptr);
+    
+    void start(const QString& host, quint16 port, const QByteArray& token,
+               const QSslConfiguration& tls = QSslConfiguration());
+    
+    QString hash() const { return m_hash; }
+    QString filePath() const { return m_filePath; }
+    
+signals:
+    void progress(const QString& hash, qint64 done, qint64 total);
+    void finished(const QString& hash, bool ok);
+    
+private slots:
+    void onConnected();
+    void onBytesWritten(qint64 bytes);
+    void onReadyRead();
+    void onDisconnected();
+    
+private:
+    void fillSendBuffer();
+    void finish(bool ok);
+    
+    Direction m_direction;
+    QString m_hash;
+    QString m_filePath;
+    qint64 m_done;
+    qint64 m_size;
+    QByteArray m_token;
+    QSslSocket *m_socket;
+    QFile m_file;
+    bool m_finished;
+};
+
+#endif // ATTACHMENTTRANSFER_H
\ No newline at end of file
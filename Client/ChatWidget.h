@@ -2,44 +2,92 @@
 #define CHATWIDGET_H
 
 #include <QWidget>
-#include <QTextEdit>
+#include <QListView>
+#include <QSet>
 #include <QLineEdit>
 #include <QPushButton>
 #include <QLabel>
 #include <QDateTime>
+#include <QTimer>
+#include "Protocol.h"
+#include "ConversationDispatcher.h"
 
 class NetworkManager;
+class MessageListModel;
 
-class ChatWidget : public QWidget {
+class ChatWidget : public QWidget, public ConversationView {
     Q_OBJECT
     
 public:
     explicit ChatWidget(NetworkManager *networkManager, const QString& currentUser, 
                        const QString& contact, bool isGroup, QWidget *parent = nullptr);
+    ~ChatWidget();
     
-    void appendMessage(const QString& sender, const QString& content, const QDateTime& timestamp);
+    void appendMessage(const QString& sender, const QString& content, const QDateTime& timestamp, int messageId = 0);
+    void showTyping(const QString& sender);
+    void showReadReceipt(const QDateTime& upTo);
+    
+protected:
+    void showEvent(QShowEvent *event) override;
     
 private slots:
     void onSendClicked();
-    void onMessageHistoryReceived(const QString& sender, const QString& recipient, 
-                                  const QString& content, const QDateTime& timestamp);
     void onGroupMembersClicked();
-    void onGroupMembersReceived(const QString& groupName, const QStringList& members, const QString& admin);
+    void onAttachClicked();
+    void onAttachmentUploaded(const QString& hash, const QString& fileName, qint64 size);
+    void onAttachmentDownloaded(const QString& hash, const QString& filePath);
+    void onAttachmentFailed(const QString& hash);
+    void onMessageClicked(const QModelIndex& index);
+    void onScrolled(int value);
+    void onRowsTrimmed(const QList<int>& messageIds, int oldestId);
+    void onRowsAboutToBeInserted(const QModelIndex& parent, int first, int last);
+    void onRowsInserted(const QModelIndex& parent, int first, int last);
+    void onInputEdited(const QString& text);
+    void updateStatus();
     
 private:
     void setupUI();
     void loadMessageHistory();
+    void sendContent(const QString& content);
+    
+    // ConversationView, called directly by the dispatcher
+    void historyRow(const ChatProtocol::Message& msg) override;
+    void historyEnd() override;
+    void groupMembers(const QStringList& members, const QString& admin) override;
     
     NetworkManager *m_networkManager;
     QString m_currentUser;
     QString m_contact;
     bool m_isGroup;
+    QString m_key; // MessageCache / dispatcher key
     
-    QTextEdit *m_chatDisplay;
+    QListView *m_chatView;
+    MessageListModel *m_model;
     QLineEdit *m_messageInput;
     QPushButton *m_sendButton;
+    QPushButton *m_attachButton;
     QPushButton *m_groupMembersButton;
     QLabel *m_contactLabel;
+    QLabel *m_statusLabel;
+    QTimer *m_typingTimer;
+    QString m_typingUser;
+    QDateTime m_seenUpTo;
+    QDateTime m_lastIncoming;
+    
+    QSet<QString> m_pendingUploads;   // hashes this chat is waiting to send
+    QSet<QString> m_pendingDownloads; // hashes this chat asked to save
+    
+    bool m_historyLoaded;  // the first page has fully arrived
+    bool m_loadingOlder;   // an older page is on its way
+    bool m_syncing;        // fetching what was sent since the newest cached message
+    bool m_hasOlder;
+    bool m_followBottom;   // keep the newest message in view
+    int m_prependAnchor;   // scroll distance from the bottom kept across a prepend
+    QList<ChatProtocol::Message> m_olderPage;
+    QSet<int> m_knownIds;  // server ids already shown
+    int m_latestId;
+    int m_oldestId;        // the next older page is requested before this id
+    int m_replyRows;
 };
 
 #endif // CHATWIDGET_H
\ No newline at end of file
@@ -1,23 +1,41 @@
 #include "ChatWidget.h"
 #include "NetworkManager.h"
+#include "MessageListModel.h"
+#include "MessageDelegate.h"
+#include "MessageCache.h"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QMessageBox>
 #include <QInputDialog>
 #include <QScrollBar>
+#include <QFileDialog>
 
 ChatWidget::ChatWidget(NetworkManager *networkManager, const QString& currentUser, 
                       const QString& contact, bool isGroup, QWidget *parent)
     : QWidget(parent), m_networkManager(networkManager), m_currentUser(currentUser),
-      m_contact(contact), m_isGroup(isGroup) {
+      m_contact(contact), m_isGroup(isGroup), m_key(MessageCache::keyFor(contact, isGroup)), m_model(new MessageListModel(currentUser, this)),
+      m_typingTimer(new QTimer(this)), m_historyLoaded(false), m_loadingOlder(false),
+      m_syncing(false), m_hasOlder(true), m_followBottom(true), m_prependAnchor(0),
+      m_latestId(0), m_oldestId(0), m_replyRows(0) {
+    
+    m_typingTimer->setSingleShot(true);
+    m_typingTimer->setInterval(ChatProtocol::TYPING_DISPLAY_MS);
+    connect(m_typingTimer, &QTimer::timeout, this, &ChatWidget::updateStatus);
     
     setupUI();
+    m_networkManager->conversations()->attach(m_key, this);
     loadMessageHistory();
     
-    connect(m_networkManager, &NetworkManager::messageHistoryReceived, 
-            this, &ChatWidget::onMessageHistoryReceived);
-    connect(m_networkManager, &NetworkManager::groupMembersReceived,
-            this, &ChatWidget::onGroupMembersReceived);
+    connect(m_networkManager, &NetworkManager::attachmentUploaded,
+            this, &ChatWidget::onAttachmentUploaded);
+    connect(m_networkManager, &NetworkManager::attachmentDownloaded,
+            this, &ChatWidget::onAttachmentDownloaded);
+    connect(m_networkManager, &NetworkManager::attachmentFailed,
+            this, &ChatWidget::onAttachmentFailed);
+}
+
+ChatWidget::~ChatWidget() {
+    m_networkManager->conversations()->detach(m_key, this);
 }
 
 void ChatWidget::setupUI() {
@@ -39,7 +57,11 @@ void ChatWidget::setupUI() {
     m_contactLabel->setFont(headerFont);
     m_contactLabel->setStyleSheet("color: #FFFFFF;");
     
+    m_statusLabel = new QLabel();
+    m_statusLabel->setStyleSheet("color: #8696A0; font-style: italic;");
+    
     headerLayout->addWidget(m_contactLabel);
+    headerLayout->addWidget(m_statusLabel);
     headerLayout->addStretch();
     
     if (m_isGroup) {
@@ -52,9 +74,19 @@ void ChatWidget::setupUI() {
     }
     
     // Chat display - DARK THEME
-    m_chatDisplay = new QTextEdit();
-    m_chatDisplay->setReadOnly(true);
-    m_chatDisplay->setStyleSheet("QTextEdit { background-color: #0D1418; border: none; padding: 10px; }");
+    // Only visible rows are laid out and painted; heights come from the delegate's cache
+    m_chatView = new QListView();
+    m_chatView->setModel(m_model);
+    m_chatView->setItemDelegate(new MessageDelegate(m_isGroup, m_chatView));
+    m_chatView->setUniformItemSizes(false);
+    m_chatView->setResizeMode(QListView::Adjust);
+    m_chatView->setLayoutMode(QListView::Batched);
+    m_chatView->setBatchSize(200);
+    m_chatView->setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+    m_chatView->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    m_chatView->setSelectionMode(QAbstractItemView::NoSelection);
+    m_chatView->setFocusPolicy(Qt::NoFocus);
+    m_chatView->setStyleSheet("QListView { background-color: #0D1418; border: none; padding: 10px; }");
     
     // Input area - DARK THEME
     QWidget *inputArea = new QWidget();
@@ -74,74 +106,268 @@ void ChatWidget::setupUI() {
                                "padding: 10px 20px; border-radius: 20px; font-weight: bold; }"
                                "QPushButton:hover { background-color: #20BA5A; }");
     
+    m_attachButton = new QPushButton("Attach");
+    m_attachButton->setStyleSheet("QPushButton { background-color: #2A2A2A; color: #E9EDEF; "
+                                 "padding: 10px 15px; border-radius: 20px; }"
+                                 "QPushButton:hover { background-color: #3A3A3A; }");
+    
+    inputLayout->addWidget(m_attachButton);
     inputLayout->addWidget(m_messageInput);
     inputLayout->addWidget(m_sendButton);
     
     mainLayout->addWidget(header);
-    mainLayout->addWidget(m_chatDisplay, 1);
+    mainLayout->addWidget(m_chatView, 1);
     mainLayout->addWidget(inputArea);
     
     connect(m_sendButton, &QPushButton::clicked, this, &ChatWidget::onSendClicked);
     connect(m_messageInput, &QLineEdit::returnPressed, this, &ChatWidget::onSendClicked);
+    connect(m_messageInput, &QLineEdit::textEdited, this, &ChatWidget::onInputEdited);
+    connect(m_attachButton, &QPushButton::clicked, this, &ChatWidget::onAttachClicked);
+    connect(m_chatView, &QListView::clicked, this, &ChatWidget::onMessageClicked);
+    connect(m_chatView->verticalScrollBar(), &QScrollBar::valueChanged, this, &ChatWidget::onScrolled);
+    connect(m_model, &QAbstractItemModel::rowsAboutToBeInserted, this, &ChatWidget::onRowsAboutToBeInserted);
+    connect(m_model, &QAbstractItemModel::rowsInserted, this, &ChatWidget::onRowsInserted);
+    connect(m_model, &MessageListModel::trimmed, this, &ChatWidget::onRowsTrimmed);
 }
 
 void ChatWidget::loadMessageHistory() {
-    m_networkManager->requestMessageHistory(m_contact, m_isGroup);
+    // Render what we already have, then ask only for what came after it
+    const QList<ChatProtocol::Message> cached = m_networkManager->messageCache()->load(
+        m_key, ChatProtocol::HISTORY_PAGE_SIZE);
+    
+    for (const auto& msg : cached) {
+        appendMessage(msg.sender, msg.content, msg.timestamp, msg.messageId);
+        m_latestId = qMax(m_latestId, msg.messageId);
+    }
+    
+    if (cached.isEmpty()) {
+        m_networkManager->requestMessageHistory(m_contact, m_isGroup);
+    } else {
+        m_syncing = true;
+        m_networkManager->requestHistorySync(m_contact, m_isGroup, m_latestId);
+    }
 }
 
 void ChatWidget::onSendClicked() {
     QString message = m_messageInput->text().trimmed();
     if (message.isEmpty()) return;
     
+    sendContent(message);
+    m_messageInput->clear();
+}
+
+void ChatWidget::sendContent(const QString& content) {
     if (m_isGroup) {
-        m_networkManager->sendGroupMessage(m_contact, message);
+        m_networkManager->sendGroupMessage(m_contact, content);
     } else {
-        m_networkManager->sendPrivateMessage(m_contact, message);
+        m_networkManager->sendPrivateMessage(m_contact, content);
     }
     
-    appendMessage(m_currentUser, message, QDateTime::currentDateTime());
-    m_messageInput->clear();
+    appendMessage(m_currentUser, content, QDateTime::currentDateTime());
+}
+
+void ChatWidget::onInputEdited(const QString& text) {
+    if (text.isEmpty()) return;
+    
+    m_networkManager->sendTyping(m_contact, m_isGroup);
+}
+
+void ChatWidget::showTyping(const QString& sender) {
+    if (sender == m_currentUser) return;
+    
+    m_typingUser = sender;
+    m_typingTimer->start();
+    updateStatus();
+}
+
+void ChatWidget::showReadReceipt(const QDateTime& upTo) {
+    if (m_seenUpTo.isValid() && upTo <= m_seenUpTo) return;
+    
+    m_seenUpTo = upTo;
+    updateStatus();
+}
+
+void ChatWidget::updateStatus() {
+    if (m_typingTimer->isActive()) {
+        m_statusLabel->setText(m_isGroup ? m_typingUser + " is typing..." : "typing...");
+    } else if (m_seenUpTo.isValid()) {
+        m_statusLabel->setText("Seen " + m_seenUpTo.toString("hh:mm"));
+    } else {
+        m_statusLabel->clear();
+    }
+}
+
+void ChatWidget::showEvent(QShowEvent *event) {
+    QWidget::showEvent(event);
+    
+    // Messages that arrived while another chat was open are read now
+    if (!m_isGroup && m_lastIncoming.isValid()) {
+        m_networkManager->markRead(m_contact, m_lastIncoming);
+    }
+}
+
+void ChatWidget::onAttachClicked() {
+    QString filePath = QFileDialog::getOpenFileName(this, "Send Attachment");
+    if (filePath.isEmpty()) return;
+    
+    QString hash = m_networkManager->uploadAttachment(filePath);
+    if (hash.isEmpty()) {
+        QMessageBox::warning(this, "Attachment", "Could not read " + filePath);
+        return;
+    }
+    m_pendingUploads.insert(hash);
+}
+
+void ChatWidget::onAttachmentUploaded(const QString& hash, const QString& fileName, qint64 size) {
+    if (!m_pendingUploads.remove(hash)) return;
+    
+    sendContent(QString(ChatProtocol::ATTACHMENT_PREFIX) + hash + ":" + QString::number(size) + ":" + fileName);
+}
+
+void ChatWidget::onAttachmentFailed(const QString& hash) {
+    if (!m_pendingUploads.remove(hash) && !m_pendingDownloads.remove(hash)) return;
+    
+    QMessageBox::warning(this, "Attachment", "Transfer interrupted, please try again to resume.");
+}
+
+void ChatWidget::onMessageClicked(const QModelIndex& index) {
+    QString hash = index.data(MessageListModel::AttachmentHashRole).toString();
+    if (hash.isEmpty()) return;
+    
+    QString fileName = index.data(MessageListModel::AttachmentNameRole).toString();
+    QString savePath = QFileDialog::getSaveFileName(this, "Save Attachment", fileName);
+    if (savePath.isEmpty()) return;
+    
+    m_pendingDownloads.insert(hash);
+    m_networkManager->downloadAttachment(hash, savePath);
 }
 
-void ChatWidget::appendMessage(const QString& sender, const QString& content, const QDateTime& timestamp) {
+void ChatWidget::onAttachmentDownloaded(const QString& hash, const QString& filePath) {
+    if (!m_pendingDownloads.remove(hash)) return;
+    
+    QMessageBox::information(this, "Attachment", "Saved to " + filePath);
+}
+
+void ChatWidget::appendMessage(const QString& sender, const QString& content, const QDateTime& timestamp, int messageId) {
     bool isSentByMe = (sender == m_currentUser);
     
-    QString alignment = isSentByMe ? "right" : "left";
-    QString bgColor = isSentByMe ? "#005C4B" : "#1E2A2F";
-    QString senderName = m_isGroup && !isSentByMe ? sender + ": " : "";
-    QString timeStr = timestamp.toString("hh:mm");
+    // The cache, the sync reply and the live stream can overlap
+    if (messageId > 0) {
+        if (m_knownIds.contains(messageId)) return;
+        m_knownIds.insert(messageId);
+        if (m_oldestId == 0 || messageId < m_oldestId) m_oldestId = messageId;
+    }
+    
+    // Queued in the model and inserted in one batch per event-loop pass
+    m_model->appendMessage(sender, content, timestamp, messageId);
+    
+    if (isSentByMe) return;
+    
+    if (sender == m_typingUser && m_typingTimer->isActive()) {
+        m_typingTimer->stop();
+        updateStatus();
+    }
+    
+    if (!m_isGroup && (!m_lastIncoming.isValid() || timestamp > m_lastIncoming)) {
+        m_lastIncoming = timestamp;
+        if (isVisible()) {
+            m_networkManager->markRead(m_contact, m_lastIncoming);
+        }
+    }
+}
+
+void ChatWidget::onRowsAboutToBeInserted(const QModelIndex& parent, int first, int last) {
+    Q_UNUSED(parent);
+    Q_UNUSED(last);
+    QScrollBar *scrollBar = m_chatView->verticalScrollBar();
+    
+    if (first == 0 && m_model->rowCount() > 0) {
+        m_prependAnchor = scrollBar->maximum() - scrollBar->value();
+    } else {
+        m_followBottom = scrollBar->value() == scrollBar->maximum();
+    }
+}
+
+void ChatWidget::onRowsInserted(const QModelIndex& parent, int first, int last) {
+    Q_UNUSED(parent);
+    
+    if (first == 0 && last + 1 < m_model->rowCount()) {
+        // Older page: keep the rows the user was looking at in place
+        m_chatView->doItemsLayout();
+        QScrollBar *scrollBar = m_chatView->verticalScrollBar();
+        scrollBar->setValue(scrollBar->maximum() - m_prependAnchor);
+    } else if (m_followBottom) {
+        m_chatView->scrollToBottom();
+    }
+}
+
+void ChatWidget::onRowsTrimmed(const QList<int>& messageIds, int oldestId) {
+    // Forget the dropped rows so scrolling back fetches and shows them again
+    for (int id : messageIds) {
+        m_knownIds.remove(id);
+    }
+    m_oldestId = oldestId;
+    m_hasOlder = true;
+}
+
+void ChatWidget::onScrolled(int value) {
+    QScrollBar *scrollBar = m_chatView->verticalScrollBar();
+    
+    // Old rows may only be dropped while the user is following new ones
+    m_followBottom = value == scrollBar->maximum();
+    m_model->setAutoTrim(m_followBottom);
     
-    QString messageHtml = QString(
-        "<div style='text-align: %1; margin: 5px;'>"
-        "  <div style='display: inline-block; background-color: %2; padding: 8px 12px; "
-        "             border-radius: 10px; max-width: 70%; text-align: left;'>"
-        "    <span style='font-weight: bold; color: #25D366;'>%3</span>"
-        "    <span style='color: #E9EDEF;'>%4</span><br>"
-        "    <span style='color: #8696A0; font-size: 10px;'>%5</span>"
-        "  </div>"
-        "</div>"
-    ).arg(alignment, bgColor, senderName, content, timeStr);
+    if (value == scrollBar->minimum() && m_historyLoaded && m_hasOlder && !m_loadingOlder) {
+        m_loadingOlder = true;
+        m_networkManager->requestMessageHistory(m_contact, m_isGroup, m_oldestId);
+    }
+}
+
+void ChatWidget::historyRow(const ChatProtocol::Message& msg) {
+    if (m_loadingOlder) {
+        m_olderPage.append(msg);
+        return;
+    }
     
-    m_chatDisplay->append(messageHtml);
-    m_chatDisplay->verticalScrollBar()->setValue(m_chatDisplay->verticalScrollBar()->maximum());
+    ++m_replyRows;
+    m_latestId = qMax(m_latestId, msg.messageId);
+    appendMessage(msg.sender, msg.content, msg.timestamp, msg.messageId);
 }
 
-void ChatWidget::onMessageHistoryReceived(const QString& sender, const QString& recipient, 
-                                         const QString& content, const QDateTime& timestamp) {
-    if (m_isGroup && recipient == m_contact) {
-        appendMessage(sender, content, timestamp);
-    } else if (!m_isGroup && (sender == m_contact || recipient == m_contact)) {
-        appendMessage(sender, content, timestamp);
+void ChatWidget::historyEnd() {
+    if (m_loadingOlder) {
+        m_hasOlder = m_olderPage.size() >= ChatProtocol::HISTORY_PAGE_SIZE;
+        m_loadingOlder = false;
+        
+        QList<ChatProtocol::Message> page;
+        for (const auto& msg : m_olderPage) {
+            if (msg.messageId > 0 && m_knownIds.contains(msg.messageId)) continue;
+            m_knownIds.insert(msg.messageId);
+            if (msg.messageId > 0 && (m_oldestId == 0 || msg.messageId < m_oldestId)) m_oldestId = msg.messageId;
+            page.append(msg);
+        }
+        m_model->prependMessages(page);
+        m_olderPage.clear();
+        return;
+    }
+    
+    // A full sync reply means there may be more after it
+    if (m_syncing && m_replyRows >= ChatProtocol::HISTORY_SYNC_LIMIT) {
+        m_replyRows = 0;
+        m_networkManager->requestHistorySync(m_contact, m_isGroup, m_latestId);
+        return;
     }
+    
+    m_syncing = false;
+    m_replyRows = 0;
+    m_historyLoaded = true;
 }
 
 void ChatWidget::onGroupMembersClicked() {
     m_networkManager->requestGroupMembers(m_contact);
 }
 
-void ChatWidget::onGroupMembersReceived(const QString& groupName, const QStringList& members, const QString& admin) {
-    if (groupName != m_contact) return;
-    
+void ChatWidget::groupMembers(const QStringList& members, const QString& admin) {
     QString membersList = "Group Admin: " + admin + "\n\nMembers:\n" + members.join("\n");
     
     QMessageBox msgBox(this);
@@ -0,0 +1,248 @@
+#include "ContactListModel.h"
+#include <algorithm>
+#include <iterator>
+
+namespace {
+const int kFetchBatch = 500;      // rows handed to the view per fetchMore()
+const int kResetThreshold = 256;  // beyond this many changes a reset is cheaper than row signals
+}
+
+ContactListModel::ContactListModel(QObject *parent)
+    : QAbstractListModel(parent), m_exposed(0), m_hasMoreRemote(false) {}
+
+int ContactListModel::rowCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : m_exposed;
+}
+
+QVariant ContactListModel::data(const QModelIndex& index, int role) const {
+    if (!index.isValid() || index.row() >= m_exposed) return QVariant();
+    
+    const Entry& entry = m_entries[entryAt(index.row())];
+    switch (role) {
+        case Qt::DisplayRole: return entry.name;
+        case IsGroupRole: return entry.isGroup;
+        default: return QVariant();
+    }
+}
+
+bool ContactListModel::canFetchMore(const QModelIndex& parent) const {
+    return !parent.isValid() && (m_exposed < visibleCount() || m_hasMoreRemote);
+}
+
+void ContactListModel::fetchMore(const QModelIndex& parent) {
+    if (parent.isValid()) return;
+    
+    int count = qMin(kFetchBatch, visibleCount() - m_exposed);
+    if (count <= 0) {
+        if (m_hasMoreRemote) emit moreRequested();
+        return;
+    }
+    
+    beginInsertRows(QModelIndex(), m_exposed, m_exposed + count - 1);
+    m_exposed += count;
+    endInsertRows();
+}
+
+ContactListModel::Entry ContactListModel::makeEntry(const QString& name, bool isGroup) {
+    return Entry{isGroup, name.toCaseFolded(), name};
+}
+
+QList<ContactListModel::Entry> ContactListModel::sortedEntries(const QStringList& names, bool isGroup) {
+    QList<Entry> entries;
+    entries.reserve(names.size());
+    for (const QString& name : names) {
+        entries.append(makeEntry(name, isGroup));
+    }
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.name == b.name;
+    }), entries.end());
+    return entries;
+}
+
+void ContactListModel::setGroups(const QStringList& groups) {
+    replaceSection(groups, true);
+}
+
+void ContactListModel::addContact(const QString& name, bool isGroup) {
+    insertEntry(makeEntry(name, isGroup));
+}
+
+void ContactListModel::addContacts(const QStringList& names, bool isGroup) {
+    if (names.size() <= kResetThreshold) {
+        for (const QString& name : names) {
+            insertEntry(makeEntry(name, isGroup));
+        }
+        return;
+    }
+    
+    QList<Entry> incoming = sortedEntries(names, isGroup);
+    QList<Entry> entries;
+    entries.reserve(m_entries.size() + incoming.size());
+    std::merge(m_entries.cbegin(), m_entries.cend(), incoming.cbegin(), incoming.cend(),
+               std::back_inserter(entries));
+    entries.erase(std::unique(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.isGroup == b.isGroup && a.name == b.name;
+    }), entries.end());
+    resetEntries(std::move(entries));
+}
+
+void ContactListModel::setFilter(const QString& prefix) {
+    QString folded = prefix.trimmed().toCaseFolded();
+    if (folded == m_filter) return;
+    
+    beginResetModel();
+    m_filter = folded;
+    updateRanges();
+    m_exposed = qMin(kFetchBatch, visibleCount());
+    endResetModel();
+}
+
+QModelIndex ContactListModel::indexOf(const QString& name, bool isGroup) {
+    Entry probe = makeEntry(name, isGroup);
+    auto it = std::lower_bound(m_entries.cbegin(), m_entries.cend(), probe);
+    if (it == m_entries.cend() || it->name != name || it->isGroup != isGroup) return QModelIndex();
+    
+    int row = visibleRow(int(it - m_entries.cbegin()));
+    if (row < 0) return QModelIndex();
+    
+    if (row >= m_exposed) {
+        beginInsertRows(QModelIndex(), m_exposed, row);
+        m_exposed = row + 1;
+        endInsertRows();
+    }
+    return index(row);
+}
+
+void ContactListModel::replaceSection(const QStringList& names, bool isGroup) {
+    QList<Entry> incoming = sortedEntries(names, isGroup);
+    
+    int split = int(std::partition_point(m_entries.cbegin(), m_entries.cend(),
+                                         [](const Entry& e) { return e.isGroup; }) - m_entries.cbegin());
+    int sectionBegin = isGroup ? 0 : split;
+    int sectionEnd = isGroup ? split : int(m_entries.size());
+    
+    // Merge the sorted old and new sections into removals and additions
+    QList<int> removed;
+    QList<Entry> added;
+    int i = sectionBegin;
+    int j = 0;
+    while (i < sectionEnd || j < incoming.size()) {
+        if (j == incoming.size() || (i < sectionEnd && m_entries[i] < incoming[j])) {
+            removed.append(i++);
+        } else if (i == sectionEnd || incoming[j] < m_entries[i]) {
+            added.append(incoming[j++]);
+        } else {
+            ++i;
+            ++j;
+        }
+    }
+    
+    if (removed.isEmpty() && added.isEmpty()) return;
+    
+    if (removed.size() + added.size() > kResetThreshold) {
+        QList<Entry> entries;
+        entries.reserve(m_entries.size() - (sectionEnd - sectionBegin) + incoming.size());
+        if (isGroup) {
+            entries.append(incoming);
+            entries.append(m_entries.mid(sectionEnd));
+        } else {
+            entries.append(m_entries.mid(0, sectionBegin));
+            entries.append(incoming);
+        }
+        resetEntries(std::move(entries));
+        return;
+    }
+    
+    // Highest index first so the remaining indices stay valid
+    for (auto it = removed.crbegin(); it != removed.crend(); ++it) {
+        removeAt(*it);
+    }
+    for (const Entry& entry : added) {
+        insertEntry(entry);
+    }
+}
+
+void ContactListModel::insertEntry(const Entry& entry) {
+    auto it = std::lower_bound(m_entries.cbegin(), m_entries.cend(), entry);
+    if (it != m_entries.cend() && it->isGroup == entry.isGroup && it->name == entry.name) return;
+    
+    int index = int(it - m_entries.cbegin());
+    
+    // Position among visible rows, taken before the ranges shift
+    int row = -1;
+    if (entry.key.startsWith(m_filter)) {
+        row = entry.isGroup ? index - m_groupRange.begin
+                            : m_groupRange.size() + index - m_userRange.begin;
+    }
+    
+    // Rows past what the view has fetched arrive later through fetchMore()
+    bool shown = row >= 0 && (row < m_exposed || m_exposed == visibleCount());
+    if (shown) beginInsertRows(QModelIndex(), row, row);
+    
+    m_entries.insert(index, entry);
+    updateRanges();
+    
+    if (shown) {
+        ++m_exposed;
+        endInsertRows();
+    }
+}
+
+void ContactListModel::removeAt(int index) {
+    int row = visibleRow(index);
+    bool shown = row >= 0 && row < m_exposed;
+    if (shown) beginRemoveRows(QModelIndex(), row, row);
+    
+    m_entries.remove(index);
+    updateRanges();
+    
+    if (shown) {
+        --m_exposed;
+        endRemoveRows();
+    }
+}
+
+int ContactListModel::visibleRow(int index) const {
+    if (index >= m_groupRange.begin && index < m_groupRange.end) {
+        return index - m_groupRange.begin;
+    }
+    if (index >= m_userRange.begin && index < m_userRange.end) {
+        return m_groupRange.size() + index - m_userRange.begin;
+    }
+    return -1;
+}
+
+int ContactListModel::entryAt(int row) const {
+    if (row < m_groupRange.size()) return m_groupRange.begin + row;
+    return m_userRange.begin + row - m_groupRange.size();
+}
+
+void ContactListModel::updateRanges() {
+    auto begin = m_entries.cbegin();
+    auto sectionSplit = std::partition_point(begin, m_entries.cend(), [](const Entry& e) { return e.isGroup; });
+    
+    // Keys starting with the prefix are contiguous from the prefix's lower bound
+    auto matchRange = [this](QList<Entry>::const_iterator first, QList<Entry>::const_iterator last) {
+        auto from = std::lower_bound(first, last, m_filter, [](const Entry& e, const QString& key) {
+            return e.key < key;
+        });
+        auto to = std::partition_point(from, last, [this](const Entry& e) {
+            return e.key.startsWith(m_filter);
+        });
+        return std::make_pair(from, to);
+    };
+    
+    auto groups = matchRange(begin, sectionSplit);
+    auto users = matchRange(sectionSplit, m_entries.cend());
+    m_groupRange = {int(groups.first - begin), int(groups.second - begin)};
+    m_userRange = {int(users.first - begin), int(users.second - begin)};
+}
+
+void ContactListModel::resetEntries(QList<Entry> entries) {
+    beginResetModel();
+    m_entries = std::move(entries);
+    updateRanges();
+    m_exposed = qMin(kFetchBatch, visibleCount());
+    endResetModel();
+}
\ No newline at end of file
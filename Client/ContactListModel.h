@@ -0,0 +1,77 @@
+#ifndef CONTACTLISTMODEL_H
+#define CONTACTLISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QStringList>
+#include <QList>
+
+// Sidebar contacts: groups first, then users, each sorted case-insensitively.
+// The sorted order doubles as the prefix index, so a filter is two binary
+// searches. Refreshes are diffed into row inserts/removes, and rows are
+// handed to the view in batches as it scrolls. Once every local row is
+// shown, scrolling further asks for the next directory page instead.
+class ContactListModel : public QAbstractListModel {
+    Q_OBJECT
+    
+public:
+    enum Roles {
+        IsGroupRole = Qt::UserRole + 1
+    };
+    
+    explicit ContactListModel(QObject *parent = nullptr);
+    
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    bool canFetchMore(const QModelIndex& parent) const override;
+    void fetchMore(const QModelIndex& parent) override;
+    
+    void setGroups(const QStringList& groups);
+    void addContact(const QString& name, bool isGroup);
+    void addContacts(const QStringList& names, bool isGroup);
+    void setHasMoreRemote(bool hasMore) { m_hasMoreRemote = hasMore; }
+    void setFilter(const QString& prefix);
+    
+    QModelIndex indexOf(const QString& name, bool isGroup); // loads rows up to it if needed
+    
+signals:
+    void moreRequested(); // the view reached the end and the server has more
+    
+private:
+    struct Entry {
+        bool isGroup;
+        QString key; // case-folded name
+        QString name;
+        
+        bool operator<(const Entry& other) const {
+            if (isGroup != other.isGroup) return isGroup;
+            if (key != other.key) return key < other.key;
+            return name < other.name;
+        }
+    };
+    
+    struct Range {
+        int begin = 0;
+        int end = 0;
+        int size() const { return end - begin; }
+    };
+    
+    static Entry makeEntry(const QString& name, bool isGroup);
+    static QList<Entry> sortedEntries(const QStringList& names, bool isGroup);
+    void replaceSection(const QStringList& names, bool isGroup);
+    void insertEntry(const Entry& entry);
+    void removeAt(int index);
+    int visibleRow(int index) const; // -1 if filtered out
+    int entryAt(int row) const;
+    int visibleCount() const { return m_groupRange.size() + m_userRange.size(); }
+    void updateRanges();
+    void resetEntries(QList<Entry> entries);
+    
+    QList<Entry> m_entries;   // sorted
+    QString m_filter;         // case-folded prefix
+    Range m_groupRange;       // entries matching the filter
+    Range m_userRange;
+    int m_exposed;            // rows handed to the view so far
+    bool m_hasMoreRemote;
+};
+
+#endif // CONTACTLISTMODEL_H
\ No newline at end of file
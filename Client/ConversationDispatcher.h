@@ -0,0 +1,39 @@
+#ifndef CONVERSATIONDISPATCHER_H
+#define CONVERSATIONDISPATCHER_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include "Protocol.h"
+
+// Receiver for events that belong to exactly one open conversation
+class ConversationView {
+public:
+    virtual ~ConversationView() = default;
+    
+    virtual void historyRow(const ChatProtocol::Message& msg) = 0;
+    virtual void historyEnd() = 0;
+    virtual void groupMembers(const QStringList& members, const QString& admin) = 0;
+};
+
+// Routes per-conversation events by cache key (MessageCache::keyFor) to the
+// one view showing that conversation, instead of broadcasting a signal to
+// every open chat and letting each filter by name.
+class ConversationDispatcher {
+public:
+    void attach(const QString& key, ConversationView *view) { m_views.insert(key, view); }
+    
+    void detach(const QString& key, ConversationView *view) {
+        auto it = m_views.find(key);
+        if (it != m_views.end() && it.value() == view) {
+            m_views.erase(it);
+        }
+    }
+    
+    ConversationView* find(const QString& key) const { return m_views.value(key); }
+    
+private:
+    QHash<QString, ConversationView*> m_views;
+};
+
+#endif // CONVERSATIONDISPATCHER_H
\ No newline at end of file
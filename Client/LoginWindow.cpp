@@ -22,6 +22,10 @@ LoginWindow::~LoginWindow() {
     }
 }
 
+void LoginWindow::setTlsConfiguration(const QSslConfiguration& config) {
+    m_networkManager->setTlsConfiguration(config);
+}
+
 void LoginWindow::setupUI() {
     setWindowTitle("Chat App - Login");
     setFixedSize(400, 350);
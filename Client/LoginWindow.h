@@ -6,6 +6,7 @@
 #include <QPushButton>
 #include <QCheckBox>
 #include <QLabel>
+#include <QSslConfiguration>
 
 class NetworkManager;
 class MainWindow;
@@ -17,6 +18,8 @@ public:
     explicit LoginWindow(QWidget *parent = nullptr);
     ~LoginWindow();
     
+    void setTlsConfiguration(const QSslConfiguration& config);
+    
 private slots:
     void onLoginClicked();
     void onRegisterClicked();
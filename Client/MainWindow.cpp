@@ -1,6 +1,7 @@
 #include "MainWindow.h"
 #include "NetworkManager.h"
 #include "ChatWidget.h"
+#include "ContactListModel.h"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QInputDialog>
@@ -8,16 +9,21 @@
 #include <QSplitter>
 
 MainWindow::MainWindow(NetworkManager *networkManager, const QString& username, QWidget *parent)
-    : QMainWindow(parent), m_networkManager(networkManager), m_username(username) {
+    : QMainWindow(parent), m_networkManager(networkManager), m_username(username), m_directoryPending(false) {
     
     setupUI();
     loadContacts();
     
-    connect(m_networkManager, &NetworkManager::usersListReceived, this, &MainWindow::onUsersListReceived);
+    connect(m_networkManager, &NetworkManager::directoryPageReceived, this, &MainWindow::onDirectoryPageReceived);
     connect(m_networkManager, &NetworkManager::groupsListReceived, this, &MainWindow::onGroupsListReceived);
     connect(m_networkManager, &NetworkManager::groupCreated, this, &MainWindow::onGroupCreated);
     connect(m_networkManager, &NetworkManager::privateMessageReceived, this, &MainWindow::onPrivateMessageReceived);
     connect(m_networkManager, &NetworkManager::groupMessageReceived, this, &MainWindow::onGroupMessageReceived);
+    connect(m_networkManager, &NetworkManager::typingReceived, this, &MainWindow::onTypingReceived);
+    connect(m_networkManager, &NetworkManager::readReceiptReceived, this, &MainWindow::onReadReceiptReceived);
+    connect(m_networkManager, &NetworkManager::reconnecting, this, &MainWindow::onReconnecting);
+    connect(m_networkManager, &NetworkManager::reconnected, this, &MainWindow::onReconnected);
+    connect(m_networkManager, &NetworkManager::sessionExpired, this, &MainWindow::onSessionExpired);
 }
 
 MainWindow::~MainWindow() {
@@ -78,15 +84,27 @@ void MainWindow::setupUI() {
     actionsLayout->addWidget(m_newChatButton);
     actionsLayout->addWidget(m_newGroupButton);
     
+    // Search box - DARK THEME
+    m_searchEdit = new QLineEdit();
+    m_searchEdit->setPlaceholderText("Search or start new chat");
+    m_searchEdit->setClearButtonEnabled(true);
+    m_searchEdit->setStyleSheet("QLineEdit { background-color: #2A2A2A; color: #FFFFFF; border: none; "
+                                "border-radius: 5px; padding: 8px; margin: 0px 10px 10px 10px; }");
+    
     // Contacts list - DARK THEME
-    m_contactsList = new QListWidget();
-    m_contactsList->setStyleSheet("QListWidget { background-color: #1E1E1E; border: none; color: #FFFFFF; }"
-                                 "QListWidget::item { padding: 12px; border-bottom: 1px solid #2A2A2A; }"
-                                 "QListWidget::item:selected { background-color: #2A2A2A; }"
-                                 "QListWidget::item:hover { background-color: #252525; }");
+    m_contacts = new ContactListModel(this);
+    m_contactsList = new QListView();
+    m_contactsList->setModel(m_contacts);
+    m_contactsList->setUniformItemSizes(true); // no per-row measuring for large directories
+    m_contactsList->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_contactsList->setStyleSheet("QListView { background-color: #1E1E1E; border: none; color: #FFFFFF; }"
+                                 "QListView::item { padding: 12px; border-bottom: 1px solid #2A2A2A; }"
+                                 "QListView::item:selected { background-color: #2A2A2A; }"
+                                 "QListView::item:hover { background-color: #252525; }");
     
     sidebarLayout->addWidget(userHeader);
     sidebarLayout->addWidget(actionsWidget);
+    sidebarLayout->addWidget(m_searchEdit);
     sidebarLayout->addWidget(m_contactsList);
     
     // Chat area - DARK THEME
@@ -101,24 +119,82 @@ void MainWindow::setupUI() {
     mainLayout->addWidget(sidebar);
     mainLayout->addWidget(m_chatStack, 1);
     
-    connect(m_contactsList, &QListWidget::itemClicked, this, &MainWindow::onContactSelected);
+    connect(m_contactsList, &QListView::clicked, this, &MainWindow::onContactSelected);
+    connect(m_searchEdit, &QLineEdit::textChanged, this, &MainWindow::onSearchEdited);
+    connect(m_searchEdit, &QLineEdit::returnPressed, this, &MainWindow::onSearchReturnPressed);
+    connect(m_contacts, &ContactListModel::moreRequested, this, &MainWindow::onMoreContactsRequested);
+    
+    m_searchTimer = new QTimer(this);
+    m_searchTimer->setSingleShot(true);
+    m_searchTimer->setInterval(150);
+    connect(m_searchTimer, &QTimer::timeout, this, &MainWindow::onSearchTimeout);
     connect(m_newChatButton, &QPushButton::clicked, this, &MainWindow::onNewChatClicked);
     connect(m_newGroupButton, &QPushButton::clicked, this, &MainWindow::onNewGroupClicked);
 }
 
 void MainWindow::loadContacts() {
-    m_networkManager->requestUsers();
     m_networkManager->requestGroups();
+    startDirectorySearch(m_searchEdit->text().trimmed());
+}
+
+void MainWindow::startDirectorySearch(const QString& prefix) {
+    m_directoryPrefix = prefix;
+    m_directoryCursor.clear();
+    m_directoryPending = true;
+    m_networkManager->searchDirectory(prefix);
 }
 
-void MainWindow::onContactSelected(QListWidgetItem *item) {
-    QString contact = item->text();
-    bool isGroup = m_groups.contains(contact);
+void MainWindow::onContactSelected(const QModelIndex& index) {
+    if (!index.isValid()) return;
+    
+    QString contact = index.data(Qt::DisplayRole).toString();
+    bool isGroup = index.data(ContactListModel::IsGroupRole).toBool();
     
     ChatWidget *chatWidget = getChatWidget(contact, isGroup);
     m_chatStack->setCurrentWidget(chatWidget);
 }
 
+void MainWindow::onSearchEdited(const QString& text) {
+    // Filter what we already have at once, then ask the server for the rest
+    m_contacts->setFilter(text);
+    m_contacts->setHasMoreRemote(false);
+    m_searchTimer->start();
+}
+
+void MainWindow::onSearchTimeout() {
+    startDirectorySearch(m_searchEdit->text().trimmed());
+}
+
+void MainWindow::onDirectoryPageReceived(const QString& prefix, const QStringList& users,
+                                         const QString& nextCursor) {
+    QStringList others = users;
+    others.removeAll(m_username);
+    m_contacts->addContacts(others, false);
+    
+    // Pages for an earlier prefix still name real users, but don't continue them
+    if (prefix != m_directoryPrefix) return;
+    
+    m_directoryPending = false;
+    m_directoryCursor = nextCursor;
+    m_contacts->setHasMoreRemote(!nextCursor.isEmpty());
+}
+
+void MainWindow::onMoreContactsRequested() {
+    if (m_directoryPending || m_directoryCursor.isEmpty()) return;
+    
+    m_directoryPending = true;
+    m_networkManager->searchDirectory(m_directoryPrefix, m_directoryCursor);
+}
+
+void MainWindow::onSearchReturnPressed() {
+    // Open the best (first) match
+    QModelIndex first = m_contacts->index(0);
+    if (!first.isValid()) return;
+    
+    m_contactsList->setCurrentIndex(first);
+    onContactSelected(first);
+}
+
 ChatWidget* MainWindow::getChatWidget(const QString& contact, bool isGroup) {
     if (m_chatWidgets.contains(contact)) {
         return m_chatWidgets[contact];
@@ -132,46 +208,9 @@ ChatWidget* MainWindow::getChatWidget(const QString& contact, bool isGroup) {
 }
 
 void MainWindow::onNewChatClicked() {
-    // Get list of all users except current user
-    QStringList availableUsers;
-    QStringList allUsers = m_networkManager->getAllUsersList();
-    
-    for (const QString& user : allUsers) {
-        if (user != m_username) {
-            availableUsers.append(user);
-        }
-    }
-    
-    if (availableUsers.isEmpty()) {
-        QMessageBox::information(this, "No Users", "No other users available to chat with.");
-        return;
-    }
-    
-    // Show dialog to select user
-    bool ok;
-    QString selectedUser = QInputDialog::getItem(this, "Start New Chat",
-                                                 "Select user to chat with:",
-                                                 availableUsers, 0, false, &ok);
-    
-    if (ok && !selectedUser.isEmpty()) {
-        // Add to contacts list if not already there
-        bool userExists = false;
-        for (int i = 0; i < m_contactsList->count(); ++i) {
-            if (m_contactsList->item(i)->text() == selectedUser) {
-                userExists = true;
-                m_contactsList->setCurrentRow(i);
-                onContactSelected(m_contactsList->item(i));
-                break;
-            }
-        }
-        
-        if (!userExists) {
-            QListWidgetItem *item = new QListWidgetItem(selectedUser);
-            m_contactsList->addItem(item);
-            m_contactsList->setCurrentItem(item);
-            onContactSelected(item);
-        }
-    }
+    // Typing in the search box looks the name up in the server's directory
+    m_searchEdit->clear();
+    m_searchEdit->setFocus();
 }
 
 void MainWindow::onNewGroupClicked() {
@@ -185,47 +224,68 @@ void MainWindow::onNewGroupClicked() {
     }
 }
 
-void MainWindow::onUsersListReceived(const QStringList& users) {
-    m_allUsers = users;  // Store the users list
-    
-    m_contactsList->clear();
-    
-    // Add groups first
-    for (const QString& group : m_groups) {
-        QListWidgetItem *item = new QListWidgetItem(group);
-        item->setIcon(QIcon());
-        m_contactsList->addItem(item);
-    }
-    
-    // Add users
-    for (const QString& user : users) {
-        if (user != m_username) {
-            QListWidgetItem *item = new QListWidgetItem(user);
-            m_contactsList->addItem(item);
-        }
-    }
-}
-
 void MainWindow::onGroupsListReceived(const QStringList& groups) {
-    m_groups = groups;
-    m_networkManager->requestUsers();
+    m_contacts->setGroups(groups);
 }
 
 void MainWindow::onGroupCreated(const QString& groupName) {
     QMessageBox::information(this, "Success", "Group created: " + groupName);
-    m_groups.append(groupName);
-    loadContacts();
+    m_contacts->addContact(groupName, true);
+    
+    QModelIndex index = m_contacts->indexOf(groupName, true);
+    if (index.isValid()) {
+        m_contactsList->setCurrentIndex(index);
+    }
 }
 
-void MainWindow::onPrivateMessageReceived(const QString& sender, const QString& content, const QDateTime& timestamp) {
+void MainWindow::onPrivateMessageReceived(const QString& sender, const QString& content,
+                                         const QDateTime& timestamp, int messageId) {
     if (sender == m_username) return;
     
+    // Senders who registered after the last refresh
+    m_contacts->addContact(sender, false);
+    
     ChatWidget *chatWidget = getChatWidget(sender, false);
-    chatWidget->appendMessage(sender, content, timestamp);
+    chatWidget->appendMessage(sender, content, timestamp, messageId);
 }
 
 void MainWindow::onGroupMessageReceived(const QString& sender, const QString& groupName, 
-                                       const QString& content, const QDateTime& timestamp) {
+                                       const QString& content, const QDateTime& timestamp, int messageId) {
+    // Our own messages are already shown; the server's copy only carries the id
+    if (sender == m_username) return;
+    
     ChatWidget *chatWidget = getChatWidget(groupName, true);
-    chatWidget->appendMessage(sender, content, timestamp);
+    chatWidget->appendMessage(sender, content, timestamp, messageId);
+}
+
+void MainWindow::onTypingReceived(const QString& sender, const QString& conversation) {
+    // Only shown in chats that are already open
+    ChatWidget *chatWidget = m_chatWidgets.value(conversation);
+    if (chatWidget) {
+        chatWidget->showTyping(sender);
+    }
+}
+
+void MainWindow::onReadReceiptReceived(const QString& reader, const QDateTime& upTo) {
+    ChatWidget *chatWidget = m_chatWidgets.value(reader);
+    if (chatWidget) {
+        chatWidget->showReadReceipt(upTo);
+    }
+}
+
+void MainWindow::onReconnecting(int delayMs) {
+    setWindowTitle(QString("Chat App - reconnecting in %1s...").arg((delayMs + 999) / 1000));
+}
+
+void MainWindow::onReconnected() {
+    setWindowTitle("Chat App");
+    
+    // Pick up anything created while offline
+    loadContacts();
+}
+
+void MainWindow::onSessionExpired(const QString& reason) {
+    setWindowTitle("Chat App - offline");
+    QMessageBox::warning(this, "Disconnected", "Your session could not be restored: " + reason +
+                         "\nPlease restart the application to log in again.");
 }
\ No newline at end of file
@@ -2,15 +2,17 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
-#include <QListWidget>
+#include <QListView>
 #include <QTextEdit>
 #include <QLineEdit>
 #include <QPushButton>
 #include <QStackedWidget>
 #include <QLabel>
+#include <QTimer>
 
 class NetworkManager;
 class ChatWidget;
+class ContactListModel;
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -20,32 +22,49 @@ public:
     ~MainWindow();
     
 private slots:
-    void onContactSelected(QListWidgetItem *item);
+    void onContactSelected(const QModelIndex& index);
+    void onSearchEdited(const QString& text);
+    void onSearchReturnPressed();
     void onNewChatClicked();
     void onNewGroupClicked();
-    void onUsersListReceived(const QStringList& users);
+    void onSearchTimeout();
+    void onDirectoryPageReceived(const QString& prefix, const QStringList& users, const QString& nextCursor);
+    void onMoreContactsRequested();
     void onGroupsListReceived(const QStringList& groups);
     void onGroupCreated(const QString& groupName);
-    void onPrivateMessageReceived(const QString& sender, const QString& content, const QDateTime& timestamp);
-    void onGroupMessageReceived(const QString& sender, const QString& groupName, const QString& content, const QDateTime& timestamp);
+    void onPrivateMessageReceived(const QString& sender, const QString& content, const QDateTime& timestamp, int messageId);
+    void onGroupMessageReceived(const QString& sender, const QString& groupName, const QString& content,
+                                const QDateTime& timestamp, int messageId);
+    void onTypingReceived(const QString& sender, const QString& conversation);
+    void onReadReceiptReceived(const QString& reader, const QDateTime& upTo);
+    void onReconnecting(int delayMs);
+    void onReconnected();
+    void onSessionExpired(const QString& reason);
     
 private:
     void setupUI();
     void loadContacts();
+    void startDirectorySearch(const QString& prefix);
     ChatWidget* getChatWidget(const QString& contact, bool isGroup);
     
     NetworkManager *m_networkManager;
     QString m_username;
-    QStringList m_allUsers;  // Store all users
     
-    QListWidget *m_contactsList;
+    QListView *m_contactsList;
+    ContactListModel *m_contacts;
+    QLineEdit *m_searchEdit;
+    QTimer *m_searchTimer;       // debounces server searches while typing
+    
+    // Directory paging for the current search prefix
+    QString m_directoryPrefix;
+    QString m_directoryCursor;   // empty once the last page arrived
+    bool m_directoryPending;
     QStackedWidget *m_chatStack;
     QPushButton *m_newChatButton;
     QPushButton *m_newGroupButton;
     QLabel *m_usernameLabel;
     
     QMap<QString, ChatWidget*> m_chatWidgets;
-    QStringList m_groups;
 };
 
 #endif // MAINWINDOW_H
\ No newline at end of file
@@ -0,0 +1,178 @@
+#include "MessageCache.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QStandardPaths>
+#include <QDir>
+#include <QDebug>
+
+namespace {
+const int kMaxCachedMessages = 50000;
+const int kMaxPerConversation = 2000;
+const int kEvictEvery = 200; // stored messages between eviction passes
+}
+
+MessageCache::MessageCache()
+    : m_connectionName("message-cache"), m_storedSinceEvict(0) {}
+
+MessageCache::~MessageCache() {
+    close();
+}
+
+bool MessageCache::open(const QString& username) {
+    close();
+    
+    // One connection per user, so several clients can share a process
+    m_connectionName = "message-cache:" + username;
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+    QDir().mkpath(dir);
+    
+    m_db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+    m_db.setDatabaseName(dir + "/cache_" + username + ".db");
+    
+    if (!m_db.open()) {
+        qDebug() << "Message cache unavailable:" << m_db.lastError().text();
+        return false;
+    }
+    
+    createTables();
+    evict();
+    return true;
+}
+
+void MessageCache::close() {
+    if (!m_db.isValid()) return;
+    
+    m_db.close();
+    m_db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+void MessageCache::createTables() {
+    QSqlQuery query(m_db);
+    
+    // A lost write only costs a refetch, so skip the fsync per commit
+    query.exec("PRAGMA journal_mode=WAL");
+    query.exec("PRAGMA synchronous=NORMAL");
+    
+    query.exec("CREATE TABLE IF NOT EXISTS messages ("
+               "conversation TEXT NOT NULL,"
+               "id INTEGER NOT NULL,"
+               "sender TEXT NOT NULL,"
+               "recipient TEXT NOT NULL,"
+               "content TEXT NOT NULL,"
+               "timestamp INTEGER NOT NULL,"
+               "PRIMARY KEY (conversation, id))");
+    
+    query.exec("CREATE TABLE IF NOT EXISTS conversations ("
+               "conversation TEXT PRIMARY KEY,"
+               "last_access INTEGER NOT NULL)");
+}
+
+QString MessageCache::keyFor(const QString& name, bool isGroup) {
+    return (isGroup ? "g:" : "u:") + name;
+}
+
+QList<ChatProtocol::Message> MessageCache::load(const QString& key, int limit) {
+    QList<ChatProtocol::Message> messages;
+    if (!isOpen()) return messages;
+    
+    QSqlQuery query(m_db);
+    query.prepare("INSERT OR REPLACE INTO conversations (conversation, last_access) VALUES (:c, :now)");
+    query.bindValue(":c", key);
+    query.bindValue(":now", QDateTime::currentMSecsSinceEpoch());
+    query.exec();
+    
+    query.prepare("SELECT id, sender, recipient, content, timestamp FROM messages "
+                  "WHERE conversation = :c ORDER BY id DESC LIMIT :limit");
+    query.bindValue(":c", key);
+    query.bindValue(":limit", limit);
+    
+    const bool isGroup = key.startsWith("g:");
+    if (query.exec()) {
+        while (query.next()) {
+            ChatProtocol::Message msg;
+            msg.type = isGroup ? ChatProtocol::MessageType::GROUP_MESSAGE : ChatProtocol::MessageType::PRIVATE_MESSAGE;
+            msg.messageId = query.value(0).toInt();
+            msg.sender = query.value(1).toString();
+            msg.recipient = query.value(2).toString();
+            msg.content = query.value(3).toString();
+            msg.timestamp = QDateTime::fromMSecsSinceEpoch(query.value(4).toLongLong());
+            messages.prepend(msg);
+        }
+    }
+    return messages;
+}
+
+void MessageCache::store(const QString& key, const QList<ChatProtocol::Message>& messages) {
+    if (!isOpen() || messages.isEmpty()) return;
+    
+    m_db.transaction();
+    QSqlQuery query(m_db);
+    
+    // New conversations start warm; only opening one refreshes it later
+    query.prepare("INSERT OR IGNORE INTO conversations (conversation, last_access) VALUES (:c, :now)");
+    query.bindValue(":c", key);
+    query.bindValue(":now", QDateTime::currentMSecsSinceEpoch());
+    query.exec();
+    
+    query.prepare("INSERT OR REPLACE INTO messages (conversation, id, sender, recipient, content, timestamp) "
+                  "VALUES (:c, :id, :sender, :recipient, :content, :ts)");
+    for (const auto& msg : messages) {
+        if (msg.messageId <= 0) continue;
+        query.bindValue(":c", key);
+        query.bindValue(":id", msg.messageId);
+        query.bindValue(":sender", msg.sender);
+        query.bindValue(":recipient", msg.recipient);
+        query.bindValue(":content", msg.content);
+        query.bindValue(":ts", msg.timestamp.toMSecsSinceEpoch());
+        query.exec();
+    }
+    
+    // Keep only the newest part of each conversation
+    query.prepare("DELETE FROM messages WHERE conversation = :c AND id <= "
+                  "(SELECT id FROM messages WHERE conversation = :inner ORDER BY id DESC LIMIT 1 OFFSET :keep)");
+    query.bindValue(":c", key);
+    query.bindValue(":inner", key);
+    query.bindValue(":keep", kMaxPerConversation);
+    query.exec();
+    
+    m_db.commit();
+    
+    m_storedSinceEvict += int(messages.size());
+    if (m_storedSinceEvict >= kEvictEvery) {
+        evict();
+    }
+}
+
+void MessageCache::evict() {
+    m_storedSinceEvict = 0;
+    
+    QSqlQuery query(m_db);
+    if (!query.exec("SELECT COUNT(*) FROM messages") || !query.next()) return;
+    qint64 total = query.value(0).toLongLong();
+    if (total <= kMaxCachedMessages) return;
+    
+    // Drop whole conversations, coldest first, until back under budget
+    QList<QPair<QString, qint64>> victims;
+    query.exec("SELECT c.conversation, COUNT(m.id) FROM conversations c "
+               "LEFT JOIN messages m ON m.conversation = c.conversation "
+               "GROUP BY c.conversation ORDER BY c.last_access ASC");
+    while (query.next() && total > kMaxCachedMessages) {
+        qint64 count = query.value(1).toLongLong();
+        victims.append(qMakePair(query.value(0).toString(), count));
+        total -= count;
+    }
+    
+    m_db.transaction();
+    for (const auto& victim : victims) {
+        query.prepare("DELETE FROM messages WHERE conversation = :c");
+        query.bindValue(":c", victim.first);
+        query.exec();
+        query.prepare("DELETE FROM conversations WHERE conversation = :c");
+        query.bindValue(":c", victim.first);
+        query.exec();
+    }
+    m_db.commit();
+    
+    qDebug() << "Evicted" << victims.size() << "cold conversations from the message cache";
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef MESSAGECACHE_H
+#define MESSAGECACHE_H
+
+#include <QSqlDatabase>
+#include <QString>
+#include <QList>
+#include "Protocol.h"
+
+// Local SQLite copy of recently seen conversations, keyed by server message
+// id, so a chat can render before the server answers. Bounded: the coldest
+// conversations (least recently opened) are evicted first.
+class MessageCache {
+public:
+    MessageCache();
+    ~MessageCache();
+    
+    bool open(const QString& username);
+    void close();
+    bool isOpen() const { return m_db.isOpen(); }
+    
+    static QString keyFor(const QString& name, bool isGroup);
+    
+    QList<ChatProtocol::Message> load(const QString& key, int limit); // newest messages, oldest first
+    void store(const QString& key, const QList<ChatProtocol::Message>& messages);
+    
+private:
+    void createTables();
+    void evict();
+    
+    QString m_connectionName;
+    QSqlDatabase m_db;
+    int m_storedSinceEvict;
+};
+
+#endif // MESSAGECACHE_H
\ No newline at end of file
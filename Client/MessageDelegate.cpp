@@ -0,0 +1,119 @@
+#include "MessageDelegate.h"
+#include "MessageListModel.h"
+#include <QPainter>
+#include <QAbstractItemView>
+
+namespace {
+const int kMargin = 5;
+const int kPaddingH = 12;
+const int kPaddingV = 8;
+const int kRadius = 10;
+const int kLineGap = 2;
+const int kMaxCachedHeights = 8192;
+
+QFont senderFont(const QFont& base) {
+    QFont font = base;
+    font.setBold(true);
+    return font;
+}
+
+QFont timeFont(const QFont& base) {
+    QFont font = base;
+    font.setPixelSize(10);
+    return font;
+}
+}
+
+MessageDelegate::MessageDelegate(bool isGroup, QObject *parent)
+    : QStyledItemDelegate(parent), m_isGroup(isGroup), m_cacheWidth(-1) {}
+
+int MessageDelegate::viewWidth(const QStyleOptionViewItem& option) const {
+    const QAbstractItemView *view = qobject_cast<const QAbstractItemView*>(option.widget);
+    return view ? view->viewport()->width() : option.rect.width();
+}
+
+MessageDelegate::Layout MessageDelegate::layoutFor(const QStyleOptionViewItem& option,
+                                                   const QModelIndex& index, int viewWidth) const {
+    const bool mine = index.data(MessageListModel::IsMineRole).toBool();
+    const bool showSender = m_isGroup && !mine;
+    const QString text = index.data(Qt::DisplayRole).toString();
+    const QString time = index.data(MessageListModel::TimestampRole).toDateTime().toLocalTime().toString("hh:mm");
+    
+    QFontMetrics textMetrics(option.font);
+    QFontMetrics senderMetrics(senderFont(option.font));
+    QFontMetrics timeMetrics(timeFont(option.font));
+    
+    const int maxBubble = qMax(viewWidth * 7 / 10, 4 * kPaddingH);
+    const int maxText = maxBubble - 2 * kPaddingH;
+    
+    QRect textBounds = textMetrics.boundingRect(QRect(0, 0, maxText, 1 << 20),
+                                                Qt::TextWordWrap, text);
+    int senderWidth = showSender ? senderMetrics.horizontalAdvance(index.data(MessageListModel::SenderRole).toString()) : 0;
+    int senderHeight = showSender ? senderMetrics.height() + kLineGap : 0;
+    int contentWidth = qMin(maxText, qMax(textBounds.width(), qMax(senderWidth, timeMetrics.horizontalAdvance(time))));
+    
+    Layout layout;
+    int bubbleWidth = contentWidth + 2 * kPaddingH;
+    int bubbleHeight = 2 * kPaddingV + senderHeight + textBounds.height() + kLineGap + timeMetrics.height();
+    int left = mine ? option.rect.left() + viewWidth - kMargin - bubbleWidth : option.rect.left() + kMargin;
+    layout.bubble = QRect(left, option.rect.top() + kMargin, bubbleWidth, bubbleHeight);
+    
+    int x = layout.bubble.left() + kPaddingH;
+    int y = layout.bubble.top() + kPaddingV;
+    layout.sender = QRect(x, y, contentWidth, senderHeight);
+    y += senderHeight;
+    layout.text = QRect(x, y, contentWidth, textBounds.height());
+    y += textBounds.height() + kLineGap;
+    layout.time = QRect(x, y, contentWidth, timeMetrics.height());
+    return layout;
+}
+
+QSize MessageDelegate::sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const {
+    const int width = viewWidth(option);
+    if (width != m_cacheWidth || m_heightCache.size() > kMaxCachedHeights) {
+        m_heightCache.clear();
+        m_cacheWidth = width;
+    }
+    
+    const quint64 id = index.data(MessageListModel::EntryIdRole).toULongLong();
+    auto it = m_heightCache.constFind(id);
+    if (it != m_heightCache.constEnd()) {
+        return QSize(width, it.value());
+    }
+    
+    int height = layoutFor(option, index, width).bubble.height() + 2 * kMargin;
+    m_heightCache.insert(id, height);
+    return QSize(width, height);
+}
+
+void MessageDelegate::paint(QPainter *painter, const QStyleOptionViewItem& option, const QModelIndex& index) const {
+    const bool mine = index.data(MessageListModel::IsMineRole).toBool();
+    const bool attachment = !index.data(MessageListModel::AttachmentHashRole).toString().isEmpty();
+    Layout layout = layoutFor(option, index, viewWidth(option));
+    
+    painter->save();
+    painter->setRenderHint(QPainter::Antialiasing);
+    
+    painter->setPen(Qt::NoPen);
+    painter->setBrush(QColor(mine ? "#005C4B" : "#1E2A2F"));
+    painter->drawRoundedRect(layout.bubble, kRadius, kRadius);
+    
+    if (!layout.sender.isEmpty()) {
+        painter->setFont(senderFont(option.font));
+        painter->setPen(QColor("#25D366"));
+        painter->drawText(layout.sender, Qt::AlignLeft | Qt::AlignTop,
+                          index.data(MessageListModel::SenderRole).toString());
+    }
+    
+    painter->setFont(option.font);
+    painter->setPen(QColor(attachment ? "#53BDEB" : "#E9EDEF"));
+    painter->drawText(layout.text, Qt::AlignLeft | Qt::AlignTop | Qt::TextWordWrap,
+                      index.data(Qt::DisplayRole).toString());
+    
+    painter->setFont(timeFont(option.font));
+    painter->setPen(QColor("#8696A0"));
+    painter->drawText(layout.time, Qt::AlignLeft | Qt::AlignTop,
+                      index.data(MessageListModel::TimestampRole).toDateTime().toLocalTime().toString("hh:mm"));
+    
+    painter->restore();
+}
\ No newline at end of file
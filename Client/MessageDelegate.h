@@ -0,0 +1,34 @@
+#ifndef MESSAGEDELEGATE_H
+#define MESSAGEDELEGATE_H
+
+#include <QStyledItemDelegate>
+#include <QHash>
+
+// Paints one chat bubble per row. Row heights depend only on the text and
+// the viewport width, so they are cached per entry until the width changes.
+class MessageDelegate : public QStyledItemDelegate {
+    Q_OBJECT
+    
+public:
+    explicit MessageDelegate(bool isGroup, QObject *parent = nullptr);
+    
+    void paint(QPainter *painter, const QStyleOptionViewItem& option, const QModelIndex& index) const override;
+    QSize sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const override;
+    
+private:
+    struct Layout {
+        QRect bubble;
+        QRect sender;
+        QRect text;
+        QRect time;
+    };
+    
+    Layout layoutFor(const QStyleOptionViewItem& option, const QModelIndex& index, int viewWidth) const;
+    int viewWidth(const QStyleOptionViewItem& option) const;
+    
+    bool m_isGroup;
+    mutable QHash<quint64, int> m_heightCache; // entry id -> row height
+    mutable int m_cacheWidth;
+};
+
+#endif // MESSAGEDELEGATE_H
\ No newline at end of file
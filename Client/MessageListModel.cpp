@@ -0,0 +1,124 @@
+#include "MessageListModel.h"
+#include <algorithm>
+
+namespace {
+const int kResidentLimit = 1000;
+}
+
+MessageListModel::MessageListModel(const QString& currentUser, QObject *parent)
+    : QAbstractListModel(parent), m_currentUser(currentUser), m_nextId(1),
+      m_residentLimit(kResidentLimit), m_autoTrim(true) {
+    
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(0);
+    connect(&m_flushTimer, &QTimer::timeout, this, &MessageListModel::flushPending);
+}
+
+int MessageListModel::rowCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : int(m_entries.size());
+}
+
+QVariant MessageListModel::data(const QModelIndex& index, int role) const {
+    if (!index.isValid() || index.row() >= m_entries.size()) return QVariant();
+    
+    const Entry& entry = m_entries[index.row()];
+    switch (role) {
+        case Qt::DisplayRole: return entry.text;
+        case SenderRole: return entry.sender;
+        case TimestampRole: return entry.timestamp;
+        case IsMineRole: return entry.mine;
+        case AttachmentHashRole: return entry.attachmentHash;
+        case AttachmentNameRole: return entry.attachmentName;
+        case EntryIdRole: return entry.id;
+        default: return QVariant();
+    }
+}
+
+MessageListModel::Entry MessageListModel::makeEntry(const QString& sender, const QString& content,
+                                                    const QDateTime& timestamp, int messageId) {
+    Entry entry;
+    entry.id = m_nextId++;
+    entry.messageId = messageId;
+    entry.sender = sender;
+    entry.timestamp = timestamp;
+    entry.mine = sender == m_currentUser;
+    
+    if (content.startsWith(ChatProtocol::ATTACHMENT_PREFIX)) {
+        // "ATTACHMENT:<hash>:<size>:<filename>" (the file name may contain ':')
+        QString reference = content.mid(int(sizeof(ChatProtocol::ATTACHMENT_PREFIX)) - 1);
+        qint64 size = reference.section(':', 1, 1).toLongLong();
+        entry.attachmentHash = reference.section(':', 0, 0);
+        entry.attachmentName = reference.section(':', 2);
+        entry.text = QString::fromUtf8("\xF0\x9F\x93\x8E ") + entry.attachmentName +
+                     QString(" (%1 KB)").arg((size + 1023) / 1024);
+    } else {
+        entry.text = content;
+    }
+    return entry;
+}
+
+void MessageListModel::appendMessage(const QString& sender, const QString& content, const QDateTime& timestamp,
+                                     int messageId) {
+    m_pending.append(makeEntry(sender, content, timestamp, messageId));
+    if (!m_flushTimer.isActive()) {
+        m_flushTimer.start();
+    }
+}
+
+void MessageListModel::flushPending() {
+    if (m_pending.isEmpty()) return;
+    
+    QList<int> dropped;
+    if (m_autoTrim) {
+        // Nobody is looking at the top, so only the newest rows stay resident
+        if (m_pending.size() > m_residentLimit) {
+            qsizetype excess = m_pending.size() - m_residentLimit;
+            for (qsizetype i = 0; i < excess; ++i) {
+                if (m_pending[i].messageId > 0) dropped.append(m_pending[i].messageId);
+            }
+            m_pending.remove(0, excess);
+        }
+        
+        qsizetype excess = m_entries.size() + m_pending.size() - m_residentLimit;
+        if (excess > 0) {
+            for (qsizetype i = 0; i < excess; ++i) {
+                if (m_entries[i].messageId > 0) dropped.append(m_entries[i].messageId);
+            }
+            beginRemoveRows(QModelIndex(), 0, int(excess) - 1);
+            m_entries.remove(0, excess);
+            endRemoveRows();
+        }
+    }
+    
+    int first = int(m_entries.size());
+    beginInsertRows(QModelIndex(), first, first + int(m_pending.size()) - 1);
+    m_entries.append(m_pending);
+    endInsertRows();
+    
+    m_pending.clear();
+    
+    if (dropped.isEmpty()) return;
+    
+    // Paging back resumes from what is still shown, so the dropped rows come back
+    int oldestId = 0;
+    for (const Entry& entry : m_entries) {
+        if (entry.messageId > 0 && (oldestId == 0 || entry.messageId < oldestId)) oldestId = entry.messageId;
+    }
+    if (oldestId == 0) oldestId = *std::max_element(dropped.cbegin(), dropped.cend()) + 1;
+    emit trimmed(dropped, oldestId);
+}
+
+void MessageListModel::prependMessages(const QList<ChatProtocol::Message>& messages) {
+    if (messages.isEmpty()) return;
+    
+    QList<Entry> entries;
+    entries.reserve(messages.size());
+    for (const auto& msg : messages) {
+        entries.append(makeEntry(msg.sender, msg.content, msg.timestamp, msg.messageId));
+    }
+    
+    beginInsertRows(QModelIndex(), 0, int(entries.size()) - 1);
+    entries.append(m_entries);
+    m_entries.swap(entries);
+    endInsertRows();
+}
\ No newline at end of file
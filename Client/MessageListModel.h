@@ -0,0 +1,70 @@
+#ifndef MESSAGELISTMODEL_H
+#define MESSAGELISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QDateTime>
+#include <QList>
+#include <QTimer>
+#include "Protocol.h"
+
+// Transcript of one conversation. Holds a window of the newest messages;
+// appends are batched into one insert per event-loop pass, and while the
+// view follows the bottom the oldest rows are dropped past the limit.
+// Older pages are fetched again on demand and prepended.
+class MessageListModel : public QAbstractListModel {
+    Q_OBJECT
+    
+public:
+    enum Roles {
+        SenderRole = Qt::UserRole + 1,
+        TimestampRole,
+        IsMineRole,
+        AttachmentHashRole,
+        AttachmentNameRole,
+        EntryIdRole
+    };
+    
+    explicit MessageListModel(const QString& currentUser, QObject *parent = nullptr);
+    
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    
+    void appendMessage(const QString& sender, const QString& content, const QDateTime& timestamp, int messageId = 0);
+    void prependMessages(const QList<ChatProtocol::Message>& messages);
+    
+    void setAutoTrim(bool enabled) { m_autoTrim = enabled; }
+    int messageCount() const { return int(m_entries.size() + m_pending.size()); } // includes unflushed
+    int residentLimit() const { return m_residentLimit; }
+    
+signals:
+    // Server ids of the dropped rows, and the oldest id still resident (or
+    // just above the dropped ones) to page back from
+    void trimmed(const QList<int>& messageIds, int oldestId);
+    
+private slots:
+    void flushPending();
+    
+private:
+    struct Entry {
+        quint64 id;
+        int messageId; // server id, 0 until the server has stored it
+        QString sender;
+        QString text;
+        QDateTime timestamp;
+        QString attachmentHash;
+        QString attachmentName;
+        bool mine;
+    };
+    
+    Entry makeEntry(const QString& sender, const QString& content, const QDateTime& timestamp, int messageId);
+    
+    QString m_currentUser;
+    QList<Entry> m_entries;
+    QList<Entry> m_pending;
+    QTimer m_flushTimer;
+    quint64 m_nextId;
+    int m_residentLimit;
+    bool m_autoTrim;
+};
+
+#endif // MESSAGELISTMODEL_H
\ No newline at end of file
@@ -1,39 +1,126 @@
 #include "NetworkManager.h"
+#include "AttachmentTransfer.h"
+#include "NetworkWorker.h"
 #include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QCryptographicHash>
+#include <QRandomGenerator>
+#include <QPromise>
+#include <QSet>
 
 NetworkManager::NetworkManager(QObject *parent) 
-    : QObject(parent), m_socket(new QTcpSocket(this)), m_expectedSize(0) {
+    : QObject(parent), m_worker(new NetworkWorker()), m_port(0), m_receiptTimer(new QTimer(this)),
+      m_nextRequestId(1), m_online(false), m_resuming(false), m_lastPrivateId(0), m_lastGroupId(0),
+      m_reconnectAttempt(0), m_reconnectTimer(new QTimer(this)) {
     
-    connect(m_socket, &QTcpSocket::connected, this, &NetworkManager::onConnected);
-    connect(m_socket, &QTcpSocket::disconnected, this, &NetworkManager::onDisconnected);
-    connect(m_socket, &QTcpSocket::readyRead, this, &NetworkManager::onReadyRead);
-    connect(m_socket, &QTcpSocket::errorOccurred, this, &NetworkManager::onError);
+    // Socket I/O and decoding run on their own thread; we only see decoded batches
+    m_worker->moveToThread(&m_networkThread);
+    connect(&m_networkThread, &QThread::finished, m_worker, &QObject::deleteLater);
+    connect(m_worker, &NetworkWorker::connected, this, &NetworkManager::onConnected);
+    connect(m_worker, &NetworkWorker::disconnected, this, &NetworkManager::onDisconnected);
+    connect(m_worker, &NetworkWorker::errorOccurred, this, &NetworkManager::onError);
+    connect(m_worker, &NetworkWorker::messagesReceived, this, &NetworkManager::onMessagesReceived);
+    m_networkThread.start();
+    
+    m_receiptTimer->setSingleShot(true);
+    m_receiptTimer->setInterval(ChatProtocol::READ_RECEIPT_FLUSH_MS);
+    connect(m_receiptTimer, &QTimer::timeout, this, &NetworkManager::flushReadReceipts);
+    
+    m_reconnectTimer->setSingleShot(true);
+    connect(m_reconnectTimer, &QTimer::timeout, this, &NetworkManager::onReconnectTimeout);
 }
 
 NetworkManager::~NetworkManager() {
-    if (m_socket->isOpen()) {
-        m_socket->close();
-    }
+    QMetaObject::invokeMethod(m_worker, &NetworkWorker::close, Qt::BlockingQueuedConnection);
+    m_networkThread.quit();
+    m_networkThread.wait();
+}
+
+void NetworkManager::setTlsConfiguration(const QSslConfiguration& config) {
+    m_tlsConfig = config;
+    QMetaObject::invokeMethod(m_worker, [worker = m_worker, config]() {
+        worker->setTlsConfiguration(config);
+    }, Qt::QueuedConnection);
 }
 
 void NetworkManager::connectToServer(const QString& host, quint16 port) {
-    m_socket->connectToHost(host, port);
+    m_host = host;
+    m_port = port;
+    QMetaObject::invokeMethod(m_worker, [worker = m_worker, host, port]() {
+        worker->connectToHost(host, port);
+    }, Qt::QueuedConnection);
 }
 
-void NetworkManager::sendMessage(const ChatProtocol::Message& msg) {
-    if (m_socket->state() != QAbstractSocket::ConnectedState) return;
+quint32 NetworkManager::request(ChatProtocol::Message msg, ReplyHandler onReply) {
+    msg.requestId = nextRequestId();
+    m_pendingReplies.insert(msg.requestId, std::make_shared<PendingReply>(PendingReply{msg, std::move(onReply)}));
+    sendMessage(msg);
+    return msg.requestId;
+}
+
+QFuture<QList<ChatProtocol::Message>> NetworkManager::request(const ChatProtocol::Message& msg) {
+    auto promise = std::make_shared<QPromise<QList<ChatProtocol::Message>>>();
+    promise->start();
+    
+    request(msg, [promise, frames = QList<ChatProtocol::Message>()](const ChatProtocol::Message& reply,
+                                                                   bool last) mutable {
+        frames.append(reply);
+        if (!last) return;
+        promise->addResult(frames);
+        promise->finish();
+    });
+    return promise->future();
+}
+
+quint32 NetworkManager::nextRequestId() {
+    quint32 id = m_nextRequestId++;
+    if (m_nextRequestId == 0) m_nextRequestId = 1; // 0 marks server pushes
+    return id;
+}
+
+bool NetworkManager::isFinalReply(const ChatProtocol::Message& reply) {
+    switch (reply.type) {
+        case ChatProtocol::MessageType::MESSAGE_HISTORY_RESPONSE:
+            return false; // rows, then MESSAGE_HISTORY_END
+        case ChatProtocol::MessageType::USERS_LIST_PART:
+        case ChatProtocol::MessageType::GROUPS_LIST_PART:
+        case ChatProtocol::MessageType::GROUP_MEMBERS_PART:
+            return false; // the list's own type carries the last part
+        default:
+            return true;
+    }
+}
+
+void NetworkManager::abandonRequests(const QString& reason) {
+    auto pending = std::move(m_pendingReplies);
+    m_pendingReplies.clear();
     
-    QByteArray data = msg.serialize();
-    QByteArray block;
-    QDataStream out(&block, QIODevice::WriteOnly);
-    out << quint32(data.size());
-    block.append(data);
+    for (auto it = pending.cbegin(); it != pending.cend(); ++it) {
+        ChatProtocol::Message failure;
+        failure.type = ChatProtocol::MessageType::ERROR_MSG;
+        failure.content = reason;
+        failure.requestId = it.key();
+        it.value()->handler(failure, true);
+    }
+}
+
+void NetworkManager::sendMessage(const ChatProtocol::Message& msg) {
+    // Untracked frames get an id too; their replies go through the signals
+    ChatProtocol::Message stamped = msg;
+    if (stamped.requestId == 0) {
+        stamped.requestId = nextRequestId();
+    }
     
-    m_socket->write(block);
-    m_socket->flush();
+    QByteArray frame = NetworkWorker::encodeFrame(stamped);
+    QMetaObject::invokeMethod(m_worker, [worker = m_worker, frame]() {
+        worker->send(frame);
+    }, Qt::QueuedConnection);
 }
 
 void NetworkManager::registerUser(const QString& username, const QString& password) {
+    m_username = username;
+    
     ChatProtocol::Message msg;
     msg.type = ChatProtocol::MessageType::REGISTER;
     msg.sender = username;
@@ -42,6 +129,8 @@ void NetworkManager::registerUser(const QString& username, const QString& passwo
 }
 
 void NetworkManager::login(const QString& username, const QString& password) {
+    m_username = username;
+    
     ChatProtocol::Message msg;
     msg.type = ChatProtocol::MessageType::LOGIN;
     msg.sender = username;
@@ -78,19 +167,68 @@ void NetworkManager::requestUsers() {
     sendMessage(msg);
 }
 
+void NetworkManager::searchDirectory(const QString& prefix, const QString& cursor) {
+    ChatProtocol::Message msg;
+    msg.type = ChatProtocol::MessageType::DIRECTORY_SEARCH;
+    msg.content = prefix;
+    msg.recipient = cursor;
+    msg.messageId = ChatProtocol::DIRECTORY_PAGE_SIZE;
+    sendMessage(msg);
+}
+
 void NetworkManager::requestGroups() {
     ChatProtocol::Message msg;
     msg.type = ChatProtocol::MessageType::GET_GROUPS;
     sendMessage(msg);
 }
 
-void NetworkManager::requestMessageHistory(const QString& recipient, bool isGroup) {
+void NetworkManager::requestMessageHistory(const QString& recipient, bool isGroup, int beforeId) {
+    ChatProtocol::Message msg;
+    msg.type = ChatProtocol::MessageType::HISTORY_BEFORE_REQUEST;
+    msg.recipient = recipient;
+    msg.messageId = beforeId;
+    if (isGroup) {
+        msg.content = "GROUP:" + recipient;
+    }
+    requestHistory(msg, MessageCache::keyFor(recipient, isGroup));
+}
+
+void NetworkManager::requestHistorySync(const QString& recipient, bool isGroup, int afterId) {
     ChatProtocol::Message msg;
-    msg.type = ChatProtocol::MessageType::MESSAGE_HISTORY_REQUEST;
+    msg.type = ChatProtocol::MessageType::HISTORY_SYNC_REQUEST;
     msg.recipient = recipient;
+    msg.messageId = afterId;
     if (isGroup) {
         msg.content = "GROUP:" + recipient;
     }
+    requestHistory(msg, MessageCache::keyFor(recipient, isGroup));
+}
+
+void NetworkManager::requestHistory(const ChatProtocol::Message& msg, const QString& key) {
+    // A resumed session re-sends the request, so rows already delivered can come again
+    request(msg, [this, key, rows = QList<ChatProtocol::Message>(), seen = QSet<int>()](
+                     const ChatProtocol::Message& reply, bool last) mutable {
+        ConversationView *view = m_conversations.find(key);
+        
+        if (reply.type == ChatProtocol::MessageType::MESSAGE_HISTORY_RESPONSE) {
+            if (reply.messageId > 0) {
+                if (seen.contains(reply.messageId)) return;
+                seen.insert(reply.messageId);
+            }
+            rows.append(reply);
+            if (view) view->historyRow(reply);
+        }
+        if (!last) return;
+        
+        m_cache.store(key, rows);
+        if (view) view->historyEnd();
+    });
+}
+
+void NetworkManager::joinGroup(const QString& groupName) {
+    ChatProtocol::Message msg;
+    msg.type = ChatProtocol::MessageType::JOIN_GROUP;
+    msg.content = groupName;
     sendMessage(msg);
 }
 
@@ -113,46 +251,278 @@ void NetworkManager::requestGroupMembers(const QString& groupName) {
     ChatProtocol::Message msg;
     msg.type = ChatProtocol::MessageType::GROUP_MEMBERS_REQUEST;
     msg.content = groupName;
+    
+    request(msg, [this, groupName, members = QStringList()](const ChatProtocol::Message& reply,
+                                                             bool last) mutable {
+        if (reply.type != ChatProtocol::MessageType::GROUP_MEMBERS_RESPONSE &&
+            reply.type != ChatProtocol::MessageType::GROUP_MEMBERS_PART) return;
+        members.append(reply.content.split(",", Qt::SkipEmptyParts));
+        if (!last) return;
+        
+        ConversationView *view = m_conversations.find(MessageCache::keyFor(groupName, true));
+        if (view) view->groupMembers(members, reply.sender);
+    });
+}
+
+void NetworkManager::sendTyping(const QString& conversation, bool isGroup) {
+    // One frame per window however many keys are pressed
+    QElapsedTimer& lastSent = m_typingSent[conversation];
+    if (lastSent.isValid() && lastSent.elapsed() < ChatProtocol::TYPING_COALESCE_MS) return;
+    lastSent.start();
+    
+    ChatProtocol::Message msg;
+    msg.type = isGroup ? ChatProtocol::MessageType::GROUP_TYPING : ChatProtocol::MessageType::TYPING;
+    msg.recipient = conversation;
+    sendMessage(msg);
+}
+
+void NetworkManager::markRead(const QString& contact, const QDateTime& upTo) {
+    // Only the high-water mark per conversation is sent, once per flush
+    qint64 mark = upTo.toMSecsSinceEpoch();
+    if (mark <= m_sentReceipts.value(contact) || mark <= m_unsentReceipts.value(contact)) return;
+    
+    m_unsentReceipts.insert(contact, mark);
+    if (!m_receiptTimer->isActive()) {
+        m_receiptTimer->start();
+    }
+}
+
+void NetworkManager::flushReadReceipts() {
+    for (auto it = m_unsentReceipts.constBegin(); it != m_unsentReceipts.constEnd(); ++it) {
+        ChatProtocol::Message msg;
+        msg.type = ChatProtocol::MessageType::READ_RECEIPT;
+        msg.recipient = it.key();
+        msg.content = QString::number(it.value());
+        sendMessage(msg);
+        m_sentReceipts.insert(it.key(), it.value());
+    }
+    m_unsentReceipts.clear();
+}
+
+QString NetworkManager::uploadAttachment(const QString& filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) return QString();
+    
+    QCryptographicHash digest(QCryptographicHash::Sha256);
+    digest.addData(&file);
+    QString hash = QString::fromLatin1(digest.result().toHex());
+    
+    m_pendingUploads[hash] = filePath;
+    
+    ChatProtocol::Message msg;
+    msg.type = ChatProtocol::MessageType::ATTACHMENT_UPLOAD_REQUEST;
+    msg.content = hash + ":" + QString::number(file.size());
     sendMessage(msg);
+    return hash;
+}
+
+void NetworkManager::downloadAttachment(const QString& hash, const QString& savePath) {
+    m_pendingDownloads[hash] = savePath;
+    
+    ChatProtocol::Message msg;
+    msg.type = ChatProtocol::MessageType::ATTACHMENT_DOWNLOAD_REQUEST;
+    msg.content = hash;
+    sendMessage(msg);
+}
+
+void NetworkManager::onUploadReady(const QString& content) {
+    // content: "<hash>:<token>:<offset>"; an empty token means already stored
+    const QStringList parts = content.split(':');
+    QString hash = parts.value(0);
+    QString filePath = m_pendingUploads.value(hash);
+    if (filePath.isEmpty()) return;
+    
+    QFileInfo info(filePath);
+    
+    if (parts.value(1).isEmpty()) {
+        m_pendingUploads.remove(hash);
+        emit attachmentUploaded(hash, info.fileName(), info.size());
+        return;
+    }
+    
+    auto *transfer = new AttachmentTransfer(AttachmentTransfer::UPLOAD, hash, filePath,
+                                            parts.value(2).toLongLong(), info.size(), this);
+    startTransfer(transfer, parts.value(1).toLatin1());
+}
+
+void NetworkManager::onDownloadReady(const QString& content) {
+    // content: "<hash>:<token>:<size>"
+    const QStringList parts = content.split(':');
+    QString hash = parts.value(0);
+    QString savePath = m_pendingDownloads.value(hash);
+    if (savePath.isEmpty()) return;
+    
+    // Resume into whatever an earlier attempt left behind
+    QString partialPath = savePath + ".part";
+    auto *transfer = new AttachmentTransfer(AttachmentTransfer::DOWNLOAD, hash, partialPath,
+                                            QFileInfo(partialPath).size(), parts.value(2).toLongLong(), this);
+    startTransfer(transfer, parts.value(1).toLatin1());
+}
+
+void NetworkManager::startTransfer(AttachmentTransfer *transfer, const QByteArray& token) {
+    connect(transfer, &AttachmentTransfer::progress, this, &NetworkManager::attachmentProgress);
+    connect(transfer, &AttachmentTransfer::finished, this, [this, transfer](const QString& hash, bool ok) {
+        transfer->deleteLater();
+        
+        if (!ok) {
+            m_pendingUploads.remove(hash);
+            m_pendingDownloads.remove(hash);
+            emit attachmentFailed(hash);
+            return;
+        }
+        
+        if (m_pendingUploads.contains(hash)) {
+            QFileInfo info(m_pendingUploads.take(hash));
+            emit attachmentUploaded(hash, info.fileName(), info.size());
+        } else if (m_pendingDownloads.contains(hash)) {
+            QString savePath = m_pendingDownloads.take(hash);
+            QFile::remove(savePath);
+            QFile::rename(transfer->filePath(), savePath);
+            emit attachmentDownloaded(hash, savePath);
+        }
+    });
+    
+    transfer->start(m_host, m_port + ChatProtocol::BULK_PORT_OFFSET, token, m_tlsConfig);
 }
 
 void NetworkManager::onConnected() {
     qDebug() << "Connected to server";
+    m_online = true;
+    
+    if (m_resuming) {
+        // Restore the session without credentials
+        ChatProtocol::Message msg;
+        msg.type = ChatProtocol::MessageType::RESUME_SESSION;
+        msg.sender = m_username;
+        msg.content = QString("%1:%2:%3").arg(m_resumeToken, QString::number(m_lastPrivateId),
+                                              QString::number(m_lastGroupId));
+        sendMessage(msg);
+        return;
+    }
     emit connected();
 }
 
 void NetworkManager::onDisconnected() {
     qDebug() << "Disconnected from server";
-    emit disconnected();
+    m_online = false;
+    m_receiptTimer->stop();
+    m_listParts.clear();
+    m_typingSent.clear();
+    m_unsentReceipts.clear();
+    m_sentReceipts.clear();
+    
+    if (m_resumeToken.isEmpty()) {
+        abandonRequests("Connection lost");
+        emit disconnected();
+        return;
+    }
+    
+    // Outstanding requests are sent again once the session is back
+    if (!m_resuming) {
+        m_resuming = true;
+        m_offlineSince.start();
+    }
+    scheduleReconnect();
 }
 
-void NetworkManager::onReadyRead() {
-    while (m_socket->bytesAvailable() > 0) {
-        if (m_expectedSize == 0) {
-            if (m_socket->bytesAvailable() < sizeof(quint32)) return;
-            QDataStream in(m_socket);
-            in >> m_expectedSize;
-        }
-        
-        m_buffer.append(m_socket->read(m_expectedSize - m_buffer.size()));
-        
-        if (m_buffer.size() == m_expectedSize) {
-            ChatProtocol::Message msg = ChatProtocol::Message::deserialize(m_buffer);
-            handleMessage(msg);
-            m_buffer.clear();
-            m_expectedSize = 0;
-        }
+void NetworkManager::scheduleReconnect() {
+    if (m_reconnectTimer->isActive()) return;
+    
+    // Exponential backoff with jitter so clients dropped together don't return together
+    int ceiling = ChatProtocol::RECONNECT_MAX_DELAY_MS;
+    if (m_reconnectAttempt < 16) {
+        ceiling = qMin(ceiling, ChatProtocol::RECONNECT_BASE_DELAY_MS << m_reconnectAttempt);
     }
+    int delay = ceiling / 2 + int(QRandomGenerator::global()->bounded(ceiling / 2 + 1));
+    ++m_reconnectAttempt;
+    
+    qDebug() << "Reconnecting in" << delay << "ms";
+    m_reconnectTimer->start(delay);
+    emit reconnecting(delay);
 }
 
-void NetworkManager::onError(QAbstractSocket::SocketError error) {
-    qDebug() << "Socket error:" << m_socket->errorString();
-    emit errorOccurred(m_socket->errorString());
+void NetworkManager::onReconnectTimeout() {
+    connectToServer(m_host, m_port);
+}
+
+void NetworkManager::onSessionToken(const QString& content) {
+    // content: "<token>:<privateId>:<groupId>"
+    const QStringList parts = content.split(':');
+    if (parts.size() != 3) return;
+    
+    m_resumeToken = parts[0];
+    m_lastPrivateId = qMax(m_lastPrivateId, parts[1].toInt());
+    m_lastGroupId = qMax(m_lastGroupId, parts[2].toInt());
+    
+    if (!m_resuming) return;
+    
+    m_resuming = false;
+    m_reconnectAttempt = 0;
+    for (const auto& pending : m_pendingReplies) {
+        sendMessage(pending->request);
+    }
+    
+    qDebug() << "Session resumed after" << m_offlineSince.elapsed() << "ms offline";
+    emit reconnected();
+}
+
+void NetworkManager::onMessagesReceived(const QList<ChatProtocol::Message>& batch) {
+    for (const auto& msg : batch) {
+        handleMessage(msg);
+    }
+    
+    // One cache transaction per conversation per batch
+    for (auto it = m_liveRows.constBegin(); it != m_liveRows.constEnd(); ++it) {
+        m_cache.store(it.key(), it.value());
+    }
+    m_liveRows.clear();
+}
+
+void NetworkManager::onError(const QString& error) {
+    qDebug() << "Socket error:" << error;
+    
+    // A failed reconnect attempt never reaches disconnected(), so retry from here
+    if (m_resuming && !m_online) {
+        scheduleReconnect();
+        return;
+    }
+    emit errorOccurred(error);
+}
+
+bool NetworkManager::collectListPart(const ChatProtocol::Message& msg, QStringList *items) {
+    // Long lists arrive as *_PART frames, then one of the list's own type
+    const bool users = msg.type == ChatProtocol::MessageType::USERS_LIST ||
+                       msg.type == ChatProtocol::MessageType::USERS_LIST_PART;
+    QString key = QString(users ? "users:" : "groups:") + msg.recipient;
+    QStringList& parts = m_listParts[key];
+    parts.append(msg.content.split(",", Qt::SkipEmptyParts));
+    
+    if (msg.type == ChatProtocol::MessageType::USERS_LIST_PART ||
+        msg.type == ChatProtocol::MessageType::GROUPS_LIST_PART) return false;
+    
+    *items = m_listParts.take(key);
+    return true;
 }
 
 void NetworkManager::handleMessage(const ChatProtocol::Message& msg) {
+    // Replies to tracked requests go to their handler, in whatever order they arrive
+    if (msg.requestId != 0) {
+        std::shared_ptr<PendingReply> pending = m_pendingReplies.value(msg.requestId);
+        if (pending) {
+            bool last = isFinalReply(msg);
+            if (last) m_pendingReplies.remove(msg.requestId);
+            pending->handler(msg, last);
+            
+            if (msg.type == ChatProtocol::MessageType::ERROR_MSG) {
+                emit errorOccurred(msg.content);
+            }
+            return;
+        }
+    }
+    
     switch (msg.type) {
         case ChatProtocol::MessageType::AUTH_SUCCESS:
+            m_cache.open(m_username);
             emit authSuccess();
             break;
             
@@ -160,37 +530,80 @@ void NetworkManager::handleMessage(const ChatProtocol::Message& msg) {
             emit authFailure(msg.content);
             break;
             
-        case ChatProtocol::MessageType::PRIVATE_MESSAGE:
-            emit privateMessageReceived(msg.sender, msg.content, msg.timestamp);
+        case ChatProtocol::MessageType::SESSION_TOKEN:
+            onSessionToken(msg.content);
+            break;
+            
+        case ChatProtocol::MessageType::RESUME_FAILURE:
+            qDebug() << "Session resume rejected:" << msg.content;
+            m_resuming = false;
+            m_resumeToken.clear();
+            abandonRequests(msg.content);
+            emit sessionExpired(msg.content);
             break;
             
+        case ChatProtocol::MessageType::PRIVATE_MESSAGE: {
+            // Our own messages come back once stored, carrying their id
+            QString contact = msg.sender == m_username ? msg.recipient : msg.sender;
+            m_lastPrivateId = qMax(m_lastPrivateId, msg.messageId);
+            m_liveRows[MessageCache::keyFor(contact, false)].append(msg);
+            emit privateMessageReceived(msg.sender, msg.content, msg.timestamp, msg.messageId);
+            break;
+        }
+            
         case ChatProtocol::MessageType::GROUP_MESSAGE:
-            emit groupMessageReceived(msg.sender, msg.recipient, msg.content, msg.timestamp);
+            m_lastGroupId = qMax(m_lastGroupId, msg.messageId);
+            m_liveRows[MessageCache::keyFor(msg.recipient, true)].append(msg);
+            emit groupMessageReceived(msg.sender, msg.recipient, msg.content, msg.timestamp, msg.messageId);
             break;
             
-        case ChatProtocol::MessageType::USERS_LIST:
-            m_allUsersList = msg.content.split(",", Qt::SkipEmptyParts);
+        case ChatProtocol::MessageType::USERS_LIST_PART:
+        case ChatProtocol::MessageType::USERS_LIST: {
+            QStringList users;
+            if (!collectListPart(msg, &users)) break;
+            m_allUsersList = users;
             emit usersListReceived(m_allUsersList);
             break;
+        }
             
-        case ChatProtocol::MessageType::GROUPS_LIST:
-            emit groupsListReceived(msg.content.split(",", Qt::SkipEmptyParts));
+        case ChatProtocol::MessageType::DIRECTORY_RESULT:
+            emit directoryPageReceived(msg.sender, msg.content.split(',', Qt::SkipEmptyParts), msg.recipient);
             break;
             
+        case ChatProtocol::MessageType::GROUPS_LIST_PART:
+        case ChatProtocol::MessageType::GROUPS_LIST: {
+            QStringList groups;
+            if (!collectListPart(msg, &groups)) break;
+            emit groupsListReceived(groups);
+            break;
+        }
+            
         case ChatProtocol::MessageType::GROUP_CREATED:
             emit groupCreated(msg.content);
             break;
             
-        case ChatProtocol::MessageType::MESSAGE_HISTORY_RESPONSE:
-            emit messageHistoryReceived(msg.sender, msg.recipient, msg.content, msg.timestamp);
+        case ChatProtocol::MessageType::ERROR_MSG:
+            emit errorOccurred(msg.content);
             break;
             
-        case ChatProtocol::MessageType::GROUP_MEMBERS_RESPONSE:
-            emit groupMembersReceived(msg.recipient, msg.content.split(",", Qt::SkipEmptyParts), msg.sender);
+        case ChatProtocol::MessageType::ATTACHMENT_UPLOAD_READY:
+            onUploadReady(msg.content);
             break;
             
-        case ChatProtocol::MessageType::ERROR_MSG:
-            emit errorOccurred(msg.content);
+        case ChatProtocol::MessageType::ATTACHMENT_DOWNLOAD_READY:
+            onDownloadReady(msg.content);
+            break;
+            
+        case ChatProtocol::MessageType::TYPING:
+            emit typingReceived(msg.sender, msg.sender);
+            break;
+            
+        case ChatProtocol::MessageType::GROUP_TYPING:
+            emit typingReceived(msg.sender, msg.recipient);
+            break;
+            
+        case ChatProtocol::MessageType::READ_RECEIPT:
+            emit readReceiptReceived(msg.sender, QDateTime::fromMSecsSinceEpoch(msg.content.toLongLong()));
             break;
             
         default:
@@ -2,16 +2,40 @@
 #define NETWORKMANAGER_H
 
 #include <QObject>
-#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSslConfiguration>
+#include <QFuture>
+#include <functional>
+#include <memory>
 #include "Protocol.h"
+#include "MessageCache.h"
+#include "ConversationDispatcher.h"
 
+class AttachmentTransfer;
+class NetworkWorker;
+
+// Client core: connection, session and request handling with no widgets, so
+// it can drive a headless client as well as the GUI. Every outgoing frame
+// gets a request id that the server echoes, so any number of requests can
+// be in flight and their replies may arrive in any order.
 class NetworkManager : public QObject {
     Q_OBJECT
     
 public:
+    // Called for every frame answering a request; last is set on the final one.
+    // A request that can no longer be answered gets a single ERROR_MSG.
+    using ReplyHandler = std::function<void(const ChatProtocol::Message& reply, bool last)>;
+    
     explicit NetworkManager(QObject *parent = nullptr);
     ~NetworkManager();
     
+    quint32 request(ChatProtocol::Message msg, ReplyHandler onReply);
+    QFuture<QList<ChatProtocol::Message>> request(const ChatProtocol::Message& msg); // every reply frame
+    
+    void setTlsConfiguration(const QSslConfiguration& config); // before connectToServer()
     void connectToServer(const QString& host, quint16 port);
     void registerUser(const QString& username, const QString& password);
     void login(const QString& username, const QString& password);
@@ -19,42 +43,105 @@ public:
     void sendGroupMessage(const QString& groupName, const QString& content);
     void createGroup(const QString& groupName);
     void requestUsers();
+    void searchDirectory(const QString& prefix, const QString& cursor = QString());
     void requestGroups();
-    void requestMessageHistory(const QString& recipient, bool isGroup = false);
+    void requestMessageHistory(const QString& recipient, bool isGroup = false, int beforeId = 0);
+    void requestHistorySync(const QString& recipient, bool isGroup, int afterId);
+    void joinGroup(const QString& groupName);
     void leaveGroup(const QString& groupName);
     void kickMember(const QString& groupName, const QString& member);
     void requestGroupMembers(const QString& groupName);
+    QString uploadAttachment(const QString& filePath); // returns the content hash
+    void downloadAttachment(const QString& hash, const QString& savePath);
+    void sendTyping(const QString& conversation, bool isGroup);
+    void markRead(const QString& contact, const QDateTime& upTo);
     
     QStringList getAllUsersList() const { return m_allUsersList; }
+    MessageCache* messageCache() { return &m_cache; }
+    ConversationDispatcher* conversations() { return &m_conversations; }
     
 signals:
     void connected();
     void disconnected();
     void authSuccess();
     void authFailure(const QString& error);
-    void privateMessageReceived(const QString& sender, const QString& content, const QDateTime& timestamp);
-    void groupMessageReceived(const QString& sender, const QString& groupName, const QString& content, const QDateTime& timestamp);
+    void privateMessageReceived(const QString& sender, const QString& content, const QDateTime& timestamp, int messageId);
+    void groupMessageReceived(const QString& sender, const QString& groupName, const QString& content,
+                              const QDateTime& timestamp, int messageId);
     void usersListReceived(const QStringList& users);
+    void directoryPageReceived(const QString& prefix, const QStringList& users, const QString& nextCursor);
     void groupsListReceived(const QStringList& groups);
     void groupCreated(const QString& groupName);
-    void messageHistoryReceived(const QString& sender, const QString& recipient, const QString& content, const QDateTime& timestamp);
-    void groupMembersReceived(const QString& groupName, const QStringList& members, const QString& admin);
     void errorOccurred(const QString& error);
+    void attachmentUploaded(const QString& hash, const QString& fileName, qint64 size);
+    void attachmentDownloaded(const QString& hash, const QString& filePath);
+    void attachmentProgress(const QString& hash, qint64 done, qint64 total);
+    void attachmentFailed(const QString& hash);
+    void typingReceived(const QString& sender, const QString& conversation);
+    void readReceiptReceived(const QString& reader, const QDateTime& upTo);
+    void reconnecting(int delayMs);
+    void reconnected();
+    void sessionExpired(const QString& reason);
     
 private slots:
     void onConnected();
     void onDisconnected();
-    void onReadyRead();
-    void onError(QAbstractSocket::SocketError error);
+    void onMessagesReceived(const QList<ChatProtocol::Message>& batch);
+    void onError(const QString& error);
+    void flushReadReceipts();
+    void onReconnectTimeout();
     
 private:
     void sendMessage(const ChatProtocol::Message& msg);
     void handleMessage(const ChatProtocol::Message& msg);
+    bool collectListPart(const ChatProtocol::Message& msg, QStringList *items);
+    quint32 nextRequestId();
+    static bool isFinalReply(const ChatProtocol::Message& reply);
+    void requestHistory(const ChatProtocol::Message& msg, const QString& key);
+    void abandonRequests(const QString& reason);
+    void startTransfer(AttachmentTransfer *transfer, const QByteArray& token);
+    void onUploadReady(const QString& content);
+    void onDownloadReady(const QString& content);
+    void scheduleReconnect();
+    void onSessionToken(const QString& content);
+    
+    struct PendingReply {
+        ChatProtocol::Message request; // re-sent if the session is resumed before the reply
+        ReplyHandler handler;
+    };
     
-    QTcpSocket *m_socket;
-    quint32 m_expectedSize;
-    QByteArray m_buffer;
+    QThread m_networkThread;
+    NetworkWorker *m_worker; // lives on m_networkThread
     QStringList m_allUsersList;  // Store received users list
+    QHash<QString, QStringList> m_listParts; // split lists still being received
+    
+    QString m_host;
+    quint16 m_port;
+    QSslConfiguration m_tlsConfig; // null: plain TCP
+    QHash<QString, QString> m_pendingUploads;   // hash -> local file
+    QHash<QString, QString> m_pendingDownloads; // hash -> save path
+    
+    QHash<QString, QElapsedTimer> m_typingSent; // conversation -> last announcement
+    QHash<QString, qint64> m_unsentReceipts;    // contact -> newest read (ms since epoch)
+    QHash<QString, qint64> m_sentReceipts;
+    QTimer *m_receiptTimer;
+    
+    QString m_username;
+    MessageCache m_cache;
+    ConversationDispatcher m_conversations;
+    quint32 m_nextRequestId;
+    QHash<quint32, std::shared_ptr<PendingReply>> m_pendingReplies;
+    QHash<QString, QList<ChatProtocol::Message>> m_liveRows; // cached once the current batch is handled
+    
+    // Session resume
+    bool m_online;
+    bool m_resuming;
+    QString m_resumeToken;
+    int m_lastPrivateId;  // newest ids received, replayed from after a reconnect
+    int m_lastGroupId;
+    int m_reconnectAttempt;
+    QTimer *m_reconnectTimer;
+    QElapsedTimer m_offlineSince;
 };
 
 #endif // NETWORKMANAGER_H
\ No newline at end of file
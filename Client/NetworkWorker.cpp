@@ -0,0 +1,172 @@
+#include "NetworkWorker.h"
+#include <QDataStream>
+#include <QtEndian>
+#include <QDebug>
+
+namespace {
+const int kFrameIntervalMs = 16;
+}
+
+NetworkWorker::NetworkWorker(QObject *parent)
+    : QObject(parent), m_socket(new QSslSocket(this)), m_heartbeatTimer(new QTimer(this)),
+      m_flushTimer(new QTimer(this)) {
+    
+    connect(m_socket, &QSslSocket::connected, this, &NetworkWorker::onConnected);
+    connect(m_socket, &QSslSocket::encrypted, this, &NetworkWorker::onEncrypted);
+    connect(m_socket, &QSslSocket::newSessionTicketReceived, this, &NetworkWorker::onSessionTicket);
+    connect(m_socket, &QSslSocket::disconnected, this, &NetworkWorker::onDisconnected);
+    connect(m_socket, &QSslSocket::readyRead, this, &NetworkWorker::onReadyRead);
+    connect(m_socket, &QSslSocket::errorOccurred, this, &NetworkWorker::onError);
+    
+    m_heartbeatTimer->setInterval(ChatProtocol::HEARTBEAT_INTERVAL_MS);
+    connect(m_heartbeatTimer, &QTimer::timeout, this, &NetworkWorker::onHeartbeatTimeout);
+    
+    m_flushTimer->setSingleShot(true);
+    connect(m_flushTimer, &QTimer::timeout, this, &NetworkWorker::flushBatch);
+}
+
+QByteArray NetworkWorker::encodeFrame(const ChatProtocol::Message& msg) {
+    QByteArray data = msg.serialize();
+    QByteArray block;
+    QDataStream out(&block, QIODevice::WriteOnly);
+    out << quint32(data.size());
+    block.append(data);
+    return block;
+}
+
+void NetworkWorker::setTlsConfiguration(const QSslConfiguration& config) {
+    m_tlsConfig = config;
+    
+    // Keep session tickets so a reconnect can resume instead of doing a full handshake
+    m_tlsConfig.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+    m_tlsConfig.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+}
+
+void NetworkWorker::connectToHost(const QString& host, quint16 port) {
+    if (m_tlsConfig.isNull()) {
+        m_socket->connectToHost(host, port);
+        return;
+    }
+    
+    m_handshakeTimer.start();
+    m_socket->setSslConfiguration(m_tlsConfig);
+    m_socket->connectToHostEncrypted(host, port);
+}
+
+void NetworkWorker::send(const QByteArray& frame) {
+    if (m_socket->state() != QAbstractSocket::ConnectedState) return;
+    
+    m_socket->write(frame);
+    m_socket->flush();
+}
+
+void NetworkWorker::close() {
+    m_heartbeatTimer->stop();
+    m_flushTimer->stop();
+    if (m_socket->isOpen()) {
+        m_socket->close();
+    }
+}
+
+void NetworkWorker::onConnected() {
+    // Encrypted sessions start once the handshake is done
+    if (m_tlsConfig.isNull()) {
+        startSession();
+    }
+}
+
+void NetworkWorker::onEncrypted() {
+    qDebug() << "TLS handshake took" << m_handshakeTimer.elapsed() << "ms"
+             << (m_tlsConfig.sessionTicket().isEmpty() ? "(full)" : "(ticket offered)");
+    onSessionTicket(); // TLS 1.2 delivers the ticket within the handshake
+    startSession();
+}
+
+void NetworkWorker::onSessionTicket() {
+    QByteArray ticket = m_socket->sslConfiguration().sessionTicket();
+    if (!ticket.isEmpty()) {
+        m_tlsConfig.setSessionTicket(ticket);
+    }
+}
+
+void NetworkWorker::startSession() {
+    m_lastReceived.start();
+    m_lastFlush.start();
+    m_heartbeatTimer->start();
+    emit connected();
+}
+
+void NetworkWorker::onDisconnected() {
+    m_heartbeatTimer->stop();
+    m_readBuffer.clear();
+    
+    // Deliver what already arrived before reporting the loss
+    flushBatch();
+    emit disconnected();
+}
+
+void NetworkWorker::onError(QAbstractSocket::SocketError error) {
+    Q_UNUSED(error);
+    emit errorOccurred(m_socket->errorString());
+}
+
+void NetworkWorker::onHeartbeatTimeout() {
+    // A half-open connection never errors on its own; give up on a silent server
+    if (m_lastReceived.elapsed() > ChatProtocol::HEARTBEAT_INTERVAL_MS + ChatProtocol::HEARTBEAT_GRACE_MS) {
+        qDebug() << "Server stopped responding";
+        m_socket->abort();
+        return;
+    }
+    
+    ChatProtocol::Message msg;
+    msg.type = ChatProtocol::MessageType::HEARTBEAT;
+    send(encodeFrame(msg));
+}
+
+void NetworkWorker::onReadyRead() {
+    m_lastReceived.restart();
+    m_readBuffer.append(m_socket->readAll());
+    
+    const qsizetype headerSize = sizeof(quint32);
+    qsizetype offset = 0;
+    
+    while (m_readBuffer.size() - offset >= headerSize) {
+        quint32 frameSize = qFromBigEndian<quint32>(m_readBuffer.constData() + offset);
+        if (m_readBuffer.size() - offset - headerSize < qsizetype(frameSize)) break;
+        
+        QByteArray frame = m_readBuffer.mid(offset + headerSize, frameSize);
+        offset += headerSize + frameSize;
+        
+        ChatProtocol::Message msg = ChatProtocol::Message::deserialize(frame);
+        
+        // Connection upkeep never needs to wake the GUI
+        if (msg.type == ChatProtocol::MessageType::HEARTBEAT) {
+            ChatProtocol::Message ack;
+            ack.type = ChatProtocol::MessageType::HEARTBEAT_ACK;
+            send(encodeFrame(ack));
+            continue;
+        }
+        if (msg.type == ChatProtocol::MessageType::HEARTBEAT_ACK) continue;
+        
+        m_batch.append(msg);
+    }
+    m_readBuffer.remove(0, offset);
+    
+    if (m_batch.isEmpty() || m_flushTimer->isActive()) return;
+    
+    // The first batch after a quiet spell goes out at once, later ones wait for the next frame
+    qint64 sinceFlush = m_lastFlush.elapsed();
+    if (sinceFlush >= kFrameIntervalMs) {
+        flushBatch();
+    } else {
+        m_flushTimer->start(int(kFrameIntervalMs - sinceFlush));
+    }
+}
+
+void NetworkWorker::flushBatch() {
+    m_lastFlush.restart();
+    if (m_batch.isEmpty()) return;
+    
+    emit messagesReceived(m_batch);
+    m_batch.clear();
+}
\ No newline at end of file
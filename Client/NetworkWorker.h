@@ -0,0 +1,60 @@
+#ifndef NETWORKWORKER_H
+#define NETWORKWORKER_H
+
+#include <QObject>
+#include <QSslSocket>
+#include <QSslConfiguration>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QList>
+#include "Protocol.h"
+
+// Owns the chat socket on the networking thread. Reads, frames and decodes
+// there, answers heartbeats itself, and hands decoded messages to the GUI
+// thread in batches, at most one batch per frame interval.
+class NetworkWorker : public QObject {
+    Q_OBJECT
+    
+public:
+    explicit NetworkWorker(QObject *parent = nullptr);
+    
+    static QByteArray encodeFrame(const ChatProtocol::Message& msg);
+    
+public slots:
+    void setTlsConfiguration(const QSslConfiguration& config);
+    void connectToHost(const QString& host, quint16 port);
+    void send(const QByteArray& frame);
+    void close();
+    
+signals:
+    void connected();
+    void disconnected();
+    void errorOccurred(const QString& error);
+    void messagesReceived(const QList<ChatProtocol::Message>& batch);
+    
+private slots:
+    void onConnected();
+    void onEncrypted();
+    void onSessionTicket();
+    void onDisconnected();
+    void onReadyRead();
+    void onError(QAbstractSocket::SocketError error);
+    void onHeartbeatTimeout();
+    void flushBatch();
+    
+private:
+    void startSession();
+    
+    QSslSocket *m_socket;   // plain TCP unless a TLS configuration is set
+    QSslConfiguration m_tlsConfig;
+    QElapsedTimer m_handshakeTimer;
+    QByteArray m_readBuffer;
+    QTimer *m_heartbeatTimer;
+    QElapsedTimer m_lastReceived;
+    
+    QTimer *m_flushTimer;
+    QElapsedTimer m_lastFlush;
+    QList<ChatProtocol::Message> m_batch;
+};
+
+#endif // NETWORKWORKER_H
\ No newline at end of file
@@ -1,4 +1,8 @@
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QSslCertificate>
+#include <QSslSocket>
+#include <QDebug>
 #include "LoginWindow.h"
 
 int main(int argc, char *argv[]) {
@@ -6,7 +10,29 @@ int main(int argc, char *argv[]) {
     
     app.setStyle("Fusion");
     
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption tlsOption("tls", "Connect to the server over TLS.");
+    QCommandLineOption caOption("ca-cert", "Also trust this PEM certificate (e.g. a self-signed server).", "path");
+    parser.addOptions({tlsOption, caOption});
+    parser.process(app);
+    
     LoginWindow loginWindow;
+    
+    if (parser.isSet(tlsOption) || parser.isSet(caOption)) {
+        if (!QSslSocket::supportsSsl()) {
+            qDebug() << "TLS is not available in this build";
+            return 1;
+        }
+        
+        QSslConfiguration tls = QSslConfiguration::defaultConfiguration();
+        tls.setProtocol(QSsl::TlsV1_2OrLater);
+        if (parser.isSet(caOption)) {
+            tls.addCaCertificates(QSslCertificate::fromPath(parser.value(caOption)));
+        }
+        loginWindow.setTlsConfiguration(tls);
+    }
+    
     loginWindow.show();
     
     return app.exec();
@@ -0,0 +1,852 @@
+#include "Benchmarks.h"
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QObject>
+#include <QRandomGenerator>
+#include <QSemaphore>
+#include <QSslCertificate>
+#include <QSslKey>
+#include <QSslSocket>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+#include <QtEndian>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "TimingWheel.h"
+#include "MessageView.h"
+#include "ChatServer.h"
+#include "DatabaseManager.h"
+#include "OutboundQueue.h"
+#include "ConversationDispatcher.h"
+#include "MessageCache.h"
+#include "NetworkManager.h"
+
+namespace {
+std::atomic<qint64> g_allocations{0};
+}
+
+#if defined(__GLIBC__)
+// Counts every heap allocation in the process, Qt's containers included
+// (they call malloc directly, so counting operator new alone misses them).
+// glibc's free() takes the memory back as usual.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+void *malloc(size_t size) noexcept {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) noexcept {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+}
+#endif
+
+namespace {
+
+const int kTimeoutMs = 60000; // for anything a benchmark waits on
+const QString kPassword = "benchmark";
+
+double perOp(qint64 ns, qint64 ops) {
+    return ops > 0 ? double(ns) / ops : 0;
+}
+
+double percentile(QVector<qint64> values, double fraction) {
+    if (values.isEmpty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[qMin(values.size() - 1, qsizetype(fraction * values.size()))];
+}
+
+// Runs this thread's event loop until done() holds; false on timeout
+bool waitUntil(const std::function<bool()>& done, int timeoutMs = kTimeoutMs) {
+    QEventLoop loop;
+    QTimer poll;
+    QElapsedTimer clock;
+    clock.start();
+    QObject::connect(&poll, &QTimer::timeout, &loop, [&] {
+        if (done() || clock.hasExpired(timeoutMs)) loop.quit();
+    });
+    poll.start(5);
+    if (!done()) loop.exec();
+    return done();
+}
+
+// A fresh in-process server on an empty database in a scratch directory, as
+// ChatReplay starts one for a replay
+class LocalServer {
+public:
+    ~LocalServer() {
+        m_server.reset();
+        if (!m_previousDir.isEmpty()) QDir::setCurrent(m_previousDir);
+    }
+    
+    bool start(quint16 port, QString *error, const QSslConfiguration& tls = QSslConfiguration()) {
+        m_previousDir = QDir::currentPath();
+        if (!m_scratch.isValid() || !QDir::setCurrent(m_scratch.path())) {
+            *error = "cannot use a scratch directory";
+            return false;
+        }
+        m_server = std::make_unique<ChatServer>();
+        m_server->setRateLimiting(false);
+        if (!tls.isNull()) m_server->setTlsConfiguration(tls);
+        m_server->warmUp();
+        if (!m_server->startServer(port)) {
+            *error = QString("cannot start the in-process server on port %1").arg(port);
+            return false;
+        }
+        return true;
+    }
+    
+    ChatServer* server() { return m_server.get(); }
+    
+private:
+    QTemporaryDir m_scratch;
+    QString m_previousDir;
+    std::unique_ptr<ChatServer> m_server;
+};
+
+// Connects, registers and logs in a headless client
+bool signIn(NetworkManager& client, quint16 port, const QString& username) {
+    bool connected = false;
+    int accepted = 0; // registration, then login
+    QMetaObject::Connection onConnected = QObject::connect(&client, &NetworkManager::connected,
+                                                           [&connected] { connected = true; });
+    QMetaObject::Connection onAccepted = QObject::connect(&client, &NetworkManager::authSuccess,
+                                                          [&accepted] { ++accepted; });
+    
+    client.connectToServer("127.0.0.1", port);
+    bool ok = waitUntil([&] { return connected; });
+    if (ok) {
+        client.registerUser(username, kPassword);
+        ok = waitUntil([&] { return accepted == 1; });
+    }
+    if (ok) {
+        client.login(username, kPassword);
+        ok = waitUntil([&] { return accepted == 2; });
+    }
+    QObject::disconnect(onConnected);
+    QObject::disconnect(onAccepted);
+    return ok;
+}
+
+// Connection deadlines as the server keeps them: every connection holds one
+// that each frame pushes back. Runs the churn on the timing wheel and then on
+// one QTimer per connection, the approach the wheel replaced.
+void timers(const Benchmarks::Options& options, QJsonObject *results) {
+    const int connections = options.scale > 0 ? options.scale : 100000;
+    const int rounds = 10;
+    const qint64 tickMs = 500;
+    auto delay = [](QRandomGenerator& random) {
+        return qint64(30000 + random.bounded(15000));
+    };
+    
+    QRandomGenerator random(1);
+    QElapsedTimer clock;
+    TimingWheel wheel(512, tickMs, 0);
+    QVector<TimingWheel::TimerId> ids(connections);
+    
+    clock.start();
+    for (int i = 0; i < connections; ++i) {
+        ids[i] = wheel.schedule(delay(random), quintptr(i), 0);
+    }
+    const qint64 scheduleNs = clock.nsecsElapsed();
+    
+    clock.restart();
+    for (int round = 0; round < rounds; ++round) {
+        for (int i = 0; i < connections; ++i) {
+            wheel.cancel(ids[i]);
+            ids[i] = wheel.schedule(delay(random), quintptr(i), 0);
+        }
+    }
+    const qint64 rescheduleNs = clock.nsecsElapsed();
+    
+    // A minute of ticks, long enough for every deadline to expire
+    const qint64 ticks = 60000 / tickMs;
+    qint64 expired = 0;
+    clock.restart();
+    for (qint64 tick = 1; tick <= ticks; ++tick) {
+        expired += wheel.advance(tick * tickMs).size();
+    }
+    const qint64 advanceNs = clock.nsecsElapsed();
+    
+    std::vector<std::unique_ptr<QTimer>> qtimers;
+    qtimers.reserve(size_t(connections));
+    clock.restart();
+    for (int i = 0; i < connections; ++i) {
+        auto timer = std::make_unique<QTimer>();
+        timer->setSingleShot(true);
+        timer->start(int(delay(random)));
+        qtimers.push_back(std::move(timer));
+    }
+    const qint64 qtimerStartNs = clock.nsecsElapsed();
+    
+    clock.restart();
+    for (int round = 0; round < rounds; ++round) {
+        for (auto& timer : qtimers) {
+            timer->start(int(delay(random)));
+        }
+    }
+    const qint64 qtimerRestartNs = clock.nsecsElapsed();
+    
+    clock.restart();
+    qtimers.clear();
+    const qint64 qtimerDestroyNs = clock.nsecsElapsed();
+    
+    results->insert("connections", connections);
+    results->insert("expired", expired);
+    results->insert("wheelScheduleNs", perOp(scheduleNs, connections));
+    results->insert("wheelRescheduleNs", perOp(rescheduleNs, qint64(rounds) * connections));
+    results->insert("wheelTickUs", perOp(advanceNs, ticks) / 1000);
+    results->insert("qtimerStartNs", perOp(qtimerStartNs, connections));
+    results->insert("qtimerRestartNs", perOp(qtimerRestartNs, qint64(rounds) * connections));
+    results->insert("qtimerDestroyNs", perOp(qtimerDestroyNs, connections));
+}
+
+// Inbound frames decoded the way processReadBuffer() does, into views over
+// a per-connection arena reset after each batch, and the way it did before,
+// copying each frame out and deserializing it into an owned Message.
+// Allocation counts need glibc; elsewhere they read 0.
+void decode(const Benchmarks::Options& options, QJsonObject *results) {
+    const qint64 frames = options.scale > 0 ? options.scale : 1000000;
+    const int batchFrames = 64;
+    
+    // One read buffer's worth of typical traffic, decoded over and over
+    QByteArray buffer;
+    QRandomGenerator random(1);
+    for (int i = 0; i < batchFrames; ++i) {
+        ChatProtocol::Message msg;
+        msg.sender = QString("user%1").arg(random.bounded(10000));
+        msg.requestId = quint32(i + 1);
+        switch (i % 4) {
+            case 0:
+            case 1:
+                msg.type = ChatProtocol::MessageType::PRIVATE_MESSAGE;
+                msg.recipient = QString("user%1").arg(random.bounded(10000));
+                msg.content = QString(20 + random.bounded(180), QChar('x'));
+                break;
+            case 2:
+                msg.type = ChatProtocol::MessageType::TYPING;
+                msg.recipient = QString("user%1").arg(random.bounded(10000));
+                break;
+            default:
+                msg.type = ChatProtocol::MessageType::HEARTBEAT;
+                break;
+        }
+        QByteArray data = msg.serialize();
+        char header[4];
+        qToBigEndian<quint32>(quint32(data.size()), header);
+        buffer.append(header, 4).append(data);
+    }
+    const qint64 batches = (frames + batchFrames - 1) / batchFrames;
+    
+    // Something to do with each decoded frame, so no decode is optimized away
+    qint64 checksum = 0;
+    auto forEachFrame = [&buffer](auto fn) {
+        qsizetype offset = 0;
+        while (offset < buffer.size()) {
+            quint32 size = qFromBigEndian<quint32>(buffer.constData() + offset);
+            fn(QByteArrayView(buffer.constData() + offset + 4, size));
+            offset += 4 + size;
+        }
+    };
+    
+    ChatProtocol::FrameArena arena;
+    QElapsedTimer clock;
+    qint64 allocations = g_allocations.load();
+    clock.start();
+    for (qint64 batch = 0; batch < batches; ++batch) {
+        forEachFrame([&](QByteArrayView frame) {
+            ChatProtocol::MessageView view;
+            if (ChatProtocol::MessageView::decode(frame, arena, &view)) {
+                checksum += view.content.size() + int(view.type);
+            }
+        });
+        arena.reset();
+    }
+    const qint64 viewNs = clock.nsecsElapsed();
+    const qint64 viewAllocations = g_allocations.load() - allocations;
+    
+    allocations = g_allocations.load();
+    clock.restart();
+    for (qint64 batch = 0; batch < batches; ++batch) {
+        forEachFrame([&](QByteArrayView frame) {
+            ChatProtocol::Message msg = ChatProtocol::Message::deserialize(frame.toByteArray());
+            checksum += msg.content.size() + int(msg.type);
+        });
+    }
+    const qint64 ownedNs = clock.nsecsElapsed();
+    const qint64 ownedAllocations = g_allocations.load() - allocations;
+    
+    const qint64 decoded = batches * batchFrames;
+    const double megabytes = double(batches) * buffer.size() / (1024 * 1024);
+    results->insert("frames", decoded);
+    results->insert("checksum", checksum);
+    results->insert("viewFramesPerSec", decoded * 1e9 / qMax<qint64>(1, viewNs));
+    results->insert("viewMBPerSec", megabytes * 1e9 / qMax<qint64>(1, viewNs));
+    results->insert("viewAllocationsPerFrame", double(viewAllocations) / decoded);
+    results->insert("ownedFramesPerSec", decoded * 1e9 / qMax<qint64>(1, ownedNs));
+    results->insert("ownedMBPerSec", megabytes * 1e9 / qMax<qint64>(1, ownedNs));
+    results->insert("ownedAllocationsPerFrame", double(ownedAllocations) / decoded);
+}
+
+// The history signal every open chat used to receive, with the filter each
+// applied before touching a row
+class HistorySource : public QObject {
+    Q_OBJECT
+    
+signals:
+    void messageHistoryReceived(const QString& sender, const QString& recipient, const QString& content,
+                                const QDateTime& timestamp, int messageId);
+};
+
+class FilteringChat : public QObject {
+    Q_OBJECT
+    
+public:
+    FilteringChat(const QString& contact, bool isGroup) : m_contact(contact), m_isGroup(isGroup) {}
+    
+    qint64 rows = 0;
+    
+public slots:
+    void onMessageHistoryReceived(const QString& sender, const QString& recipient, const QString& content,
+                                  const QDateTime& timestamp, int messageId) {
+        Q_UNUSED(content);
+        Q_UNUSED(timestamp);
+        Q_UNUSED(messageId);
+        if (m_isGroup ? recipient != m_contact : (sender != m_contact && recipient != m_contact)) return;
+        ++rows;
+    }
+    
+private:
+    QString m_contact;
+    bool m_isGroup;
+};
+
+class CountingView : public ConversationView {
+public:
+    qint64 rows = 0;
+    
+    void historyRow(const ChatProtocol::Message& msg) override {
+        Q_UNUSED(msg);
+        ++rows;
+    }
+    void historyEnd() override {}
+    void groupMembers(const QStringList& members, const QString& admin) override {
+        Q_UNUSED(members);
+        Q_UNUSED(admin);
+    }
+};
+
+// History rows delivered with a couple of hundred chats open: looked up by
+// conversation key in the ConversationDispatcher and handed to the one view,
+// and emitted as a signal that every open chat receives and filters, as
+// ChatWidget did before the dispatcher.
+void dispatch(const Benchmarks::Options& options, QJsonObject *results) {
+    const int chats = 200;
+    const qint64 rows = options.scale > 0 ? options.scale : 200000;
+    const QString self = "me";
+    
+    // A quarter of the open chats are groups
+    QVector<ChatProtocol::Message> messages(chats);
+    QVector<QString> keys(chats);
+    ConversationDispatcher dispatcher;
+    std::vector<std::unique_ptr<CountingView>> views;
+    HistorySource source;
+    std::vector<std::unique_ptr<FilteringChat>> widgets;
+    for (int i = 0; i < chats; ++i) {
+        const bool isGroup = i % 4 == 0;
+        const QString name = QString(isGroup ? "group%1" : "user%1").arg(i);
+        ChatProtocol::Message& msg = messages[i];
+        msg.type = ChatProtocol::MessageType::MESSAGE_HISTORY_RESPONSE;
+        msg.sender = isGroup ? QString("user%1").arg(i + 1) : name;
+        msg.recipient = isGroup ? name : self;
+        msg.content = QString(80, QChar('x'));
+        msg.timestamp = QDateTime::currentDateTimeUtc();
+        msg.messageId = i + 1;
+        keys[i] = MessageCache::keyFor(name, isGroup);
+        
+        views.push_back(std::make_unique<CountingView>());
+        dispatcher.attach(keys[i], views.back().get());
+        widgets.push_back(std::make_unique<FilteringChat>(name, isGroup));
+        QObject::connect(&source, &HistorySource::messageHistoryReceived,
+                         widgets.back().get(), &FilteringChat::onMessageHistoryReceived);
+    }
+    
+    QRandomGenerator random(1);
+    QVector<int> order(int(qMin<qint64>(rows, 1 << 16)));
+    for (int& chat : order) {
+        chat = random.bounded(chats);
+    }
+    
+    QElapsedTimer clock;
+    clock.start();
+    for (qint64 row = 0; row < rows; ++row) {
+        const int chat = order[int(row % order.size())];
+        if (ConversationView *view = dispatcher.find(keys[chat])) {
+            view->historyRow(messages[chat]);
+        }
+    }
+    const qint64 dispatchNs = clock.nsecsElapsed();
+    
+    clock.restart();
+    for (qint64 row = 0; row < rows; ++row) {
+        const ChatProtocol::Message& msg = messages[order[int(row % order.size())]];
+        emit source.messageHistoryReceived(msg.sender, msg.recipient, msg.content, msg.timestamp, msg.messageId);
+    }
+    const qint64 broadcastNs = clock.nsecsElapsed();
+    
+    qint64 dispatched = 0;
+    qint64 filtered = 0;
+    for (int i = 0; i < chats; ++i) {
+        dispatched += views[i]->rows;
+        filtered += widgets[i]->rows;
+    }
+    results->insert("chats", chats);
+    results->insert("rows", rows);
+    results->insert("dispatchedRows", dispatched);
+    results->insert("broadcastRows", filtered);
+    results->insert("dispatchNsPerRow", perOp(dispatchNs, rows));
+    results->insert("broadcastNsPerRow", perOp(broadcastNs, rows));
+}
+
+// A burst of private messages landing on one client, as after a busy chat
+// comes back into view. Decoding runs on the client's networking thread, so
+// what is left on this (the GUI) thread is handling the batches; a timer due
+// every 16 ms frame measures how late it fires while they arrive. The sender
+// uses a plain socket on a thread of its own to keep its work off this one.
+bool burst(const Benchmarks::Options& options, QJsonObject *results, QString *error) {
+    const int messages = options.scale > 0 ? options.scale : 5000;
+    const qint64 frameUs = 16000;
+    
+    LocalServer local;
+    if (!local.start(options.port, error)) return false;
+    
+    NetworkManager reader;
+    if (!signIn(reader, options.port, "burst-reader")) {
+        *error = "the reading client could not sign in";
+        return false;
+    }
+    int received = 0;
+    QObject::connect(&reader, &NetworkManager::privateMessageReceived,
+                     [&received](const QString& sender) {
+        if (sender == "burst-writer") ++received;
+    });
+    
+    std::atomic<bool> writerReady{false};
+    std::atomic<bool> stop{false};
+    QSemaphore go;
+    std::unique_ptr<QThread> writer(QThread::create([&, port = options.port] {
+        QTcpSocket socket;
+        socket.connectToHost("127.0.0.1", port);
+        if (!socket.waitForConnected(kTimeoutMs)) return;
+        
+        auto send = [&socket](ChatProtocol::MessageType type, const QString& sender, const QString& recipient,
+                              const QString& content) {
+            ChatProtocol::Message msg;
+            msg.type = type;
+            msg.sender = sender;
+            msg.recipient = recipient;
+            msg.content = content;
+            socket.write(OutboundQueue::encodeFrame(msg));
+        };
+        send(ChatProtocol::MessageType::REGISTER, "burst-writer", QString(), kPassword);
+        send(ChatProtocol::MessageType::LOGIN, "burst-writer", QString(), kPassword);
+        
+        // Both answered with AUTH_SUCCESS before anything is sent
+        QByteArray buffer;
+        int accepted = 0;
+        while (accepted < 2 && socket.waitForReadyRead(kTimeoutMs)) {
+            buffer.append(socket.readAll());
+            while (buffer.size() >= 4) {
+                quint32 size = qFromBigEndian<quint32>(buffer.constData());
+                if (buffer.size() - 4 < qsizetype(size)) break;
+                if (ChatProtocol::Message::deserialize(buffer.mid(4, size)).type ==
+                    ChatProtocol::MessageType::AUTH_SUCCESS) {
+                    ++accepted;
+                }
+                buffer.remove(0, 4 + size);
+            }
+        }
+        if (accepted < 2) return;
+        writerReady = true;
+        go.acquire();
+        
+        const QString content(120, QChar('x'));
+        for (int i = 0; i < messages; ++i) {
+            send(ChatProtocol::MessageType::PRIVATE_MESSAGE, QString(), "burst-reader", content);
+        }
+        // Echoes of the sent messages come back too; read them so the server never waits on us
+        while (!stop) {
+            socket.waitForBytesWritten(10);
+            socket.waitForReadyRead(10);
+            socket.readAll();
+        }
+    }));
+    writer->start();
+    auto stopWriter = [&] {
+        stop = true;
+        go.release();
+        writer->wait();
+    };
+    if (!waitUntil([&] { return writerReady.load() || writer->isFinished(); }) || !writerReady) {
+        stopWriter();
+        *error = "the sending client could not sign in";
+        return false;
+    }
+    
+    QVector<qint64> lateUs;
+    QElapsedTimer frameClock;
+    QTimer probe;
+    probe.setTimerType(Qt::PreciseTimer);
+    QObject::connect(&probe, &QTimer::timeout, [&] {
+        lateUs.append(qMax<qint64>(0, frameClock.nsecsElapsed() / 1000 - frameUs));
+        frameClock.restart();
+    });
+    
+    QElapsedTimer clock;
+    clock.start();
+    frameClock.start();
+    probe.start(int(frameUs / 1000));
+    go.release();
+    const bool delivered = waitUntil([&] { return received >= messages; });
+    const qint64 deliveredUs = clock.nsecsElapsed() / 1000;
+    probe.stop();
+    stopWriter();
+    if (!delivered) {
+        *error = QString("only %1 of %2 messages arrived").arg(received).arg(messages);
+        return false;
+    }
+    
+    const qint64 missed = std::count_if(lateUs.cbegin(), lateUs.cend(), [frameUs](qint64 late) {
+        return late >= frameUs;
+    });
+    results->insert("messages", messages);
+    results->insert("deliveredMs", deliveredUs / 1000.0);
+    results->insert("messagesPerSec", messages * 1e6 / qMax<qint64>(1, deliveredUs));
+    results->insert("frameLateP99Ms", percentile(lateUs, 0.99) / 1000);
+    results->insert("frameLateMaxMs", lateUs.isEmpty() ? 0 : *std::max_element(lateUs.cbegin(), lateUs.cend()) / 1000.0);
+    results->insert("framesMissed", missed);
+    results->insert("frames", lateUs.size());
+    return true;
+}
+
+// Signed-in clients all dropped by the server at once, as in a network blip,
+// each timed from the drop until its session is resumed. The client waits a
+// jittered backoff before trying, so the resume itself is reported apart.
+bool reconnect(const Benchmarks::Options& options, QJsonObject *results, QString *error) {
+    const int clients = options.scale > 0 ? options.scale : 50;
+    
+    LocalServer local;
+    if (!local.start(options.port, error)) return false;
+    
+    std::vector<std::unique_ptr<NetworkManager>> managers;
+    for (int i = 0; i < clients; ++i) {
+        managers.push_back(std::make_unique<NetworkManager>());
+        if (!signIn(*managers.back(), options.port, QString("reconnect%1").arg(i))) {
+            *error = QString("client %1 could not sign in").arg(i);
+            return false;
+        }
+    }
+    
+    QVector<qint64> totalUs;
+    QVector<qint64> resumeUs;
+    QVector<int> backoffMs(clients);
+    int expired = 0;
+    QElapsedTimer clock;
+    for (int i = 0; i < clients; ++i) {
+        NetworkManager *manager = managers[i].get();
+        QObject::connect(manager, &NetworkManager::reconnecting, [&backoffMs, i](int delayMs) {
+            backoffMs[i] += delayMs;
+        });
+        QObject::connect(manager, &NetworkManager::reconnected, [&, i] {
+            const qint64 us = clock.nsecsElapsed() / 1000;
+            totalUs.append(us);
+            resumeUs.append(qMax<qint64>(0, us - qint64(backoffMs[i]) * 1000));
+        });
+        QObject::connect(manager, &NetworkManager::sessionExpired, [&expired] { ++expired; });
+    }
+    
+    clock.start();
+    for (ClientHandler *handler : local.server()->handlers()) {
+        handler->closeConnection();
+    }
+    if (!waitUntil([&] { return totalUs.size() + expired >= clients; })) {
+        *error = QString("only %1 of %2 clients came back").arg(totalUs.size() + expired).arg(clients);
+        return false;
+    }
+    
+    results->insert("clients", clients);
+    results->insert("resumed", totalUs.size());
+    results->insert("expired", expired);
+    results->insert("reconnectP50Ms", percentile(totalUs, 0.5) / 1000);
+    results->insert("reconnectP99Ms", percentile(totalUs, 0.99) / 1000);
+    results->insert("reconnectMaxMs", percentile(totalUs, 1.0) / 1000);
+    results->insert("resumeP50Ms", percentile(resumeUs, 0.5) / 1000);
+    results->insert("resumeP99Ms", percentile(resumeUs, 0.99) / 1000);
+    return true;
+}
+
+// The server's TLS setup, as ChatServer --tls-cert loads it. Call it before
+// the server moves to its scratch directory, so relative paths still resolve.
+bool loadTls(const Benchmarks::Options& options, QSslConfiguration *config, QString *error) {
+    if (!QSslSocket::supportsSsl()) {
+        *error = "no TLS backend available";
+        return false;
+    }
+    QList<QSslCertificate> chain = QSslCertificate::fromPath(options.tlsCertificate);
+    QFile keyFile(options.tlsKey);
+    QByteArray pem = keyFile.open(QIODevice::ReadOnly) ? keyFile.readAll() : QByteArray();
+    QSslKey key(pem, QSsl::Ec);
+    if (key.isNull()) key = QSslKey(pem, QSsl::Rsa);
+    if (chain.isEmpty() || key.isNull()) {
+        *error = "needs a PEM certificate and key (--tls-cert, --tls-key)";
+        return false;
+    }
+    
+    *config = QSslConfiguration::defaultConfiguration();
+    config->setLocalCertificateChain(chain);
+    config->setPrivateKey(key);
+    config->setProtocol(QSsl::TlsV1_2OrLater);
+    config->setPeerVerifyMode(QSslSocket::VerifyNone);
+    config->setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+    return true;
+}
+
+struct HandshakeRun {
+    qint64 elapsedUs = 0;
+    QVector<qint64> latencyUs; // connect to encrypted, per handshake
+    int failed = 0;
+};
+
+// Runs count handshakes, concurrency at a time, closing each socket once encrypted
+bool handshakes(quint16 port, const QSslConfiguration& config, int count, int concurrency, HandshakeRun *run) {
+    int started = 0;
+    int finished = 0;
+    std::function<void()> startOne = [&] {
+        if (started == count) return;
+        ++started;
+        
+        auto *socket = new QSslSocket();
+        QElapsedTimer clock;
+        clock.start();
+        auto done = [&, socket](bool encrypted, qint64 us) {
+            socket->disconnect();
+            socket->abort();
+            socket->deleteLater();
+            if (encrypted) {
+                run->latencyUs.append(us);
+            } else {
+                ++run->failed;
+            }
+            ++finished;
+            startOne();
+        };
+        QObject::connect(socket, &QSslSocket::encrypted, [done, clock] { done(true, clock.nsecsElapsed() / 1000); });
+        QObject::connect(socket, &QSslSocket::errorOccurred, [done] { done(false, 0); });
+        socket->setSslConfiguration(config);
+        socket->connectToHostEncrypted("127.0.0.1", port);
+    };
+    
+    QElapsedTimer clock;
+    clock.start();
+    for (int i = 0; i < concurrency; ++i) {
+        startOne();
+    }
+    const bool ok = waitUntil([&] { return finished == count; });
+    run->elapsedUs = clock.nsecsElapsed() / 1000;
+    return ok;
+}
+
+// Reconnect handshakes against the TLS server: full ones, with no session
+// ticket to offer, then ones resuming from the ticket a first connection
+// was given, as NetworkWorker does after a drop
+bool tls(const Benchmarks::Options& options, QJsonObject *results, QString *error) {
+    const int count = options.scale > 0 ? options.scale : 2000;
+    const int concurrency = 50;
+    
+    QSslConfiguration serverConfig;
+    if (!loadTls(options, &serverConfig, error)) return false;
+    LocalServer local;
+    if (!local.start(options.port, error, serverConfig)) return false;
+    
+    QSslConfiguration fullConfig = QSslConfiguration::defaultConfiguration();
+    fullConfig.setProtocol(QSsl::TlsV1_2OrLater);
+    fullConfig.setPeerVerifyMode(QSslSocket::VerifyNone);
+    fullConfig.setSslOption(QSsl::SslOptionDisableSessionTickets, true);
+    
+    QSslConfiguration resumeConfig = fullConfig;
+    resumeConfig.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+    resumeConfig.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    {
+        // TLS 1.3 sends the ticket after the handshake, so wait for it
+        QSslSocket first;
+        first.setSslConfiguration(resumeConfig);
+        first.connectToHostEncrypted("127.0.0.1", options.port);
+        waitUntil([&] { return !first.sslConfiguration().sessionTicket().isEmpty() ||
+                               first.state() == QAbstractSocket::UnconnectedState; }, 5000);
+        const QByteArray ticket = first.sslConfiguration().sessionTicket();
+        if (ticket.isEmpty()) {
+            *error = "the server issued no session ticket";
+            return false;
+        }
+        resumeConfig.setSessionTicket(ticket);
+        first.abort();
+    }
+    
+    HandshakeRun full;
+    HandshakeRun resumed;
+    if (!handshakes(options.port, fullConfig, count, concurrency, &full) ||
+        !handshakes(options.port, resumeConfig, count, concurrency, &resumed)) {
+        *error = "handshakes did not finish in time";
+        return false;
+    }
+    
+    results->insert("handshakes", count);
+    results->insert("concurrency", concurrency);
+    results->insert("fullFailed", full.failed);
+    results->insert("fullPerSec", full.latencyUs.size() * 1e6 / qMax<qint64>(1, full.elapsedUs));
+    results->insert("fullP50Ms", percentile(full.latencyUs, 0.5) / 1000);
+    results->insert("fullP99Ms", percentile(full.latencyUs, 0.99) / 1000);
+    results->insert("resumedFailed", resumed.failed);
+    results->insert("resumedPerSec", resumed.latencyUs.size() * 1e6 / qMax<qint64>(1, resumed.elapsedUs));
+    results->insert("resumedP50Ms", percentile(resumed.latencyUs, 0.5) / 1000);
+    results->insert("resumedP99Ms", percentile(resumed.latencyUs, 0.99) / 1000);
+    return true;
+}
+
+// Private messages appended across many conversations, then history pages
+// read back from random points, on SQLite and on the message log. The
+// history cache is off so every read reaches the store. The SQLite figures
+// include its fsync per insert, as the server runs it.
+bool storage(const Benchmarks::Options& options, QJsonObject *results, QString *error) {
+    const qint64 messages = options.scale > 0 ? options.scale : 200000;
+    const int conversations = 1000;
+    const int reads = 2000;
+    const QString content(120, QChar('x'));
+    
+    QTemporaryDir scratch;
+    const QString previousDir = QDir::currentPath();
+    for (const QString backend : {"sqlite", "log"}) {
+        const QString dir = scratch.filePath(backend);
+        if (!scratch.isValid() || !QDir().mkpath(dir) || !QDir::setCurrent(dir)) {
+            *error = "cannot use a scratch directory";
+            return false;
+        }
+        
+        int firstId = 0;
+        int lastId = 0;
+        QVector<qint64> latestUs;
+        QVector<qint64> pageUs;
+        qint64 appendUs = 0;
+        {
+            DatabaseManager db;
+            if (!db.connect(backend == "log" ? dir + "/messages" : QString())) {
+                QDir::setCurrent(previousDir);
+                *error = QString("cannot open the %1 store").arg(backend);
+                return false;
+            }
+            db.setHistoryCacheSize(0);
+            
+            auto user = [](int conversation, int side) {
+                return QString("user%1").arg(conversation * 2 + side);
+            };
+            QElapsedTimer clock;
+            clock.start();
+            for (qint64 i = 0; i < messages; ++i) {
+                const int conversation = int(i % conversations);
+                const int side = int(i / conversations % 2);
+                int id = db.savePrivateMessage(user(conversation, side), user(conversation, 1 - side), content);
+                if (id <= 0) continue;
+                if (firstId == 0) firstId = id;
+                lastId = id;
+            }
+            appendUs = clock.nsecsElapsed() / 1000;
+            
+            QRandomGenerator random(1);
+            for (int i = 0; i < reads && lastId > 0; ++i) {
+                const int conversation = random.bounded(conversations);
+                clock.restart();
+                db.getPrivateMessageHistory(user(conversation, 0), user(conversation, 1), ChatProtocol::HISTORY_PAGE_SIZE);
+                latestUs.append(clock.nsecsElapsed() / 1000);
+                
+                const int beforeId = firstId + int(random.bounded(quint32(lastId - firstId + 1)));
+                clock.restart();
+                db.getPrivateMessagesBefore(user(conversation, 0), user(conversation, 1), beforeId,
+                                            ChatProtocol::HISTORY_PAGE_SIZE);
+                pageUs.append(clock.nsecsElapsed() / 1000);
+            }
+        }
+        
+        qint64 diskBytes = 0;
+        QDirIterator files(dir, QDir::Files, QDirIterator::Subdirectories);
+        while (files.hasNext()) {
+            diskBytes += QFileInfo(files.next()).size();
+        }
+        results->insert(backend + "AppendsPerSec", messages * 1e6 / qMax<qint64>(1, appendUs));
+        results->insert(backend + "LatestPageP50Us", percentile(latestUs, 0.5));
+        results->insert(backend + "LatestPageP99Us", percentile(latestUs, 0.99));
+        results->insert(backend + "OlderPageP50Us", percentile(pageUs, 0.5));
+        results->insert(backend + "OlderPageP99Us", percentile(pageUs, 0.99));
+        results->insert(backend + "DiskMB", diskBytes / (1024.0 * 1024.0));
+    }
+    QDir::setCurrent(previousDir);
+    
+    results->insert("messages", messages);
+    results->insert("conversations", conversations);
+    return true;
+}
+
+} // namespace
+
+namespace Benchmarks {
+
+QStringList names() {
+    return {"timers", "decode", "dispatch", "burst", "reconnect", "tls", "storage"};
+}
+
+bool run(const QString& name, const Options& options, QJsonObject *results, QString *error) {
+    if (name == "timers") {
+        timers(options, results);
+    } else if (name == "decode") {
+        decode(options, results);
+    } else if (name == "dispatch") {
+        dispatch(options, results);
+    } else if (name == "burst") {
+        return burst(options, results, error);
+    } else if (name == "reconnect") {
+        return reconnect(options, results, error);
+    } else if (name == "tls") {
+        return tls(options, results, error);
+    } else if (name == "storage") {
+        return storage(options, results, error);
+    } else {
+        *error = QString("unknown benchmark, expected one of: %1").arg(names().join(", "));
+        return false;
+    }
+    return true;
+}
+
+} // namespace Benchmarks
+
+#include "Benchmarks.moc"
\ No newline at end of file
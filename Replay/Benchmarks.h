@@ -0,0 +1,26 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+
+// In-process measurements for changes a replayed capture can't time on its
+// own. Each benchmark fills named figures that ChatReplay prints, writes
+// with --report and compares against a --baseline from another build.
+namespace Benchmarks {
+
+struct Options {
+    int scale = 0; // the benchmark's main size; 0 for its default
+    quint16 port = 23456; // for benchmarks that start an in-process server
+    QString tlsCertificate; // PEM pair for benchmarks that serve TLS
+    QString tlsKey;
+};
+
+QStringList names();
+
+bool run(const QString& name, const Options& options, QJsonObject *results, QString *error);
+
+} // namespace Benchmarks
+
+#endif // BENCHMARKS_H
\ No newline at end of file
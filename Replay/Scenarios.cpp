@@ -0,0 +1,166 @@
+#include "Scenarios.h"
+#include "Protocol.h"
+
+namespace {
+using ChatProtocol::MessageType;
+using ChatProtocol::TrafficCapture;
+
+const char kPassword[] = "replay-password";
+
+QString userName(int i) {
+    return QString("user%1").arg(i);
+}
+
+class Builder {
+public:
+    explicit Builder(QList<TrafficCapture::Record> *records) : m_records(records) {}
+    
+    void advance(qint64 us) { m_nowUs += us; }
+    
+    void open(quint32 connection) { add(TrafficCapture::OPEN, connection, QByteArray()); }
+    void close(quint32 connection) { add(TrafficCapture::CLOSE, connection, QByteArray()); }
+    
+    // A new connection for user i: connect, register, log in
+    void signIn(int i) {
+        open(quint32(i));
+        send(quint32(i), MessageType::REGISTER, userName(i), QString(), kPassword, false);
+        send(quint32(i), MessageType::LOGIN, userName(i), QString(), kPassword, false);
+    }
+    
+    void send(quint32 connection, MessageType type, const QString& sender, const QString& recipient,
+              const QString& content, bool timed) {
+        ChatProtocol::Message msg;
+        msg.type = type;
+        msg.sender = sender;
+        msg.recipient = recipient;
+        msg.content = content;
+        msg.requestId = timed ? ++m_lastRequestId : 0;
+        add(TrafficCapture::FRAME, connection, msg.serialize());
+    }
+    
+private:
+    void add(TrafficCapture::Event event, quint32 connection, const QByteArray& frame) {
+        TrafficCapture::Record record;
+        record.event = event;
+        record.connection = connection;
+        record.offsetUs = m_nowUs;
+        record.frame = frame;
+        m_records->append(record);
+    }
+    
+    QList<TrafficCapture::Record> *m_records;
+    qint64 m_nowUs = 0;
+    quint32 m_lastRequestId = 0;
+};
+
+// Many mostly idle connections, each sending a heartbeat and a private
+// message once a second: the connection backends' per-connection overhead
+void connections(Builder& b, int count) {
+    for (int i = 0; i < count; ++i) {
+        b.signIn(i);
+        b.advance(1000);
+    }
+    b.advance(2000000);
+    
+    const int rounds = 10;
+    const qint64 spacingUs = 1000000 / count;
+    for (int round = 0; round < rounds; ++round) {
+        for (int i = 0; i < count; ++i) {
+            b.send(quint32(i), MessageType::HEARTBEAT, userName(i), QString(), QString(), true);
+            b.send(quint32(i), MessageType::PRIVATE_MESSAGE, userName(i), userName((i + 1) % count),
+                   QString("round %1").arg(round), true);
+            b.advance(spacingUs);
+        }
+    }
+    
+    for (int i = 0; i < count; ++i) {
+        b.close(quint32(i));
+    }
+}
+
+// One group of `members`, one of whom posts a burst; every member gets every
+// message, so the replay's settle time is the last recipient's delay
+void fanout(Builder& b, int members) {
+    const QString group = "fanout";
+    b.signIn(0);
+    b.send(0, MessageType::CREATE_GROUP, userName(0), QString(), group, false);
+    b.advance(100000);
+    
+    for (int i = 1; i < members; ++i) {
+        b.signIn(i);
+        b.send(quint32(i), MessageType::JOIN_GROUP, userName(i), QString(), group, false);
+        b.advance(2000);
+    }
+    b.advance(5000000);
+    
+    // Pushes only: the sender gets its copy like every other member
+    const int burst = 50;
+    for (int n = 0; n < burst; ++n) {
+        b.send(0, MessageType::GROUP_MESSAGE, userName(0), group, QString("fanout %1").arg(n), false);
+        b.advance(20000);
+    }
+    
+    for (int i = 0; i < members; ++i) {
+        b.close(quint32(i));
+    }
+}
+
+// A directory of `users` in groups of ten with history in every group and
+// between neighbours: state for timing a restart, cold or from a snapshot
+void populate(Builder& b, int users) {
+    const int groupSize = 10;
+    const int messagesEach = 20;
+    
+    for (int i = 0; i < users; ++i) {
+        b.signIn(i);
+        b.advance(1000);
+    }
+    b.advance(2000000);
+    
+    auto groupOf = [](int i) { return QString("group%1").arg(i / groupSize); };
+    for (int i = 0; i < users; i += groupSize) {
+        b.send(quint32(i), MessageType::CREATE_GROUP, userName(i), QString(), groupOf(i), false);
+    }
+    b.advance(1000000);
+    for (int i = 0; i < users; ++i) {
+        if (i % groupSize != 0) b.send(quint32(i), MessageType::JOIN_GROUP, userName(i), QString(), groupOf(i), false);
+    }
+    b.advance(2000000);
+    
+    for (int n = 0; n < messagesEach; ++n) {
+        for (int i = 0; i < users; ++i) {
+            b.send(quint32(i), MessageType::PRIVATE_MESSAGE, userName(i), userName((i + 1) % users),
+                   QString("message %1").arg(n), false);
+            b.send(quint32(i), MessageType::GROUP_MESSAGE, userName(i), groupOf(i), QString("message %1").arg(n), false);
+            b.advance(200);
+        }
+    }
+    
+    for (int i = 0; i < users; ++i) {
+        b.close(quint32(i));
+    }
+}
+}
+
+namespace Scenarios {
+
+QStringList names() {
+    return {"connections", "fanout", "populate"};
+}
+
+bool build(const QString& name, int scale, QList<ChatProtocol::TrafficCapture::Record> *records, QString *error) {
+    Builder builder(records);
+    if (name == "connections") {
+        connections(builder, scale > 0 ? scale : 1000);
+    } else if (name == "fanout") {
+        fanout(builder, scale > 0 ? scale : 4096);
+    } else if (name == "populate") {
+        populate(builder, scale > 0 ? scale : 2000);
+    } else {
+        *error = QString("unknown scenario, expected one of: %1").arg(names().join(", "));
+        return false;
+    }
+    return true;
+}
+
+} // namespace Scenarios
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef SCENARIOS_H
+#define SCENARIOS_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include "TrafficCapture.h"
+
+// Synthetic captures for load shapes that are awkward to record from real
+// clients. Setup frames (register, login, joins) carry request id 0, so the
+// replay report only times the traffic a scenario is about. Offsets leave the
+// setup time to finish before that traffic starts when replayed at the
+// captured pace.
+namespace Scenarios {
+
+QStringList names();
+
+// scale is the scenario's main size (connections, members, users); 0 for its default
+bool build(const QString& name, int scale, QList<ChatProtocol::TrafficCapture::Record> *records, QString *error);
+
+} // namespace Scenarios
+
+#endif // SCENARIOS_H
\ No newline at end of file
@@ -0,0 +1,231 @@
+#include "TrafficReplayer.h"
+#include "Protocol.h"
+#include <QTimer>
+#include <QtEndian>
+#include <algorithm>
+#include <utility>
+
+namespace {
+const int kBatchFrames = 256;     // frames per step before replies get a chance to be read
+const int kDrainTimeoutMs = 5000; // wait for outstanding replies after the last frame
+const int kSettleMs = 500;        // quiet time that ends a run once every reply is in
+
+qint64 percentile(const QList<qint64>& sorted, double fraction) {
+    if (sorted.isEmpty()) return 0;
+    return sorted[qMin(sorted.size() - 1, qsizetype(fraction * sorted.size()))];
+}
+}
+
+QJsonObject TrafficReplayer::Report::toJson() const {
+    return QJsonObject{
+        {"connections", connections},
+        {"framesSent", framesSent},
+        {"repliesMatched", repliesMatched},
+        {"unanswered", unanswered},
+        {"pushesReceived", pushesReceived},
+        {"elapsedUs", elapsedUs},
+        {"settleUs", settleUs},
+        {"framesPerSec", framesPerSec},
+        {"p50Us", p50Us},
+        {"p90Us", p90Us},
+        {"p99Us", p99Us},
+        {"maxUs", maxUs}
+    };
+}
+
+TrafficReplayer::Report TrafficReplayer::Report::fromJson(const QJsonObject& json) {
+    Report report;
+    report.connections = json["connections"].toInt();
+    report.framesSent = json["framesSent"].toInteger();
+    report.repliesMatched = json["repliesMatched"].toInteger();
+    report.unanswered = json["unanswered"].toInteger();
+    report.pushesReceived = json["pushesReceived"].toInteger();
+    report.elapsedUs = json["elapsedUs"].toInteger();
+    report.settleUs = json["settleUs"].toInteger();
+    report.framesPerSec = json["framesPerSec"].toDouble();
+    report.p50Us = json["p50Us"].toInteger();
+    report.p90Us = json["p90Us"].toInteger();
+    report.p99Us = json["p99Us"].toInteger();
+    report.maxUs = json["maxUs"].toInteger();
+    return report;
+}
+
+TrafficReplayer::TrafficReplayer(const QList<ChatProtocol::TrafficCapture::Record>& records, const QString& host,
+                                 quint16 port, bool realTime, QObject *parent)
+    : QObject(parent), m_records(records), m_next(0), m_host(host), m_port(port), m_realTime(realTime),
+      m_done(false), m_lastEventUs(0), m_lastSendUs(0), m_lastReceiveUs(0) {
+    m_settleTimer.setSingleShot(true);
+    connect(&m_settleTimer, &QTimer::timeout, this, &TrafficReplayer::settle);
+}
+
+TrafficReplayer::~TrafficReplayer() {
+    for (Connection *connection : m_connections) {
+        delete connection->socket;
+        delete connection;
+    }
+}
+
+void TrafficReplayer::start() {
+    m_clock.start();
+    step();
+}
+
+void TrafficReplayer::step() {
+    // Captured offsets are relative to the first record, not to capture start
+    const qint64 base = m_records.isEmpty() ? 0 : m_records.first().offsetUs;
+    
+    for (int sent = 0; m_next < m_records.size() && sent < kBatchFrames; ++sent) {
+        const ChatProtocol::TrafficCapture::Record& record = m_records[m_next];
+        
+        if (m_realTime) {
+            qint64 waitUs = record.offsetUs - base - nowUs();
+            if (waitUs > 1000) {
+                QTimer::singleShot(int(waitUs / 1000), this, &TrafficReplayer::step);
+                return;
+            }
+        }
+        
+        switch (record.event) {
+            case ChatProtocol::TrafficCapture::OPEN:
+                open(record.connection);
+                break;
+            case ChatProtocol::TrafficCapture::FRAME:
+                if (Connection *connection = m_connections.value(record.connection)) {
+                    send(connection, record.frame);
+                }
+                break;
+            case ChatProtocol::TrafficCapture::CLOSE:
+                close(record.connection);
+                break;
+        }
+        ++m_next;
+    }
+    
+    if (m_next < m_records.size()) {
+        QTimer::singleShot(0, this, &TrafficReplayer::step);
+        return;
+    }
+    
+    if (inFlightCount() == 0) {
+        settle();
+    } else {
+        QTimer::singleShot(kDrainTimeoutMs, this, &TrafficReplayer::finish);
+    }
+}
+
+void TrafficReplayer::open(quint32 id) {
+    auto connection = new Connection;
+    connection->socket = new QTcpSocket;
+    m_connections.insert(id, connection);
+    
+    connect(connection->socket, &QTcpSocket::connected, this, [this, connection]() { onConnected(connection); });
+    connect(connection->socket, &QTcpSocket::readyRead, this, [this, connection]() { onReadyRead(connection); });
+    connection->socket->connectToHost(m_host, m_port);
+}
+
+void TrafficReplayer::send(Connection *connection, const QByteArray& frame) {
+    if (connection->socket->state() != QAbstractSocket::ConnectedState) {
+        connection->pending.append(frame);
+        return;
+    }
+    
+    quint32 requestId = ChatProtocol::Message::deserialize(frame).requestId;
+    if (requestId != 0) connection->inFlight.insert(requestId, nowUs());
+    
+    char header[sizeof(quint32)];
+    qToBigEndian<quint32>(quint32(frame.size()), header);
+    connection->socket->write(header, sizeof(header));
+    connection->socket->write(frame);
+    ++m_report.framesSent;
+    m_lastEventUs = m_lastSendUs = nowUs();
+}
+
+void TrafficReplayer::close(quint32 id) {
+    Connection *connection = m_connections.value(id);
+    if (!connection) return;
+    
+    // Frames still waiting on the connect go out first
+    if (connection->socket->state() != QAbstractSocket::ConnectedState) {
+        connection->closing = true;
+        return;
+    }
+    connection->socket->disconnectFromHost();
+}
+
+void TrafficReplayer::onConnected(Connection *connection) {
+    connection->socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    
+    const QList<QByteArray> pending = std::exchange(connection->pending, {});
+    for (const QByteArray& frame : pending) {
+        send(connection, frame);
+    }
+    if (connection->closing) connection->socket->disconnectFromHost();
+}
+
+void TrafficReplayer::onReadyRead(Connection *connection) {
+    connection->readBuffer.append(connection->socket->readAll());
+    const qsizetype headerSize = sizeof(quint32);
+    qsizetype offset = 0;
+    const qint64 now = nowUs();
+    
+    while (connection->readBuffer.size() - offset >= headerSize) {
+        quint32 frameSize = qFromBigEndian<quint32>(connection->readBuffer.constData() + offset);
+        if (connection->readBuffer.size() - offset - headerSize < qsizetype(frameSize)) break;
+        
+        // Only the first frame of a reply times the request
+        quint32 requestId = ChatProtocol::Message::deserialize(
+            connection->readBuffer.mid(offset + headerSize, frameSize)).requestId;
+        auto it = connection->inFlight.find(requestId);
+        if (requestId != 0 && it != connection->inFlight.end()) {
+            m_latenciesUs.append(now - it.value());
+            connection->inFlight.erase(it);
+        } else if (requestId == 0) {
+            ++m_report.pushesReceived;
+        }
+        m_lastEventUs = m_lastReceiveUs = now;
+        offset += headerSize + frameSize;
+    }
+    connection->readBuffer.remove(0, offset);
+    
+    if (m_next == m_records.size() && inFlightCount() == 0 && !m_settleTimer.isActive()) settle();
+}
+
+qint64 TrafficReplayer::inFlightCount() const {
+    qint64 count = 0;
+    for (const Connection *connection : m_connections) {
+        count += connection->inFlight.size() + connection->pending.size();
+    }
+    return count;
+}
+
+void TrafficReplayer::settle() {
+    // Pushes have no reply to wait for, so wait for the traffic to stop instead
+    qint64 quietMs = (nowUs() - m_lastEventUs) / 1000;
+    if (quietMs >= kSettleMs) {
+        finish();
+    } else {
+        m_settleTimer.start(int(kSettleMs - quietMs));
+    }
+}
+
+void TrafficReplayer::finish() {
+    if (m_done) return;
+    m_done = true;
+    
+    std::sort(m_latenciesUs.begin(), m_latenciesUs.end());
+    m_report.connections = int(m_connections.size());
+    m_report.repliesMatched = m_latenciesUs.size();
+    m_report.unanswered = inFlightCount();
+    m_report.elapsedUs = m_lastEventUs;
+    m_report.settleUs = qMax<qint64>(0, m_lastReceiveUs - m_lastSendUs);
+    m_report.framesPerSec = m_lastEventUs > 0 ? m_report.framesSent * 1e6 / m_lastEventUs : 0;
+    m_report.p50Us = percentile(m_latenciesUs, 0.50);
+    m_report.p90Us = percentile(m_latenciesUs, 0.90);
+    m_report.p99Us = percentile(m_latenciesUs, 0.99);
+    m_report.maxUs = m_latenciesUs.isEmpty() ? 0 : m_latenciesUs.last();
+    
+    for (Connection *connection : m_connections) {
+        connection->socket->abort();
+    }
+    emit finished();
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#ifndef TRAFFICREPLAYER_H
+#define TRAFFICREPLAYER_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QJsonObject>
+#include <QHash>
+#include <QList>
+#include "TrafficCapture.h"
+
+// Re-drives a server with captured client traffic. Every captured connection
+// gets its own socket and its frames are sent in capture order, either at the
+// captured pace or back to back. Replies are matched to requests by request
+// id to measure latency; pushes are counted, and the run ends once traffic
+// has been quiet for a moment so fan-out still in flight is included.
+class TrafficReplayer : public QObject {
+    Q_OBJECT
+    
+public:
+    struct Report {
+        int connections = 0;
+        qint64 framesSent = 0;
+        qint64 repliesMatched = 0;
+        qint64 unanswered = 0;
+        qint64 pushesReceived = 0;
+        qint64 elapsedUs = 0;
+        qint64 settleUs = 0; // from the last frame sent to the last frame received
+        double framesPerSec = 0;
+        qint64 p50Us = 0;
+        qint64 p90Us = 0;
+        qint64 p99Us = 0;
+        qint64 maxUs = 0;
+        
+        QJsonObject toJson() const;
+        static Report fromJson(const QJsonObject& json);
+    };
+    
+    TrafficReplayer(const QList<ChatProtocol::TrafficCapture::Record>& records, const QString& host, quint16 port,
+                    bool realTime, QObject *parent = nullptr);
+    ~TrafficReplayer();
+    
+    void start();
+    Report report() const { return m_report; }
+    
+signals:
+    void finished();
+    
+private:
+    struct Connection {
+        QTcpSocket *socket = nullptr;
+        QByteArray readBuffer;
+        QList<QByteArray> pending; // frames sent before the socket connected
+        bool closing = false;
+        QHash<quint32, qint64> inFlight; // request id -> send time (us)
+    };
+    
+    void step();
+    void open(quint32 id);
+    void send(Connection *connection, const QByteArray& frame);
+    void close(quint32 id);
+    void onConnected(Connection *connection);
+    void onReadyRead(Connection *connection);
+    qint64 inFlightCount() const;
+    void settle();
+    void finish();
+    qint64 nowUs() const { return m_clock.nsecsElapsed() / 1000; }
+    
+    QList<ChatProtocol::TrafficCapture::Record> m_records;
+    qsizetype m_next;
+    QString m_host;
+    quint16 m_port;
+    bool m_realTime;
+    bool m_done;
+    
+    QHash<quint32, Connection*> m_connections; // closed ones too, so late replies still count
+    QElapsedTimer m_clock;
+    qint64 m_lastEventUs;
+    qint64 m_lastSendUs;
+    qint64 m_lastReceiveUs;
+    QTimer m_settleTimer;
+    QList<qint64> m_latenciesUs;
+    Report m_report;
+};
+
+#endif // TRAFFICREPLAYER_H
\ No newline at end of file
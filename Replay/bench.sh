@@ -0,0 +1,94 @@
+#!/bin/sh
+# A/B runs of generated scenarios with ChatReplay. Usage:
+#   Replay/bench.sh <build-dir> <benchmark> [scale]
+# Reports land in ./bench-<benchmark>/ as JSON next to the capture; set
+# BASELINE to a report from another build to print deltas against it.
+set -e
+
+BUILD=${1:?build directory}
+BENCH=${2:?benchmark}
+SCALE=${3:-0}
+REPLAY="$BUILD/Replay/ChatReplay"
+OUT="bench-$BENCH"
+mkdir -p "$OUT"
+
+case "$BENCH" in
+    io-uring)
+        # Same connections through QTcpSocket, then through the reactor;
+        # needs a build with CHAT_WITH_IO_URING=ON
+        "$REPLAY" --generate connections --scale "$SCALE" "$OUT/connections.ccap"
+        "$REPLAY" --report "$OUT/qt.json" "$OUT/connections.ccap"
+        "$REPLAY" --io-uring --report "$OUT/io-uring.json" --baseline "$OUT/qt.json" "$OUT/connections.ccap"
+        ;;
+    fanout)
+        # Delivery of a burst to every member of one large group; compare the
+        # settle time across group sizes, or against another build's report
+        "$REPLAY" --generate fanout --scale "$SCALE" "$OUT/fanout.ccap"
+        "$REPLAY" --max-group-members 0 --report "$OUT/fanout.json" ${BASELINE:+--baseline "$BASELINE"} "$OUT/fanout.ccap"
+        ;;
+    warm-start)
+        # Fill a database (and a snapshot of it) by replay, then time a real
+        # server starting on it cold and from the snapshot
+        SERVER="$BUILD/Server/ChatServer"
+        DATA="$OUT/data"
+        rm -rf "$DATA"
+        "$REPLAY" --generate populate --scale "$SCALE" "$OUT/populate.ccap"
+        "$REPLAY" --data-dir "$DATA" --snapshot "$DATA/state.snap" "$OUT/populate.ccap"
+        for mode in cold snapshot; do
+            [ "$mode" = snapshot ] && ARGS="--snapshot state.snap" || ARGS=""
+            (cd "$DATA" && exec "$SERVER" --port 23457 $ARGS) 2> "$OUT/$mode.log" &
+            PID=$!
+            for _ in $(seq 600); do
+                grep -q "^Warm\|(cold)" "$OUT/$mode.log" && break
+                sleep 0.1
+            done
+            kill "$PID"
+            wait "$PID" 2>/dev/null || true
+            echo "$mode:"
+            grep "Ready to accept\|Snapshot loaded\|^Warm" "$OUT/$mode.log"
+        done
+        ;;
+    timers)
+        # Connection deadline churn on the timing wheel and on one QTimer per
+        # connection, in the same process
+        "$REPLAY" --bench timers --scale "$SCALE" --report "$OUT/timers.json" ${BASELINE:+--baseline "$BASELINE"}
+        ;;
+    decode)
+        # Inbound frames through the arena-backed views and through owned
+        # Messages: frames/s and heap allocations per frame for each
+        "$REPLAY" --bench decode --scale "$SCALE" --report "$OUT/decode.json" ${BASELINE:+--baseline "$BASELINE"}
+        ;;
+    dispatch)
+        # History rows with 200 chats open, routed by conversation key and
+        # broadcast to every chat that filters them itself
+        "$REPLAY" --bench dispatch --scale "$SCALE" --report "$OUT/dispatch.json" ${BASELINE:+--baseline "$BASELINE"}
+        ;;
+    burst)
+        # 5,000 private messages landing on one headless client: delivery time
+        # and how late its GUI thread runs a 16 ms frame timer meanwhile
+        "$REPLAY" --bench burst --scale "$SCALE" --report "$OUT/burst.json" ${BASELINE:+--baseline "$BASELINE"}
+        ;;
+    reconnect)
+        # Signed-in clients dropped together by the server: time until each
+        # session is resumed, with and without the backoff before the attempt
+        "$REPLAY" --bench reconnect --scale "$SCALE" --report "$OUT/reconnect.json" ${BASELINE:+--baseline "$BASELINE"}
+        ;;
+    tls)
+        # Full and ticket-resumed handshakes against the in-process server,
+        # with a self-signed EC pair like the one ChatServer documents
+        [ -f "$OUT/server.key" ] || openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes \
+            -days 1 -subj /CN=localhost -keyout "$OUT/server.key" -out "$OUT/server.crt" 2>/dev/null
+        "$REPLAY" --bench tls --scale "$SCALE" --tls-cert "$OUT/server.crt" --tls-key "$OUT/server.key" \
+            --report "$OUT/tls.json" ${BASELINE:+--baseline "$BASELINE"}
+        ;;
+    storage)
+        # Appends and history pages on SQLite and on the message log; pass a
+        # scale of 100000000 for the full-size run (a day or more on SQLite, and
+        # tens of GB of disk)
+        "$REPLAY" --bench storage --scale "$SCALE" --report "$OUT/storage.json" ${BASELINE:+--baseline "$BASELINE"}
+        ;;
+    *)
+        echo "unknown benchmark: $BENCH (io-uring, fanout, warm-start, timers, decode, dispatch, burst, reconnect, tls, storage)" >&2
+        exit 1
+        ;;
+esac
\ No newline at end of file
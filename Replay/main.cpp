@@ -0,0 +1,209 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QDebug>
+#include <memory>
+#include "TrafficReplayer.h"
+#include "Scenarios.h"
+#include "Benchmarks.h"
+#include "ChatServer.h"
+
+namespace {
+QString delta(double current, double baseline) {
+    if (baseline == 0) return "n/a";
+    return QString("%1%2%").arg(current >= baseline ? "+" : "").arg(100.0 * (current - baseline) / baseline, 0, 'f', 1);
+}
+
+void printReport(const TrafficReplayer::Report& report, const TrafficReplayer::Report *baseline) {
+    qInfo().noquote() << QString("Connections: %1, frames: %2, replies timed: %3, unanswered: %4, pushes: %5")
+                         .arg(report.connections).arg(report.framesSent).arg(report.repliesMatched)
+                         .arg(report.unanswered).arg(report.pushesReceived);
+    
+    auto line = [baseline](const char *name, double value, double base, const char *unit) {
+        QString text = QString("%1: %2 %3").arg(name).arg(value, 0, 'f', 1).arg(unit);
+        if (baseline) text += QString("  (baseline %1, %2)").arg(base, 0, 'f', 1).arg(delta(value, base));
+        qInfo().noquote() << text;
+    };
+    const TrafficReplayer::Report none;
+    const TrafficReplayer::Report& base = baseline ? *baseline : none;
+    line("Throughput", report.framesPerSec, base.framesPerSec, "frames/s");
+    line("Latency p50", report.p50Us / 1000.0, base.p50Us / 1000.0, "ms");
+    line("Latency p90", report.p90Us / 1000.0, base.p90Us / 1000.0, "ms");
+    line("Latency p99", report.p99Us / 1000.0, base.p99Us / 1000.0, "ms");
+    line("Latency max", report.maxUs / 1000.0, base.maxUs / 1000.0, "ms");
+    line("Settle after last frame", report.settleUs / 1000.0, base.settleUs / 1000.0, "ms");
+}
+
+void printResults(const QJsonObject& results, const QJsonObject& baseline) {
+    for (auto it = results.constBegin(); it != results.constEnd(); ++it) {
+        QString text = QString("%1: %2").arg(it.key()).arg(it.value().toDouble(), 0, 'f', 1);
+        if (baseline.contains(it.key())) {
+            const double base = baseline[it.key()].toDouble();
+            text += QString("  (baseline %1, %2)").arg(base, 0, 'f', 1).arg(delta(it.value().toDouble(), base));
+        }
+        qInfo().noquote() << text;
+    }
+}
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays a capture recorded with ChatServer --capture.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("capture", "Capture file to replay (or to write with --generate); none with --bench.");
+    QCommandLineOption fastOption("fast", "Send frames back to back instead of at the captured pace.");
+    QCommandLineOption serverOption("server", "Replay against a running server instead of a fresh in-process one.", "host:port");
+    QCommandLineOption portOption("port", "Port for the in-process server.", "port", "23456");
+    QCommandLineOption reportOption("report", "Write the results as JSON to this file.", "path");
+    QCommandLineOption baselineOption("baseline", "Compare against a JSON report from another build.", "path");
+    QCommandLineOption generateOption("generate", QString("Write a synthetic capture instead of replaying (%1).")
+                                                  .arg(Scenarios::names().join(", ")), "scenario");
+    QCommandLineOption benchOption("bench", QString("Run an in-process benchmark instead of a replay (%1).")
+                                            .arg(Benchmarks::names().join(", ")), "name");
+    QCommandLineOption scaleOption("scale", "Size of the generated scenario or benchmark (0 for its default).", "count", "0");
+    QCommandLineOption ioUringOption("io-uring", "Serve the in-process server's connections from io_uring.");
+    QCommandLineOption groupLimitOption("max-group-members", "Largest group on the in-process server (0 for no limit).",
+                                        "count", "10");
+    QCommandLineOption dataDirOption("data-dir", "Keep the in-process server's database here instead of a scratch directory.",
+                                     "dir");
+    QCommandLineOption snapshotOption("snapshot", "Have the in-process server write a snapshot here when the replay ends.",
+                                      "path");
+    QCommandLineOption tlsCertOption("tls-cert", "PEM certificate chain for benchmarks that serve TLS.", "path");
+    QCommandLineOption tlsKeyOption("tls-key", "Private key (PEM) for --tls-cert.", "path");
+    parser.addOptions({fastOption, serverOption, portOption, reportOption, baselineOption, generateOption, benchOption,
+                       scaleOption, ioUringOption, groupLimitOption, dataDirOption, snapshotOption, tlsCertOption,
+                       tlsKeyOption});
+    parser.process(app);
+    
+    if (parser.isSet(benchOption)) {
+        Benchmarks::Options options;
+        options.scale = parser.value(scaleOption).toInt();
+        options.port = parser.value(portOption).toUShort();
+        options.tlsCertificate = parser.value(tlsCertOption);
+        options.tlsKey = parser.value(tlsKeyOption);
+        
+        QJsonObject baseline;
+        if (parser.isSet(baselineOption)) {
+            QFile file(parser.value(baselineOption));
+            if (!file.open(QIODevice::ReadOnly)) {
+                qCritical() << "Cannot read baseline:" << file.errorString();
+                return 1;
+            }
+            baseline = QJsonDocument::fromJson(file.readAll()).object();
+        }
+        
+        // Resolved now: benchmarks with a server run it in a scratch directory
+        const QString reportPath = parser.isSet(reportOption) ? QFileInfo(parser.value(reportOption)).absoluteFilePath()
+                                                              : QString();
+        QJsonObject results;
+        QString error;
+        if (!Benchmarks::run(parser.value(benchOption), options, &results, &error)) {
+            qCritical() << "Cannot run benchmark:" << error;
+            return 1;
+        }
+        printResults(results, baseline);
+        
+        if (!reportPath.isEmpty()) {
+            QFile file(reportPath);
+            if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(results).toJson()) < 0) {
+                qCritical() << "Cannot write report:" << file.errorString();
+                return 1;
+            }
+        }
+        return 0;
+    }
+    
+    if (parser.positionalArguments().size() != 1) parser.showHelp(1);
+    
+    if (parser.isSet(generateOption)) {
+        QList<ChatProtocol::TrafficCapture::Record> records;
+        QString error;
+        if (!Scenarios::build(parser.value(generateOption), parser.value(scaleOption).toInt(), &records, &error) ||
+            !ChatProtocol::TrafficCapture::write(parser.positionalArguments().first(), records, &error)) {
+            qCritical() << "Cannot generate capture:" << error;
+            return 1;
+        }
+        qInfo() << "Wrote" << records.size() << "records";
+        return 0;
+    }
+    
+    QList<ChatProtocol::TrafficCapture::Record> records;
+    QString error;
+    if (!ChatProtocol::TrafficCapture::read(parser.positionalArguments().first(), &records, &error)) {
+        qCritical() << "Cannot read capture:" << error;
+        return 1;
+    }
+    qInfo() << "Loaded" << records.size() << "records";
+    
+    std::unique_ptr<TrafficReplayer::Report> baseline;
+    if (parser.isSet(baselineOption)) {
+        QFile file(parser.value(baselineOption));
+        if (!file.open(QIODevice::ReadOnly)) {
+            qCritical() << "Cannot read baseline:" << file.errorString();
+            return 1;
+        }
+        baseline = std::make_unique<TrafficReplayer::Report>(
+            TrafficReplayer::Report::fromJson(QJsonDocument::fromJson(file.readAll()).object()));
+    }
+    
+    // Resolved now: the in-process server changes the working directory
+    const QString reportPath = parser.isSet(reportOption) ? QFileInfo(parser.value(reportOption)).absoluteFilePath()
+                                                          : QString();
+    
+    // A fresh server gets an empty database in a scratch directory, unless told where
+    QTemporaryDir scratch;
+    const QString dataDir = parser.isSet(dataDirOption) ? parser.value(dataDirOption) : scratch.path();
+    std::unique_ptr<ChatServer> server;
+    QString host = "127.0.0.1";
+    quint16 port = 0;
+    if (parser.isSet(serverOption)) {
+        QStringList parts = parser.value(serverOption).split(':');
+        host = parts.value(0);
+        port = parts.value(1).toUShort();
+    } else {
+        if (dataDir.isEmpty() || !QDir().mkpath(dataDir) || !QDir::setCurrent(dataDir)) {
+            qCritical() << "Cannot use data directory" << dataDir;
+            return 1;
+        }
+        server = std::make_unique<ChatServer>();
+        server->setRateLimiting(false);
+        server->setGroupMemberLimit(qMax(0, parser.value(groupLimitOption).toInt()));
+        if (parser.isSet(snapshotOption)) {
+            // Written when the server shuts down at the end of the replay
+            server->enableSnapshots(QFileInfo(parser.value(snapshotOption)).absoluteFilePath(), 24 * 60 * 60);
+        }
+        if (parser.isSet(ioUringOption) && !server->enableIoUring()) {
+            qCritical() << "Cannot set up io_uring for the in-process server";
+            return 1;
+        }
+        server->warmUp();
+        port = parser.value(portOption).toUShort();
+        if (!server->startServer(port)) {
+            qCritical() << "Cannot start the in-process server on port" << port;
+            return 1;
+        }
+    }
+    
+    TrafficReplayer replayer(records, host, port, !parser.isSet(fastOption));
+    QObject::connect(&replayer, &TrafficReplayer::finished, &app, &QCoreApplication::quit);
+    replayer.start();
+    app.exec();
+    
+    TrafficReplayer::Report report = replayer.report();
+    printReport(report, baseline.get());
+    
+    if (!reportPath.isEmpty()) {
+        QFile file(reportPath);
+        if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(report.toJson()).toJson()) < 0) {
+            qCritical() << "Cannot write report:" << file.errorString();
+            return 1;
+        }
+    }
+    return 0;
+}
\ No newline at end of file
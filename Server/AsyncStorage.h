@@ -0,0 +1,115 @@
+#ifndef ASYNCSTORAGE_H
+#define ASYNCSTORAGE_H
+
+#include <QObject>
+#include <QThreadPool>
+#include <QMutex>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+// Coroutine that starts running immediately and frees itself when it
+// finishes; nobody awaits it
+struct AsyncTask {
+    struct promise_type {
+        AsyncTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// Runs storage work on a small pool so connection threads never block on
+// SQLite. `co_await storage.call(target, fn)` suspends the handler, runs fn
+// on the pool and resumes the handler on the thread that owns the target's
+// context. If the connection has gone away in the meantime the handler is
+// destroyed instead of resumed.
+class AsyncStorage {
+public:
+    // Where awaiting handlers resume; clear() before the context is deleted
+    class ResumeTarget {
+    public:
+        explicit ResumeTarget(QObject *context = nullptr) : m_context(context) {}
+        
+        void setContext(QObject *context) {
+            QMutexLocker locker(&m_mutex);
+            m_context = context;
+        }
+        
+        void clear() { setContext(nullptr); }
+        
+        // Queues fn on the context's thread from any thread; false if there is none
+        template <typename Fn>
+        bool post(Fn fn) {
+            QMutexLocker locker(&m_mutex);
+            if (!m_context) return false;
+            QMetaObject::invokeMethod(m_context, std::move(fn), Qt::QueuedConnection);
+            return true;
+        }
+        
+    private:
+        friend class AsyncStorage;
+        QMutex m_mutex;
+        QObject *m_context;
+    };
+    
+    template <typename T>
+    class Call {
+    public:
+        Call(QThreadPool *pool, std::shared_ptr<ResumeTarget> target, std::function<T()> work)
+            : m_pool(pool), m_target(std::move(target)), m_work(std::move(work)) {}
+        
+        bool await_ready() const noexcept { return false; }
+        
+        void await_suspend(std::coroutine_handle<> handle) {
+            m_pool->start([this, resumer = std::make_shared<Resumer>(handle), target = m_target,
+                           work = std::move(m_work)]() {
+                m_result = work();
+                
+                // Holding the lock keeps the context alive until the resume is queued
+                QMutexLocker locker(&target->m_mutex);
+                if (target->m_context) {
+                    QMetaObject::invokeMethod(target->m_context, [resumer]() { resumer->resume(); },
+                                              Qt::QueuedConnection);
+                }
+            });
+        }
+        
+        T await_resume() { return std::move(*m_result); }
+        
+    private:
+        // Destroys the suspended coroutine if it is dropped without resuming,
+        // e.g. when the queued resume is discarded with its context
+        struct Resumer {
+            explicit Resumer(std::coroutine_handle<> h) : handle(h) {}
+            ~Resumer() { if (handle) handle.destroy(); }
+            void resume() { std::exchange(handle, {}).resume(); }
+            std::coroutine_handle<> handle;
+        };
+        
+        QThreadPool *m_pool;
+        std::shared_ptr<ResumeTarget> m_target;
+        std::function<T()> m_work;
+        std::optional<T> m_result;
+    };
+    
+    explicit AsyncStorage(int threads = 4) { m_pool.setMaxThreadCount(threads); }
+    ~AsyncStorage() { m_pool.waitForDone(); }
+    
+    void setThreadCount(int threads) { m_pool.setMaxThreadCount(threads); }
+    
+    template <typename Fn>
+    Call<std::invoke_result_t<Fn>> call(std::shared_ptr<ResumeTarget> target, Fn work) {
+        return Call<std::invoke_result_t<Fn>>(&m_pool, std::move(target), std::move(work));
+    }
+    
+private:
+    QThreadPool m_pool;
+};
+
+#endif // ASYNCSTORAGE_H
\ No newline at end of file
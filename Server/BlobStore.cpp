@@ -0,0 +1,112 @@
+#include "BlobStore.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QCryptographicHash>
+#include <QRandomGenerator>
+#include <QDeadlineTimer>
+#include <QDebug>
+
+namespace {
+const qint64 kTicketLifetimeMs = 60000;
+}
+
+BlobStore::BlobStore(const QString& root) : m_root(root) {
+    QDir().mkpath(m_root + "/partial");
+}
+
+bool BlobStore::isValidHash(const QString& hash) {
+    if (hash.size() != 64) return false;
+    for (QChar c : hash) {
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+    }
+    return true;
+}
+
+QString BlobStore::blobPath(const QString& hash) const {
+    return m_root + "/" + hash.left(2) + "/" + hash;
+}
+
+QString BlobStore::partialPath(const QString& hash) const {
+    return m_root + "/partial/" + hash;
+}
+
+bool BlobStore::contains(const QString& hash) const {
+    return QFileInfo::exists(blobPath(hash));
+}
+
+qint64 BlobStore::blobSize(const QString& hash) const {
+    return QFileInfo(blobPath(hash)).size();
+}
+
+qint64 BlobStore::partialSize(const QString& hash) const {
+    QFileInfo info(partialPath(hash));
+    return info.exists() ? info.size() : 0;
+}
+
+bool BlobStore::commit(const QString& hash) {
+    QFile partial(partialPath(hash));
+    if (!partial.open(QIODevice::ReadOnly)) return false;
+    
+    QCryptographicHash digest(QCryptographicHash::Sha256);
+    digest.addData(&partial);
+    partial.close();
+    
+    if (QString::fromLatin1(digest.result().toHex()) != hash) {
+        qDebug() << "Discarding corrupt upload:" << hash;
+        partial.remove();
+        return false;
+    }
+    
+    QDir().mkpath(QFileInfo(blobPath(hash)).path());
+    
+    // Someone else may have completed the same content first
+    if (contains(hash)) {
+        partial.remove();
+        return true;
+    }
+    return partial.rename(blobPath(hash));
+}
+
+bool BlobStore::beginUpload(const QString& hash) {
+    QMutexLocker locker(&m_mutex);
+    if (m_activeUploads.contains(hash)) return false;
+    m_activeUploads.insert(hash);
+    return true;
+}
+
+void BlobStore::endUpload(const QString& hash) {
+    QMutexLocker locker(&m_mutex);
+    m_activeUploads.remove(hash);
+}
+
+QByteArray BlobStore::issueTicket(const Ticket& ticket) {
+    quint64 random[2];
+    QRandomGenerator::system()->fillRange(random);
+    QByteArray token = QByteArray(reinterpret_cast<const char*>(random), sizeof(random)).toHex();
+    
+    Ticket issued = ticket;
+    issued.expiresAt = QDeadlineTimer::current().deadline() + kTicketLifetimeMs;
+    
+    QMutexLocker locker(&m_mutex);
+    const qint64 now = QDeadlineTimer::current().deadline();
+    for (auto it = m_tickets.begin(); it != m_tickets.end();) {
+        if (it.value().expiresAt < now) {
+            it = m_tickets.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    m_tickets.insert(token, issued);
+    return token;
+}
+
+bool BlobStore::redeemTicket(const QByteArray& token, Ticket *ticket) {
+    QMutexLocker locker(&m_mutex);
+    auto it = m_tickets.find(token);
+    if (it == m_tickets.end()) return false;
+    
+    *ticket = it.value();
+    m_tickets.erase(it);
+    return ticket->expiresAt >= QDeadlineTimer::current().deadline();
+}
\ No newline at end of file
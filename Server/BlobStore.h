@@ -0,0 +1,52 @@
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+
+// Content-addressed attachment storage. Blobs live at <root>/<aa>/<sha256>
+// so identical uploads are stored once; partial uploads are kept as
+// <root>/partial/<sha256> and resumed from their current size.
+class BlobStore {
+public:
+    enum Direction {
+        UPLOAD,
+        DOWNLOAD
+    };
+    
+    // One-shot permission to use the bulk channel, issued over the chat connection
+    struct Ticket {
+        Direction direction = DOWNLOAD;
+        QString hash;
+        qint64 size = 0;
+        qint64 expiresAt = 0;
+    };
+    
+    explicit BlobStore(const QString& root = "blobs");
+    
+    static bool isValidHash(const QString& hash);
+    
+    bool contains(const QString& hash) const;
+    qint64 blobSize(const QString& hash) const;
+    QString blobPath(const QString& hash) const;
+    QString partialPath(const QString& hash) const;
+    qint64 partialSize(const QString& hash) const;
+    bool commit(const QString& hash);
+    
+    bool beginUpload(const QString& hash);
+    void endUpload(const QString& hash);
+    
+    QByteArray issueTicket(const Ticket& ticket);
+    bool redeemTicket(const QByteArray& token, Ticket *ticket);
+    
+private:
+    QString m_root;
+    QMutex m_mutex;
+    QHash<QByteArray, Ticket> m_tickets;
+    QSet<QString> m_activeUploads;
+};
+
+#endif // BLOBSTORE_H
\ No newline at end of file
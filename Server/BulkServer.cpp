@@ -0,0 +1,156 @@
+#include "BulkServer.h"
+#include "BlobStore.h"
+#include "Protocol.h"
+#include <QThread>
+#include <QDataStream>
+#include <QDebug>
+
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <cerrno>
+#endif
+
+namespace {
+const int kTimeoutMs = 30000;
+const quint32 kMaxHeaderSize = 1024;
+}
+
+BulkServer::BulkServer(BlobStore *blobs, QObject *parent)
+    : QTcpServer(parent), m_blobs(blobs) {}
+
+void BulkServer::incomingConnection(qintptr socketDescriptor) {
+    QThread *thread = QThread::create([this, socketDescriptor]() {
+        serveTransfer(socketDescriptor);
+    });
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+    thread->start();
+}
+
+void BulkServer::serveTransfer(qintptr socketDescriptor) {
+    // Without startServerEncryption() a QSslSocket is a plain TCP socket
+    QSslSocket socket;
+    if (!socket.setSocketDescriptor(socketDescriptor)) return;
+    
+    if (!m_tlsConfig.isNull()) {
+        socket.setSslConfiguration(m_tlsConfig);
+        socket.startServerEncryption();
+        if (!socket.waitForEncrypted(kTimeoutMs)) return;
+    }
+    
+    // Keep at most a few chunks buffered so a fast uploader is throttled by TCP
+    socket.setReadBufferSize(4 * ChatProtocol::ATTACHMENT_CHUNK_SIZE);
+    
+    // Header: quint32 length, then the ticket token and starting offset
+    while (socket.bytesAvailable() < qint64(sizeof(quint32))) {
+        if (!socket.waitForReadyRead(kTimeoutMs)) return;
+    }
+    
+    quint32 headerSize = 0;
+    QDataStream(&socket) >> headerSize;
+    if (headerSize > kMaxHeaderSize) return;
+    
+    while (socket.bytesAvailable() < headerSize) {
+        if (!socket.waitForReadyRead(kTimeoutMs)) return;
+    }
+    
+    QByteArray token;
+    qint64 offset = -1;
+    QDataStream header(socket.read(headerSize));
+    header >> token >> offset;
+    
+    BlobStore::Ticket ticket;
+    if (!m_blobs->redeemTicket(token, &ticket) || offset < 0 || offset > ticket.size) {
+        qDebug() << "Rejected bulk transfer with invalid ticket";
+        return;
+    }
+    
+    bool ok;
+    if (ticket.direction == BlobStore::UPLOAD) {
+        ok = receiveUpload(socket, ticket.hash, offset, ticket.size);
+    } else {
+        ok = sendDownload(socket, ticket.hash, offset, ticket.size);
+    }
+    
+    qDebug() << (ticket.direction == BlobStore::UPLOAD ? "Upload" : "Download")
+             << ticket.hash << (ok ? "completed" : "interrupted");
+    
+    socket.disconnectFromHost();
+    if (socket.state() != QAbstractSocket::UnconnectedState) {
+        socket.waitForDisconnected(kTimeoutMs);
+    }
+}
+
+bool BulkServer::receiveUpload(QSslSocket& socket, const QString& hash, qint64 offset, qint64 size) {
+    if (!m_blobs->beginUpload(hash)) return false;
+    
+    bool ok = false;
+    QFile partial(m_blobs->partialPath(hash));
+    
+    // Resuming is only valid from exactly where the stored part ends
+    if (offset == m_blobs->partialSize(hash) && partial.open(QIODevice::Append)) {
+        qint64 received = offset;
+        
+        while (received < size) {
+            if (socket.bytesAvailable() == 0 && !socket.waitForReadyRead(kTimeoutMs)) break;
+            
+            QByteArray chunk = socket.read(qMin(size - received, ChatProtocol::ATTACHMENT_CHUNK_SIZE));
+            if (partial.write(chunk) != chunk.size()) break;
+            received += chunk.size();
+        }
+        
+        partial.close();
+        ok = received == size && m_blobs->commit(hash);
+    }
+    
+    m_blobs->endUpload(hash);
+    
+    char status = ok ? 1 : 0;
+    socket.write(&status, 1);
+    socket.waitForBytesWritten(kTimeoutMs);
+    return ok;
+}
+
+bool BulkServer::sendDownload(QSslSocket& socket, const QString& hash, qint64 offset, qint64 size) {
+    QFile blob(m_blobs->blobPath(hash));
+    if (!blob.open(QIODevice::ReadOnly)) return false;
+    
+    return sendFileRange(socket, blob, offset, size);
+}
+
+bool BulkServer::sendFileRange(QSslSocket& socket, QFile& file, qint64 offset, qint64 size) {
+#ifdef Q_OS_LINUX
+    // Zero-copy: the kernel moves page-cache pages straight to the socket.
+    // Encrypted connections have to pass through userspace.
+    if (!socket.isEncrypted()) {
+        const int socketFd = int(socket.socketDescriptor());
+        off_t position = offset;
+        
+        while (position < size) {
+            size_t count = size_t(qMin<qint64>(size - position, 16 * ChatProtocol::ATTACHMENT_CHUNK_SIZE));
+            ssize_t sent = ::sendfile(socketFd, file.handle(), &position, count);
+            if (sent > 0) continue;
+            
+            if (sent < 0 && (errno == EAGAIN || errno == EINTR)) {
+                pollfd pfd = {socketFd, POLLOUT, 0};
+                if (::poll(&pfd, 1, kTimeoutMs) <= 0) return false;
+                continue;
+            }
+            return false;
+        }
+        return true;
+    }
+#endif
+    if (!file.seek(offset)) return false;
+    
+    qint64 remaining = size - offset;
+    while (remaining > 0) {
+        QByteArray chunk = file.read(qMin(remaining, ChatProtocol::ATTACHMENT_CHUNK_SIZE));
+        if (chunk.isEmpty()) return false;
+        
+        socket.write(chunk);
+        if (!socket.waitForBytesWritten(kTimeoutMs)) return false;
+        remaining -= chunk.size();
+    }
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef BULKSERVER_H
+#define BULKSERVER_H
+
+#include <QTcpServer>
+#include <QSslSocket>
+#include <QSslConfiguration>
+#include <QFile>
+
+class BlobStore;
+
+// Listener for the attachment channel. Each connection presents a ticket
+// issued over the chat connection, then streams one upload or download on
+// its own thread, so chat traffic never waits behind file data.
+class BulkServer : public QTcpServer {
+    Q_OBJECT
+    
+public:
+    explicit BulkServer(BlobStore *blobs, QObject *parent = nullptr);
+    
+    void setTlsConfiguration(const QSslConfiguration& config) { m_tlsConfig = config; }
+    
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+    
+private:
+    void serveTransfer(qintptr socketDescriptor);
+    bool receiveUpload(QSslSocket& socket, const QString& hash, qint64 offset, qint64 size);
+    bool sendDownload(QSslSocket& socket, const QString& hash, qint64 offset, qint64 size);
+    bool sendFileRange(QSslSocket& socket, QFile& file, qint64 offset, qint64 size);
+    
+    BlobStore *m_blobs;
+    QSslConfiguration m_tlsConfig; // null: plain TCP
+};
+
+#endif // BULKSERVER_H
\ No newline at end of file
@@ -3,35 +3,160 @@
 
 #include <QTcpServer>
 #include <QTcpSocket>
-#include <QMap>
+#include <QSet>
 #include <QMutex>
+#include <QReadWriteLock>
+#include <QThreadPool>
+#include <QHash>
+#include <QTimer>
+#include <QSslConfiguration>
+#include <QElapsedTimer>
+#include <atomic>
+#include <memory>
+#include <vector>
 #include "Protocol.h"
+#include "TimingWheel.h"
+#include "RateLimiter.h"
+#include "NameTable.h"
+#include "ResumeTokens.h"
+#include "UserDirectory.h"
+#include "BlobStore.h"
+#include "BulkServer.h"
+#include "TrafficCapture.h"
+#include "OutboundQueue.h"
 #include "DatabaseManager.h"
+#include "AsyncStorage.h"
+#include "ClientHandler.h"
 
-class ClientHandler;
+class StateSnapshot;
 
 class ChatServer : public QTcpServer {
     Q_OBJECT
     
 public:
-    explicit ChatServer(QObject *parent = nullptr);
+    explicit ChatServer(const QString& messageLogPath = QString(), QObject *parent = nullptr);
     ~ChatServer();
     
     bool startServer(quint16 port);
+    
+    // Encrypts chat and attachment connections; call before startServer()
+    void setTlsConfiguration(const QSslConfiguration& config);
+    bool tlsEnabled() const { return !m_tlsConfig.isNull(); }
     void broadcastToUser(const QString& username, const ChatProtocol::Message& msg);
-    void broadcastToGroup(const QString& groupName, const ChatProtocol::Message& msg);
+    void broadcastToUser(NameId userId, const ChatProtocol::Message& msg);
+    void broadcastToGroup(const QVector<NameId>& members, const ChatProtocol::Message& msg);
+    void updateGroupMember(const QString& groupName, const QString& username, bool joined);
+    
+    // Member ids of a group. The cached lookup never touches the database;
+    // groupMemberIds() reads it on a miss, so call that from storage work.
+    bool cachedGroupMembers(const QString& groupName, QVector<NameId> *members);
+    QVector<NameId> groupMemberIds(const QString& groupName);
+    
+    BulkServer* bulkServer() { return &m_bulkServer; }
+    
+    void setHistoryCacheSize(qint64 bytes) { m_database.setHistoryCacheSize(bytes); }
+    void setStorageThreads(int threads) { m_storage.setThreadCount(threads); }
+    void setGroupMemberLimit(int limit) { m_database.setGroupMemberLimit(limit); }
+    
+    // Records every inbound frame for replay with the ChatReplay tool
+    bool startCapture(const QString& path);
+    void setRateLimiting(bool enabled) { m_rateLimiter.setEnabled(enabled); }
+    
+    // Moves plain connections onto one io_uring reactor thread (Linux, CHAT_WITH_IO_URING builds)
+    bool enableIoUring();
+    
+    // Warm start: periodically saves the in-memory state and loads it in warmUp()
+    void enableSnapshots(const QString& path, int intervalSecs);
+    void warmUp(); // call once before accepting connections
+    
+    // Periodically moves messages older than maxAgeDays into archive segments
+    bool enableRetention(const QString& archiveDirectory, int maxAgeDays);
+    
+    // Zero-downtime restart support
+    QList<ClientHandler*> handlers();
+    bool detachSession(ClientHandler *handler, ClientHandler::SessionState *state);
+    void adoptSession(const ClientHandler::SessionState& state);
+    QByteArray saveResumeTokens() { return m_resumeTokens.save(m_names); } // so resumes work on the successor
+    void loadResumeTokens(const QByteArray& bytes) { m_resumeTokens.load(bytes, m_names); }
     
 protected:
     void incomingConnection(qintptr socketDescriptor) override;
     
 private slots:
     void onClientDisconnected(const QString& username);
+    void onTimerTick();
+    void logStats();
+    void runRetention();
+    void writeSnapshot();
     
 private:
-    QMap<QString, ClientHandler*> m_clients; // username -> handler
-    QMutex m_clientsMutex;
+    enum ConnectionDeadline {
+        AUTH_DEADLINE,
+        HEARTBEAT_DEADLINE,
+        IDLE_DEADLINE
+    };
+    
+    ClientHandler* createHandler(qintptr socketDescriptor);
+    void scheduleDeadline(ClientHandler *handler, ConnectionDeadline kind, qint64 delayMs);
+    void cancelDeadline(ClientHandler *handler);
+    QVector<NameId> loadGroupMembers(const QString& groupName);
+    void catchUp(const StateSnapshot& snapshot);
+    void saveSnapshot();
+    void deliverShard(const QVector<NameId>& members, qsizetype begin, OutboundQueue::Lane lane, const QByteArray& frame);
+    
+    NameTable m_names;
+    QSet<ClientHandler*> m_handlers; // every live connection, authenticated or not
+    QHash<NameId, ClientHandler*> m_clients; // user id -> handler
+    QReadWriteLock m_clientsLock; // lookups share it, so fan-out shards run side by side
     DatabaseManager m_database;
     
+    QHash<NameId, QVector<NameId>> m_groupMembers; // group id -> member ids
+    QMutex m_groupsMutex;
+    quint64 m_groupsEpoch = 0; // bumped by every membership change, under m_groupsMutex
+    // Deliver the shards of large groups, one thread each: shard i of every
+    // message goes to lane i % count, so shards queued on a lane stay in order
+    std::vector<std::unique_ptr<QThreadPool>> m_fanoutLanes;
+    
+    // Connection deadlines, owned by the server thread
+    TimingWheel m_timers;
+    QTimer m_tickTimer;
+    QHash<ClientHandler*, TimingWheel::TimerId> m_connectionTimers;
+    
+    RateLimiter m_rateLimiter;
+    QTimer m_statsTimer;
+    ResumeTokens m_resumeTokens;
+    UserDirectory m_directory;
+    
+    QSslConfiguration m_tlsConfig;
+    std::atomic<quint64> m_tlsHandshakes{0}; // completed since the last stats line
+    
+    BlobStore m_blobs;
+    BulkServer m_bulkServer;
+    
+    // Retention job, one pass at a time on its own thread
+    int m_retentionDays = 0;
+    QTimer m_retentionTimer;
+    QThread *m_retentionThread = nullptr;
+    std::atomic<bool> m_stopping{false};
+    
+    // Warm-start snapshot; catch-up after loading one runs on its own thread
+    QString m_snapshotPath;
+    QTimer m_snapshotTimer;
+    QThread *m_snapshotThread = nullptr;
+    QThread *m_catchUpThread = nullptr;
+    QElapsedTimer m_startClock;
+    bool m_acceptedAny = false;
+    
+    ChatProtocol::TrafficCapture m_capture;
+    std::atomic<quint32> m_nextConnectionId{0};
+    
+    // Handlers' database calls; declared after m_database so it drains first
+    AsyncStorage m_storage;
+    
+#ifdef CHAT_IO_URING
+    std::unique_ptr<IoUringReactor> m_reactor;
+#endif
+    
     friend class ClientHandler;
 };
 
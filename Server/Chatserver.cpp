@@ -1,54 +1,482 @@
 #include "ChatServer.h"
 #include "ClientHandler.h"
 #include <QDebug>
+#include <QDeadlineTimer>
+#include <QElapsedTimer>
+#include <QThread>
+#include "StateSnapshot.h"
 
-ChatServer::ChatServer(QObject *parent) : QTcpServer(parent) {
-    if (!m_database.connect()) {
+namespace {
+// Group members delivered per fan-out task
+const qsizetype kFanoutShardSize = 2048;
+// Fan-out threads are capped so large groups cannot take over the machine
+const int kMaxFanoutLanes = 8;
+}
+
+ChatServer::ChatServer(const QString& messageLogPath, QObject *parent)
+    : QTcpServer(parent), m_timers(512, 500, QDeadlineTimer::current().deadline()),
+      m_bulkServer(&m_blobs) {
+    m_startClock.start();
+    
+    if (!m_database.connect(messageLogPath)) {
         qDebug() << "Failed to connect to database!";
     }
+    
+    m_tickTimer.setInterval(int(m_timers.tickInterval()));
+    connect(&m_tickTimer, &QTimer::timeout, this, &ChatServer::onTimerTick);
+    m_tickTimer.start();
+    
+    m_statsTimer.setInterval(60000);
+    connect(&m_statsTimer, &QTimer::timeout, this, &ChatServer::logStats);
+    m_statsTimer.start();
+    
+    const int lanes = qBound(1, QThread::idealThreadCount() / 2, kMaxFanoutLanes);
+    for (int i = 0; i < lanes; ++i) {
+        auto pool = std::make_unique<QThreadPool>();
+        pool->setMaxThreadCount(1);
+        m_fanoutLanes.push_back(std::move(pool));
+    }
 }
 
 ChatServer::~ChatServer() {
-    QMutexLocker locker(&m_clientsMutex);
+    m_stopping = true;
+    for (QThread *thread : {m_retentionThread, m_catchUpThread, m_snapshotThread}) {
+        if (!thread) continue;
+        thread->wait();
+        delete thread;
+    }
+    
+    // The freshest image for the next start
+    if (!m_snapshotPath.isEmpty()) saveSnapshot();
+    
+    // Queued shards look handlers up, so they finish before any is deleted
+    for (auto& lane : m_fanoutLanes) {
+        lane->waitForDone();
+    }
+    
+    QWriteLocker locker(&m_clientsLock);
     qDeleteAll(m_clients);
 }
 
+void ChatServer::setTlsConfiguration(const QSslConfiguration& config) {
+    m_tlsConfig = config;
+    m_bulkServer.setTlsConfiguration(config);
+}
+
+bool ChatServer::enableRetention(const QString& archiveDirectory, int maxAgeDays) {
+    if (maxAgeDays <= 0 || !m_database.openArchive(archiveDirectory)) return false;
+    m_retentionDays = maxAgeDays;
+    
+    m_retentionTimer.setInterval(3600 * 1000);
+    connect(&m_retentionTimer, &QTimer::timeout, this, &ChatServer::runRetention);
+    m_retentionTimer.start();
+    runRetention();
+    return true;
+}
+
+void ChatServer::runRetention() {
+    if (m_retentionThread && m_retentionThread->isRunning()) return;
+    delete m_retentionThread;
+    
+    // Archiving locks the database only per batch, so inserts interleave with it
+    QDateTime cutoff = QDateTime::currentDateTimeUtc().addDays(-m_retentionDays);
+    m_retentionThread = QThread::create([this, cutoff]() {
+        QElapsedTimer timer;
+        timer.start();
+        int archived = m_database.archiveMessagesBefore(cutoff, &m_stopping);
+        if (archived > 0) {
+            qDebug() << "Archived" << archived << "messages in" << timer.elapsed() << "ms,"
+                     << m_database.archiveSegmentCount() << "archive segments";
+        }
+    });
+    m_retentionThread->start(QThread::LowPriority);
+}
+
+void ChatServer::enableSnapshots(const QString& path, int intervalSecs) {
+    m_snapshotPath = path;
+    m_snapshotTimer.setInterval(intervalSecs * 1000);
+    connect(&m_snapshotTimer, &QTimer::timeout, this, &ChatServer::writeSnapshot);
+    m_snapshotTimer.start();
+}
+
+void ChatServer::warmUp() {
+    StateSnapshot snapshot;
+    QElapsedTimer timer;
+    timer.start();
+    
+    if (m_snapshotPath.isEmpty() || !snapshot.read(m_snapshotPath)) {
+        if (!m_snapshotPath.isEmpty()) qDebug() << "No usable snapshot at" << m_snapshotPath;
+        m_directory.load(m_database.getAllUsers());
+        qDebug() << "User directory loaded:" << m_directory.size() << "users";
+        qDebug() << "Ready to accept" << m_startClock.elapsed() << "ms after start (cold)";
+        return;
+    }
+    
+    // Serve from the snapshot right away; the store catches it up in the background
+    m_directory.load(snapshot.users);
+    {
+        QMutexLocker locker(&m_groupsMutex);
+        for (const StateSnapshot::Group& group : snapshot.groups) {
+            QVector<NameId> ids;
+            ids.reserve(group.members.size());
+            for (const QString& member : group.members) {
+                ids.append(m_names.intern(member));
+            }
+            m_groupMembers.insert(m_names.intern(group.name), ids);
+        }
+    }
+    qDebug() << "Snapshot loaded in" << timer.elapsed() << "ms:" << snapshot.users.size() << "users,"
+             << snapshot.groups.size() << "groups," << snapshot.conversations.size() << "conversations";
+    qDebug() << "Ready to accept" << m_startClock.elapsed() << "ms after start (from snapshot)";
+    
+    m_catchUpThread = QThread::create([this, snapshot]() { catchUp(snapshot); });
+    m_catchUpThread->start(QThread::LowPriority);
+}
+
+void ChatServer::catchUp(const StateSnapshot& snapshot) {
+    m_directory.merge(m_database.getAllUsers());
+    m_database.warmHistory(snapshot.conversations, snapshot.latestPrivateId, snapshot.latestGroupId, &m_stopping);
+    
+    // Membership keeps no change log, so every group is re-read. A join or
+    // leave during a read drops that group, which then loads on first use.
+    for (const StateSnapshot::Group& group : snapshot.groups) {
+        if (m_stopping) return;
+        loadGroupMembers(group.name);
+    }
+    
+    qDebug() << "Warm" << m_startClock.elapsed() << "ms after start";
+}
+
+void ChatServer::writeSnapshot() {
+    if (m_snapshotThread && m_snapshotThread->isRunning()) return;
+    delete m_snapshotThread;
+    
+    m_snapshotThread = QThread::create([this]() { saveSnapshot(); });
+    m_snapshotThread->start(QThread::LowPriority);
+}
+
+void ChatServer::saveSnapshot() {
+    QElapsedTimer timer;
+    timer.start();
+    StateSnapshot snapshot;
+    
+    // Ids first: anything stored after them is fetched again on load
+    snapshot.latestPrivateId = m_database.latestPrivateMessageId();
+    snapshot.latestGroupId = m_database.latestGroupMessageId();
+    snapshot.users = m_directory.all();
+    
+    QHash<NameId, QVector<NameId>> groups;
+    {
+        QMutexLocker locker(&m_groupsMutex);
+        groups = m_groupMembers;
+    }
+    for (auto it = groups.cbegin(); it != groups.cend(); ++it) {
+        StateSnapshot::Group group;
+        group.name = m_names.name(it.key());
+        group.members.reserve(it.value().size());
+        for (NameId member : it.value()) {
+            group.members.append(m_names.name(member));
+        }
+        snapshot.groups.append(group);
+    }
+    
+    snapshot.conversations = m_database.historyCacheContents();
+    
+    if (!snapshot.write(m_snapshotPath)) {
+        qDebug() << "Failed to write snapshot" << m_snapshotPath;
+        return;
+    }
+    qDebug() << "Snapshot written in" << timer.elapsed() << "ms:" << snapshot.users.size() << "users,"
+             << snapshot.groups.size() << "groups," << snapshot.conversations.size() << "conversations";
+}
+
+bool ChatServer::enableIoUring() {
+#ifdef CHAT_IO_URING
+    auto reactor = std::make_unique<IoUringReactor>();
+    if (!reactor->setup()) return false;
+    reactor->start();
+    m_reactor = std::move(reactor);
+    qDebug() << "Plain connections use the io_uring backend";
+    return true;
+#else
+    qDebug() << "This build has no io_uring backend";
+    return false;
+#endif
+}
+
+bool ChatServer::startCapture(const QString& path) {
+    if (!m_capture.open(path)) return false;
+    qDebug() << "Capturing inbound traffic to" << path;
+    return true;
+}
+
 bool ChatServer::startServer(quint16 port) {
-    return listen(QHostAddress::Any, port);
+    if (!listen(QHostAddress::Any, port)) return false;
+    
+    if (!m_bulkServer.listen(QHostAddress::Any, port + ChatProtocol::BULK_PORT_OFFSET)) {
+        qDebug() << "Attachment channel unavailable:" << m_bulkServer.errorString();
+    }
+    return true;
 }
 
 void ChatServer::incomingConnection(qintptr socketDescriptor) {
     qDebug() << "New connection incoming...";
+    if (!m_acceptedAny) {
+        m_acceptedAny = true;
+        qDebug() << "First connection accepted" << m_startClock.elapsed() << "ms after start";
+    }
+    ClientHandler *handler = createHandler(socketDescriptor);
+    
+    handler->start(); // Start the thread
+}
+
+ClientHandler* ChatServer::createHandler(qintptr socketDescriptor) {
     ClientHandler *handler = new ClientHandler(socketDescriptor, this, &m_database);
     
     connect(handler, &ClientHandler::disconnected, this, &ChatServer::onClientDisconnected);
+    connect(handler, &QThread::finished, this, [this, handler]() {
+        cancelDeadline(handler);
+        QWriteLocker locker(&m_clientsLock);
+        m_handlers.remove(handler);
+    });
     
-    handler->start(); // Start the thread
+    scheduleDeadline(handler, AUTH_DEADLINE, ChatProtocol::AUTH_TIMEOUT_MS);
+    
+    QWriteLocker locker(&m_clientsLock);
+    m_handlers.insert(handler);
+    return handler;
+}
+
+QList<ClientHandler*> ChatServer::handlers() {
+    QReadLocker locker(&m_clientsLock);
+    return m_handlers.values();
+}
+
+bool ChatServer::detachSession(ClientHandler *handler, ClientHandler::SessionState *state) {
+    // Must not hold m_clientsLock here: the handler thread may be waiting on it
+    if (!handler->detachSession(state)) return false;
+    
+    NameId userId = m_names.find(state->username);
+    QWriteLocker locker(&m_clientsLock);
+    if (m_clients.value(userId) == handler) {
+        m_clients.remove(userId);
+    }
+    return true;
+}
+
+void ChatServer::adoptSession(const ClientHandler::SessionState& state) {
+    ClientHandler *handler = createHandler(state.socketDescriptor);
+    handler->restoreSession(state);
+    
+    if (!state.username.isEmpty()) {
+        scheduleDeadline(handler, HEARTBEAT_DEADLINE, ChatProtocol::HEARTBEAT_INTERVAL_MS);
+        NameId userId = m_names.intern(state.username);
+        QWriteLocker locker(&m_clientsLock);
+        m_clients[userId] = handler;
+    }
+    
+    handler->start();
+    qDebug() << "Adopted session:" << (state.username.isEmpty() ? "(unauthenticated)" : state.username);
+}
+
+void ChatServer::scheduleDeadline(ClientHandler *handler, ConnectionDeadline kind, qint64 delayMs) {
+    cancelDeadline(handler);
+    m_connectionTimers[handler] = m_timers.schedule(delayMs, quintptr(handler), kind);
+}
+
+void ChatServer::cancelDeadline(ClientHandler *handler) {
+    auto it = m_connectionTimers.find(handler);
+    if (it != m_connectionTimers.end()) {
+        m_timers.cancel(it.value());
+        m_connectionTimers.erase(it);
+    }
+}
+
+void ChatServer::onTimerTick() {
+    const qint64 now = QDeadlineTimer::current().deadline();
+    const QList<TimingWheel::Expired> expired = m_timers.advance(now);
+    
+    for (const TimingWheel::Expired& timer : expired) {
+        ClientHandler *handler = reinterpret_cast<ClientHandler*>(timer.owner);
+        m_connectionTimers.remove(handler);
+        
+        // Traffic doesn't touch the wheel; deadlines are pushed back lazily here
+        const qint64 idleFor = now - handler->lastActivity();
+        
+        switch (timer.kind) {
+            case AUTH_DEADLINE:
+                if (handler->isAuthenticated()) {
+                    scheduleDeadline(handler, HEARTBEAT_DEADLINE, ChatProtocol::HEARTBEAT_INTERVAL_MS - idleFor);
+                } else {
+                    qDebug() << "Closing connection that never authenticated";
+                    handler->closeConnection();
+                }
+                break;
+                
+            case HEARTBEAT_DEADLINE:
+                if (idleFor < ChatProtocol::HEARTBEAT_INTERVAL_MS) {
+                    scheduleDeadline(handler, HEARTBEAT_DEADLINE, ChatProtocol::HEARTBEAT_INTERVAL_MS - idleFor);
+                } else {
+                    ChatProtocol::Message probe;
+                    probe.type = ChatProtocol::MessageType::HEARTBEAT;
+                    handler->sendMessage(probe);
+                    scheduleDeadline(handler, IDLE_DEADLINE, ChatProtocol::HEARTBEAT_GRACE_MS);
+                }
+                break;
+                
+            case IDLE_DEADLINE:
+                if (idleFor < ChatProtocol::HEARTBEAT_GRACE_MS) {
+                    scheduleDeadline(handler, HEARTBEAT_DEADLINE, ChatProtocol::HEARTBEAT_INTERVAL_MS - idleFor);
+                } else {
+                    qDebug() << "Reaping idle connection:" << handler->getUsername();
+                    handler->closeConnection();
+                }
+                break;
+        }
+    }
+}
+
+void ChatServer::logStats() {
+    m_capture.flush();
+    
+    quint64 handshakes = m_tlsHandshakes.exchange(0);
+    if (handshakes > 0) {
+        qDebug() << "TLS handshakes:" << handshakes << QString("(%1/s)").arg(double(handshakes) * 1000 /
+                                                                            m_statsTimer.interval(), 0, 'f', 1);
+    }
+    
+    for (int i = 0; i < RateLimiter::CATEGORY_COUNT; ++i) {
+        auto category = static_cast<RateLimiter::Category>(i);
+        quint64 throttled = m_rateLimiter.throttledCount(category);
+        if (throttled > 0) {
+            qDebug() << "Throttled" << RateLimiter::categoryName(category) << "requests:" << throttled;
+        }
+    }
+    
+    // Otherwise every account that ever sent a request keeps its buckets
+    m_rateLimiter.pruneIdle(QDeadlineTimer::current().deadline());
+    for (ClientHandler *handler : handlers()) {
+        handler->expireTyping();
+    }
+    
+    ConversationCache::Stats cache = m_database.takeHistoryCacheStats();
+    if (cache.hits + cache.misses > 0) {
+        qDebug() << "History cache:" << QString("%1% hit rate").arg(100.0 * cache.hits / (cache.hits + cache.misses), 0, 'f', 1)
+                 << "over" << cache.hits + cache.misses << "requests," << cache.conversations << "conversations,"
+                 << cache.bytes / 1024 << "KB";
+    }
 }
 
 void ChatServer::onClientDisconnected(const QString& username) {
-    QMutexLocker locker(&m_clientsMutex);
-    if (m_clients.contains(username)) {
-        m_clients.remove(username);
+    NameId userId = m_names.find(username);
+    ClientHandler *handler = qobject_cast<ClientHandler*>(sender());
+    QWriteLocker locker(&m_clientsLock);
+    
+    // A resumed session may already have replaced this connection
+    if (m_clients.value(userId) == handler && m_clients.remove(userId) > 0) {
         m_database.setUserOnlineStatus(username, false);
         qDebug() << "User disconnected:" << username;
     }
 }
 
 void ChatServer::broadcastToUser(const QString& username, const ChatProtocol::Message& msg) {
-    QMutexLocker locker(&m_clientsMutex);
-    if (m_clients.contains(username)) {
-        m_clients[username]->sendMessage(msg);
+    broadcastToUser(m_names.find(username), msg);
+}
+
+void ChatServer::broadcastToUser(NameId userId, const ChatProtocol::Message& msg) {
+    QReadLocker locker(&m_clientsLock);
+    ClientHandler *handler = m_clients.value(userId);
+    if (handler) {
+        handler->sendMessage(msg);
     }
 }
 
-void ChatServer::broadcastToGroup(const QString& groupName, const ChatProtocol::Message& msg) {
-    QStringList members = m_database.getGroupMembers(groupName);
-    QMutexLocker locker(&m_clientsMutex);
+void ChatServer::broadcastToGroup(const QVector<NameId>& members, const ChatProtocol::Message& msg) {
+    if (members.isEmpty()) return;
     
-    for (const QString& member : members) {
-        if (m_clients.contains(member)) {
-            m_clients[member]->sendMessage(msg);
+    // Encoded once; every recipient's queue shares the same bytes
+    const QByteArray frame = OutboundQueue::encodeFrame(msg);
+    const OutboundQueue::Lane lane = OutboundQueue::laneFor(msg.type);
+    
+    // Large groups are split into shards; the caller delivers the first and
+    // queues the rest on the fan-out lanes without waiting. A shard always
+    // lands on the same lane, so a sender's messages reach each member in
+    // order unless a leave shifts that member into another shard in between.
+    const qsizetype shards = (members.size() + kFanoutShardSize - 1) / kFanoutShardSize;
+    for (qsizetype shard = 1; shard < shards; ++shard) {
+        QThreadPool *pool = m_fanoutLanes[size_t(shard % qsizetype(m_fanoutLanes.size()))].get();
+        pool->start([this, members, frame, lane, shard]() {
+            deliverShard(members, shard * kFanoutShardSize, lane, frame);
+        });
+    }
+    deliverShard(members, 0, lane, frame);
+}
+
+void ChatServer::deliverShard(const QVector<NameId>& members, qsizetype begin, OutboundQueue::Lane lane,
+                              const QByteArray& frame) {
+    const qsizetype end = qMin(members.size(), begin + kFanoutShardSize);
+    QReadLocker locker(&m_clientsLock);
+    
+    for (qsizetype i = begin; i < end; ++i) {
+        ClientHandler *handler = m_clients.value(members[i]);
+        if (handler) {
+            handler->sendFrame(lane, frame);
         }
     }
+}
+
+bool ChatServer::cachedGroupMembers(const QString& groupName, QVector<NameId> *members) {
+    QMutexLocker locker(&m_groupsMutex);
+    auto it = m_groupMembers.constFind(m_names.find(groupName));
+    if (it == m_groupMembers.constEnd()) return false;
+    
+    *members = it.value();
+    return true;
+}
+
+QVector<NameId> ChatServer::groupMemberIds(const QString& groupName) {
+    QVector<NameId> members;
+    if (cachedGroupMembers(groupName, &members)) return members;
+    return loadGroupMembers(groupName);
+}
+
+QVector<NameId> ChatServer::loadGroupMembers(const QString& groupName) {
+    // Read without the lock so fan-outs from other groups never wait on SQLite
+    quint64 epoch;
+    {
+        QMutexLocker locker(&m_groupsMutex);
+        epoch = m_groupsEpoch;
+    }
+    const QStringList members = m_database.getGroupMembers(groupName);
+    
+    QVector<NameId> ids;
+    ids.reserve(members.size());
+    for (const QString& member : members) {
+        ids.append(m_names.intern(member));
+    }
+    
+    // A membership change during the read may be missing from it, so it is
+    // used once and the group loads again on next use
+    QMutexLocker locker(&m_groupsMutex);
+    if (ids.isEmpty() || epoch != m_groupsEpoch) {
+        m_groupMembers.remove(m_names.find(groupName));
+    } else {
+        m_groupMembers.insert(m_names.intern(groupName), ids);
+    }
+    return ids;
+}
+
+void ChatServer::updateGroupMember(const QString& groupName, const QString& username, bool joined) {
+    // Patched in place: reloading a large group's membership costs far more
+    QMutexLocker locker(&m_groupsMutex);
+    ++m_groupsEpoch;
+    auto it = m_groupMembers.find(m_names.find(groupName));
+    if (it == m_groupMembers.end()) return;
+    
+    NameId member = m_names.intern(username);
+    if (!joined) {
+        it->removeAll(member);
+    } else if (!it->contains(member)) {
+        it->append(member);
+    }
 }
\ No newline at end of file
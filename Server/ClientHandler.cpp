@@ -2,10 +2,39 @@
 #include "ChatServer.h"
 #include "DatabaseManager.h"
 #include <QDebug>
+#include <QDataStream>
+#include <QtEndian>
+#include <QDeadlineTimer>
+#include <QSemaphore>
+#include <tuple>
+#include <utility>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+#ifdef CHAT_IO_URING
+#include <QHostAddress>
+#include <sys/socket.h>
+#endif
+
+namespace {
+// Bytes queued in the socket's write buffer before we stop and let the lanes
+// reorder; the last frame may cross the mark. The kernel buffer keeps its
+// default size so bulk replies are not throttled on long round trips.
+const qint64 kOutboxHighWater = OutboundQueue::kBulkChunkBytes / 4;
+const qint64 kTypingMinGapMs = ChatProtocol::TYPING_COALESCE_MS / 2;
+const int kDetachTimeoutMs = 2000; // for queued sends to reach the kernel during a handoff
+}
 
 ClientHandler::ClientHandler(qintptr socketDescriptor, ChatServer *server, DatabaseManager *db)
-    : m_socketDescriptor(socketDescriptor), m_socket(nullptr), m_server(server),
-      m_database(db), m_authenticated(false) {}
+    : m_socketDescriptor(socketDescriptor), m_connectionId(++server->m_nextConnectionId), m_socket(nullptr),
+#ifdef CHAT_IO_URING
+      m_ringConnection(nullptr),
+#endif
+      m_tls(server->tlsEnabled()), m_server(server),
+      m_database(db), m_userId(INVALID_NAME), m_authenticated(false),
+      m_resumeTarget(std::make_shared<AsyncStorage::ResumeTarget>()), m_framesHeld(false),
+      m_lastActivity(QDeadlineTimer::current().deadline()) {}
 
 ClientHandler::~ClientHandler() {
     if (m_socket) {
@@ -15,125 +44,511 @@ ClientHandler::~ClientHandler() {
 }
 
 void ClientHandler::run() {
-    m_socket = new QTcpSocket();
+#ifdef CHAT_IO_URING
+    // TLS stays on QSslSocket; plain connections move to the shared ring
+    if (m_server->m_reactor && !m_tls) {
+        runOnReactor();
+        return;
+    }
+#endif
+    
+    QSslSocket *sslSocket = m_tls ? new QSslSocket() : nullptr;
+    m_socket = sslSocket ? sslSocket : new QTcpSocket();
+    m_resumeTarget->setContext(m_socket);
     
     if (!m_socket->setSocketDescriptor(m_socketDescriptor)) {
         qDebug() << "Failed to set socket descriptor";
+        m_resumeTarget->clear();
         return;
     }
+    m_peerAddress = m_socket->peerAddress().toString();
+    
+    if (sslSocket) {
+        // readyRead only fires for decrypted data, and writes queue until the handshake is done
+        sslSocket->setSslConfiguration(m_server->m_tlsConfig);
+        connect(sslSocket, &QSslSocket::encrypted, this, [this]() {
+            ++m_server->m_tlsHandshakes;
+        }, Qt::DirectConnection);
+        sslSocket->startServerEncryption();
+    }
     
     connect(m_socket, &QTcpSocket::readyRead, this, &ClientHandler::onReadyRead, Qt::DirectConnection);
     connect(m_socket, &QTcpSocket::disconnected, this, &ClientHandler::onSocketDisconnected, Qt::DirectConnection);
+    connect(m_socket, &QTcpSocket::bytesWritten, this, &ClientHandler::drainOutbox, Qt::DirectConnection);
+    
+    m_server->m_capture.record(ChatProtocol::TrafficCapture::OPEN, m_connectionId);
+    
+    // Anything queued before the socket existed
+    drainOutbox();
+    
+    // Frames handed over from a previous server process
+    if (!m_readBuffer.isEmpty()) {
+        processReadBuffer();
+    }
     
     exec(); // Event loop for this thread
+    
+    // Handlers still waiting on storage are dropped rather than resumed
+    m_resumeTarget->clear();
 }
 
 void ClientHandler::sendMessage(const ChatProtocol::Message& msg) {
-    if (!m_socket || m_socket->state() != QAbstractSocket::ConnectedState) return;
+    // May be called from any thread; the socket is only touched on ours
+    if (m_outbox.enqueue(msg)) scheduleDrain();
+}
+
+void ClientHandler::sendFrame(OutboundQueue::Lane lane, const QByteArray& frame) {
+    if (m_outbox.enqueueFrame(lane, frame)) scheduleDrain();
+}
+
+void ClientHandler::scheduleDrain() {
+    if (QThread::currentThread() == this) {
+        drainOutbox();
+    } else {
+        // Before run() or after exec() there is no context; run() drains on its own
+        m_resumeTarget->post([this]() { drainOutbox(); });
+    }
+}
+
+template <typename Fn>
+auto ClientHandler::storage(Fn work) {
+    // Capture values, not `this`: the work may finish after the handler is gone
+    return m_server->m_storage.call(m_resumeTarget, std::move(work));
+}
+
+void ClientHandler::reply(const ChatProtocol::MessageView& request, ChatProtocol::Message response) {
+    // Lets the client match replies to requests it has pipelined
+    response.requestId = request.requestId;
+    sendMessage(response);
+}
+
+void ClientHandler::drainOutbox() {
+    m_outbox.beginDrain();
     
-    QByteArray data = msg.serialize();
-    QByteArray block;
-    QDataStream out(&block, QIODevice::WriteOnly);
-    out << quint32(data.size());
-    block.append(data);
+#ifdef CHAT_IO_URING
+    if (m_ringConnection) {
+        // Frames dequeued together reach the reactor as one send
+        IoUringReactor *reactor = m_server->m_reactor.get();
+        QByteArray batch;
+        QByteArray frame;
+        while (reactor->pendingBytes(m_ringConnection) + batch.size() < kOutboxHighWater && m_outbox.dequeue(&frame)) {
+            batch.append(frame);
+        }
+        if (!batch.isEmpty()) reactor->send(m_ringConnection, batch);
+        return;
+    }
+#endif
+    if (!m_socket || m_socket->state() != QAbstractSocket::ConnectedState) return;
     
-    m_socket->write(block);
+    // Only a little is handed to the socket at a time, so a frame that
+    // arrives later on a higher lane can still overtake queued bulk data
+    QByteArray frame;
+    while (m_socket->bytesToWrite() < kOutboxHighWater && m_outbox.dequeue(&frame)) {
+        m_socket->write(frame);
+    }
     m_socket->flush();
 }
 
 void ClientHandler::onReadyRead() {
-    static quint32 expectedSize = 0;
-    static QByteArray buffer;
-    
-    while (m_socket->bytesAvailable() > 0) {
-        if (expectedSize == 0) {
-            if (m_socket->bytesAvailable() < sizeof(quint32)) return;
-            QDataStream in(m_socket);
-            in >> expectedSize;
-        }
+    m_lastActivity = QDeadlineTimer::current().deadline();
+    m_readBuffer.append(m_socket->readAll());
+    processReadBuffer();
+}
+
+void ClientHandler::processReadBuffer() {
+    const qsizetype headerSize = sizeof(quint32);
+    qsizetype offset = 0;
+    
+    // Frames are decoded in place; the buffer is compacted once per batch
+    while (!m_framesHeld && m_readBuffer.size() - offset >= headerSize) {
+        quint32 frameSize = qFromBigEndian<quint32>(m_readBuffer.constData() + offset);
+        if (m_readBuffer.size() - offset - headerSize < qsizetype(frameSize)) break;
         
-        buffer.append(m_socket->read(expectedSize - buffer.size()));
+        QByteArrayView frame(m_readBuffer.constData() + offset + headerSize, frameSize);
+        offset += headerSize + frameSize;
+        m_server->m_capture.record(ChatProtocol::TrafficCapture::FRAME, m_connectionId, frame);
         
-        if (buffer.size() == expectedSize) {
-            ChatProtocol::Message msg = ChatProtocol::Message::deserialize(buffer);
+        ChatProtocol::MessageView msg;
+        if (ChatProtocol::MessageView::decode(frame, m_arena, &msg)) {
             handleMessage(msg);
-            buffer.clear();
-            expectedSize = 0;
+        } else {
+            ChatProtocol::Message owned = ChatProtocol::Message::deserialize(frame.toByteArray());
+            handleMessage(ChatProtocol::MessageView::fromMessage(owned));
         }
     }
+    
+    m_readBuffer.remove(0, offset);
+    m_arena.reset();
+}
+
+#ifdef CHAT_IO_URING
+void ClientHandler::runOnReactor() {
+    QObject context;
+    m_resumeTarget->setContext(&context);
+    
+    sockaddr_storage peer = {};
+    socklen_t peerSize = sizeof(peer);
+    if (getpeername(int(m_socketDescriptor), reinterpret_cast<sockaddr*>(&peer), &peerSize) == 0) {
+        m_peerAddress = QHostAddress(reinterpret_cast<sockaddr*>(&peer)).toString();
+    }
+    m_ringConnection = m_server->m_reactor->attach(int(m_socketDescriptor), this);
+    m_server->m_capture.record(ChatProtocol::TrafficCapture::OPEN, m_connectionId);
+    
+    drainOutbox();
+    if (!m_readBuffer.isEmpty()) {
+        processReadBuffer();
+    }
+    
+    exec();
+    
+    // Nothing is posted to the context after this, so it can go
+    m_resumeTarget->clear();
+    if (m_ringConnection) m_server->m_reactor->release(m_ringConnection); // unless detached
+    m_ringConnection = nullptr;
+}
+
+bool ClientHandler::detachFromReactor(SessionState *state) {
+    if (!m_ringConnection) return false;
+    IoUringReactor *reactor = m_server->m_reactor.get();
+    
+    // Everything still queued goes to the reactor, which writes it out before letting go
+    m_outbox.beginDrain();
+    QByteArray batch;
+    QByteArray frame;
+    while (m_outbox.dequeue(&frame)) {
+        batch.append(frame);
+    }
+    if (!batch.isEmpty()) reactor->send(m_ringConnection, batch);
+    
+    QByteArray unread;
+    int fd = reactor->detach(std::exchange(m_ringConnection, nullptr), &unread, kDetachTimeoutMs);
+    if (fd < 0) {
+        onSocketDisconnected();
+        return false;
+    }
+    
+    state->socketDescriptor = fd;
+    state->username = m_username;
+    state->pendingData = m_readBuffer + unread;
+    state->connectionState = saveConnectionState();
+    m_readBuffer.clear();
+    quit();
+    return true;
+}
+
+void ClientHandler::onReceived(const char *data, qsizetype size) {
+    QByteArray bytes(data, size);
+    m_resumeTarget->post([this, bytes]() {
+        m_lastActivity = QDeadlineTimer::current().deadline();
+        m_readBuffer.append(bytes);
+        processReadBuffer();
+    });
+}
+
+void ClientHandler::onSent(qint64 pendingBytes) {
+    if (pendingBytes < kOutboxHighWater && !m_outbox.isEmpty()) {
+        m_resumeTarget->post([this]() { drainOutbox(); });
+    }
+}
+
+void ClientHandler::onClosed() {
+    m_resumeTarget->post([this]() { onSocketDisconnected(); });
+}
+#endif
+
+void ClientHandler::restoreSession(const SessionState& state) {
+    m_socketDescriptor = state.socketDescriptor;
+    m_tls = false;
+    m_userId = m_server->m_names.intern(state.username);
+    m_username = m_server->m_names.name(m_userId);
+    m_authenticated = m_userId != INVALID_NAME;
+    m_readBuffer = state.pendingData;
+    loadConnectionState(state.connectionState);
+}
+
+QByteArray ClientHandler::saveConnectionState() const {
+    QByteArray bytes;
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    
+    out << quint32(m_rateBuckets.size());
+    for (const TokenBucket& bucket : m_rateBuckets) {
+        bucket.save(out);
+    }
+    out << m_typingForwarded;
+    
+    // Contacts by name: name ids are per process
+    out << quint32(m_readForwarded.size());
+    for (auto it = m_readForwarded.constBegin(); it != m_readForwarded.constEnd(); ++it) {
+        out << m_server->m_names.name(it.key()) << it.value();
+    }
+    return bytes;
+}
+
+void ClientHandler::loadConnectionState(const QByteArray& bytes) {
+    // Empty from a predecessor that didn't send it; the connection starts fresh
+    if (bytes.isEmpty()) return;
+    QDataStream in(bytes);
+    
+    quint32 count = 0;
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        TokenBucket bucket;
+        bucket.load(in);
+        if (i < m_rateBuckets.size()) m_rateBuckets[i] = bucket;
+    }
+    in >> m_typingForwarded;
+    
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString contact;
+        qint64 readUpTo = 0;
+        in >> contact >> readUpTo;
+        if (!contact.isEmpty()) m_readForwarded.insert(m_server->m_names.intern(contact), readUpTo);
+    }
+}
+
+bool ClientHandler::detachSession(SessionState *state) {
+#ifdef Q_OS_UNIX
+    // The TLS session lives in this process; those clients reconnect instead
+    if (m_tls) return false;
+    
+#ifdef CHAT_IO_URING
+    if (m_server->m_reactor) {
+        // No socket object to block on; the handler thread answers through a shared slot
+        struct Result {
+            QSemaphore done;
+            std::atomic<bool> abandoned{false};
+            bool detached = false;
+            SessionState state;
+        };
+        auto result = std::make_shared<Result>();
+        bool posted = m_resumeTarget->post([this, result]() {
+            if (!result->abandoned) result->detached = detachFromReactor(&result->state);
+            result->done.release();
+        });
+        if (!posted || !result->done.tryAcquire(1, 2 * kDetachTimeoutMs)) {
+            result->abandoned = true;
+            return false;
+        }
+        *state = result->state;
+        return result->detached;
+    }
+#endif
+    if (!m_socket) return false;
+    
+    bool detached = false;
+    
+    // The socket belongs to the handler thread, so release it there
+    QMetaObject::invokeMethod(m_socket, [this, state, &detached]() {
+        if (m_socket->state() != QAbstractSocket::ConnectedState) return;
+        
+        m_socket->disconnect(this);
+        do {
+            drainOutbox();
+        } while (m_socket->bytesToWrite() > 0 && m_socket->waitForBytesWritten(100));
+        m_readBuffer.append(m_socket->readAll());
+        
+        int fd = ::dup(int(m_socket->socketDescriptor()));
+        if (fd < 0) return;
+        
+        state->socketDescriptor = fd;
+        state->username = m_username;
+        state->pendingData = m_readBuffer;
+        state->connectionState = saveConnectionState();
+        m_readBuffer.clear();
+        
+        // Closes only our descriptor; the connection stays open through the dup
+        m_socket->abort();
+        detached = true;
+        quit();
+    }, Qt::BlockingQueuedConnection);
+    
+    return detached;
+#else
+    Q_UNUSED(state);
+    return false;
+#endif
+}
+
+void ClientHandler::expireTyping() {
+    m_resumeTarget->post([this]() {
+        const qint64 now = QDeadlineTimer::current().deadline();
+        for (auto it = m_typingForwarded.begin(); it != m_typingForwarded.end();) {
+            if (now - it.value() >= kTypingMinGapMs) {
+                it = m_typingForwarded.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    });
+}
+
+void ClientHandler::closeConnection() {
+#ifdef CHAT_IO_URING
+    if (m_ringConnection) {
+        m_server->m_reactor->shutdown(m_ringConnection);
+        return;
+    }
+#endif
+    if (!m_socket) return;
+    
+    QMetaObject::invokeMethod(m_socket, [this]() {
+        m_socket->abort();
+    }, Qt::QueuedConnection);
 }
 
 void ClientHandler::onSocketDisconnected() {
+    m_server->m_capture.record(ChatProtocol::TrafficCapture::CLOSE, m_connectionId);
     emit disconnected(m_username);
     quit();
 }
 
-void ClientHandler::handleMessage(const ChatProtocol::Message& msg) {
+bool ClientHandler::checkRateLimit(const ChatProtocol::MessageView& msg) {
+    RateLimiter::Category category = RateLimiter::categoryFor(msg.type);
+    if (category == RateLimiter::UNLIMITED) return true;
+    
+    RateLimiter& limiter = m_server->m_rateLimiter;
+    const qint64 now = QDeadlineTimer::current().deadline();
+    
+    bool allowed = limiter.allowConnection(m_rateBuckets, category, now);
+    if (allowed && m_authenticated) {
+        allowed = limiter.allowUser(m_username, category, now);
+    } else if (allowed && category == RateLimiter::AUTH) {
+        // A reconnect brings fresh connection buckets, so attempts also count
+        // against the peer address and against the account they name
+        allowed = limiter.allowAddress(m_peerAddress, now) &&
+                  limiter.allowUser(msg.sender.toString(), category, now);
+    }
+    if (allowed) return true;
+    
+    // Ephemeral events are simply dropped; an error frame would cost more
+    if (category == RateLimiter::EPHEMERAL) return false;
+    
+    ChatProtocol::Message response;
+    response.type = ChatProtocol::MessageType::ERROR_MSG;
+    response.recipient = msg.recipient.toString();
+    response.content = QString("Too many %1 requests, please slow down").arg(RateLimiter::categoryName(category));
+    reply(msg, response);
+    return false;
+}
+
+void ClientHandler::handleMessage(const ChatProtocol::MessageView& msg) {
+    // Throttle before any handler touches the database
+    if (!checkRateLimit(msg)) return;
+    
     switch (msg.type) {
         case ChatProtocol::MessageType::REGISTER:
-            handleRegister(msg);
+            handleRegister(msg.toMessage());
             break;
         case ChatProtocol::MessageType::LOGIN:
-            handleLogin(msg);
+            handleLogin(msg.toMessage());
+            break;
+        case ChatProtocol::MessageType::RESUME_SESSION:
+            handleResume(msg.toMessage());
             break;
         case ChatProtocol::MessageType::PRIVATE_MESSAGE:
-            handlePrivateMessage(msg);
+            handlePrivateMessage(msg.toMessage());
             break;
         case ChatProtocol::MessageType::CREATE_GROUP:
-            handleCreateGroup(msg);
+            handleCreateGroup(msg.toMessage());
             break;
         case ChatProtocol::MessageType::GROUP_MESSAGE:
-            handleGroupMessage(msg);
+            handleGroupMessage(msg.toMessage());
             break;
         case ChatProtocol::MessageType::GET_USERS:
             handleGetUsers(msg);
             break;
+        case ChatProtocol::MessageType::DIRECTORY_SEARCH:
+            handleDirectorySearch(msg);
+            break;
         case ChatProtocol::MessageType::GET_GROUPS:
-            handleGetGroups(msg);
+            handleGetGroups(msg.toMessage());
             break;
         case ChatProtocol::MessageType::MESSAGE_HISTORY_REQUEST:
-            handleMessageHistory(msg);
+        case ChatProtocol::MessageType::HISTORY_BEFORE_REQUEST:
+        case ChatProtocol::MessageType::HISTORY_SYNC_REQUEST:
+            handleMessageHistory(msg.toMessage());
+            break;
+        case ChatProtocol::MessageType::JOIN_GROUP:
+            handleJoinGroup(msg.toMessage());
             break;
         case ChatProtocol::MessageType::LEAVE_GROUP:
-            handleLeaveGroup(msg);
+            handleLeaveGroup(msg.toMessage());
             break;
         case ChatProtocol::MessageType::KICK_MEMBER:
-            handleKickMember(msg);
+            handleKickMember(msg.toMessage());
             break;
         case ChatProtocol::MessageType::GROUP_MEMBERS_REQUEST:
-            handleGroupMembersRequest(msg);
+            handleGroupMembersRequest(msg.toMessage());
+            break;
+        case ChatProtocol::MessageType::HEARTBEAT:
+            handleHeartbeat(msg);
+            break;
+        case ChatProtocol::MessageType::HEARTBEAT_ACK:
+            break; // activity already recorded in onReadyRead
+        case ChatProtocol::MessageType::ATTACHMENT_UPLOAD_REQUEST:
+            handleAttachmentUpload(msg);
+            break;
+        case ChatProtocol::MessageType::ATTACHMENT_DOWNLOAD_REQUEST:
+            handleAttachmentDownload(msg);
+            break;
+        case ChatProtocol::MessageType::TYPING:
+        case ChatProtocol::MessageType::GROUP_TYPING:
+            handleTyping(msg.toMessage());
+            break;
+        case ChatProtocol::MessageType::READ_RECEIPT:
+            handleReadReceipt(msg);
             break;
         default:
             qDebug() << "Unknown message type";
     }
 }
 
-void ClientHandler::handleRegister(const ChatProtocol::Message& msg) {
+AsyncTask ClientHandler::handleRegister(ChatProtocol::Message msg) {
     ChatProtocol::Message response;
     
-    if (m_database->registerUser(msg.sender, msg.content)) {
+    QString username = msg.sender;
+    DatabaseManager *db = m_database;
+    
+    // Password hashing runs on the storage pool; later frames wait for the outcome
+    m_framesHeld = true;
+    bool registered = co_await storage([db, username, password = msg.content]() {
+        return db->registerUser(username, password);
+    });
+    m_framesHeld = false;
+    
+    if (registered) {
         response.type = ChatProtocol::MessageType::AUTH_SUCCESS;
         response.content = "Registration successful";
-        qDebug() << "✓ New user registered:" << msg.sender;
+        m_server->m_directory.insert(username);
+        qDebug() << "✓ New user registered:" << username;
     } else {
         response.type = ChatProtocol::MessageType::AUTH_FAILURE;
         response.content = "Username already exists";
-        qDebug() << "✗ Registration failed (username exists):" << msg.sender;
+        qDebug() << "✗ Registration failed (username exists):" << username;
     }
     
-    sendMessage(response);
+    reply(ChatProtocol::MessageView::fromMessage(msg), response);
+    processReadBuffer();
 }
 
-void ClientHandler::handleLogin(const ChatProtocol::Message& msg) {
+AsyncTask ClientHandler::handleLogin(ChatProtocol::Message msg) {
     ChatProtocol::Message response;
     
-    if (m_database->loginUser(msg.sender, msg.content)) {
-        m_username = msg.sender;
-        m_authenticated = true;
-        m_database->setUserOnlineStatus(m_username, true);
-        
-        QMutexLocker locker(&m_server->m_clientsMutex);
-        m_server->m_clients[m_username] = this;
+    QString username = msg.sender;
+    DatabaseManager *db = m_database;
+    
+    m_framesHeld = true;
+    auto [valid, privateMark, groupMark] = co_await storage([db, username, password = msg.content]() {
+        // The token's watermarks: a fresh login starts from the newest messages
+        bool ok = db->loginUser(username, password);
+        if (ok) db->setUserOnlineStatus(username, true);
+        return std::make_tuple(ok, db->latestPrivateMessageId(), db->latestGroupMessageId());
+    });
+    m_framesHeld = false;
+    
+    if (valid) {
+        attachUser(m_server->m_names.intern(username));
         
         response.type = ChatProtocol::MessageType::AUTH_SUCCESS;
         response.content = "Login successful";
@@ -141,76 +556,247 @@ void ClientHandler::handleLogin(const ChatProtocol::Message& msg) {
     } else {
         response.type = ChatProtocol::MessageType::AUTH_FAILURE;
         response.content = "Invalid credentials";
-        qDebug() << "✗ Login failed for:" << msg.sender;
+        qDebug() << "✗ Login failed for:" << username;
     }
     
-    sendMessage(response);
+    reply(ChatProtocol::MessageView::fromMessage(msg), response);
+    if (m_authenticated) {
+        sendSessionToken(privateMark, groupMark);
+    }
+    processReadBuffer();
 }
 
-void ClientHandler::handlePrivateMessage(const ChatProtocol::Message& msg) {
-    if (!m_authenticated) return;
+AsyncTask ClientHandler::handleResume(ChatProtocol::Message msg) {
+    // content: "<token>:<privateId>:<groupId>"
+    const QStringList parts = msg.content.split(':');
+    NameId userId = m_server->m_names.find(msg.sender);
+    
+    if (m_authenticated || parts.size() != 3 || userId == INVALID_NAME ||
+        !m_server->m_resumeTokens.redeem(parts[0].toLatin1(), userId)) {
+        ChatProtocol::Message response;
+        response.type = ChatProtocol::MessageType::RESUME_FAILURE;
+        response.content = "Session expired, please log in again";
+        reply(ChatProtocol::MessageView::fromMessage(msg), response);
+        co_return;
+    }
+    
+    attachUser(userId);
+    qDebug() << "✓ Session resumed:" << m_username;
+    
+    // Later frames wait until the replay and the new token are out
+    m_framesHeld = true;
+    DatabaseManager *db = m_database;
+    const QString username = m_username;
+    int marks[2] = {parts[1].toInt(), parts[2].toInt()};
+    bool markOnline = true; // with the first page
+    
+    // Only what was stored after the client's newest ids, a page at a time until caught up
+    for (int kind = 0; kind < 2; ++kind) {
+        const bool groups = kind == 1;
+        int afterId = marks[kind];
+        
+        for (;;) {
+            auto [latest, page] = co_await storage([db, username, groups, afterId, markOnline]() {
+                if (markOnline) db->setUserOnlineStatus(username, true);
+                // Read first: a short page then holds every missed row up to it
+                int latest = groups ? db->latestGroupMessageId() : db->latestPrivateMessageId();
+                QList<ChatProtocol::Message> page =
+                    groups ? db->getMissedGroupMessages(username, afterId, ChatProtocol::RESUME_REPLAY_LIMIT)
+                           : db->getMissedPrivateMessages(username, afterId, ChatProtocol::RESUME_REPLAY_LIMIT);
+                return std::make_pair(latest, page);
+            });
+            markOnline = false;
+            
+            for (const auto& missedMsg : page) {
+                sendMessage(missedMsg);
+            }
+            if (!page.isEmpty()) afterId = page.last().messageId;
+            
+            // The watermark never passes what was actually replayed or pushed
+            if (page.size() < ChatProtocol::RESUME_REPLAY_LIMIT) {
+                marks[kind] = qMax(latest, afterId);
+                break;
+            }
+        }
+    }
     
-    m_database->savePrivateMessage(msg.sender, msg.recipient, msg.content);
-    m_server->broadcastToUser(msg.recipient, msg);
+    sendSessionToken(marks[0], marks[1]);
+    m_framesHeld = false;
+    processReadBuffer();
 }
 
-void ClientHandler::handleCreateGroup(const ChatProtocol::Message& msg) {
-    if (!m_authenticated) return;
+void ClientHandler::attachUser(NameId userId) {
+    m_userId = userId;
+    m_username = m_server->m_names.name(m_userId);
+    m_authenticated = true;
+    
+    QWriteLocker locker(&m_server->m_clientsLock);
+    ClientHandler *previous = m_server->m_clients.value(m_userId);
+    m_server->m_clients[m_userId] = this;
+    
+    // The old connection is probably dead already; make sure it goes away
+    if (previous && previous != this) {
+        previous->closeConnection();
+    }
+}
+
+void ClientHandler::sendSessionToken(int privateMark, int groupMark) {
+    ChatProtocol::Message token;
+    token.type = ChatProtocol::MessageType::SESSION_TOKEN;
+    token.content = QString("%1:%2:%3").arg(QString::fromLatin1(m_server->m_resumeTokens.issue(m_userId)),
+                                            QString::number(privateMark), QString::number(groupMark));
+    sendMessage(token);
+}
+
+AsyncTask ClientHandler::handlePrivateMessage(ChatProtocol::Message msg) {
+    if (!m_authenticated) co_return;
+    
+    NameId recipientId = m_server->m_names.find(msg.recipient);
+    
+    // Deliver with the interned names rather than the strings decoded off the wire
+    ChatProtocol::Message delivery = msg;
+    delivery.sender = m_username;
+    delivery.requestId = 0; // a push; only reply() echoes the sender's id
+    if (recipientId != INVALID_NAME) {
+        delivery.recipient = m_server->m_names.name(recipientId);
+    }
+    
+    // Stored and echoed before the next frame, as the sender expects
+    m_framesHeld = true;
+    DatabaseManager *db = m_database;
+    delivery.messageId = co_await storage([db, delivery]() {
+        return db->savePrivateMessage(delivery.sender, delivery.recipient, delivery.content);
+    });
+    m_framesHeld = false;
+    
+    m_server->broadcastToUser(recipientId, delivery);
+    
+    // Echo back so the sender learns the stored id
+    if (recipientId != m_userId) {
+        reply(ChatProtocol::MessageView::fromMessage(msg), delivery);
+    }
+    processReadBuffer();
+}
+
+AsyncTask ClientHandler::handleCreateGroup(ChatProtocol::Message msg) {
+    if (!m_authenticated) co_return;
     
     ChatProtocol::Message response;
     
-    if (m_database->createGroup(msg.content, m_username)) {
+    QString groupName = msg.content;
+    
+    m_framesHeld = true;
+    DatabaseManager *db = m_database;
+    bool created = co_await storage([db, groupName, username = m_username]() {
+        return db->createGroup(groupName, username);
+    });
+    m_framesHeld = false;
+    
+    if (created) {
         response.type = ChatProtocol::MessageType::GROUP_CREATED;
-        response.content = msg.content;
+        response.content = groupName;
     } else {
         response.type = ChatProtocol::MessageType::ERROR_MSG;
         response.content = "Group already exists";
     }
     
-    sendMessage(response);
+    reply(ChatProtocol::MessageView::fromMessage(msg), response);
+    processReadBuffer();
 }
 
-void ClientHandler::handleGroupMessage(const ChatProtocol::Message& msg) {
-    if (!m_authenticated) return;
+AsyncTask ClientHandler::handleGroupMessage(ChatProtocol::Message msg) {
+    if (!m_authenticated) co_return;
+    
+    ChatProtocol::Message delivery = std::move(msg);
+    delivery.sender = m_username;
+    delivery.requestId = 0; // members, the sender included, get it as a push
+    
+    m_framesHeld = true;
+    DatabaseManager *db = m_database;
+    ChatServer *server = m_server;
+    QVector<NameId> members;
+    std::tie(delivery.messageId, members) = co_await storage([db, server, delivery]() {
+        // Members are looked up here too, so a cache miss reads SQLite on the pool
+        int messageId = db->saveGroupMessage(delivery.sender, delivery.recipient, delivery.content);
+        return std::make_tuple(messageId, server->groupMemberIds(delivery.recipient));
+    });
+    m_framesHeld = false;
     
-    m_database->saveGroupMessage(msg.sender, msg.recipient, msg.content);
-    m_server->broadcastToGroup(msg.recipient, msg);
+    m_server->broadcastToGroup(members, delivery);
+    processReadBuffer();
 }
 
-void ClientHandler::handleGetUsers(const ChatProtocol::Message& msg) {
+void ClientHandler::handleGetUsers(const ChatProtocol::MessageView& msg) {
     if (!m_authenticated) return;
     
-    QStringList users = m_database->getAllUsers();
+    // Whole-directory listing, kept for older clients; served from the index
+    QStringList users = m_server->m_directory.all();
     ChatProtocol::Message response;
     response.type = ChatProtocol::MessageType::USERS_LIST;
     response.content = users.join(",");
     
-    sendMessage(response);
+    reply(msg, response);
 }
 
-void ClientHandler::handleGetGroups(const ChatProtocol::Message& msg) {
+void ClientHandler::handleDirectorySearch(const ChatProtocol::MessageView& msg) {
     if (!m_authenticated) return;
     
-    QStringList groups = m_database->getUserGroups(m_username);
+    int limit = msg.messageId > 0 ? qMin(msg.messageId, ChatProtocol::DIRECTORY_PAGE_MAX)
+                                  : ChatProtocol::DIRECTORY_PAGE_SIZE;
+    
+    ChatProtocol::Message response;
+    response.type = ChatProtocol::MessageType::DIRECTORY_RESULT;
+    response.sender = msg.content.toString();
+    response.content = m_server->m_directory.search(response.sender, msg.recipient.toString(), limit,
+                                                    &response.recipient).join(",");
+    
+    reply(msg, response);
+}
+
+AsyncTask ClientHandler::handleGetGroups(ChatProtocol::Message msg) {
+    if (!m_authenticated) co_return;
+    
+    DatabaseManager *db = m_database;
+    QStringList groups = co_await storage([db, username = m_username]() {
+        return db->getUserGroups(username);
+    });
     ChatProtocol::Message response;
     response.type = ChatProtocol::MessageType::GROUPS_LIST;
     response.content = groups.join(",");
     
-    sendMessage(response);
+    reply(ChatProtocol::MessageView::fromMessage(msg), response);
 }
 
-void ClientHandler::handleMessageHistory(const ChatProtocol::Message& msg) {
-    if (!m_authenticated) return;
-    
-    QList<ChatProtocol::Message> history;
+AsyncTask ClientHandler::handleMessageHistory(ChatProtocol::Message msg) {
+    if (!m_authenticated) co_return;
     
-    if (msg.content.startsWith("GROUP:")) {
-        QString groupName = msg.content.mid(6);
-        history = m_database->getGroupMessageHistory(groupName, 100);
-    } else {
-        history = m_database->getPrivateMessageHistory(m_username, msg.recipient, 100);
+    QString conversation = msg.recipient;
+    const bool isGroup = msg.content.startsWith(u"GROUP:");
+    if (isGroup) {
+        conversation = msg.content.mid(6);
     }
     
+    DatabaseManager *db = m_database;
+    const ChatProtocol::MessageType type = msg.type;
+    const int fromId = msg.messageId;
+    QList<ChatProtocol::Message> history = co_await storage([db, username = m_username, conversation, isGroup, type, fromId]() {
+        if (type == ChatProtocol::MessageType::HISTORY_SYNC_REQUEST) {
+            // Everything after the client's newest cached id, oldest first
+            return isGroup ? db->getGroupMessagesAfter(conversation, fromId, ChatProtocol::HISTORY_SYNC_LIMIT)
+                           : db->getPrivateMessagesAfter(username, conversation, fromId, ChatProtocol::HISTORY_SYNC_LIMIT);
+        }
+        if (type == ChatProtocol::MessageType::HISTORY_BEFORE_REQUEST && fromId > 0) {
+            return isGroup ? db->getGroupMessagesBefore(conversation, fromId, ChatProtocol::HISTORY_PAGE_SIZE)
+                           : db->getPrivateMessagesBefore(username, conversation, fromId, ChatProtocol::HISTORY_PAGE_SIZE);
+        }
+        // The newest page goes through the offset path, which fills the cache
+        const int offset = qMax(0, fromId);
+        return isGroup ? db->getGroupMessageHistory(conversation, ChatProtocol::HISTORY_PAGE_SIZE, offset)
+                       : db->getPrivateMessageHistory(username, conversation, ChatProtocol::HISTORY_PAGE_SIZE, offset);
+    });
+    
+    const ChatProtocol::MessageView request = ChatProtocol::MessageView::fromMessage(msg);
+    
     for (const auto& histMsg : history) {
         ChatProtocol::Message response;
         response.type = ChatProtocol::MessageType::MESSAGE_HISTORY_RESPONSE;
@@ -218,48 +804,218 @@ void ClientHandler::handleMessageHistory(const ChatProtocol::Message& msg) {
         response.recipient = histMsg.recipient;
         response.content = histMsg.content;
         response.timestamp = histMsg.timestamp;
-        sendMessage(response);
+        response.messageId = histMsg.messageId;
+        reply(request, response);
     }
+    
+    // Stored rows may have an empty sender, so the end has its own type
+    ChatProtocol::Message end;
+    end.type = ChatProtocol::MessageType::MESSAGE_HISTORY_END;
+    end.recipient = conversation;
+    reply(request, end);
 }
 
-void ClientHandler::handleLeaveGroup(const ChatProtocol::Message& msg) {
-    if (!m_authenticated) return;
+AsyncTask ClientHandler::handleJoinGroup(ChatProtocol::Message msg) {
+    if (!m_authenticated) co_return;
     
-    m_database->removeGroupMember(msg.content, m_username);
+    QString groupName = msg.content;
+    ChatProtocol::Message response;
+    
+    m_framesHeld = true;
+    DatabaseManager *db = m_database;
+    bool joined = co_await storage([db, groupName, username = m_username]() {
+        return db->addGroupMember(groupName, username);
+    });
+    m_framesHeld = false;
+    
+    if (joined) {
+        m_server->updateGroupMember(groupName, m_username, true);
+        response.type = ChatProtocol::MessageType::SUCCESS_MSG;
+        response.content = "Joined group: " + groupName;
+    } else {
+        response.type = ChatProtocol::MessageType::ERROR_MSG;
+        response.content = "Could not join " + groupName + " (full or no such group)";
+    }
+    reply(ChatProtocol::MessageView::fromMessage(msg), response);
+    processReadBuffer();
+}
+
+AsyncTask ClientHandler::handleLeaveGroup(ChatProtocol::Message msg) {
+    if (!m_authenticated) co_return;
+    
+    QString groupName = msg.content;
+    m_framesHeld = true;
+    DatabaseManager *db = m_database;
+    co_await storage([db, groupName, username = m_username]() {
+        db->removeGroupMember(groupName, username);
+        return true;
+    });
+    m_framesHeld = false;
+    m_server->updateGroupMember(groupName, m_username, false);
     
     ChatProtocol::Message response;
     response.type = ChatProtocol::MessageType::SUCCESS_MSG;
-    response.content = "Left group: " + msg.content;
-    sendMessage(response);
+    response.content = "Left group: " + groupName;
+    reply(ChatProtocol::MessageView::fromMessage(msg), response);
+    processReadBuffer();
 }
 
-void ClientHandler::handleKickMember(const ChatProtocol::Message& msg) {
-    if (!m_authenticated) return;
+AsyncTask ClientHandler::handleKickMember(ChatProtocol::Message msg) {
+    if (!m_authenticated) co_return;
     
     QString groupName = msg.recipient;
     QString memberToKick = msg.content;
     
-    if (m_database->isGroupAdmin(groupName, m_username)) {
-        m_database->removeGroupMember(groupName, memberToKick);
+    m_framesHeld = true;
+    DatabaseManager *db = m_database;
+    bool kicked = co_await storage([db, groupName, memberToKick, username = m_username]() {
+        if (!db->isGroupAdmin(groupName, username)) return false;
+        db->removeGroupMember(groupName, memberToKick);
+        return true;
+    });
+    m_framesHeld = false;
+    
+    if (kicked) {
+        m_server->updateGroupMember(groupName, memberToKick, false);
         
         ChatProtocol::Message notification;
         notification.type = ChatProtocol::MessageType::SUCCESS_MSG;
         notification.content = "You were removed from " + groupName;
         m_server->broadcastToUser(memberToKick, notification);
     }
+    processReadBuffer();
 }
 
-void ClientHandler::handleGroupMembersRequest(const ChatProtocol::Message& msg) {
-    if (!m_authenticated) return;
+AsyncTask ClientHandler::handleGroupMembersRequest(ChatProtocol::Message msg) {
+    if (!m_authenticated) co_return;
     
-    QStringList members = m_database->getGroupMembers(msg.content);
-    QString adminUsername = m_database->getGroupAdmin(msg.content);
+    QString groupName = msg.content;
+    DatabaseManager *db = m_database;
+    auto [members, adminUsername] = co_await storage([db, groupName]() {
+        return std::make_pair(db->getGroupMembers(groupName), db->getGroupAdmin(groupName));
+    });
     
     ChatProtocol::Message response;
     response.type = ChatProtocol::MessageType::GROUP_MEMBERS_RESPONSE;
-    response.recipient = msg.content;
+    response.recipient = groupName;
     response.content = members.join(",");
     response.sender = adminUsername;
     
-    sendMessage(response);
+    reply(ChatProtocol::MessageView::fromMessage(msg), response);
+}
+
+void ClientHandler::handleHeartbeat(const ChatProtocol::MessageView& msg) {
+    ChatProtocol::Message response;
+    response.type = ChatProtocol::MessageType::HEARTBEAT_ACK;
+    reply(msg, response);
+}
+
+void ClientHandler::handleAttachmentUpload(const ChatProtocol::MessageView& msg) {
+    if (!m_authenticated) return;
+    
+    // content: "<sha256>:<size>"
+    const QStringList parts = msg.content.toString().split(':');
+    QString hash = parts.value(0);
+    qint64 size = parts.value(1).toLongLong();
+    BlobStore& blobs = m_server->m_blobs;
+    
+    ChatProtocol::Message response;
+    
+    if (!BlobStore::isValidHash(hash) || size <= 0 || size > ChatProtocol::MAX_ATTACHMENT_SIZE) {
+        response.type = ChatProtocol::MessageType::ERROR_MSG;
+        response.content = "Invalid attachment";
+    } else if (blobs.contains(hash)) {
+        // Deduplicated: nothing to transfer
+        response.type = ChatProtocol::MessageType::ATTACHMENT_UPLOAD_READY;
+        response.content = hash + "::" + QString::number(size);
+    } else {
+        BlobStore::Ticket ticket;
+        ticket.direction = BlobStore::UPLOAD;
+        ticket.hash = hash;
+        ticket.size = size;
+        
+        response.type = ChatProtocol::MessageType::ATTACHMENT_UPLOAD_READY;
+        response.content = hash + ":" + QString::fromLatin1(blobs.issueTicket(ticket)) + ":" +
+                           QString::number(blobs.partialSize(hash));
+    }
+    
+    reply(msg, response);
+}
+
+void ClientHandler::handleAttachmentDownload(const ChatProtocol::MessageView& msg) {
+    if (!m_authenticated) return;
+    
+    // content: "<sha256>"
+    QString hash = msg.content.toString();
+    BlobStore& blobs = m_server->m_blobs;
+    
+    ChatProtocol::Message response;
+    
+    if (!BlobStore::isValidHash(hash) || !blobs.contains(hash)) {
+        response.type = ChatProtocol::MessageType::ERROR_MSG;
+        response.content = "Attachment not found";
+    } else {
+        BlobStore::Ticket ticket;
+        ticket.direction = BlobStore::DOWNLOAD;
+        ticket.hash = hash;
+        ticket.size = blobs.blobSize(hash);
+        
+        response.type = ChatProtocol::MessageType::ATTACHMENT_DOWNLOAD_READY;
+        response.content = hash + ":" + QString::fromLatin1(blobs.issueTicket(ticket)) + ":" +
+                           QString::number(ticket.size);
+    }
+    
+    reply(msg, response);
+}
+
+AsyncTask ClientHandler::handleTyping(ChatProtocol::Message msg) {
+    if (!m_authenticated || msg.recipient.isEmpty()) co_return;
+    
+    // Clients already coalesce; this only guards against ones that don't
+    QString conversation = msg.recipient;
+    auto it = m_typingForwarded.constFind(conversation);
+    if (it != m_typingForwarded.constEnd() &&
+        QDeadlineTimer::current().deadline() - it.value() < kTypingMinGapMs) co_return;
+    
+    // Never persisted: forwarded to whoever is online right now
+    ChatProtocol::Message event;
+    event.type = msg.type;
+    event.sender = m_username;
+    event.recipient = conversation;
+    
+    // Only real conversations of the sender's are remembered, and expired on the stats tick
+    if (msg.type == ChatProtocol::MessageType::GROUP_TYPING) {
+        // Frames are not held: a late typing event is harmless
+        QVector<NameId> members;
+        if (!m_server->cachedGroupMembers(conversation, &members)) {
+            ChatServer *server = m_server;
+            members = co_await storage([server, conversation]() { return server->groupMemberIds(conversation); });
+        }
+        if (!members.contains(m_userId)) co_return;
+        
+        m_typingForwarded.insert(conversation, QDeadlineTimer::current().deadline());
+        m_server->broadcastToGroup(members, event);
+    } else {
+        NameId recipientId = m_server->m_names.find(conversation);
+        if (recipientId == INVALID_NAME) co_return;
+        
+        m_typingForwarded.insert(conversation, QDeadlineTimer::current().deadline());
+        m_server->broadcastToUser(recipientId, event);
+    }
+}
+
+void ClientHandler::handleReadReceipt(const ChatProtocol::MessageView& msg) {
+    if (!m_authenticated) return;
+    
+    NameId contactId = m_server->m_names.find(msg.recipient.toString());
+    qint64 readUpTo = msg.content.toString().toLongLong();
+    if (contactId == INVALID_NAME || readUpTo <= m_readForwarded.value(contactId)) return;
+    m_readForwarded.insert(contactId, readUpTo);
+    
+    ChatProtocol::Message event;
+    event.type = ChatProtocol::MessageType::READ_RECEIPT;
+    event.sender = m_username;
+    event.recipient = m_server->m_names.name(contactId);
+    event.content = QString::number(readUpTo);
+    m_server->broadcastToUser(contactId, event);
 }
\ No newline at end of file
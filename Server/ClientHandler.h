@@ -3,20 +3,52 @@
 
 #include <QThread>
 #include <QTcpSocket>
+#include <QSslSocket>
+#include <QHash>
+#include <atomic>
+#include <memory>
 #include "Protocol.h"
+#include "MessageView.h"
+#include "RateLimiter.h"
+#include "NameTable.h"
+#include "OutboundQueue.h"
+#include "AsyncStorage.h"
+#ifdef CHAT_IO_URING
+#include "IoUringReactor.h"
+#endif
 
 class ChatServer;
 class DatabaseManager;
 
-class ClientHandler : public QThread {
+class ClientHandler : public QThread
+#ifdef CHAT_IO_URING
+    , private IoUringReactor::Listener
+#endif
+{
     Q_OBJECT
     
 public:
+    // Connection state carried across a zero-downtime restart
+    struct SessionState {
+        qintptr socketDescriptor = -1;
+        QString username;
+        QByteArray pendingData;     // inbound bytes not yet parsed into frames
+        QByteArray connectionState; // rate buckets and coalescing state, see saveConnectionState()
+    };
+    
     ClientHandler(qintptr socketDescriptor, ChatServer *server, DatabaseManager *db);
     ~ClientHandler();
     
     void sendMessage(const ChatProtocol::Message& msg);
+    void sendFrame(OutboundQueue::Lane lane, const QByteArray& frame); // pre-encoded, see OutboundQueue::encodeFrame
     QString getUsername() const { return m_username; }
+    bool isAuthenticated() const { return m_authenticated; }
+    qint64 lastActivity() const { return m_lastActivity; } // monotonic ms
+    void closeConnection();
+    void expireTyping(); // drops coalescing entries too old to hold anything back; any thread
+    
+    void restoreSession(const SessionState& state); // call before start()
+    bool detachSession(SessionState *state);         // blocks until the socket is released
     
 signals:
     void disconnected(const QString& username);
@@ -27,27 +59,74 @@ protected:
 private slots:
     void onReadyRead();
     void onSocketDisconnected();
+    void drainOutbox();
     
 private:
-    void handleMessage(const ChatProtocol::Message& msg);
-    void handleRegister(const ChatProtocol::Message& msg);
-    void handleLogin(const ChatProtocol::Message& msg);
-    void handlePrivateMessage(const ChatProtocol::Message& msg);
-    void handleCreateGroup(const ChatProtocol::Message& msg);
-    void handleGroupMessage(const ChatProtocol::Message& msg);
-    void handleGetUsers(const ChatProtocol::Message& msg);
-    void handleGetGroups(const ChatProtocol::Message& msg);
-    void handleMessageHistory(const ChatProtocol::Message& msg);
-    void handleLeaveGroup(const ChatProtocol::Message& msg);
-    void handleKickMember(const ChatProtocol::Message& msg);
-    void handleGroupMembersRequest(const ChatProtocol::Message& msg);
+#ifdef CHAT_IO_URING
+    // Reactor-side events, posted over to this thread
+    void runOnReactor();
+    bool detachFromReactor(SessionState *state);
+    void onReceived(const char *data, qsizetype size) override;
+    void onSent(qint64 pendingBytes) override;
+    void onClosed() override;
+#endif
+    QByteArray saveConnectionState() const;
+    void loadConnectionState(const QByteArray& bytes);
+    void scheduleDrain();
+    void processReadBuffer();
+    void reply(const ChatProtocol::MessageView& request, ChatProtocol::Message response);
+    bool checkRateLimit(const ChatProtocol::MessageView& msg);
+    void handleMessage(const ChatProtocol::MessageView& msg);
+    template <typename Fn>
+    auto storage(Fn work);
+    
+    // Coroutines: they copy the request, since views die with the batch
+    AsyncTask handleRegister(ChatProtocol::Message msg);
+    AsyncTask handleLogin(ChatProtocol::Message msg);
+    AsyncTask handleResume(ChatProtocol::Message msg);
+    void attachUser(NameId userId);
+    void sendSessionToken(int privateMark, int groupMark); // newest ids the client has been sent
+    AsyncTask handlePrivateMessage(ChatProtocol::Message msg);
+    AsyncTask handleCreateGroup(ChatProtocol::Message msg);
+    AsyncTask handleGroupMessage(ChatProtocol::Message msg);
+    void handleGetUsers(const ChatProtocol::MessageView& msg);
+    void handleDirectorySearch(const ChatProtocol::MessageView& msg);
+    AsyncTask handleGetGroups(ChatProtocol::Message msg);
+    AsyncTask handleMessageHistory(ChatProtocol::Message msg);
+    AsyncTask handleJoinGroup(ChatProtocol::Message msg);
+    AsyncTask handleLeaveGroup(ChatProtocol::Message msg);
+    AsyncTask handleKickMember(ChatProtocol::Message msg);
+    AsyncTask handleGroupMembersRequest(ChatProtocol::Message msg);
+    AsyncTask handleTyping(ChatProtocol::Message msg);
+    void handleHeartbeat(const ChatProtocol::MessageView& msg);
+    void handleAttachmentUpload(const ChatProtocol::MessageView& msg);
+    void handleAttachmentDownload(const ChatProtocol::MessageView& msg);
+    void handleReadReceipt(const ChatProtocol::MessageView& msg);
     
     qintptr m_socketDescriptor;
+    quint32 m_connectionId; // names this connection in traffic captures
+    QString m_peerAddress;  // keys auth rate limits before login
     QTcpSocket *m_socket;
+#ifdef CHAT_IO_URING
+    IoUringReactor::Connection *m_ringConnection;
+#endif
+    bool m_tls; // encrypt this connection; sessions handed over from another process never are
     ChatServer *m_server;
     DatabaseManager *m_database;
-    QString m_username;
-    bool m_authenticated;
+    QString m_username; // interned, shares data with the server's NameTable
+    NameId m_userId;
+    std::atomic<bool> m_authenticated;
+    std::atomic<qint64> m_lastActivity;
+    QByteArray m_readBuffer;
+    ChatProtocol::FrameArena m_arena; // backs decoded frames, reset per batch
+    // Context of this thread (the socket, or a plain object on the reactor backend)
+    // while the event loop runs; other threads post here, and so do storage resumes
+    std::shared_ptr<AsyncStorage::ResumeTarget> m_resumeTarget;
+    bool m_framesHeld; // later frames wait while a handler's storage call is in flight, keeping requests in order
+    RateLimiter::Buckets m_rateBuckets;
+    OutboundQueue m_outbox;
+    QHash<QString, qint64> m_typingForwarded; // conversation -> last forward (monotonic ms)
+    QHash<NameId, qint64> m_readForwarded;    // reader's high-water mark per contact
 };
 
 #endif // CLIENTHANDLER_H
\ No newline at end of file
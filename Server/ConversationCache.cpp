@@ -0,0 +1,133 @@
+#include "ConversationCache.h"
+#include <algorithm>
+
+ConversationCache::ConversationCache(qint64 maxBytes, int depth)
+    : m_depth(depth), m_entries(maxBytes) {}
+
+void ConversationCache::setMaxBytes(qint64 maxBytes) {
+    QMutexLocker locker(&m_mutex);
+    m_entries.setMaxCost(maxBytes);
+}
+
+qint64 ConversationCache::cost(const Entry& entry) {
+    qint64 bytes = sizeof(Entry);
+    for (const ChatProtocol::Message& msg : entry.messages) {
+        bytes += sizeof(ChatProtocol::Message) +
+                 2 * (msg.sender.size() + msg.recipient.size() + msg.content.size());
+    }
+    return bytes;
+}
+
+std::atomic<quint64>& ConversationCache::stripe(const QString& conversation) const {
+    return m_appendEpochs[qHash(conversation) % m_appendEpochs.size()];
+}
+
+bool ConversationCache::before(const QString& conversation, int beforeId, int limit,
+                               QList<ChatProtocol::Message> *page) {
+    QMutexLocker locker(&m_mutex);
+    const Entry *entry = m_entries.object(conversation);
+    
+    // Walked from the newest end, so ids only need to be roughly in order
+    QList<ChatProtocol::Message> newest;
+    if (entry) {
+        for (auto it = entry->messages.crbegin(); it != entry->messages.crend() && newest.size() < limit; ++it) {
+            if (it->messageId < beforeId) newest.append(*it);
+        }
+    }
+    if (!entry || (!entry->complete && newest.size() < limit)) {
+        ++m_misses;
+        return false;
+    }
+    
+    page->clear();
+    for (auto it = newest.crbegin(); it != newest.crend(); ++it) {
+        page->append(*it);
+    }
+    ++m_hits;
+    return true;
+}
+
+QList<ChatProtocol::Message> ConversationCache::window(const QList<ChatProtocol::Message>& messages,
+                                                       int limit, int offset) {
+    qsizetype end = qMax<qsizetype>(0, messages.size() - offset);
+    qsizetype begin = qMax<qsizetype>(0, end - limit);
+    return messages.mid(begin, end - begin);
+}
+
+bool ConversationCache::history(const QString& conversation, int limit, int offset,
+                                QList<ChatProtocol::Message> *page) {
+    QMutexLocker locker(&m_mutex);
+    const Entry *entry = m_entries.object(conversation);
+    if (!entry || (!entry->complete && offset + limit > entry->messages.size())) {
+        ++m_misses;
+        return false;
+    }
+    
+    *page = window(entry->messages, limit, offset);
+    ++m_hits;
+    return true;
+}
+
+quint64 ConversationCache::beginFill(const QString& conversation) const {
+    return stripe(conversation).load();
+}
+
+void ConversationCache::fill(const QString& conversation, const QList<ChatProtocol::Message>& newest,
+                             quint64 ticket) {
+    auto entry = new Entry{newest, newest.size() < m_depth};
+    qint64 bytes = cost(*entry);
+    
+    QMutexLocker locker(&m_mutex);
+    if (stripe(conversation).load() != ticket) {
+        delete entry;
+        return;
+    }
+    m_entries.insert(conversation, entry, bytes); // deletes it if over budget
+}
+
+void ConversationCache::append(const QString& conversation, const ChatProtocol::Message& msg) {
+    QMutexLocker locker(&m_mutex);
+    ++stripe(conversation);
+    
+    Entry *entry = m_entries.take(conversation);
+    if (!entry) return;
+    
+    // Concurrent sends can finish out of id order, and a fill that read the
+    // row before its append may already hold it
+    auto it = std::lower_bound(entry->messages.begin(), entry->messages.end(), msg,
+                               [](const ChatProtocol::Message& a, const ChatProtocol::Message& b) {
+        return a.messageId < b.messageId;
+    });
+    if (it != entry->messages.end() && it->messageId == msg.messageId) {
+        m_entries.insert(conversation, entry, cost(*entry));
+        return;
+    }
+    entry->messages.insert(it, msg);
+    if (entry->messages.size() > m_depth) {
+        entry->messages.removeFirst();
+        entry->complete = false;
+    }
+    m_entries.insert(conversation, entry, cost(*entry));
+}
+
+ConversationCache::Stats ConversationCache::takeStats() {
+    Stats stats;
+    stats.hits = m_hits.exchange(0);
+    stats.misses = m_misses.exchange(0);
+    
+    QMutexLocker locker(&m_mutex);
+    stats.conversations = int(m_entries.count());
+    stats.bytes = m_entries.totalCost();
+    return stats;
+}
+
+QList<ConversationCache::Conversation> ConversationCache::conversations() {
+    QMutexLocker locker(&m_mutex);
+    const QList<QString> keys = m_entries.keys();
+    QList<Conversation> result;
+    result.reserve(keys.size());
+    for (const QString& key : keys) {
+        result.append({key, m_entries.object(key)->messages});
+    }
+    return result;
+}
\ No newline at end of file
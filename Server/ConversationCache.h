@@ -0,0 +1,72 @@
+#ifndef CONVERSATIONCACHE_H
+#define CONVERSATIONCACHE_H
+
+#include <QString>
+#include <QList>
+#include <QCache>
+#include <QMutex>
+#include <array>
+#include <atomic>
+#include "Protocol.h"
+
+// The newest messages of recently opened conversations, so a busy group
+// opened by many members costs one store query instead of one each.
+// Entries are LRU-evicted against a byte budget. Sends append to entries
+// already cached; a conversation is loaded on its first history miss, and
+// a load that raced with a send to it is dropped rather than cached stale.
+class ConversationCache {
+public:
+    struct Conversation {
+        QString key;
+        QList<ChatProtocol::Message> messages; // oldest first
+    };
+    
+    struct Stats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        int conversations = 0;
+        qint64 bytes = 0;
+    };
+    
+    explicit ConversationCache(qint64 maxBytes = 64 * 1024 * 1024, int depth = 2 * ChatProtocol::HISTORY_PAGE_SIZE);
+    
+    void setMaxBytes(qint64 maxBytes);
+    int depth() const { return m_depth; }
+    
+    // Newest-first window, returned oldest first; false if not cached
+    bool history(const QString& conversation, int limit, int offset, QList<ChatProtocol::Message> *page);
+    // The page just below an id, returned oldest first; false if not cached that deep
+    bool before(const QString& conversation, int beforeId, int limit, QList<ChatProtocol::Message> *page);
+    
+    // Load protocol: take a ticket, read the newest depth() messages, then fill
+    quint64 beginFill(const QString& conversation) const;
+    void fill(const QString& conversation, const QList<ChatProtocol::Message>& newest, quint64 ticket);
+    
+    void append(const QString& conversation, const ChatProtocol::Message& msg);
+    
+    Stats takeStats(); // counters reset, sizes are current
+    QList<Conversation> conversations(); // copy of every entry, for snapshots
+    
+    static QList<ChatProtocol::Message> window(const QList<ChatProtocol::Message>& messages, int limit, int offset);
+    
+private:
+    struct Entry {
+        QList<ChatProtocol::Message> messages; // oldest first, at most depth
+        bool complete;                         // holds the whole conversation
+    };
+    
+    static qint64 cost(const Entry& entry);
+    std::atomic<quint64>& stripe(const QString& conversation) const;
+    
+    const int m_depth;
+    QCache<QString, Entry> m_entries; // cost in bytes
+    QMutex m_mutex;
+    
+    // Bumped by every append; a fill whose stripe moved since its ticket is dropped
+    mutable std::array<std::atomic<quint64>, 64> m_appendEpochs{};
+    
+    std::atomic<quint64> m_hits{0};
+    std::atomic<quint64> m_misses{0};
+};
+
+#endif // CONVERSATIONCACHE_H
\ No newline at end of file
@@ -1,7 +1,22 @@
 #include "DatabaseManager.h"
+#include "MessageLog.h"
+#include "MessageArchive.h"
 #include <QSqlError>
 #include <QDebug>
 #include <QDateTime>
+#include <QTimeZone>
+
+namespace {
+const int kArchiveBatch = 5000; // messages per archive segment
+
+// CURRENT_TIMESTAMP is UTC text without a zone; read it as UTC, like every
+// other timestamp the server hands out
+QDateTime storedTimestamp(const QVariant& value) {
+    QDateTime timestamp = value.toDateTime();
+    timestamp.setTimeZone(QTimeZone::UTC);
+    return timestamp;
+}
+}
 
 DatabaseManager::DatabaseManager() {
     m_db = QSqlDatabase::addDatabase("QSQLITE");
@@ -11,7 +26,7 @@ DatabaseManager::~DatabaseManager() {
     disconnect();
 }
 
-bool DatabaseManager::connect() {
+bool DatabaseManager::connect(const QString& messageLogPath) {
     QMutexLocker locker(&m_mutex);
     
     // SQLite uses a file path instead of host/username/password
@@ -23,10 +38,19 @@ bool DatabaseManager::connect() {
     }
     
     createTables();
+    
+    if (!messageLogPath.isEmpty()) {
+        m_log = std::make_unique<MessageLog>();
+        if (!m_log->open(messageLogPath)) {
+            m_log.reset();
+            return false;
+        }
+    }
     return true;
 }
 void DatabaseManager::disconnect() {
     QMutexLocker locker(&m_mutex);
+    m_log.reset();
     if (m_db.isOpen()) {
         m_db.close();
     }
@@ -167,7 +191,8 @@ QStringList DatabaseManager::getUserGroups(const QString& username) {
 bool DatabaseManager::addGroupMember(const QString& groupName, const QString& username) {
     QMutexLocker locker(&m_mutex);
     
-    if (getGroupMemberCount(groupName) >= 10) {
+    const int limit = m_groupMemberLimit;
+    if (limit > 0 && countGroupMembers(groupName) >= limit) {
         return false; // Group is full
     }
     
@@ -243,6 +268,10 @@ QString DatabaseManager::getGroupAdmin(const QString& groupName) {
 
 int DatabaseManager::getGroupMemberCount(const QString& groupName) {
     QMutexLocker locker(&m_mutex);
+    return countGroupMembers(groupName);
+}
+
+int DatabaseManager::countGroupMembers(const QString& groupName) {
     QSqlQuery query(m_db);
     
     query.prepare("SELECT COUNT(*) FROM group_members gm "
@@ -256,7 +285,14 @@ int DatabaseManager::getGroupMemberCount(const QString& groupName) {
     return 0;
 }
 
-void DatabaseManager::savePrivateMessage(const QString& sender, const QString& recipient, const QString& content) {
+int DatabaseManager::savePrivateMessage(const QString& sender, const QString& recipient, const QString& content) {
+    if (m_log) {
+        // The cache inserts by id, so log appends that finish out of order still line up
+        int id = m_log->append(MessageLog::PRIVATE, sender, recipient, content);
+        if (id > 0) cacheMessage(ChatProtocol::MessageType::PRIVATE_MESSAGE, sender, recipient, content, id);
+        return id;
+    }
+    
     QMutexLocker locker(&m_mutex);
     QSqlQuery query(m_db);
     
@@ -264,37 +300,137 @@ void DatabaseManager::savePrivateMessage(const QString& sender, const QString& r
     query.bindValue(":sender", sender);
     query.bindValue(":recipient", recipient);
     query.bindValue(":content", content);
-    query.exec();
+    
+    if (!query.exec()) return 0;
+    
+    // Cached under the insert's lock, so the cache never shows a newer id without an older one
+    int id = query.lastInsertId().toInt();
+    cacheMessage(ChatProtocol::MessageType::PRIVATE_MESSAGE, sender, recipient, content, id);
+    return id;
 }
 
-void DatabaseManager::saveGroupMessage(const QString& sender, const QString& groupName, const QString& content) {
+int DatabaseManager::saveGroupMessage(const QString& sender, const QString& groupName, const QString& content) {
     QMutexLocker locker(&m_mutex);
     QSqlQuery query(m_db);
     
     query.prepare("SELECT id FROM groups WHERE group_name = :name");
     query.bindValue(":name", groupName);
     
-    if (!query.exec() || !query.next()) return;
+    if (!query.exec() || !query.next()) return 0;
     int groupId = query.value(0).toInt();
     
+    if (m_log) {
+        locker.unlock();
+        int id = m_log->append(MessageLog::GROUP, sender, groupName, content);
+        if (id > 0) cacheMessage(ChatProtocol::MessageType::GROUP_MESSAGE, sender, groupName, content, id);
+        return id;
+    }
+    
     query.prepare("INSERT INTO group_messages (sender, group_id, content) VALUES (:sender, :gid, :content)");
     query.bindValue(":sender", sender);
     query.bindValue(":gid", groupId);
     query.bindValue(":content", content);
-    query.exec();
+    
+    if (!query.exec()) return 0;
+    
+    int id = query.lastInsertId().toInt();
+    cacheMessage(ChatProtocol::MessageType::GROUP_MESSAGE, sender, groupName, content, id);
+    return id;
+}
+
+void DatabaseManager::cacheMessage(ChatProtocol::MessageType type, const QString& sender, const QString& recipient,
+                                   const QString& content, int id) {
+    ChatProtocol::Message msg;
+    msg.type = type;
+    msg.sender = sender;
+    msg.recipient = recipient;
+    msg.content = content;
+    msg.timestamp = QDateTime::currentDateTimeUtc();
+    msg.messageId = id;
+    
+    m_historyCache.append(type == ChatProtocol::MessageType::PRIVATE_MESSAGE
+                              ? MessageLog::privateConversation(sender, recipient)
+                              : MessageLog::groupConversation(recipient), msg);
+}
+
+QList<ChatProtocol::Message> DatabaseManager::getPrivateMessageHistory(const QString& user1, const QString& user2, int limit, int offset) {
+    const QString conversation = MessageLog::privateConversation(user1, user2);
+    QList<ChatProtocol::Message> page;
+    if (m_historyCache.history(conversation, limit, offset, &page)) return page;
+    
+    // Pages within the cached depth load the whole depth once for everyone after
+    if (offset + limit > m_historyCache.depth()) return loadPrivateHistory(user1, user2, limit, offset);
+    
+    quint64 ticket = m_historyCache.beginFill(conversation);
+    QList<ChatProtocol::Message> newest = loadPrivateHistory(user1, user2, m_historyCache.depth(), 0);
+    m_historyCache.fill(conversation, newest, ticket);
+    return ConversationCache::window(newest, limit, offset);
+}
+
+QList<ChatProtocol::Message> DatabaseManager::getGroupMessageHistory(const QString& groupName, int limit, int offset) {
+    const QString conversation = MessageLog::groupConversation(groupName);
+    QList<ChatProtocol::Message> page;
+    if (m_historyCache.history(conversation, limit, offset, &page)) return page;
+    
+    if (offset + limit > m_historyCache.depth()) return loadGroupHistory(groupName, limit, offset);
+    
+    quint64 ticket = m_historyCache.beginFill(conversation);
+    QList<ChatProtocol::Message> newest = loadGroupHistory(groupName, m_historyCache.depth(), 0);
+    m_historyCache.fill(conversation, newest, ticket);
+    return ConversationCache::window(newest, limit, offset);
+}
+
+void DatabaseManager::warmHistory(const QList<ConversationCache::Conversation>& conversations, int privateWatermark,
+                                  int groupWatermark, const std::atomic<bool> *cancel) {
+    const int depth = m_historyCache.depth();
+    
+    for (const ConversationCache::Conversation& conversation : conversations) {
+        if (cancel && *cancel) return;
+        
+        const bool isGroup = conversation.key.startsWith("g:");
+        const QString groupName = conversation.key.mid(2);
+        const QString user1 = conversation.key.mid(2).section('\n', 0, 0);
+        const QString user2 = conversation.key.mid(2).section('\n', 1);
+        
+        // A send racing the snapshot may be missing from its copy but is never above the watermark
+        const int lastId = conversation.messages.isEmpty() ? 0 : conversation.messages.last().messageId;
+        const int afterId = qMin(lastId, isGroup ? groupWatermark : privateWatermark);
+        
+        quint64 ticket = m_historyCache.beginFill(conversation.key);
+        QList<ChatProtocol::Message> newer = isGroup ? getGroupMessagesAfter(groupName, afterId, depth)
+                                                     : getPrivateMessagesAfter(user1, user2, afterId, depth);
+        
+        QList<ChatProtocol::Message> newest;
+        if (newer.size() >= depth) {
+            // Too far behind to stitch; read the newest window outright
+            newest = isGroup ? loadGroupHistory(groupName, depth, 0) : loadPrivateHistory(user1, user2, depth, 0);
+        } else {
+            for (const ChatProtocol::Message& msg : conversation.messages) {
+                if (msg.messageId <= afterId) newest.append(msg);
+            }
+            newest += newer;
+            if (newest.size() > depth) newest = newest.mid(newest.size() - depth);
+        }
+        
+        // Dropped if a send reached this conversation meanwhile; its next read loads it as usual
+        m_historyCache.fill(conversation.key, newest, ticket);
+    }
 }
 
-QList<ChatProtocol::Message> DatabaseManager::getPrivateMessageHistory(const QString& user1, const QString& user2, int limit) {
+QList<ChatProtocol::Message> DatabaseManager::loadPrivateHistory(const QString& user1, const QString& user2, int limit, int offset) {
+    if (m_log) return m_log->history(MessageLog::privateConversation(user1, user2), limit, offset);
+    
     QMutexLocker locker(&m_mutex);
     QList<ChatProtocol::Message> messages;
     QSqlQuery query(m_db);
     
-    query.prepare("SELECT sender, recipient, content, timestamp FROM private_messages "
+    query.prepare("SELECT sender, recipient, content, timestamp, rowid FROM private_messages "
                   "WHERE (sender = :u1 AND recipient = :u2) OR (sender = :u2 AND recipient = :u1) "
-                  "ORDER BY timestamp DESC LIMIT :limit");
+                  "ORDER BY timestamp DESC, rowid DESC LIMIT :limit OFFSET :offset");
     query.bindValue(":u1", user1);
     query.bindValue(":u2", user2);
     query.bindValue(":limit", limit);
+    query.bindValue(":offset", offset);
     
     if (query.exec()) {
         while (query.next()) {
@@ -303,24 +439,126 @@ QList<ChatProtocol::Message> DatabaseManager::getPrivateMessageHistory(const QSt
             msg.sender = query.value(0).toString();
             msg.recipient = query.value(1).toString();
             msg.content = query.value(2).toString();
-            msg.timestamp = query.value(3).toDateTime();
+            msg.timestamp = storedTimestamp(query.value(3));
+            msg.messageId = query.value(4).toInt();
             messages.prepend(msg);
         }
     }
+    
+    if (m_archive && messages.size() < limit) {
+        // An empty page may still have skipped hot rows; count them to offset into the archive
+        int hotCount = int(messages.size()) + offset;
+        if (messages.isEmpty() && offset > 0) {
+            query.prepare("SELECT COUNT(*) FROM private_messages "
+                          "WHERE (sender = :u1 AND recipient = :u2) OR (sender = :u2 AND recipient = :u1)");
+            query.bindValue(":u1", user1);
+            query.bindValue(":u2", user2);
+            if (query.exec() && query.next()) hotCount = query.value(0).toInt();
+        }
+        locker.unlock();
+        prependArchivedHistory(messages, MessageLog::privateConversation(user1, user2), hotCount, limit, offset);
+    }
     return messages;
 }
 
-QList<ChatProtocol::Message> DatabaseManager::getGroupMessageHistory(const QString& groupName, int limit) {
+QList<ChatProtocol::Message> DatabaseManager::loadGroupHistory(const QString& groupName, int limit, int offset) {
+    if (m_log) return m_log->history(MessageLog::groupConversation(groupName), limit, offset);
+    
     QMutexLocker locker(&m_mutex);
     QList<ChatProtocol::Message> messages;
     QSqlQuery query(m_db);
     
-    query.prepare("SELECT gm.sender, g.group_name, gm.content, gm.timestamp "
+    query.prepare("SELECT gm.sender, g.group_name, gm.content, gm.timestamp, gm.rowid "
                   "FROM group_messages gm "
                   "JOIN groups g ON gm.group_id = g.id "
                   "WHERE g.group_name = :name "
-                  "ORDER BY gm.timestamp DESC LIMIT :limit");
+                  "ORDER BY gm.timestamp DESC, gm.rowid DESC LIMIT :limit OFFSET :offset");
+    query.bindValue(":name", groupName);
+    query.bindValue(":limit", limit);
+    query.bindValue(":offset", offset);
+    
+    if (query.exec()) {
+        while (query.next()) {
+            ChatProtocol::Message msg;
+            msg.type = ChatProtocol::MessageType::GROUP_MESSAGE;
+            msg.sender = query.value(0).toString();
+            msg.recipient = query.value(1).toString();
+            msg.content = query.value(2).toString();
+            msg.timestamp = storedTimestamp(query.value(3));
+            msg.messageId = query.value(4).toInt();
+            messages.prepend(msg);
+        }
+    }
+    
+    if (m_archive && messages.size() < limit) {
+        int hotCount = int(messages.size()) + offset;
+        if (messages.isEmpty() && offset > 0) {
+            query.prepare("SELECT COUNT(*) FROM group_messages gm "
+                          "JOIN groups g ON gm.group_id = g.id WHERE g.group_name = :name");
+            query.bindValue(":name", groupName);
+            if (query.exec() && query.next()) hotCount = query.value(0).toInt();
+        }
+        locker.unlock();
+        prependArchivedHistory(messages, MessageLog::groupConversation(groupName), hotCount, limit, offset);
+    }
+    return messages;
+}
+
+QList<ChatProtocol::Message> DatabaseManager::getPrivateMessagesBefore(const QString& user1, const QString& user2, int beforeId, int limit) {
+    const QString conversation = MessageLog::privateConversation(user1, user2);
+    QList<ChatProtocol::Message> messages;
+    if (m_historyCache.before(conversation, beforeId, limit, &messages)) return messages;
+    if (m_log) return m_log->before(conversation, beforeId, limit);
+    
+    QMutexLocker locker(&m_mutex);
+    QSqlQuery query(m_db);
+    
+    query.prepare("SELECT sender, recipient, content, timestamp, rowid FROM private_messages "
+                  "WHERE ((sender = :u1 AND recipient = :u2) OR (sender = :u2 AND recipient = :u1)) "
+                  "AND rowid < :before ORDER BY rowid DESC LIMIT :limit");
+    query.bindValue(":u1", user1);
+    query.bindValue(":u2", user2);
+    query.bindValue(":before", beforeId);
+    query.bindValue(":limit", limit);
+    
+    if (query.exec()) {
+        while (query.next()) {
+            ChatProtocol::Message msg;
+            msg.type = ChatProtocol::MessageType::PRIVATE_MESSAGE;
+            msg.sender = query.value(0).toString();
+            msg.recipient = query.value(1).toString();
+            msg.content = query.value(2).toString();
+            msg.timestamp = storedTimestamp(query.value(3));
+            msg.messageId = query.value(4).toInt();
+            messages.prepend(msg);
+        }
+    }
+    locker.unlock();
+    
+    // Archived rows are all older than the hot ones, so they continue the page
+    if (m_archive && messages.size() < limit) {
+        const int below = messages.isEmpty() ? beforeId : messages.first().messageId;
+        messages = m_archive->before(conversation, below, limit - int(messages.size())) + messages;
+    }
+    return messages;
+}
+
+QList<ChatProtocol::Message> DatabaseManager::getGroupMessagesBefore(const QString& groupName, int beforeId, int limit) {
+    const QString conversation = MessageLog::groupConversation(groupName);
+    QList<ChatProtocol::Message> messages;
+    if (m_historyCache.before(conversation, beforeId, limit, &messages)) return messages;
+    if (m_log) return m_log->before(conversation, beforeId, limit);
+    
+    QMutexLocker locker(&m_mutex);
+    QSqlQuery query(m_db);
+    
+    query.prepare("SELECT gm.sender, g.group_name, gm.content, gm.timestamp, gm.rowid "
+                  "FROM group_messages gm "
+                  "JOIN groups g ON gm.group_id = g.id "
+                  "WHERE g.group_name = :name AND gm.rowid < :before "
+                  "ORDER BY gm.rowid DESC LIMIT :limit");
     query.bindValue(":name", groupName);
+    query.bindValue(":before", beforeId);
     query.bindValue(":limit", limit);
     
     if (query.exec()) {
@@ -330,9 +568,282 @@ QList<ChatProtocol::Message> DatabaseManager::getGroupMessageHistory(const QStri
             msg.sender = query.value(0).toString();
             msg.recipient = query.value(1).toString();
             msg.content = query.value(2).toString();
-            msg.timestamp = query.value(3).toDateTime();
+            msg.timestamp = storedTimestamp(query.value(3));
+            msg.messageId = query.value(4).toInt();
             messages.prepend(msg);
         }
     }
+    locker.unlock();
+    
+    if (m_archive && messages.size() < limit) {
+        const int below = messages.isEmpty() ? beforeId : messages.first().messageId;
+        messages = m_archive->before(conversation, below, limit - int(messages.size())) + messages;
+    }
+    return messages;
+}
+
+QList<ChatProtocol::Message> DatabaseManager::getPrivateMessagesAfter(const QString& user1, const QString& user2, int afterId, int limit) {
+    if (m_log) return m_log->after(MessageLog::privateConversation(user1, user2), afterId, limit);
+    
+    // Archived rows are all older than the hot ones, so they lead
+    QList<ChatProtocol::Message> messages;
+    if (m_archive && afterId < m_archive->lastId(MessageLog::PRIVATE)) {
+        messages = m_archive->after(MessageLog::privateConversation(user1, user2), afterId, limit);
+        if (messages.size() >= limit) return messages;
+    }
+    
+    QMutexLocker locker(&m_mutex);
+    QSqlQuery query(m_db);
+    
+    query.prepare("SELECT sender, recipient, content, timestamp, rowid FROM private_messages "
+                  "WHERE ((sender = :u1 AND recipient = :u2) OR (sender = :u2 AND recipient = :u1)) "
+                  "AND rowid > :after ORDER BY rowid ASC LIMIT :limit");
+    query.bindValue(":u1", user1);
+    query.bindValue(":u2", user2);
+    query.bindValue(":after", afterId);
+    query.bindValue(":limit", limit - int(messages.size()));
+    
+    if (query.exec()) {
+        while (query.next()) {
+            ChatProtocol::Message msg;
+            msg.type = ChatProtocol::MessageType::PRIVATE_MESSAGE;
+            msg.sender = query.value(0).toString();
+            msg.recipient = query.value(1).toString();
+            msg.content = query.value(2).toString();
+            msg.timestamp = storedTimestamp(query.value(3));
+            msg.messageId = query.value(4).toInt();
+            messages.append(msg);
+        }
+    }
+    return messages;
+}
+
+QList<ChatProtocol::Message> DatabaseManager::getGroupMessagesAfter(const QString& groupName, int afterId, int limit) {
+    if (m_log) return m_log->after(MessageLog::groupConversation(groupName), afterId, limit);
+    
+    QList<ChatProtocol::Message> messages;
+    if (m_archive && afterId < m_archive->lastId(MessageLog::GROUP)) {
+        messages = m_archive->after(MessageLog::groupConversation(groupName), afterId, limit);
+        if (messages.size() >= limit) return messages;
+    }
+    
+    QMutexLocker locker(&m_mutex);
+    QSqlQuery query(m_db);
+    
+    query.prepare("SELECT gm.sender, g.group_name, gm.content, gm.timestamp, gm.rowid "
+                  "FROM group_messages gm "
+                  "JOIN groups g ON gm.group_id = g.id "
+                  "WHERE g.group_name = :name AND gm.rowid > :after "
+                  "ORDER BY gm.rowid ASC LIMIT :limit");
+    query.bindValue(":name", groupName);
+    query.bindValue(":after", afterId);
+    query.bindValue(":limit", limit - int(messages.size()));
+    
+    if (query.exec()) {
+        while (query.next()) {
+            ChatProtocol::Message msg;
+            msg.type = ChatProtocol::MessageType::GROUP_MESSAGE;
+            msg.sender = query.value(0).toString();
+            msg.recipient = query.value(1).toString();
+            msg.content = query.value(2).toString();
+            msg.timestamp = storedTimestamp(query.value(3));
+            msg.messageId = query.value(4).toInt();
+            messages.append(msg);
+        }
+    }
+    return messages;
+}
+
+int DatabaseManager::latestPrivateMessageId() {
+    if (m_log) return m_log->latestId(MessageLog::PRIVATE);
+    
+    QMutexLocker locker(&m_mutex);
+    QSqlQuery query(m_db);
+    
+    if (query.exec("SELECT MAX(rowid) FROM private_messages") && query.next()) {
+        return query.value(0).toInt();
+    }
+    return 0;
+}
+
+int DatabaseManager::latestGroupMessageId() {
+    if (m_log) return m_log->latestId(MessageLog::GROUP);
+    
+    QMutexLocker locker(&m_mutex);
+    QSqlQuery query(m_db);
+    
+    if (query.exec("SELECT MAX(rowid) FROM group_messages") && query.next()) {
+        return query.value(0).toInt();
+    }
+    return 0;
+}
+
+QList<ChatProtocol::Message> DatabaseManager::getMissedPrivateMessages(const QString& username, int afterId, int limit) {
+    if (m_log) return m_log->after(m_log->privateConversationsOf(username), afterId, limit);
+    
+    QMutexLocker locker(&m_mutex);
+    QList<ChatProtocol::Message> messages;
+    QSqlQuery query(m_db);
+    
+    query.prepare("SELECT sender, recipient, content, timestamp, rowid FROM private_messages "
+                  "WHERE (sender = :u1 OR recipient = :u2) AND rowid > :after "
+                  "ORDER BY rowid ASC LIMIT :limit");
+    query.bindValue(":u1", username);
+    query.bindValue(":u2", username);
+    query.bindValue(":after", afterId);
+    query.bindValue(":limit", limit);
+    
+    if (query.exec()) {
+        while (query.next()) {
+            ChatProtocol::Message msg;
+            msg.type = ChatProtocol::MessageType::PRIVATE_MESSAGE;
+            msg.sender = query.value(0).toString();
+            msg.recipient = query.value(1).toString();
+            msg.content = query.value(2).toString();
+            msg.timestamp = storedTimestamp(query.value(3));
+            msg.messageId = query.value(4).toInt();
+            messages.append(msg);
+        }
+    }
+    return messages;
+}
+
+QList<ChatProtocol::Message> DatabaseManager::getMissedGroupMessages(const QString& username, int afterId, int limit) {
+    if (m_log) {
+        QStringList conversations;
+        for (const QString& group : getUserGroups(username)) {
+            conversations.append(MessageLog::groupConversation(group));
+        }
+        return m_log->after(conversations, afterId, limit);
+    }
+    
+    QMutexLocker locker(&m_mutex);
+    QList<ChatProtocol::Message> messages;
+    QSqlQuery query(m_db);
+    
+    query.prepare("SELECT gm.sender, g.group_name, gm.content, gm.timestamp, gm.rowid "
+                  "FROM group_messages gm "
+                  "JOIN groups g ON gm.group_id = g.id "
+                  "JOIN group_members m ON m.group_id = g.id "
+                  "WHERE m.username = :username AND gm.rowid > :after "
+                  "ORDER BY gm.rowid ASC LIMIT :limit");
+    query.bindValue(":username", username);
+    query.bindValue(":after", afterId);
+    query.bindValue(":limit", limit);
+    
+    if (query.exec()) {
+        while (query.next()) {
+            ChatProtocol::Message msg;
+            msg.type = ChatProtocol::MessageType::GROUP_MESSAGE;
+            msg.sender = query.value(0).toString();
+            msg.recipient = query.value(1).toString();
+            msg.content = query.value(2).toString();
+            msg.timestamp = storedTimestamp(query.value(3));
+            msg.messageId = query.value(4).toInt();
+            messages.append(msg);
+        }
+    }
     return messages;
+}
+
+void DatabaseManager::prependArchivedHistory(QList<ChatProtocol::Message>& messages, const QString& conversation,
+                                             int hotCount, int limit, int offset) {
+    QList<ChatProtocol::Message> older = m_archive->history(conversation, limit - int(messages.size()),
+                                                            qMax(0, offset - hotCount));
+    if (older.isEmpty()) return;
+    older.append(messages);
+    messages = older;
+}
+
+bool DatabaseManager::openArchive(const QString& directory) {
+    auto archive = std::make_unique<MessageArchive>();
+    if (!archive->open(directory)) return false;
+    
+    QMutexLocker locker(&m_mutex);
+    m_archive = std::move(archive);
+    return true;
+}
+
+int DatabaseManager::archiveSegmentCount() const {
+    return m_archive ? m_archive->segmentCount() : 0;
+}
+
+int DatabaseManager::archiveMessagesBefore(const QDateTime& cutoff, const std::atomic<bool> *cancel) {
+    if (!m_archive || m_log) return 0;
+    
+    // Same text form as CURRENT_TIMESTAMP, so the comparison is a string compare in UTC
+    QString stamp = cutoff.toUTC().toString("yyyy-MM-dd HH:mm:ss");
+    int total = 0;
+    for (bool groups : {false, true}) {
+        int moved = 0;
+        while ((!cancel || !cancel->load()) && (moved = archiveBatch(groups, stamp)) > 0) {
+            total += moved;
+        }
+    }
+    return total;
+}
+
+int DatabaseManager::archiveBatch(bool groups, const QString& cutoff) {
+    QList<ChatProtocol::Message> batch;
+    {
+        QMutexLocker locker(&m_mutex);
+        QSqlQuery query(m_db);
+        
+        // The newest row always stays hot, so SQLite never reuses an archived rowid
+        if (groups) {
+            query.prepare("SELECT gm.sender, g.group_name, gm.content, gm.timestamp, gm.rowid "
+                          "FROM group_messages gm "
+                          "JOIN groups g ON gm.group_id = g.id "
+                          "WHERE gm.timestamp < :cutoff AND gm.rowid < (SELECT MAX(rowid) FROM group_messages) "
+                          "ORDER BY gm.rowid ASC LIMIT :limit");
+        } else {
+            query.prepare("SELECT sender, recipient, content, timestamp, rowid FROM private_messages "
+                          "WHERE timestamp < :cutoff AND rowid < (SELECT MAX(rowid) FROM private_messages) "
+                          "ORDER BY rowid ASC LIMIT :limit");
+        }
+        query.bindValue(":cutoff", cutoff);
+        query.bindValue(":limit", kArchiveBatch);
+        
+        if (!query.exec()) return 0;
+        while (query.next()) {
+            ChatProtocol::Message msg;
+            msg.type = groups ? ChatProtocol::MessageType::GROUP_MESSAGE : ChatProtocol::MessageType::PRIVATE_MESSAGE;
+            msg.sender = query.value(0).toString();
+            msg.recipient = query.value(1).toString();
+            msg.content = query.value(2).toString();
+            msg.timestamp = storedTimestamp(query.value(3));
+            msg.messageId = query.value(4).toInt();
+            batch.append(msg);
+        }
+    }
+    if (batch.isEmpty()) return 0;
+    
+    // Compression and the file write run unlocked so sends are never held up
+    MessageArchive::Segment segment;
+    MessageLog::Kind kind = groups ? MessageLog::GROUP : MessageLog::PRIVATE;
+    if (!m_archive->write(kind, batch, &segment)) {
+        qDebug() << "Failed to write archive segment" << segment.path;
+        m_archive->discard(segment);
+        return 0;
+    }
+    
+    // The batch is every matching row up to its last id, so the delete removes exactly it
+    QMutexLocker locker(&m_mutex);
+    QSqlQuery query(m_db);
+    if (groups) {
+        query.prepare("DELETE FROM group_messages WHERE rowid <= :last AND timestamp < :cutoff "
+                      "AND group_id IN (SELECT id FROM groups)");
+    } else {
+        query.prepare("DELETE FROM private_messages WHERE rowid <= :last AND timestamp < :cutoff");
+    }
+    query.bindValue(":last", segment.lastId);
+    query.bindValue(":cutoff", cutoff);
+    
+    if (!query.exec()) {
+        qDebug() << "Failed to trim archived messages:" << query.lastError().text();
+        m_archive->discard(segment);
+        return 0;
+    }
+    m_archive->publish(segment);
+    return int(batch.size());
 }
\ No newline at end of file
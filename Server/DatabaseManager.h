@@ -6,14 +6,22 @@
 #include <QString>
 #include <QStringList>
 #include <QMutex>
+#include <QDateTime>
+#include <memory>
+#include <atomic>
 #include "Protocol.h"
+#include "ConversationCache.h"
+
+class MessageLog;
+class MessageArchive;
 
 class DatabaseManager {
 public:
     DatabaseManager();
     ~DatabaseManager();
     
-    bool connect();
+    // With a log directory, messages go to an append-only MessageLog instead of SQLite
+    bool connect(const QString& messageLogPath = QString());
     void disconnect();
     
     // User management
@@ -31,18 +39,58 @@ public:
     bool isGroupAdmin(const QString& groupName, const QString& username);
     QString getGroupAdmin(const QString& groupName);
     int getGroupMemberCount(const QString& groupName);
+    void setGroupMemberLimit(int limit) { m_groupMemberLimit = limit; } // 0: unlimited
     
     // Message management
-    void savePrivateMessage(const QString& sender, const QString& recipient, const QString& content);
-    void saveGroupMessage(const QString& sender, const QString& groupName, const QString& content);
-    QList<ChatProtocol::Message> getPrivateMessageHistory(const QString& user1, const QString& user2, int limit);
-    QList<ChatProtocol::Message> getGroupMessageHistory(const QString& groupName, int limit);
+    // Messages are identified by their rowid, which only ever grows
+    int savePrivateMessage(const QString& sender, const QString& recipient, const QString& content);
+    int saveGroupMessage(const QString& sender, const QString& groupName, const QString& content);
+    QList<ChatProtocol::Message> getPrivateMessageHistory(const QString& user1, const QString& user2, int limit, int offset = 0);
+    QList<ChatProtocol::Message> getGroupMessageHistory(const QString& groupName, int limit, int offset = 0);
+    // The page just below an id, so paging back is unaffected by newer messages
+    QList<ChatProtocol::Message> getPrivateMessagesBefore(const QString& user1, const QString& user2, int beforeId, int limit);
+    QList<ChatProtocol::Message> getGroupMessagesBefore(const QString& groupName, int beforeId, int limit);
+    QList<ChatProtocol::Message> getPrivateMessagesAfter(const QString& user1, const QString& user2, int afterId, int limit);
+    QList<ChatProtocol::Message> getGroupMessagesAfter(const QString& groupName, int afterId, int limit);
+    
+    // Session resume: newest ids, and everything a user missed after them
+    int latestPrivateMessageId();
+    int latestGroupMessageId();
+    QList<ChatProtocol::Message> getMissedPrivateMessages(const QString& username, int afterId, int limit);
+    QList<ChatProtocol::Message> getMissedGroupMessages(const QString& username, int afterId, int limit);
+    
+    // Recent history of active conversations is served from memory
+    void setHistoryCacheSize(qint64 bytes) { m_historyCache.setMaxBytes(bytes); }
+    ConversationCache::Stats takeHistoryCacheStats() { return m_historyCache.takeStats(); }
+    QList<ConversationCache::Conversation> historyCacheContents() { return m_historyCache.conversations(); }
+    
+    // Refills the cache from a snapshot, fetching what was stored after the watermarks
+    void warmHistory(const QList<ConversationCache::Conversation>& conversations, int privateWatermark,
+                     int groupWatermark, const std::atomic<bool> *cancel = nullptr);
+    
+    // Retention: messages older than the cutoff move to compressed archive segments.
+    // History queries continue into the archive past the oldest hot row.
+    bool openArchive(const QString& directory);
+    int archiveMessagesBefore(const QDateTime& cutoff, const std::atomic<bool> *cancel = nullptr);
+    int archiveSegmentCount() const;
     
 private:
     void createTables();
+    int countGroupMembers(const QString& groupName); // caller holds m_mutex
+    void cacheMessage(ChatProtocol::MessageType type, const QString& sender, const QString& recipient,
+                      const QString& content, int id);
+    QList<ChatProtocol::Message> loadPrivateHistory(const QString& user1, const QString& user2, int limit, int offset);
+    QList<ChatProtocol::Message> loadGroupHistory(const QString& groupName, int limit, int offset);
+    int archiveBatch(bool groups, const QString& cutoff);
+    void prependArchivedHistory(QList<ChatProtocol::Message>& messages, const QString& conversation,
+                                int hotCount, int limit, int offset);
     
     QSqlDatabase m_db;
-    QMutex m_mutex;
+    mutable QMutex m_mutex;
+    std::unique_ptr<MessageLog> m_log;
+    std::unique_ptr<MessageArchive> m_archive;
+    ConversationCache m_historyCache;
+    std::atomic<int> m_groupMemberLimit{10};
 };
 
 #endif // DATABASEMANAGER_H
\ No newline at end of file
@@ -0,0 +1,295 @@
+#include "HandoffManager.h"
+#include "ChatServer.h"
+#include "ClientHandler.h"
+#include <QSocketNotifier>
+#include <QDataStream>
+#include <QDebug>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <utility>
+
+namespace {
+
+// A successor that connects but never says what it wants is dropped after this
+const int kRequestTimeoutMs = 5000;
+
+bool fillAddress(const QString& path, sockaddr_un *addr) {
+    QByteArray encoded = path.toLocal8Bit();
+    if (encoded.size() >= int(sizeof(addr->sun_path))) return false;
+    
+    std::memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    std::memcpy(addr->sun_path, encoded.constData(), encoded.size());
+    return true;
+}
+
+bool writeAll(int fd, const char *data, qsizetype size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool readAll(int fd, char *data, qsizetype size) {
+    while (size > 0) {
+        ssize_t n = ::read(fd, data, size);
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+} // namespace
+
+HandoffManager::HandoffManager(ChatServer *server, QObject *parent)
+    : QObject(parent), m_server(server), m_listenFd(-1), m_notifier(nullptr), m_successorFd(-1),
+      m_successorNotifier(nullptr) {
+    m_successorDeadline.setSingleShot(true);
+    m_successorDeadline.setInterval(kRequestTimeoutMs);
+    connect(&m_successorDeadline, &QTimer::timeout, this, &HandoffManager::dropSuccessor);
+}
+
+HandoffManager::~HandoffManager() {
+    dropSuccessor();
+    // The socket path is left alone: a successor may already have re-bound it
+    if (m_listenFd >= 0) {
+        ::close(m_listenFd);
+    }
+}
+
+bool HandoffManager::listen(const QString& path) {
+    sockaddr_un addr;
+    if (!fillAddress(path, &addr)) return false;
+    
+    m_listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listenFd < 0) return false;
+    
+    ::unlink(addr.sun_path);
+    if (::bind(m_listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        ::listen(m_listenFd, 1) < 0) {
+        qDebug() << "Handoff socket unavailable:" << path << std::strerror(errno);
+        ::close(m_listenFd);
+        m_listenFd = -1;
+        return false;
+    }
+    
+    m_notifier = new QSocketNotifier(m_listenFd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &HandoffManager::onSuccessorConnected);
+    
+    qDebug() << "Waiting for restart handoff on" << path;
+    return true;
+}
+
+void HandoffManager::onSuccessorConnected() {
+    int fd = ::accept(m_listenFd, nullptr, nullptr);
+    if (fd < 0) return;
+    
+    // One successor at a time; the request is read when it arrives, not waited for
+    if (m_successorFd >= 0) {
+        ::close(fd);
+        return;
+    }
+    m_successorFd = fd;
+    m_successorNotifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(m_successorNotifier, &QSocketNotifier::activated, this, &HandoffManager::onSuccessorRequest);
+    m_successorDeadline.start();
+}
+
+void HandoffManager::onSuccessorRequest() {
+    char request = 0;
+    ssize_t n = ::recv(m_successorFd, &request, 1, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (n != 1) {
+        dropSuccessor();
+        return;
+    }
+    
+    int fd = std::exchange(m_successorFd, -1);
+    dropSuccessor(); // only the notifier and deadline now
+    
+    m_notifier->setEnabled(false);
+    handOff(fd, request == 'A');
+    ::close(fd);
+}
+
+void HandoffManager::dropSuccessor() {
+    m_successorDeadline.stop();
+    if (QSocketNotifier *notifier = std::exchange(m_successorNotifier, nullptr)) {
+        // May be the notifier whose signal got us here
+        notifier->setEnabled(false);
+        notifier->deleteLater();
+    }
+    if (m_successorFd >= 0) {
+        qDebug() << "Handoff successor closed or sent no request in time, dropping it";
+        ::close(std::exchange(m_successorFd, -1));
+    }
+}
+
+void HandoffManager::handOff(int fd, bool includeClients) {
+    qDebug() << "Handing off to new server process" << (includeClients ? "with sessions" : "(listener only)");
+    
+    m_server->pauseAccepting();
+    if (!sendItem(fd, LISTENER, QByteArray(), int(m_server->socketDescriptor()))) {
+        qDebug() << "Handoff failed, resuming service";
+        m_server->resumeAccepting();
+        m_notifier->setEnabled(true);
+        return;
+    }
+    
+    BulkServer *bulk = m_server->bulkServer();
+    if (bulk->isListening()) {
+        bulk->pauseAccepting();
+        sendItem(fd, BULK_LISTENER, QByteArray(), int(bulk->socketDescriptor()));
+    }
+    
+    int sessions = 0;
+    if (includeClients) {
+        for (ClientHandler *handler : m_server->handlers()) {
+            ClientHandler::SessionState state;
+            if (!m_server->detachSession(handler, &state)) continue;
+            
+            QByteArray payload;
+            QDataStream out(&payload, QIODevice::WriteOnly);
+            out << state.username << state.pendingData << state.connectionState;
+            
+            if (sendItem(fd, SESSION, payload, int(state.socketDescriptor))) {
+                ++sessions;
+            } else {
+                qDebug() << "Lost session during handoff:" << state.username;
+            }
+            ::close(int(state.socketDescriptor));
+        }
+    }
+    
+    // Clients that reconnect instead (TLS, or a listener-only handoff) resume on the successor
+    sendItem(fd, RESUME_TOKENS, m_server->saveResumeTokens(), -1);
+    sendItem(fd, DONE, QByteArray(), -1);
+    
+    // The successor owns its own copy of the listening sockets now
+    m_server->close();
+    bulk->close();
+    qDebug() << "Handoff complete," << sessions << "sessions transferred";
+    emit handoffComplete();
+}
+
+bool HandoffManager::takeOver(const QString& path, bool includeClients) {
+    sockaddr_un addr;
+    if (!fillAddress(path, &addr)) return false;
+    
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        qDebug() << "No running server to take over at" << path;
+        ::close(fd);
+        return false;
+    }
+    
+    char request = includeClients ? 'A' : 'L';
+    bool listening = false;
+    
+    if (writeAll(fd, &request, 1)) {
+        quint8 kind = 0;
+        QByteArray payload;
+        int passedFd = -1;
+        
+        while (receiveItem(fd, &kind, &payload, &passedFd) && kind != DONE) {
+            if (kind == LISTENER && passedFd >= 0) {
+                listening = m_server->setSocketDescriptor(passedFd);
+            } else if (kind == BULK_LISTENER && passedFd >= 0) {
+                m_server->bulkServer()->setSocketDescriptor(passedFd);
+            } else if (kind == SESSION && passedFd >= 0) {
+                ClientHandler::SessionState state;
+                QDataStream in(payload);
+                in >> state.username >> state.pendingData >> state.connectionState;
+                state.socketDescriptor = passedFd;
+                m_server->adoptSession(state);
+            } else if (kind == RESUME_TOKENS) {
+                m_server->loadResumeTokens(payload);
+            } else if (passedFd >= 0) {
+                ::close(passedFd);
+            }
+        }
+    }
+    
+    ::close(fd);
+    return listening;
+}
+
+bool HandoffManager::sendItem(int fd, quint8 kind, const QByteArray& payload, int passedFd) {
+    char header[5];
+    header[0] = char(kind);
+    quint32 size = quint32(payload.size());
+    std::memcpy(header + 1, &size, sizeof(size));
+    
+    iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    
+    // The descriptor rides along with the header as ancillary data
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    if (passedFd >= 0) {
+        std::memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &passedFd, sizeof(int));
+    }
+    
+    ssize_t sent = ::sendmsg(fd, &msg, 0);
+    if (sent <= 0) return false;
+    if (sent < ssize_t(sizeof(header)) && !writeAll(fd, header + sent, sizeof(header) - sent)) return false;
+    
+    return writeAll(fd, payload.constData(), payload.size());
+}
+
+bool HandoffManager::receiveItem(int fd, quint8 *kind, QByteArray *payload, int *passedFd) {
+    char header[5];
+    
+    iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    
+    ssize_t received = ::recvmsg(fd, &msg, 0);
+    if (received <= 0) return false;
+    if (received < ssize_t(sizeof(header)) && !readAll(fd, header + received, sizeof(header) - received)) return false;
+    
+    *passedFd = -1;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            std::memcpy(passedFd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    
+    quint32 size = 0;
+    *kind = quint8(header[0]);
+    std::memcpy(&size, header + 1, sizeof(size));
+    
+    payload->resize(size);
+    return readAll(fd, payload->data(), size);
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef HANDOFFMANAGER_H
+#define HANDOFFMANAGER_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QTimer>
+
+class ChatServer;
+class QSocketNotifier;
+
+// Passes the listening socket, and optionally live client sessions, from a
+// running server to its replacement over a Unix domain socket (SCM_RIGHTS).
+class HandoffManager : public QObject {
+    Q_OBJECT
+    
+public:
+    explicit HandoffManager(ChatServer *server, QObject *parent = nullptr);
+    ~HandoffManager();
+    
+    // Old process: wait for a successor on the given path
+    bool listen(const QString& path);
+    // New process: take the listener (and sessions) from the predecessor
+    bool takeOver(const QString& path, bool includeClients);
+    
+signals:
+    void handoffComplete();
+    
+private slots:
+    void onSuccessorConnected();
+    void onSuccessorRequest();
+    void dropSuccessor();
+    
+private:
+    enum ItemKind : quint8 {
+        LISTENER = 1,
+        SESSION = 2,
+        DONE = 3,
+        BULK_LISTENER = 4,
+        RESUME_TOKENS = 5
+    };
+    
+    void handOff(int fd, bool includeClients);
+    static bool sendItem(int fd, quint8 kind, const QByteArray& payload, int passedFd);
+    static bool receiveItem(int fd, quint8 *kind, QByteArray *payload, int *passedFd);
+    
+    ChatServer *m_server;
+    int m_listenFd;
+    QSocketNotifier *m_notifier;
+    
+    // A connected successor whose one-byte request has not arrived yet
+    int m_successorFd;
+    QSocketNotifier *m_successorNotifier;
+    QTimer m_successorDeadline;
+};
+
+#endif // HANDOFFMANAGER_H
\ No newline at end of file
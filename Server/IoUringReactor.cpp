@@ -0,0 +1,359 @@
+#include "IoUringReactor.h"
+#include <QDebug>
+#include <QDeadlineTimer>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+const unsigned kBufferCount = 1024;      // power of two; shared by all connections
+const unsigned kBufferSize = 16 * 1024;
+const int kBufferGroup = 0;
+const quint64 kCancelTag = 0;            // nothing to do when a cancel request completes
+const quint64 kWakeTag = 1;              // connection tags are 8-aligned pointers
+const quint64 kOpMask = 7;
+
+enum Op : quint64 {
+    RECEIVE = 2,
+    SEND = 3
+};
+}
+
+struct IoUringReactor::Connection {
+    int fd = -1;
+    QMutex listenerMutex;
+    Listener *listener = nullptr;
+    std::atomic<qint64> pending{0}; // bytes accepted by send() and not yet written
+    
+    // Reactor thread only
+    QByteArray outbox;  // queued while a send is in flight
+    QByteArray sending;
+    qint64 sendOffset = 0;
+    int opsInFlight = 0;
+    bool receiving = false;
+    bool closed = false;
+    bool released = false;
+    std::shared_ptr<Handover> handover; // set by detach(); the descriptor goes there, not to close()
+    
+    template <typename Fn>
+    void notify(Fn fn) {
+        QMutexLocker locker(&listenerMutex);
+        if (listener) fn(listener);
+    }
+};
+
+IoUringReactor::IoUringReactor(unsigned entries)
+    : m_entries(entries), m_ready(false), m_bufferRing(nullptr), m_buffers(nullptr), m_wakeFd(-1),
+      m_wakeValue(0), m_stopping(false) {}
+
+IoUringReactor::~IoUringReactor() {
+    stop();
+    
+    for (Connection *connection : m_connections) {
+        ::close(connection->fd);
+        delete connection;
+    }
+    if (m_bufferRing) io_uring_free_buf_ring(&m_ring, m_bufferRing, kBufferCount, kBufferGroup);
+    if (m_ready) io_uring_queue_exit(&m_ring);
+    if (m_wakeFd >= 0) ::close(m_wakeFd);
+    std::free(m_buffers);
+}
+
+bool IoUringReactor::setup() {
+    int ret = io_uring_queue_init(m_entries, &m_ring, 0);
+    if (ret < 0) {
+        qDebug() << "io_uring unavailable:" << strerror(-ret);
+        return false;
+    }
+    m_ready = true;
+    
+    m_bufferRing = io_uring_setup_buf_ring(&m_ring, kBufferCount, kBufferGroup, 0, &ret);
+    if (!m_bufferRing) {
+        qDebug() << "io_uring buffer rings unavailable:" << strerror(-ret);
+        return false;
+    }
+    
+    m_buffers = static_cast<char*>(std::aligned_alloc(4096, size_t(kBufferCount) * kBufferSize));
+    if (!m_buffers) return false;
+    for (unsigned id = 0; id < kBufferCount; ++id) {
+        io_uring_buf_ring_add(m_bufferRing, m_buffers + size_t(id) * kBufferSize, kBufferSize, id,
+                              io_uring_buf_ring_mask(kBufferCount), int(id));
+    }
+    io_uring_buf_ring_advance(m_bufferRing, kBufferCount);
+    
+    m_wakeFd = eventfd(0, EFD_CLOEXEC);
+    return m_wakeFd >= 0;
+}
+
+void IoUringReactor::stop() {
+    if (!isRunning()) return;
+    m_stopping = true;
+    eventfd_write(m_wakeFd, 1);
+    wait();
+}
+
+IoUringReactor::Connection* IoUringReactor::attach(int fd, Listener *listener) {
+    auto connection = new Connection;
+    connection->fd = fd;
+    connection->listener = listener;
+    post({Command::ATTACH, connection, QByteArray()});
+    return connection;
+}
+
+void IoUringReactor::send(Connection *connection, const QByteArray& data) {
+    connection->pending += data.size();
+    post({Command::SEND, connection, data});
+}
+
+qint64 IoUringReactor::pendingBytes(const Connection *connection) const {
+    return connection->pending;
+}
+
+void IoUringReactor::shutdown(Connection *connection) {
+    // The outstanding receive then completes with 0 and the close runs as usual
+    ::shutdown(connection->fd, SHUT_RDWR);
+}
+
+void IoUringReactor::release(Connection *connection) {
+    {
+        QMutexLocker locker(&connection->listenerMutex);
+        connection->listener = nullptr;
+    }
+    post({Command::RELEASE, connection, QByteArray()});
+}
+
+int IoUringReactor::detach(Connection *connection, QByteArray *unread, int timeoutMs) {
+    {
+        QMutexLocker locker(&connection->listenerMutex);
+        connection->listener = nullptr;
+    }
+    auto handover = std::make_shared<Handover>();
+    post({Command::DETACH, connection, QByteArray(), handover});
+    
+    QDeadlineTimer deadline(timeoutMs);
+    QMutexLocker locker(&handover->mutex);
+    while (!handover->finished && handover->done.wait(&handover->mutex, deadline)) {}
+    if (!handover->finished) {
+        handover->abandoned = true;
+        return -1;
+    }
+    *unread = handover->unread;
+    return handover->fd;
+}
+
+void IoUringReactor::post(Command command) {
+    bool wake;
+    {
+        QMutexLocker locker(&m_commandsMutex);
+        wake = m_commands.isEmpty();
+        m_commands.append(std::move(command));
+    }
+    // One wakeup covers everything queued before the reactor gets to it
+    if (wake) eventfd_write(m_wakeFd, 1);
+}
+
+void IoUringReactor::run() {
+    armWake();
+    
+    while (!m_stopping) {
+        int ret = io_uring_submit_and_wait(&m_ring, 1);
+        if (ret < 0 && ret != -EINTR) {
+            qDebug() << "io_uring wait failed:" << strerror(-ret);
+            break;
+        }
+        
+        unsigned head;
+        unsigned seen = 0;
+        io_uring_cqe *cqe;
+        io_uring_for_each_cqe(&m_ring, head, cqe) {
+            complete(cqe);
+            ++seen;
+        }
+        io_uring_cq_advance(&m_ring, seen);
+    }
+}
+
+io_uring_sqe* IoUringReactor::nextSqe() {
+    io_uring_sqe *sqe = io_uring_get_sqe(&m_ring);
+    if (!sqe) {
+        // Submission queue full: push what we have and take a fresh slot
+        io_uring_submit(&m_ring);
+        sqe = io_uring_get_sqe(&m_ring);
+    }
+    return sqe;
+}
+
+void IoUringReactor::armWake() {
+    io_uring_sqe *sqe = nextSqe();
+    io_uring_prep_read(sqe, m_wakeFd, &m_wakeValue, sizeof(m_wakeValue), 0);
+    io_uring_sqe_set_data64(sqe, kWakeTag);
+}
+
+void IoUringReactor::armReceive(Connection *connection) {
+    io_uring_sqe *sqe = nextSqe();
+    io_uring_prep_recv(sqe, connection->fd, nullptr, kBufferSize, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    io_uring_sqe_set_data64(sqe, quint64(reinterpret_cast<quintptr>(connection)) | RECEIVE);
+    ++connection->opsInFlight;
+    connection->receiving = true;
+}
+
+void IoUringReactor::armSend(Connection *connection) {
+    io_uring_sqe *sqe = nextSqe();
+    io_uring_prep_send(sqe, connection->fd, connection->sending.constData() + connection->sendOffset,
+                       size_t(connection->sending.size() - connection->sendOffset), MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, quint64(reinterpret_cast<quintptr>(connection)) | SEND);
+    ++connection->opsInFlight;
+}
+
+void IoUringReactor::runCommands() {
+    QList<Command> commands;
+    {
+        QMutexLocker locker(&m_commandsMutex);
+        commands.swap(m_commands);
+    }
+    
+    for (Command& command : commands) {
+        Connection *connection = command.connection;
+        switch (command.kind) {
+            case Command::ATTACH:
+                m_connections.insert(connection);
+                armReceive(connection);
+                break;
+            case Command::SEND:
+                if (connection->closed) {
+                    connection->pending -= command.data.size();
+                } else {
+                    connection->outbox.append(command.data);
+                    flushOutbox(connection);
+                }
+                break;
+            case Command::RELEASE:
+                connection->released = true;
+                ::shutdown(connection->fd, SHUT_RDWR);
+                maybeDelete(connection);
+                break;
+            case Command::DETACH:
+                // Sends in flight run to completion; only the receive is called back
+                connection->released = true;
+                connection->handover = std::move(command.handover);
+                if (connection->receiving) {
+                    io_uring_sqe *sqe = nextSqe();
+                    io_uring_prep_cancel64(sqe, quint64(reinterpret_cast<quintptr>(connection)) | RECEIVE, 0);
+                    io_uring_sqe_set_data64(sqe, kCancelTag);
+                    // Before the connection can be freed and its address reused
+                    io_uring_submit(&m_ring);
+                }
+                maybeDelete(connection);
+                break;
+        }
+    }
+}
+
+void IoUringReactor::complete(const io_uring_cqe *cqe) {
+    quint64 tag = io_uring_cqe_get_data64(cqe);
+    if (tag == kCancelTag) return;
+    if (tag == kWakeTag) {
+        runCommands();
+        if (!m_stopping) armWake();
+        return;
+    }
+    
+    auto connection = reinterpret_cast<Connection*>(quintptr(tag & ~kOpMask));
+    --connection->opsInFlight;
+    if ((tag & kOpMask) == RECEIVE) {
+        onReceive(connection, cqe);
+    } else {
+        onSend(connection, cqe->res);
+    }
+    maybeDelete(connection);
+}
+
+void IoUringReactor::onReceive(Connection *connection, const io_uring_cqe *cqe) {
+    connection->receiving = false;
+    if (cqe->res == -ECANCELED) return; // taken back by detach()
+    if (cqe->res == -ENOBUFS) {
+        // Every ring buffer is in use; they come back as soon as listeners copy them
+        if (!connection->released) armReceive(connection);
+        return;
+    }
+    if (cqe->res <= 0) {
+        if (cqe->flags & IORING_CQE_F_BUFFER) recycleBuffer(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        markClosed(connection);
+        return;
+    }
+    
+    unsigned id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    const char *data = m_buffers + size_t(id) * kBufferSize;
+    if (connection->handover) {
+        connection->handover->unread.append(data, cqe->res); // read before the cancel landed
+    } else {
+        connection->notify([data, cqe](Listener *listener) { listener->onReceived(data, cqe->res); });
+    }
+    recycleBuffer(id);
+    
+    if (!connection->closed && !connection->released) armReceive(connection);
+}
+
+void IoUringReactor::onSend(Connection *connection, int result) {
+    if (result < 0) {
+        connection->pending -= connection->sending.size() - connection->sendOffset + connection->outbox.size();
+        connection->sending.clear();
+        connection->outbox.clear();
+        markClosed(connection);
+        return;
+    }
+    
+    connection->sendOffset += result;
+    if (connection->sendOffset < connection->sending.size()) {
+        armSend(connection);
+        return;
+    }
+    
+    qint64 pending = connection->pending -= connection->sending.size();
+    connection->sending.clear();
+    connection->sendOffset = 0;
+    flushOutbox(connection);
+    connection->notify([pending](Listener *listener) { listener->onSent(pending); });
+}
+
+void IoUringReactor::flushOutbox(Connection *connection) {
+    // Everything queued while the last send was in flight goes out as one write
+    if (!connection->sending.isEmpty() || connection->outbox.isEmpty() || connection->closed) return;
+    connection->sending.swap(connection->outbox);
+    connection->sendOffset = 0;
+    armSend(connection);
+}
+
+void IoUringReactor::markClosed(Connection *connection) {
+    if (connection->closed) return;
+    connection->closed = true;
+    connection->notify([](Listener *listener) { listener->onClosed(); });
+}
+
+void IoUringReactor::maybeDelete(Connection *connection) {
+    if (!connection->released || connection->opsInFlight > 0) return;
+    m_connections.remove(connection);
+    
+    bool handedOver = false;
+    if (connection->handover) {
+        Handover& handover = *connection->handover;
+        QMutexLocker locker(&handover.mutex);
+        handedOver = !handover.abandoned && !connection->closed;
+        handover.fd = handedOver ? connection->fd : -1;
+        handover.finished = true;
+        handover.done.wakeAll();
+    }
+    if (!handedOver) ::close(connection->fd);
+    delete connection;
+}
+
+void IoUringReactor::recycleBuffer(unsigned id) {
+    io_uring_buf_ring_add(m_bufferRing, m_buffers + size_t(id) * kBufferSize, kBufferSize, id,
+                          io_uring_buf_ring_mask(kBufferCount), 0);
+    io_uring_buf_ring_advance(m_bufferRing, 1);
+}
\ No newline at end of file
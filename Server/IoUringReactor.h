@@ -0,0 +1,100 @@
+#ifndef IOURINGREACTOR_H
+#define IOURINGREACTOR_H
+
+#include <QThread>
+#include <QByteArray>
+#include <QList>
+#include <QSet>
+#include <QMutex>
+#include <QWaitCondition>
+#include <atomic>
+#include <memory>
+#include <liburing.h>
+
+// Linux-only transport for plain TCP connections. One thread owns an
+// io_uring and every connection's receive and send: each loop submits the
+// pending operations of all connections with a single syscall and reaps
+// their completions together. Receives draw from a buffer ring registered
+// with the kernel, so idle connections hold no buffer. Listeners are called
+// on the reactor thread and must only hand the work to their own thread.
+class IoUringReactor : public QThread {
+public:
+    class Listener {
+    public:
+        virtual ~Listener() = default;
+        virtual void onReceived(const char *data, qsizetype size) = 0; // data is only valid during the call
+        virtual void onSent(qint64 pendingBytes) = 0;
+        virtual void onClosed() = 0;
+    };
+    
+    struct Connection;
+    
+    explicit IoUringReactor(unsigned entries = 4096);
+    ~IoUringReactor();
+    
+    bool setup(); // false if the kernel lacks io_uring or buffer rings
+    void stop();
+    
+    // Thread-safe; the handle stays valid until release(), which also closes the descriptor
+    Connection* attach(int fd, Listener *listener);
+    void send(Connection *connection, const QByteArray& data);
+    qint64 pendingBytes(const Connection *connection) const;
+    void shutdown(Connection *connection);
+    void release(Connection *connection);
+    
+    // Blocking, for a session handoff: lets queued sends finish, takes back the
+    // receive and returns the still-open descriptor with any bytes it had read
+    // but not delivered. The handle is gone afterwards; -1 if the connection
+    // closed or the timeout passed, in which case the reactor closes it.
+    int detach(Connection *connection, QByteArray *unread, int timeoutMs);
+    
+protected:
+    void run() override;
+    
+private:
+    struct Handover {
+        QMutex mutex;
+        QWaitCondition done;
+        bool finished = false;
+        bool abandoned = false; // the caller stopped waiting
+        int fd = -1;
+        QByteArray unread;
+    };
+    
+    struct Command {
+        enum Kind { ATTACH, SEND, RELEASE, DETACH } kind;
+        Connection *connection;
+        QByteArray data;
+        std::shared_ptr<Handover> handover;
+    };
+    
+    void post(Command command);
+    io_uring_sqe* nextSqe();
+    void armWake();
+    void armReceive(Connection *connection);
+    void armSend(Connection *connection);
+    void runCommands();
+    void complete(const io_uring_cqe *cqe);
+    void onReceive(Connection *connection, const io_uring_cqe *cqe);
+    void onSend(Connection *connection, int result);
+    void flushOutbox(Connection *connection);
+    void markClosed(Connection *connection);
+    void maybeDelete(Connection *connection);
+    void recycleBuffer(unsigned id);
+    
+    unsigned m_entries;
+    io_uring m_ring;
+    bool m_ready;
+    io_uring_buf_ring *m_bufferRing;
+    char *m_buffers;
+    int m_wakeFd;
+    quint64 m_wakeValue;
+    std::atomic<bool> m_stopping;
+    
+    QMutex m_commandsMutex;
+    QList<Command> m_commands;
+    
+    QSet<Connection*> m_connections; // reactor thread only
+};
+
+#endif // IOURINGREACTOR_H
\ No newline at end of file
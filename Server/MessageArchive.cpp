@@ -0,0 +1,274 @@
+#include "MessageArchive.h"
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QTimeZone>
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+const quint32 kMagic = 0x43415243; // "CARC"
+const quint8 kVersion = 1;
+const int kInflatedSegments = 4;
+
+QString conversationOf(const ChatProtocol::Message& msg) {
+    return msg.type == ChatProtocol::MessageType::PRIVATE_MESSAGE
+        ? MessageLog::privateConversation(msg.sender, msg.recipient)
+        : MessageLog::groupConversation(msg.recipient);
+}
+
+bool segmentOrder(const MessageArchive::Segment& a, const MessageArchive::Segment& b) {
+    if (a.kind != b.kind) return a.kind < b.kind;
+    return a.firstId < b.firstId;
+}
+}
+
+bool MessageArchive::open(const QString& directory) {
+    QDir dir(directory);
+    if (!dir.mkpath(".")) {
+        qDebug() << "Cannot create archive directory" << directory;
+        return false;
+    }
+    m_directory = dir.absolutePath();
+    
+    QList<Segment> segments;
+    for (const QString& name : dir.entryList({"*.arc"}, QDir::Files)) {
+        Segment segment;
+        if (readHeader(dir.filePath(name), &segment)) {
+            segments.append(segment);
+        } else {
+            qDebug() << "Skipping unreadable archive segment" << name;
+        }
+    }
+    std::sort(segments.begin(), segments.end(), segmentOrder);
+    
+    QWriteLocker locker(&m_lock);
+    m_segments = segments;
+    qDebug() << "Message archive opened:" << m_segments.size() << "segments";
+    return true;
+}
+
+bool MessageArchive::write(MessageLog::Kind kind, const QList<ChatProtocol::Message>& messages, Segment *segment) {
+    if (messages.isEmpty()) return false;
+    
+    segment->kind = kind;
+    segment->firstId = messages.first().messageId;
+    segment->lastId = messages.last().messageId;
+    segment->conversations.clear();
+    
+    QByteArray records;
+    QDataStream out(&records, QIODevice::WriteOnly);
+    out << quint32(messages.size());
+    for (const ChatProtocol::Message& msg : messages) {
+        out << qint32(msg.messageId) << msg.timestamp.toMSecsSinceEpoch() << msg.sender << msg.recipient << msg.content;
+        segment->conversations.insert(conversationOf(msg));
+    }
+    
+    QStringList conversations(segment->conversations.cbegin(), segment->conversations.cend());
+    conversations.sort();
+    
+    segment->path = QDir(m_directory).filePath(QString("%1-%2.arc")
+                                               .arg(kind == MessageLog::PRIVATE ? "private" : "group")
+                                               .arg(segment->firstId, 10, 10, QChar('0')));
+    
+    // Written aside and renamed, so a crash never leaves a partial segment
+    QSaveFile file(segment->path);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    
+    QDataStream stream(&file);
+    stream << kMagic << kVersion << quint8(kind) << qint32(segment->firstId) << qint32(segment->lastId)
+           << conversations << qCompress(records);
+    return stream.status() == QDataStream::Ok && file.commit();
+}
+
+void MessageArchive::publish(const Segment& segment) {
+    QWriteLocker locker(&m_lock);
+    
+    // A rerun after a crash rewrites the same file
+    m_segments.removeIf([&segment](const Segment& existing) { return existing.path == segment.path; });
+    auto it = std::upper_bound(m_segments.begin(), m_segments.end(), segment, segmentOrder);
+    m_segments.insert(it, segment);
+}
+
+void MessageArchive::discard(const Segment& segment) {
+    QFile::remove(segment.path);
+}
+
+bool MessageArchive::readHeader(const QString& path, Segment *segment) const {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    
+    QDataStream stream(&file);
+    quint32 magic = 0;
+    quint8 version = 0;
+    quint8 kind = 0;
+    qint32 firstId = 0;
+    qint32 lastId = 0;
+    QStringList conversations;
+    stream >> magic >> version >> kind >> firstId >> lastId >> conversations;
+    if (stream.status() != QDataStream::Ok || magic != kMagic || version != kVersion || kind > MessageLog::GROUP) {
+        return false;
+    }
+    
+    segment->path = path;
+    segment->kind = MessageLog::Kind(kind);
+    segment->firstId = firstId;
+    segment->lastId = lastId;
+    segment->conversations = QSet<QString>(conversations.cbegin(), conversations.cend());
+    return true;
+}
+
+MessageArchive::Records MessageArchive::load(const Segment& segment) const {
+    {
+        QMutexLocker locker(&m_inflatedMutex);
+        for (int i = 0; i < m_inflated.size(); ++i) {
+            if (m_inflated[i].first == segment.path) {
+                m_inflated.move(i, 0);
+                return m_inflated.first().second;
+            }
+        }
+    }
+    
+    QFile file(segment.path);
+    if (!file.open(QIODevice::ReadOnly)) return nullptr;
+    
+    QDataStream stream(&file);
+    quint32 magic;
+    quint8 version, kind;
+    qint32 firstId, lastId;
+    QStringList conversations;
+    QByteArray compressed;
+    stream >> magic >> version >> kind >> firstId >> lastId >> conversations >> compressed;
+    if (stream.status() != QDataStream::Ok) return nullptr;
+    
+    QByteArray data = qUncompress(compressed);
+    QDataStream in(data);
+    quint32 count = 0;
+    in >> count;
+    
+    auto records = std::make_shared<QList<ChatProtocol::Message>>();
+    records->reserve(count);
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        ChatProtocol::Message msg;
+        qint32 id;
+        qint64 msecs;
+        in >> id >> msecs >> msg.sender >> msg.recipient >> msg.content;
+        msg.type = segment.kind == MessageLog::PRIVATE ? ChatProtocol::MessageType::PRIVATE_MESSAGE
+                                                       : ChatProtocol::MessageType::GROUP_MESSAGE;
+        msg.timestamp = QDateTime::fromMSecsSinceEpoch(msecs, QTimeZone::UTC);
+        msg.messageId = id;
+        records->append(msg);
+    }
+    if (in.status() != QDataStream::Ok) {
+        qDebug() << "Corrupt archive segment" << segment.path;
+        return nullptr;
+    }
+    
+    QMutexLocker locker(&m_inflatedMutex);
+    m_inflated.prepend({segment.path, records});
+    if (m_inflated.size() > kInflatedSegments) m_inflated.removeLast();
+    return records;
+}
+
+QList<ChatProtocol::Message> MessageArchive::history(const QString& conversation, int limit, int offset) const {
+    QList<ChatProtocol::Message> messages;
+    if (limit <= 0) return messages;
+    
+    QList<Segment> candidates;
+    {
+        QReadLocker locker(&m_lock);
+        for (auto it = m_segments.crbegin(); it != m_segments.crend(); ++it) {
+            if (it->conversations.contains(conversation)) candidates.append(*it);
+        }
+    }
+    
+    // Collect newest first until the page and everything it skips are covered
+    QList<ChatProtocol::Message> newest;
+    int needed = offset + limit;
+    for (const Segment& segment : candidates) {
+        Records records = load(segment);
+        if (!records) continue;
+        
+        for (auto it = records->crbegin(); it != records->crend() && newest.size() < needed; ++it) {
+            if (conversationOf(*it) == conversation) newest.append(*it);
+        }
+        if (newest.size() >= needed) break;
+    }
+    
+    for (int i = int(newest.size()) - 1; i >= offset; --i) {
+        messages.append(newest[i]);
+    }
+    return messages;
+}
+
+QList<ChatProtocol::Message> MessageArchive::before(const QString& conversation, int beforeId, int limit) const {
+    QList<ChatProtocol::Message> messages;
+    if (limit <= 0) return messages;
+    
+    QList<Segment> candidates;
+    {
+        QReadLocker locker(&m_lock);
+        for (auto it = m_segments.crbegin(); it != m_segments.crend(); ++it) {
+            if (it->firstId < beforeId && it->conversations.contains(conversation)) candidates.append(*it);
+        }
+    }
+    
+    // Newest first from just below the id, then flipped
+    QList<ChatProtocol::Message> newest;
+    for (const Segment& segment : candidates) {
+        Records records = load(segment);
+        if (!records) continue;
+        
+        for (auto it = records->crbegin(); it != records->crend() && newest.size() < limit; ++it) {
+            if (it->messageId < beforeId && conversationOf(*it) == conversation) newest.append(*it);
+        }
+        if (newest.size() >= limit) break;
+    }
+    
+    for (auto it = newest.crbegin(); it != newest.crend(); ++it) {
+        messages.append(*it);
+    }
+    return messages;
+}
+
+QList<ChatProtocol::Message> MessageArchive::after(const QString& conversation, int afterId, int limit) const {
+    QList<ChatProtocol::Message> messages;
+    if (limit <= 0) return messages;
+    
+    QList<Segment> candidates;
+    {
+        QReadLocker locker(&m_lock);
+        for (const Segment& segment : m_segments) {
+            if (segment.lastId > afterId && segment.conversations.contains(conversation)) candidates.append(segment);
+        }
+    }
+    
+    for (const Segment& segment : candidates) {
+        Records records = load(segment);
+        if (!records) continue;
+        
+        for (const ChatProtocol::Message& msg : *records) {
+            if (msg.messageId > afterId && conversationOf(msg) == conversation) {
+                messages.append(msg);
+                if (messages.size() == limit) return messages;
+            }
+        }
+    }
+    return messages;
+}
+
+int MessageArchive::lastId(MessageLog::Kind kind) const {
+    QReadLocker locker(&m_lock);
+    int id = 0;
+    for (const Segment& segment : m_segments) {
+        if (segment.kind == kind) id = qMax(id, segment.lastId);
+    }
+    return id;
+}
+
+int MessageArchive::segmentCount() const {
+    QReadLocker locker(&m_lock);
+    return int(m_segments.size());
+}
\ No newline at end of file
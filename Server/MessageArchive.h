@@ -0,0 +1,58 @@
+#ifndef MESSAGEARCHIVE_H
+#define MESSAGEARCHIVE_H
+
+#include <QString>
+#include <QSet>
+#include <QList>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <memory>
+#include "Protocol.h"
+#include "MessageLog.h"
+
+// Cold message history moved out of the SQLite tables by the retention job.
+// Each segment is an immutable file holding one kind of message in id order:
+// a small uncompressed header listing its id range and conversations, then
+// the records as one qCompress()ed block. Only headers are kept in memory;
+// a query inflates the segments that mention its conversation, newest first,
+// and keeps the last few inflated in a small LRU.
+class MessageArchive {
+public:
+    struct Segment {
+        QString path;
+        MessageLog::Kind kind = MessageLog::PRIVATE;
+        int firstId = 0;
+        int lastId = 0;
+        QSet<QString> conversations; // MessageLog conversation keys
+    };
+    
+    bool open(const QString& directory);
+    
+    // Writes a segment file for messages sorted by id; it is not searched until published
+    bool write(MessageLog::Kind kind, const QList<ChatProtocol::Message>& messages, Segment *segment);
+    void publish(const Segment& segment);
+    void discard(const Segment& segment);
+    
+    // Same windows as the hot table queries, oldest first
+    QList<ChatProtocol::Message> history(const QString& conversation, int limit, int offset) const;
+    QList<ChatProtocol::Message> before(const QString& conversation, int beforeId, int limit) const;
+    QList<ChatProtocol::Message> after(const QString& conversation, int afterId, int limit) const;
+    
+    int lastId(MessageLog::Kind kind) const;
+    int segmentCount() const;
+    
+private:
+    using Records = std::shared_ptr<const QList<ChatProtocol::Message>>;
+    
+    bool readHeader(const QString& path, Segment *segment) const;
+    Records load(const Segment& segment) const;
+    
+    QString m_directory;
+    QList<Segment> m_segments; // by kind, then ascending ids
+    mutable QReadWriteLock m_lock;
+    
+    mutable QList<QPair<QString, Records>> m_inflated; // most recent first
+    mutable QMutex m_inflatedMutex;
+};
+
+#endif // MESSAGEARCHIVE_H
\ No newline at end of file
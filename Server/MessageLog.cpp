@@ -0,0 +1,365 @@
+#include "MessageLog.h"
+#include <QDir>
+#include <QDateTime>
+#include <QTimeZone>
+#include <QDebug>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+const qint64 kSegmentBytes = 64 * 1024 * 1024; // preallocated, so the mapping never moves
+const int kHeaderBytes = 8;                    // payload size, checksum, kind, reserved
+const int kFixedPayload = 20;                  // id, timestamp, three field lengths
+
+struct Record {
+    quint8 kind;
+    qint32 id;
+    qint64 msecs;
+    QString sender;
+    QString recipient;
+    QString content;
+    qint64 size; // header included
+};
+
+// A zero size marks the unwritten tail; a bad checksum marks a torn append
+bool decodeRecord(const uchar *p, qint64 available, Record *record) {
+    if (available < kHeaderBytes) return false;
+    
+    quint32 size = qFromLittleEndian<quint32>(p);
+    if (size < quint32(kFixedPayload) || size > available - kHeaderBytes) return false;
+    
+    const uchar *payload = p + kHeaderBytes;
+    quint16 checksum = qFromLittleEndian<quint16>(p + 4);
+    if (qChecksum(QByteArrayView(payload, size)) != checksum) return false;
+    
+    quint16 senderBytes = qFromLittleEndian<quint16>(payload + 12);
+    quint16 recipientBytes = qFromLittleEndian<quint16>(payload + 14);
+    quint32 contentBytes = qFromLittleEndian<quint32>(payload + 16);
+    if (quint64(kFixedPayload) + senderBytes + recipientBytes + contentBytes != size) return false;
+    
+    const char *text = reinterpret_cast<const char*>(payload + kFixedPayload);
+    record->kind = p[6];
+    record->id = qFromLittleEndian<qint32>(payload);
+    record->msecs = qFromLittleEndian<qint64>(payload + 4);
+    record->sender = QString::fromUtf8(text, senderBytes);
+    record->recipient = QString::fromUtf8(text + senderBytes, recipientBytes);
+    record->content = QString::fromUtf8(text + senderBytes + recipientBytes, contentBytes);
+    record->size = kHeaderBytes + size;
+    return record->kind <= MessageLog::GROUP;
+}
+}
+
+MessageLog::MessageLog(int shardCount)
+    : m_shardCount(qMax(1, shardCount)) {
+    m_lastId[PRIVATE] = 0;
+    m_lastId[GROUP] = 0;
+}
+
+MessageLog::~MessageLog() {
+    close();
+}
+
+bool MessageLog::open(const QString& directory) {
+    close();
+    
+    QDir dir(directory);
+    if (!dir.mkpath(".")) {
+        qDebug() << "Cannot create message log directory" << directory;
+        return false;
+    }
+    
+    // Conversations are routed by shard count, so an existing log keeps its own
+    int shardCount = dir.entryList({"shard-*"}, QDir::Dirs).size();
+    if (shardCount == 0) shardCount = m_shardCount;
+    
+    for (int i = 0; i < shardCount; ++i) {
+        auto shard = std::make_unique<Shard>();
+        shard->directory = dir.filePath(QString("shard-%1").arg(i));
+        if (!openShard(*shard)) {
+            close();
+            return false;
+        }
+        m_shards.push_back(std::move(shard));
+    }
+    
+    for (int kind = PRIVATE; kind <= GROUP; ++kind) {
+        QMutexLocker locker(&m_watermarks[kind].mutex);
+        m_watermarks[kind].committed = m_lastId[kind].load();
+        m_watermarks[kind].done.clear();
+    }
+    
+    qDebug() << "Message log opened at" << directory << "with" << shardCount << "shards, last ids"
+             << m_lastId[PRIVATE].load() << m_lastId[GROUP].load();
+    return true;
+}
+
+void MessageLog::close() {
+    for (auto& shard : m_shards) {
+        QWriteLocker locker(&shard->lock);
+        for (auto& segment : shard->segments) {
+            segment->file.unmap(segment->data);
+            segment->file.close();
+        }
+    }
+    m_shards.clear();
+    
+    QWriteLocker locker(&m_usersLock);
+    m_userConversations.clear();
+}
+
+QString MessageLog::privateConversation(const QString& user1, const QString& user2) {
+    // Both directions of a chat share one conversation
+    return user1 < user2 ? "p:" + user1 + '\n' + user2 : "p:" + user2 + '\n' + user1;
+}
+
+QString MessageLog::groupConversation(const QString& groupName) {
+    return "g:" + groupName;
+}
+
+MessageLog::Shard& MessageLog::shardFor(const QString& conversation) const {
+    // FNV-1a; qHash is seeded per process and would move conversations between runs
+    quint32 hash = 2166136261u;
+    for (QChar c : conversation) {
+        hash = (hash ^ c.unicode()) * 16777619u;
+    }
+    return *m_shards[hash % m_shards.size()];
+}
+
+bool MessageLog::openShard(Shard& shard) {
+    QDir dir(shard.directory);
+    if (!dir.mkpath(".")) return false;
+    
+    QStringList files = dir.entryList({"*.seg"}, QDir::Files, QDir::Name);
+    for (int i = 0; i < files.size(); ++i) {
+        if (!openSegment(shard, i)) return false;
+        scanSegment(shard, quint16(i));
+    }
+    
+    if (shard.segments.empty()) return openSegment(shard, 0);
+    return true;
+}
+
+bool MessageLog::openSegment(Shard& shard, int number) {
+    auto segment = std::make_unique<Segment>();
+    segment->file.setFileName(QDir(shard.directory).filePath(QString("%1.seg").arg(number, 6, 10, QChar('0'))));
+    
+    if (!segment->file.open(QIODevice::ReadWrite)) {
+        qDebug() << "Cannot open log segment" << segment->file.fileName() << segment->file.errorString();
+        return false;
+    }
+    
+    if (segment->file.size() < kSegmentBytes && !segment->file.resize(kSegmentBytes)) return false;
+    
+    segment->data = segment->file.map(0, kSegmentBytes);
+    if (!segment->data) {
+        qDebug() << "Cannot map log segment" << segment->file.fileName() << segment->file.errorString();
+        return false;
+    }
+    
+    shard.segments.push_back(std::move(segment));
+    return true;
+}
+
+void MessageLog::scanSegment(Shard& shard, quint16 number) {
+    Segment& segment = *shard.segments[number];
+    Record record;
+    qint64 pos = 0;
+    
+    while (decodeRecord(segment.data + pos, kSegmentBytes - pos, &record)) {
+        QString conversation = record.kind == PRIVATE ? privateConversation(record.sender, record.recipient)
+                                                      : groupConversation(record.recipient);
+        shard.index[conversation].append({record.id, quint32(pos), number});
+        if (record.id > m_lastId[record.kind]) m_lastId[record.kind] = record.id;
+        if (record.kind == PRIVATE) noteParticipants(record.sender, record.recipient, conversation);
+        pos += record.size;
+    }
+    segment.end = pos;
+    
+    // Zero whatever a crash left past the last good record so appends start clean
+    if (pos + kHeaderBytes <= kSegmentBytes && qFromLittleEndian<quint32>(segment.data + pos) != 0) {
+        qDebug() << "Dropping torn tail of" << segment.file.fileName() << "at" << pos;
+        segment.file.resize(pos);
+        segment.file.resize(kSegmentBytes);
+    }
+}
+
+int MessageLog::append(Kind kind, const QString& sender, const QString& recipient, const QString& content) {
+    if (m_shards.empty()) return 0;
+    
+    QByteArray senderBytes = sender.toUtf8();
+    QByteArray recipientBytes = recipient.toUtf8();
+    QByteArray contentBytes = content.toUtf8();
+    if (senderBytes.size() > 0xffff || recipientBytes.size() > 0xffff) return 0;
+    
+    qint64 payloadSize = kFixedPayload + senderBytes.size() + recipientBytes.size() + contentBytes.size();
+    if (kHeaderBytes + payloadSize > kSegmentBytes) return 0;
+    
+    // Build the record outside the lock; only the id and checksum depend on it
+    QByteArray record(kHeaderBytes + payloadSize, Qt::Uninitialized);
+    uchar *p = reinterpret_cast<uchar*>(record.data());
+    uchar *payload = p + kHeaderBytes;
+    qToLittleEndian<quint32>(quint32(payloadSize), p);
+    p[6] = kind;
+    p[7] = 0;
+    qToLittleEndian<qint64>(QDateTime::currentMSecsSinceEpoch(), payload + 4);
+    qToLittleEndian<quint16>(quint16(senderBytes.size()), payload + 12);
+    qToLittleEndian<quint16>(quint16(recipientBytes.size()), payload + 14);
+    qToLittleEndian<quint32>(quint32(contentBytes.size()), payload + 16);
+    char *text = reinterpret_cast<char*>(payload + kFixedPayload);
+    memcpy(text, senderBytes.constData(), senderBytes.size());
+    memcpy(text + senderBytes.size(), recipientBytes.constData(), recipientBytes.size());
+    memcpy(text + senderBytes.size() + recipientBytes.size(), contentBytes.constData(), contentBytes.size());
+    
+    QString conversation = kind == PRIVATE ? privateConversation(sender, recipient) : groupConversation(recipient);
+    Shard& shard = shardFor(conversation);
+    
+    QWriteLocker locker(&shard.lock);
+    
+    if (shard.segments.back()->end + record.size() > kSegmentBytes) {
+        if (shard.segments.size() > 0xffff || !openSegment(shard, int(shard.segments.size()))) return 0;
+    }
+    Segment& segment = *shard.segments.back();
+    
+    // Ids are taken under the shard lock so each conversation's index stays sorted
+    int id = m_lastId[kind].fetch_add(1) + 1;
+    qToLittleEndian<qint32>(id, payload);
+    qToLittleEndian<quint16>(qChecksum(QByteArrayView(payload, payloadSize)), p + 4);
+    
+    if (!segment.file.seek(segment.end) || segment.file.write(record) != record.size() || !segment.file.flush()) {
+        qDebug() << "Message log append failed:" << segment.file.errorString();
+        locker.unlock();
+        commit(kind, id); // the id stays unused, but later ones must not wait on it
+        return 0;
+    }
+    
+    shard.index[conversation].append({id, quint32(segment.end), quint16(shard.segments.size() - 1)});
+    segment.end += record.size();
+    locker.unlock();
+    
+    if (kind == PRIVATE) noteParticipants(sender, recipient, conversation);
+    commit(kind, id);
+    return id;
+}
+
+void MessageLog::commit(Kind kind, int id) {
+    Watermark& watermark = m_watermarks[kind];
+    QMutexLocker locker(&watermark.mutex);
+    
+    if (id != watermark.committed + 1) {
+        watermark.done.insert(id);
+        return;
+    }
+    watermark.committed = id;
+    while (watermark.done.remove(watermark.committed + 1)) {
+        ++watermark.committed;
+    }
+}
+
+int MessageLog::latestId(Kind kind) const {
+    QMutexLocker locker(&m_watermarks[kind].mutex);
+    return m_watermarks[kind].committed;
+}
+
+ChatProtocol::Message MessageLog::read(const Shard& shard, const Location& location) const {
+    const Segment& segment = *shard.segments[location.segment];
+    Record record;
+    ChatProtocol::Message msg;
+    if (!decodeRecord(segment.data + location.offset, segment.end - location.offset, &record)) return msg;
+    
+    msg.type = record.kind == PRIVATE ? ChatProtocol::MessageType::PRIVATE_MESSAGE
+                                      : ChatProtocol::MessageType::GROUP_MESSAGE;
+    msg.sender = record.sender;
+    msg.recipient = record.recipient;
+    msg.content = record.content;
+    msg.timestamp = QDateTime::fromMSecsSinceEpoch(record.msecs, QTimeZone::UTC);
+    msg.messageId = record.id;
+    return msg;
+}
+
+QList<ChatProtocol::Message> MessageLog::history(const QString& conversation, int limit, int offset) const {
+    QList<ChatProtocol::Message> messages;
+    if (m_shards.empty() || limit <= 0) return messages;
+    
+    const Shard& shard = shardFor(conversation);
+    QReadLocker locker(&shard.lock);
+    
+    auto it = shard.index.constFind(conversation);
+    if (it == shard.index.cend()) return messages;
+    
+    qsizetype end = it->size() - qMax(0, offset);
+    qsizetype begin = qMax<qsizetype>(0, end - limit);
+    for (qsizetype i = begin; i < end; ++i) {
+        messages.append(read(shard, it->at(i)));
+    }
+    return messages;
+}
+
+QList<ChatProtocol::Message> MessageLog::before(const QString& conversation, int beforeId, int limit) const {
+    QList<ChatProtocol::Message> messages;
+    if (m_shards.empty() || limit <= 0) return messages;
+    
+    const Shard& shard = shardFor(conversation);
+    QReadLocker locker(&shard.lock);
+    
+    auto it = shard.index.constFind(conversation);
+    if (it == shard.index.cend()) return messages;
+    
+    auto end = std::lower_bound(it->cbegin(), it->cend(), beforeId, [](const Location& location, int id) {
+        return location.id < id;
+    });
+    auto begin = end - qMin<qsizetype>(limit, end - it->cbegin());
+    for (; begin != end; ++begin) {
+        messages.append(read(shard, *begin));
+    }
+    return messages;
+}
+
+QList<ChatProtocol::Message> MessageLog::after(const QString& conversation, int afterId, int limit) const {
+    QList<ChatProtocol::Message> messages;
+    if (m_shards.empty() || limit <= 0) return messages;
+    
+    const Shard& shard = shardFor(conversation);
+    QReadLocker locker(&shard.lock);
+    
+    auto it = shard.index.constFind(conversation);
+    if (it == shard.index.cend()) return messages;
+    
+    auto from = std::upper_bound(it->cbegin(), it->cend(), afterId, [](int id, const Location& location) {
+        return id < location.id;
+    });
+    for (; from != it->cend() && messages.size() < limit; ++from) {
+        messages.append(read(shard, *from));
+    }
+    return messages;
+}
+
+QList<ChatProtocol::Message> MessageLog::after(const QStringList& conversations, int afterId, int limit) const {
+    QList<ChatProtocol::Message> messages;
+    for (const QString& conversation : conversations) {
+        messages.append(after(conversation, afterId, limit));
+    }
+    
+    std::sort(messages.begin(), messages.end(), [](const ChatProtocol::Message& a, const ChatProtocol::Message& b) {
+        return a.messageId < b.messageId;
+    });
+    if (messages.size() > limit) messages.resize(limit);
+    return messages;
+}
+
+QStringList MessageLog::privateConversationsOf(const QString& username) const {
+    QReadLocker locker(&m_usersLock);
+    return m_userConversations.value(username).values();
+}
+
+void MessageLog::noteParticipants(const QString& sender, const QString& recipient, const QString& conversation) {
+    {
+        QReadLocker locker(&m_usersLock);
+        auto it = m_userConversations.constFind(sender);
+        if (it != m_userConversations.cend() && it->contains(conversation)) return;
+    }
+    
+    QWriteLocker locker(&m_usersLock);
+    m_userConversations[sender].insert(conversation);
+    m_userConversations[recipient].insert(conversation);
+}
\ No newline at end of file
@@ -0,0 +1,101 @@
+#ifndef MESSAGELOG_H
+#define MESSAGELOG_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QFile>
+#include <QReadWriteLock>
+#include <QMutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "Protocol.h"
+
+// Append-only message store, an alternative to the SQLite message tables.
+// Conversations are spread over shards by a stable hash; each shard appends
+// to fixed-size segment files that are memory-mapped once for reads, and
+// keeps an in-memory index of record offsets per conversation. Sending is a
+// single append under the shard's lock, and a history page is a walk over
+// ascending offsets in the mapping. Indexes are rebuilt by scanning the
+// segments on open, which also drops a torn record at the tail.
+class MessageLog {
+public:
+    enum Kind : quint8 {
+        PRIVATE,
+        GROUP
+    };
+    
+    explicit MessageLog(int shardCount = 16);
+    ~MessageLog();
+    
+    bool open(const QString& directory);
+    void close();
+    
+    static QString privateConversation(const QString& user1, const QString& user2);
+    static QString groupConversation(const QString& groupName);
+    
+    // Returns the new message id, or 0 if it could not be written
+    int append(Kind kind, const QString& sender, const QString& recipient, const QString& content);
+    
+    // Same windows as the SQLite queries: newest page after skipping offset, the
+    // page just below an id, or everything after an id; all returned oldest first
+    QList<ChatProtocol::Message> history(const QString& conversation, int limit, int offset) const;
+    QList<ChatProtocol::Message> before(const QString& conversation, int beforeId, int limit) const;
+    QList<ChatProtocol::Message> after(const QString& conversation, int afterId, int limit) const;
+    QList<ChatProtocol::Message> after(const QStringList& conversations, int afterId, int limit) const;
+    
+    QStringList privateConversationsOf(const QString& username) const;
+    
+    // Highest id with every id up to it written and indexed, so a reader that
+    // asks for rows after an older id and sees nothing up to here misses none
+    int latestId(Kind kind) const;
+    
+private:
+    struct Location {
+        qint32 id;
+        quint32 offset;
+        quint16 segment;
+    };
+    
+    struct Segment {
+        QFile file;
+        uchar *data = nullptr; // mapped for the full segment size
+        qint64 end = 0;        // bytes of valid records
+    };
+    
+    struct Shard {
+        QString directory;
+        mutable QReadWriteLock lock;
+        std::vector<std::unique_ptr<Segment>> segments; // the last one takes appends
+        QHash<QString, QVector<Location>> index;        // conversation -> records, oldest first
+    };
+    
+    Shard& shardFor(const QString& conversation) const;
+    bool openShard(Shard& shard);
+    bool openSegment(Shard& shard, int number);
+    void scanSegment(Shard& shard, quint16 number);
+    ChatProtocol::Message read(const Shard& shard, const Location& location) const;
+    void noteParticipants(const QString& sender, const QString& recipient, const QString& conversation);
+    void commit(Kind kind, int id);
+    
+    // Appends on different shards finish out of order; the committed id only
+    // moves past an id once it and everything below it are done
+    struct Watermark {
+        mutable QMutex mutex;
+        int committed = 0;
+        QSet<int> done; // finished above committed, waiting on a lower id
+    };
+    
+    int m_shardCount; // used when the directory is new, otherwise what it was created with
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::atomic<int> m_lastId[2]; // last id handed out
+    Watermark m_watermarks[2];
+    
+    mutable QReadWriteLock m_usersLock;
+    QHash<QString, QSet<QString>> m_userConversations; // username -> private conversations
+};
+
+#endif // MESSAGELOG_H
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include "NameTable.h"
+
+NameId NameTable::intern(const QString& name) {
+    if (name.isEmpty()) return INVALID_NAME;
+    
+    {
+        QReadLocker locker(&m_lock);
+        NameId id = m_ids.value(name, INVALID_NAME);
+        if (id != INVALID_NAME) return id;
+    }
+    
+    QWriteLocker locker(&m_lock);
+    auto it = m_ids.find(name);
+    if (it != m_ids.end()) return it.value();
+    
+    m_names.append(name);
+    NameId id = NameId(m_names.size());
+    m_ids.insert(m_names.last(), id);
+    return id;
+}
+
+NameId NameTable::find(const QString& name) const {
+    QReadLocker locker(&m_lock);
+    return m_ids.value(name, INVALID_NAME);
+}
+
+QString NameTable::name(NameId id) const {
+    QReadLocker locker(&m_lock);
+    if (id == INVALID_NAME || id > NameId(m_names.size())) return QString();
+    return m_names[id - 1];
+}
+
+int NameTable::size() const {
+    QReadLocker locker(&m_lock);
+    return int(m_names.size());
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef NAMETABLE_H
+#define NAMETABLE_H
+
+#include <QString>
+#include <QHash>
+#include <QVector>
+#include <QReadWriteLock>
+
+using NameId = quint32;
+constexpr NameId INVALID_NAME = 0;
+
+// Interns usernames and group names: each distinct name is stored once and
+// identified by a compact id, so hot-path lookups and comparisons work on
+// integers and every message reuses the same shared string data.
+class NameTable {
+public:
+    NameId intern(const QString& name);
+    NameId find(const QString& name) const;
+    QString name(NameId id) const;
+    
+    int size() const;
+    
+private:
+    mutable QReadWriteLock m_lock;
+    QHash<QString, NameId> m_ids;
+    QVector<QString> m_names; // id - 1 -> name
+};
+
+#endif // NAMETABLE_H
\ No newline at end of file
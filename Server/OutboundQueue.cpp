@@ -0,0 +1,144 @@
+#include "OutboundQueue.h"
+#include <QDataStream>
+#include <QStringList>
+
+namespace {
+// Live frames sent per bulk frame while both lanes are busy
+const int kLiveWeight = 4;
+
+// The type every part but the last is sent as, or ERROR_MSG if the list is never split
+ChatProtocol::MessageType listPartType(ChatProtocol::MessageType type) {
+    switch (type) {
+        case ChatProtocol::MessageType::USERS_LIST: return ChatProtocol::MessageType::USERS_LIST_PART;
+        case ChatProtocol::MessageType::GROUPS_LIST: return ChatProtocol::MessageType::GROUPS_LIST_PART;
+        case ChatProtocol::MessageType::GROUP_MEMBERS_RESPONSE: return ChatProtocol::MessageType::GROUP_MEMBERS_PART;
+        default: return ChatProtocol::MessageType::ERROR_MSG;
+    }
+}
+}
+
+OutboundQueue::Lane OutboundQueue::laneFor(ChatProtocol::MessageType type) {
+    switch (type) {
+        case ChatProtocol::MessageType::PRIVATE_MESSAGE:
+        case ChatProtocol::MessageType::GROUP_MESSAGE:
+        case ChatProtocol::MessageType::TYPING:
+        case ChatProtocol::MessageType::GROUP_TYPING:
+        case ChatProtocol::MessageType::READ_RECEIPT:
+            return LIVE_LANE;
+        case ChatProtocol::MessageType::USERS_LIST:
+        case ChatProtocol::MessageType::GROUPS_LIST:
+        case ChatProtocol::MessageType::MESSAGE_HISTORY_RESPONSE:
+        case ChatProtocol::MessageType::MESSAGE_HISTORY_END: // same lane, so it stays behind the rows
+        case ChatProtocol::MessageType::GROUP_MEMBERS_RESPONSE:
+        case ChatProtocol::MessageType::USERS_LIST_PART:
+        case ChatProtocol::MessageType::GROUPS_LIST_PART:
+        case ChatProtocol::MessageType::GROUP_MEMBERS_PART:
+            return BULK_LANE;
+        default:
+            return CONTROL_LANE;
+    }
+}
+
+QByteArray OutboundQueue::encodeFrame(const ChatProtocol::Message& msg) {
+    QByteArray data = msg.serialize();
+    QByteArray block;
+    QDataStream out(&block, QIODevice::WriteOnly);
+    out << quint32(data.size());
+    block.append(data);
+    return block;
+}
+
+bool OutboundQueue::enqueue(const ChatProtocol::Message& msg) {
+    Lane lane = laneFor(msg.type);
+    QList<QByteArray> frames;
+    const ChatProtocol::MessageType partType = listPartType(msg.type);
+    
+    if (partType != ChatProtocol::MessageType::ERROR_MSG && msg.content.size() > kBulkChunkChars) {
+        // Leading parts go out as the part type, so the list's own type still
+        // means the whole (or final) list
+        QList<QStringList> parts(1);
+        int partChars = 0;
+        for (const QString& item : msg.content.split(',')) {
+            if (partChars + item.size() > kBulkChunkChars && !parts.last().isEmpty()) {
+                parts.append(QStringList());
+                partChars = 0;
+            }
+            parts.last().append(item);
+            partChars += item.size() + 1;
+        }
+        
+        ChatProtocol::Message part = msg;
+        for (int i = 0; i < parts.size(); ++i) {
+            part.content = parts[i].join(',');
+            part.type = i + 1 < parts.size() ? partType : msg.type;
+            frames.append(encodeFrame(part));
+        }
+    } else {
+        frames.append(encodeFrame(msg));
+    }
+    
+    QMutexLocker locker(&m_mutex);
+    for (const QByteArray& frame : frames) {
+        m_lanes[lane].enqueue(frame);
+    }
+    
+    if (m_drainScheduled) return false;
+    m_drainScheduled = true;
+    return true;
+}
+
+bool OutboundQueue::enqueueFrame(Lane lane, const QByteArray& frame) {
+    QMutexLocker locker(&m_mutex);
+    m_lanes[lane].enqueue(frame);
+    
+    if (m_drainScheduled) return false;
+    m_drainScheduled = true;
+    return true;
+}
+
+void OutboundQueue::beginDrain() {
+    QMutexLocker locker(&m_mutex);
+    m_drainScheduled = false;
+}
+
+bool OutboundQueue::dequeue(QByteArray *frame) {
+    QMutexLocker locker(&m_mutex);
+    
+    if (!m_lanes[CONTROL_LANE].isEmpty()) {
+        *frame = m_lanes[CONTROL_LANE].dequeue();
+        return true;
+    }
+    
+    bool liveWaiting = !m_lanes[LIVE_LANE].isEmpty();
+    bool bulkWaiting = !m_lanes[BULK_LANE].isEmpty();
+    
+    if (liveWaiting && (!bulkWaiting || m_liveStreak < kLiveWeight)) {
+        ++m_liveStreak;
+        *frame = m_lanes[LIVE_LANE].dequeue();
+        return true;
+    }
+    
+    if (bulkWaiting) {
+        m_liveStreak = 0;
+        *frame = m_lanes[BULK_LANE].dequeue();
+        return true;
+    }
+    
+    return false;
+}
+
+bool OutboundQueue::isEmpty() {
+    QMutexLocker locker(&m_mutex);
+    for (const auto& lane : m_lanes) {
+        if (!lane.isEmpty()) return false;
+    }
+    return true;
+}
+
+void OutboundQueue::clear() {
+    QMutexLocker locker(&m_mutex);
+    for (auto& lane : m_lanes) {
+        lane.clear();
+    }
+    m_liveStreak = 0;
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#ifndef OUTBOUNDQUEUE_H
+#define OUTBOUNDQUEUE_H
+
+#include <QByteArray>
+#include <QQueue>
+#include <QMutex>
+#include <array>
+#include "Protocol.h"
+
+// Per-connection outbound frames, split into priority lanes so a live
+// message is never stuck behind a directory listing or a history replay.
+// Control frames always go first; live and bulk share the rest by weight.
+// Thread-safe: any thread may enqueue, the connection's thread dequeues.
+class OutboundQueue {
+public:
+    enum Lane {
+        CONTROL_LANE,
+        LIVE_LANE,
+        BULK_LANE,
+        LANE_COUNT
+    };
+    
+    // Large list payloads are split into parts of this many characters so no
+    // single bulk frame is big; QString travels as UTF-16, so on the wire a
+    // part is twice that many bytes
+    static constexpr int kBulkChunkChars = 8192;
+    static constexpr qint64 kBulkChunkBytes = 2 * kBulkChunkChars;
+    
+    static Lane laneFor(ChatProtocol::MessageType type);
+    static QByteArray encodeFrame(const ChatProtocol::Message& msg);
+    
+    // Returns true when the caller has to schedule a drain
+    bool enqueue(const ChatProtocol::Message& msg);
+    bool enqueueFrame(Lane lane, const QByteArray& frame); // already encoded, e.g. once per fan-out
+    void beginDrain();
+    bool dequeue(QByteArray *frame);
+    bool isEmpty();
+    void clear();
+    
+private:
+    QMutex m_mutex;
+    std::array<QQueue<QByteArray>, LANE_COUNT> m_lanes;
+    int m_liveStreak = 0;
+    bool m_drainScheduled = false;
+};
+
+#endif // OUTBOUNDQUEUE_H
\ No newline at end of file
@@ -0,0 +1,183 @@
+#include "RateLimiter.h"
+#include <QDataStream>
+
+namespace {
+
+struct Limit {
+    double ratePerSec;
+    double burst;
+};
+
+// Indexed by RateLimiter::Category
+const Limit kConnectionLimits[] = {
+    {1.0, 5.0},   // AUTH
+    {10.0, 20.0}, // MESSAGE
+    {2.0, 10.0},  // HISTORY
+    {1.0, 5.0},   // DIRECTORY
+    {1.0, 5.0},   // GROUP_ADMIN
+    {2.0, 10.0},  // ATTACHMENT
+    {5.0, 10.0},  // EPHEMERAL
+    {5.0, 10.0}   // SEARCH
+};
+
+const Limit kUserLimits[] = {
+    {2.0, 10.0},  // AUTH
+    {20.0, 40.0}, // MESSAGE
+    {4.0, 20.0},  // HISTORY
+    {2.0, 10.0},  // DIRECTORY
+    {2.0, 10.0},  // GROUP_ADMIN
+    {4.0, 20.0},  // ATTACHMENT
+    {10.0, 20.0}, // EPHEMERAL
+    {10.0, 20.0}  // SEARCH
+};
+
+// Auth attempts per peer address; looser than per account, since many users
+// can share one address behind NAT
+const Limit kAddressAuthLimit = {5.0, 30.0};
+
+} // namespace
+
+bool TokenBucket::tryConsume(double ratePerSec, double burst, qint64 nowMs) {
+    if (m_tokens < 0.0) {
+        m_tokens = burst;
+    } else {
+        m_tokens = qMin(burst, m_tokens + (nowMs - m_lastRefillMs) * ratePerSec / 1000.0);
+    }
+    m_lastRefillMs = nowMs;
+    
+    if (m_tokens < 1.0) return false;
+    m_tokens -= 1.0;
+    return true;
+}
+
+bool TokenBucket::isFull(double ratePerSec, double burst, qint64 nowMs) const {
+    return m_tokens < 0.0 || m_tokens + (nowMs - m_lastRefillMs) * ratePerSec / 1000.0 >= burst;
+}
+
+void TokenBucket::save(QDataStream& out) const {
+    out << m_tokens << m_lastRefillMs;
+}
+
+void TokenBucket::load(QDataStream& in) {
+    in >> m_tokens >> m_lastRefillMs;
+}
+
+RateLimiter::Category RateLimiter::categoryFor(ChatProtocol::MessageType type) {
+    switch (type) {
+        case ChatProtocol::MessageType::REGISTER:
+        case ChatProtocol::MessageType::LOGIN:
+        case ChatProtocol::MessageType::RESUME_SESSION:
+            return AUTH;
+        case ChatProtocol::MessageType::PRIVATE_MESSAGE:
+        case ChatProtocol::MessageType::GROUP_MESSAGE:
+            return MESSAGE;
+        case ChatProtocol::MessageType::MESSAGE_HISTORY_REQUEST:
+        case ChatProtocol::MessageType::HISTORY_BEFORE_REQUEST:
+        case ChatProtocol::MessageType::HISTORY_SYNC_REQUEST:
+            return HISTORY;
+        case ChatProtocol::MessageType::GET_USERS:
+        case ChatProtocol::MessageType::GET_GROUPS:
+        case ChatProtocol::MessageType::GROUP_MEMBERS_REQUEST:
+            return DIRECTORY;
+        case ChatProtocol::MessageType::CREATE_GROUP:
+        case ChatProtocol::MessageType::JOIN_GROUP:
+        case ChatProtocol::MessageType::LEAVE_GROUP:
+        case ChatProtocol::MessageType::KICK_MEMBER:
+            return GROUP_ADMIN;
+        case ChatProtocol::MessageType::ATTACHMENT_UPLOAD_REQUEST:
+        case ChatProtocol::MessageType::ATTACHMENT_DOWNLOAD_REQUEST:
+            return ATTACHMENT;
+        case ChatProtocol::MessageType::TYPING:
+        case ChatProtocol::MessageType::GROUP_TYPING:
+        case ChatProtocol::MessageType::READ_RECEIPT:
+            return EPHEMERAL;
+        case ChatProtocol::MessageType::DIRECTORY_SEARCH:
+            return SEARCH; // served from memory, so allowed at typing speed
+        default:
+            return UNLIMITED;
+    }
+}
+
+const char* RateLimiter::categoryName(Category category) {
+    switch (category) {
+        case AUTH: return "auth";
+        case MESSAGE: return "message";
+        case HISTORY: return "history";
+        case DIRECTORY: return "directory";
+        case GROUP_ADMIN: return "group-admin";
+        case ATTACHMENT: return "attachment";
+        case EPHEMERAL: return "ephemeral";
+        case SEARCH: return "search";
+        default: return "unlimited";
+    }
+}
+
+bool RateLimiter::allowConnection(Buckets& buckets, Category category, qint64 nowMs) {
+    if (category == UNLIMITED || !m_enabled) return true;
+    
+    const Limit& limit = kConnectionLimits[category];
+    if (buckets[category].tryConsume(limit.ratePerSec, limit.burst, nowMs)) return true;
+    
+    m_throttled[category].fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool RateLimiter::allowUser(const QString& username, Category category, qint64 nowMs) {
+    if (category == UNLIMITED || username.isEmpty() || !m_enabled) return true;
+    
+    const Limit& limit = kUserLimits[category];
+    bool allowed;
+    {
+        QMutexLocker locker(&m_mutex);
+        allowed = m_userBuckets[username][category].tryConsume(limit.ratePerSec, limit.burst, nowMs);
+    }
+    
+    if (!allowed) {
+        m_throttled[category].fetch_add(1, std::memory_order_relaxed);
+    }
+    return allowed;
+}
+
+bool RateLimiter::allowAddress(const QString& address, qint64 nowMs) {
+    if (address.isEmpty() || !m_enabled) return true;
+    
+    bool allowed;
+    {
+        QMutexLocker locker(&m_mutex);
+        allowed = m_addressBuckets[address].tryConsume(kAddressAuthLimit.ratePerSec, kAddressAuthLimit.burst, nowMs);
+    }
+    
+    if (!allowed) {
+        m_throttled[AUTH].fetch_add(1, std::memory_order_relaxed);
+    }
+    return allowed;
+}
+
+int RateLimiter::pruneIdle(qint64 nowMs) {
+    QMutexLocker locker(&m_mutex);
+    int pruned = 0;
+    
+    for (auto it = m_userBuckets.begin(); it != m_userBuckets.end();) {
+        bool full = true;
+        for (int i = 0; i < CATEGORY_COUNT && full; ++i) {
+            full = (*it)[i].isFull(kUserLimits[i].ratePerSec, kUserLimits[i].burst, nowMs);
+        }
+        
+        if (full) {
+            it = m_userBuckets.erase(it);
+            ++pruned;
+        } else {
+            ++it;
+        }
+    }
+    
+    for (auto it = m_addressBuckets.begin(); it != m_addressBuckets.end();) {
+        if (it->isFull(kAddressAuthLimit.ratePerSec, kAddressAuthLimit.burst, nowMs)) {
+            it = m_addressBuckets.erase(it);
+            ++pruned;
+        } else {
+            ++it;
+        }
+    }
+    return pruned;
+}
\ No newline at end of file
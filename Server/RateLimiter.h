@@ -0,0 +1,73 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <array>
+#include <atomic>
+#include "Protocol.h"
+
+class QDataStream;
+
+class TokenBucket {
+public:
+    bool tryConsume(double ratePerSec, double burst, qint64 nowMs);
+    // True once it has refilled, when dropping it changes nothing
+    bool isFull(double ratePerSec, double burst, qint64 nowMs) const;
+    
+    // Carried to the successor in a restart handoff
+    void save(QDataStream& out) const;
+    void load(QDataStream& in);
+    
+private:
+    double m_tokens = -1.0; // negative until first use, then starts full
+    qint64 m_lastRefillMs = 0;
+};
+
+// Token-bucket limits per request category, checked before any DB work.
+// Connection buckets live in the ClientHandler and need no locking; user
+// buckets are shared by every connection of the same account. Before login,
+// auth attempts also count against the peer address, since a new connection
+// comes with fresh buckets.
+class RateLimiter {
+public:
+    enum Category {
+        AUTH,
+        MESSAGE,
+        HISTORY,
+        DIRECTORY,
+        GROUP_ADMIN,
+        ATTACHMENT,
+        EPHEMERAL,
+        SEARCH,
+        CATEGORY_COUNT,
+        UNLIMITED = CATEGORY_COUNT
+    };
+    
+    using Buckets = std::array<TokenBucket, CATEGORY_COUNT>;
+    
+    static Category categoryFor(ChatProtocol::MessageType type);
+    static const char* categoryName(Category category);
+    
+    bool allowConnection(Buckets& buckets, Category category, qint64 nowMs);
+    bool allowUser(const QString& username, Category category, qint64 nowMs);
+    bool allowAddress(const QString& address, qint64 nowMs); // AUTH only
+    
+    // Drops user and address buckets that have refilled; returns how many were dropped
+    int pruneIdle(qint64 nowMs);
+    
+    quint64 throttledCount(Category category) const { return m_throttled[category]; }
+    
+    // Off only for load replays, which would otherwise measure the throttling
+    void setEnabled(bool enabled) { m_enabled = enabled; }
+    
+private:
+    QMutex m_mutex;
+    QHash<QString, Buckets> m_userBuckets;
+    QHash<QString, TokenBucket> m_addressBuckets;
+    std::array<std::atomic<quint64>, CATEGORY_COUNT> m_throttled{};
+    std::atomic<bool> m_enabled{true};
+};
+
+#endif // RATELIMITER_H
\ No newline at end of file
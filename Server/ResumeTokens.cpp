@@ -0,0 +1,68 @@
+#include "ResumeTokens.h"
+#include <QRandomGenerator>
+#include <QDeadlineTimer>
+#include <QDataStream>
+#include "Protocol.h"
+
+QByteArray ResumeTokens::issue(NameId userId) {
+    quint64 random[4];
+    QRandomGenerator::system()->fillRange(random);
+    QByteArray token = QByteArray(reinterpret_cast<const char*>(random), sizeof(random)).toHex();
+    
+    const qint64 now = QDeadlineTimer::current().deadline();
+    
+    QMutexLocker locker(&m_mutex);
+    for (auto it = m_tokens.begin(); it != m_tokens.end();) {
+        if (it.value().expiresAt < now) {
+            it = m_tokens.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    m_tokens.insert(token, {userId, now + ChatProtocol::RESUME_TOKEN_LIFETIME_MS});
+    return token;
+}
+
+bool ResumeTokens::redeem(const QByteArray& token, NameId userId) {
+    QMutexLocker locker(&m_mutex);
+    auto it = m_tokens.find(token);
+    if (it == m_tokens.end()) return false;
+    
+    Entry entry = it.value();
+    m_tokens.erase(it);
+    return entry.userId == userId && entry.expiresAt >= QDeadlineTimer::current().deadline();
+}
+
+QByteArray ResumeTokens::save(const NameTable& names) {
+    const qint64 now = QDeadlineTimer::current().deadline();
+    QByteArray bytes;
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    
+    QMutexLocker locker(&m_mutex);
+    quint32 live = 0;
+    for (const Entry& entry : m_tokens) {
+        if (entry.expiresAt >= now) ++live;
+    }
+    out << live;
+    for (auto it = m_tokens.constBegin(); it != m_tokens.constEnd(); ++it) {
+        if (it.value().expiresAt < now) continue;
+        out << it.key() << names.name(it.value().userId) << it.value().expiresAt;
+    }
+    return bytes;
+}
+
+void ResumeTokens::load(const QByteArray& bytes, NameTable& names) {
+    QDataStream in(bytes);
+    quint32 count = 0;
+    in >> count;
+    
+    QMutexLocker locker(&m_mutex);
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QByteArray token;
+        QString username;
+        qint64 expiresAt = 0;
+        in >> token >> username >> expiresAt;
+        if (in.status() != QDataStream::Ok || username.isEmpty()) break;
+        m_tokens.insert(token, {names.intern(username), expiresAt});
+    }
+}
\ No newline at end of file
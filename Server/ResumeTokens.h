@@ -0,0 +1,33 @@
+#ifndef RESUMETOKENS_H
+#define RESUMETOKENS_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include "NameTable.h"
+
+// Single-use tokens that let a client that lost its connection restore its
+// session without sending credentials again. Each resume consumes the
+// token and the server hands out a fresh one.
+class ResumeTokens {
+public:
+    QByteArray issue(NameId userId);
+    bool redeem(const QByteArray& token, NameId userId);
+    
+    // Live tokens for a successor process on the same host (a restart handoff).
+    // Users travel by name, since ids are per process; expiry times stay valid
+    // because the processes share the monotonic clock.
+    QByteArray save(const NameTable& names);
+    void load(const QByteArray& bytes, NameTable& names);
+    
+private:
+    struct Entry {
+        NameId userId;
+        qint64 expiresAt; // monotonic ms
+    };
+    
+    QMutex m_mutex;
+    QHash<QByteArray, Entry> m_tokens;
+};
+
+#endif // RESUMETOKENS_H
\ No newline at end of file
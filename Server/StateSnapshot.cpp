@@ -0,0 +1,86 @@
+#include "StateSnapshot.h"
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <QDebug>
+
+bool StateSnapshot::write(const QString& path) const {
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    
+    QDataStream stream(&file);
+    stream << kMagic << kVersion << qint32(latestPrivateId) << qint32(latestGroupId) << users;
+    
+    stream << quint32(groups.size());
+    for (const Group& group : groups) {
+        stream << group.name << group.members;
+    }
+    
+    stream << quint32(conversations.size());
+    for (const ConversationCache::Conversation& conversation : conversations) {
+        stream << conversation.key << quint32(conversation.messages.size());
+        for (const ChatProtocol::Message& msg : conversation.messages) {
+            stream << qint32(msg.type) << qint32(msg.messageId) << msg.timestamp.toMSecsSinceEpoch()
+                   << msg.sender << msg.recipient << msg.content;
+        }
+    }
+    
+    return stream.status() == QDataStream::Ok && file.commit();
+}
+
+bool StateSnapshot::read(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || file.size() == 0) return false;
+    
+    uchar *data = file.map(0, file.size());
+    if (!data) return false;
+    
+    // Decoded in place from the mapping; only the strings are copied out
+    const QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(data), file.size());
+    QDataStream stream(bytes);
+    
+    quint32 magic = 0;
+    quint8 version = 0;
+    qint32 privateId = 0;
+    qint32 groupId = 0;
+    stream >> magic >> version;
+    if (magic != kMagic || version != kVersion) {
+        file.unmap(data);
+        return false;
+    }
+    stream >> privateId >> groupId >> users;
+    latestPrivateId = privateId;
+    latestGroupId = groupId;
+    
+    quint32 count = 0;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        Group group;
+        stream >> group.name >> group.members;
+        groups.append(group);
+    }
+    
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        ConversationCache::Conversation conversation;
+        quint32 messages = 0;
+        stream >> conversation.key >> messages;
+        for (quint32 j = 0; j < messages && stream.status() == QDataStream::Ok; ++j) {
+            ChatProtocol::Message msg;
+            qint32 type = 0;
+            qint32 id = 0;
+            qint64 ms = 0;
+            stream >> type >> id >> ms >> msg.sender >> msg.recipient >> msg.content;
+            msg.type = ChatProtocol::MessageType(type);
+            msg.messageId = id;
+            msg.timestamp = QDateTime::fromMSecsSinceEpoch(ms);
+            conversation.messages.append(msg);
+        }
+        conversations.append(conversation);
+    }
+    
+    const bool ok = stream.status() == QDataStream::Ok;
+    file.unmap(data);
+    if (!ok) qDebug() << "Snapshot is truncated or corrupt:" << path;
+    return ok;
+}
\ No newline at end of file
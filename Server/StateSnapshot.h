@@ -0,0 +1,36 @@
+#ifndef STATESNAPSHOT_H
+#define STATESNAPSHOT_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include "Protocol.h"
+#include "ConversationCache.h"
+
+// Warm-start image of the server's in-memory state: the user directory,
+// cached group membership and the history cache. Written aside and renamed
+// like archive segments, and parsed straight out of a file mapping on load.
+// The newest message ids when it was taken tell the loader where to start
+// catching up from the store.
+class StateSnapshot {
+public:
+    struct Group {
+        QString name;
+        QStringList members;
+    };
+    
+    int latestPrivateId = 0; // read before the cache was copied
+    int latestGroupId = 0;
+    QStringList users;
+    QList<Group> groups;
+    QList<ConversationCache::Conversation> conversations;
+    
+    bool write(const QString& path) const;
+    bool read(const QString& path);
+    
+private:
+    static constexpr quint32 kMagic = 0x43534E50; // "CSNP"
+    static constexpr quint8 kVersion = 1;
+};
+
+#endif // STATESNAPSHOT_H
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "TimingWheel.h"
+
+TimingWheel::TimingWheel(int slotCount, qint64 tickMs, qint64 startMs)
+    : m_freeHead(-1), m_current(0), m_tickMs(tickMs), m_lastTickMs(startMs), m_activeCount(0) {
+    
+    // Round up to a power of two so the slot index is a mask
+    int slots = 1;
+    while (slots < slotCount) slots <<= 1;
+    
+    m_slots.fill(-1, slots);
+    m_mask = slots - 1;
+}
+
+TimingWheel::TimerId TimingWheel::schedule(qint64 delayMs, quintptr owner, int kind) {
+    qint64 ticks = qMax<qint64>(1, (delayMs + m_tickMs - 1) / m_tickMs);
+    
+    int index = allocate();
+    Entry& entry = m_entries[index];
+    entry.owner = owner;
+    entry.kind = kind;
+    entry.rounds = quint32((ticks - 1) / m_slots.size());
+    link(index, int((m_current + ticks) & m_mask));
+    
+    ++m_activeCount;
+    return (TimerId(entry.generation) << 32) | TimerId(index + 1);
+}
+
+bool TimingWheel::cancel(TimerId id) {
+    int index = int(id & 0xFFFFFFFF) - 1;
+    quint32 generation = quint32(id >> 32);
+    
+    if (index < 0 || index >= m_entries.size()) return false;
+    Entry& entry = m_entries[index];
+    if (entry.slot < 0 || entry.generation != generation) return false;
+    
+    unlink(index);
+    release(index);
+    --m_activeCount;
+    return true;
+}
+
+QList<TimingWheel::Expired> TimingWheel::advance(qint64 nowMs) {
+    QList<Expired> expired;
+    
+    while (m_lastTickMs + m_tickMs <= nowMs) {
+        m_lastTickMs += m_tickMs;
+        m_current = (m_current + 1) & m_mask;
+        
+        int index = m_slots[m_current];
+        while (index >= 0) {
+            Entry& entry = m_entries[index];
+            int next = entry.next;
+            
+            if (entry.rounds > 0) {
+                --entry.rounds;
+            } else {
+                expired.append({entry.owner, entry.kind});
+                unlink(index);
+                release(index);
+                --m_activeCount;
+            }
+            index = next;
+        }
+    }
+    
+    return expired;
+}
+
+int TimingWheel::allocate() {
+    if (m_freeHead >= 0) {
+        int index = m_freeHead;
+        m_freeHead = m_entries[index].next;
+        return index;
+    }
+    
+    m_entries.append(Entry());
+    return int(m_entries.size()) - 1;
+}
+
+void TimingWheel::release(int index) {
+    Entry& entry = m_entries[index];
+    ++entry.generation; // invalidates outstanding TimerIds
+    entry.slot = -1;
+    entry.prev = -1;
+    entry.next = m_freeHead;
+    m_freeHead = index;
+}
+
+void TimingWheel::link(int index, int slot) {
+    Entry& entry = m_entries[index];
+    entry.slot = slot;
+    entry.prev = -1;
+    entry.next = m_slots[slot];
+    
+    if (entry.next >= 0) {
+        m_entries[entry.next].prev = index;
+    }
+    m_slots[slot] = index;
+}
+
+void TimingWheel::unlink(int index) {
+    Entry& entry = m_entries[index];
+    
+    if (entry.prev >= 0) {
+        m_entries[entry.prev].next = entry.next;
+    } else {
+        m_slots[entry.slot] = entry.next;
+    }
+    
+    if (entry.next >= 0) {
+        m_entries[entry.next].prev = entry.prev;
+    }
+}
\ No newline at end of file
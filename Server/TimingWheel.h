@@ -0,0 +1,55 @@
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <QtGlobal>
+#include <QList>
+#include <QVector>
+
+// Hashed timing wheel: O(1) schedule and cancel for large numbers of
+// coarse-grained deadlines. Not thread-safe; owned by a single thread.
+class TimingWheel {
+public:
+    using TimerId = quint64;
+    static constexpr TimerId InvalidTimer = 0;
+    
+    struct Expired {
+        quintptr owner;
+        int kind;
+    };
+    
+    TimingWheel(int slotCount, qint64 tickMs, qint64 startMs);
+    
+    TimerId schedule(qint64 delayMs, quintptr owner, int kind);
+    bool cancel(TimerId id);
+    QList<Expired> advance(qint64 nowMs);
+    
+    int activeCount() const { return m_activeCount; }
+    qint64 tickInterval() const { return m_tickMs; }
+    
+private:
+    struct Entry {
+        quintptr owner = 0;
+        int kind = 0;
+        quint32 generation = 0;
+        quint32 rounds = 0;
+        int slot = -1; // -1 when the entry is free
+        int prev = -1;
+        int next = -1;
+    };
+    
+    int allocate();
+    void release(int index);
+    void link(int index, int slot);
+    void unlink(int index);
+    
+    QVector<Entry> m_entries;
+    QVector<int> m_slots; // head entry of each slot's list
+    int m_freeHead;
+    int m_mask;
+    int m_current;
+    qint64 m_tickMs;
+    qint64 m_lastTickMs;
+    int m_activeCount;
+};
+
+#endif // TIMINGWHEEL_H
\ No newline at end of file
@@ -0,0 +1,64 @@
+#include "UserDirectory.h"
+
+void UserDirectory::load(const QStringList& names) {
+    QWriteLocker locker(&m_lock);
+    m_entries.clear();
+    for (const QString& name : names) {
+        m_entries.insert({name.toCaseFolded(), name});
+    }
+}
+
+void UserDirectory::insert(const QString& name) {
+    Entry entry{name.toCaseFolded(), name};
+    QWriteLocker locker(&m_lock);
+    m_entries.insert(std::move(entry));
+}
+
+void UserDirectory::merge(const QStringList& names) {
+    QWriteLocker locker(&m_lock);
+    for (const QString& name : names) {
+        m_entries.insert({name.toCaseFolded(), name});
+    }
+}
+
+QStringList UserDirectory::search(const QString& prefix, const QString& cursor, int limit,
+                                  QString *nextCursor) const {
+    const QString key = prefix.toCaseFolded();
+    QStringList names;
+    nextCursor->clear();
+    
+    QReadLocker locker(&m_lock);
+    
+    // Start at the first name with the prefix, or just past the cursor if that is later
+    auto it = m_entries.lower_bound({key, QString()});
+    if (!cursor.isEmpty()) {
+        Entry after{cursor.toCaseFolded(), cursor};
+        if (it != m_entries.end() && !(after < *it)) {
+            it = m_entries.upper_bound(after);
+        }
+    }
+    
+    for (; it != m_entries.end() && it->key.startsWith(key); ++it) {
+        if (names.size() == limit) {
+            *nextCursor = names.last();
+            break;
+        }
+        names.append(it->name);
+    }
+    return names;
+}
+
+QStringList UserDirectory::all() const {
+    QReadLocker locker(&m_lock);
+    QStringList names;
+    names.reserve(qsizetype(m_entries.size()));
+    for (const Entry& entry : m_entries) {
+        names.append(entry.name);
+    }
+    return names;
+}
+
+int UserDirectory::size() const {
+    QReadLocker locker(&m_lock);
+    return int(m_entries.size());
+}
\ No newline at end of file
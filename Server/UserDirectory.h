@@ -0,0 +1,40 @@
+#ifndef USERDIRECTORY_H
+#define USERDIRECTORY_H
+
+#include <QString>
+#include <QStringList>
+#include <QReadWriteLock>
+#include <set>
+
+// In-memory index of every registered username, ordered case-insensitively.
+// Prefix searches and cursor continuation are a tree lookup plus a short
+// walk, so directory queries never touch the database. Loaded once at
+// startup and kept current by registration.
+class UserDirectory {
+public:
+    void load(const QStringList& names);
+    void insert(const QString& name);
+    void merge(const QStringList& names); // adds the ones not already present
+    
+    // Up to limit names starting with prefix, after the name in cursor.
+    // nextCursor is left empty when nothing further matches.
+    QStringList search(const QString& prefix, const QString& cursor, int limit, QString *nextCursor) const;
+    QStringList all() const;
+    int size() const;
+    
+private:
+    struct Entry {
+        QString key; // case-folded name
+        QString name;
+        
+        bool operator<(const Entry& other) const {
+            if (key != other.key) return key < other.key;
+            return name < other.name;
+        }
+    };
+    
+    mutable QReadWriteLock m_lock;
+    std::set<Entry> m_entries;
+};
+
+#endif // USERDIRECTORY_H
\ No newline at end of file
@@ -1,19 +1,134 @@
 #include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QSslCertificate>
+#include <QSslKey>
+#include <QSslSocket>
 #include "ChatServer.h"
 #include <QDebug>
 
+#ifdef Q_OS_UNIX
+#include "HandoffManager.h"
+#endif
+
+// A self-signed pair for local runs:
+//   openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 365 \
+//     -subj /CN=localhost -addext subjectAltName=DNS:localhost,IP:127.0.0.1 \
+//     -keyout server.key -out server.crt
+// An EC key keeps full handshakes cheap when many clients reconnect at once.
+static bool loadTlsConfiguration(const QString& certPath, const QString& keyPath, QSslConfiguration *config) {
+    QList<QSslCertificate> chain = QSslCertificate::fromPath(certPath);
+    QFile keyFile(keyPath);
+    if (chain.isEmpty() || !keyFile.open(QIODevice::ReadOnly)) return false;
+    
+    QByteArray pem = keyFile.readAll();
+    QSslKey key(pem, QSsl::Ec);
+    if (key.isNull()) key = QSslKey(pem, QSsl::Rsa);
+    if (key.isNull()) return false;
+    
+    *config = QSslConfiguration::defaultConfiguration();
+    config->setLocalCertificateChain(chain);
+    config->setPrivateKey(key);
+    config->setProtocol(QSsl::TlsV1_2OrLater);
+    config->setPeerVerifyMode(QSslSocket::VerifyNone); // clients authenticate with LOGIN
+    
+    // Hand out session tickets so returning clients can skip the full handshake
+    config->setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+    return true;
+}
+
 int main(int argc, char *argv[]) {
     QCoreApplication app(argc, argv);
     
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption portOption("port", "Port to listen on.", "port", "12345");
+    QCommandLineOption handoffOption("handoff-socket", "Accept restart handoffs on this Unix socket.", "path");
+    QCommandLineOption takeoverOption("takeover", "Take over from the server listening on this handoff socket.", "path");
+    QCommandLineOption sessionsOption("takeover-sessions", "Also take over established client sessions.");
+    QCommandLineOption certOption("tls-cert", "Serve TLS with this PEM certificate chain.", "path");
+    QCommandLineOption keyOption("tls-key", "Private key (PEM) for --tls-cert.", "path");
+    QCommandLineOption messageLogOption("message-log", "Store messages in an append-only log in this directory instead of SQLite.", "dir");
+    QCommandLineOption archiveAgeOption("archive-after-days", "Move messages older than this many days into archive segments.", "days");
+    QCommandLineOption archiveDirOption("archive-dir", "Directory for archived message segments.", "dir", "archive");
+    QCommandLineOption ioUringOption("io-uring", "Serve plain connections from an io_uring reactor (Linux).");
+    QCommandLineOption captureOption("capture", "Record inbound traffic (including credentials) to this file for ChatReplay.", "path");
+    QCommandLineOption historyCacheOption("history-cache-mb", "Memory for recent conversation history (0 disables).", "mb", "64");
+    QCommandLineOption groupLimitOption("max-group-members", "Largest group members can join (0 for no limit).", "count", "10");
+    QCommandLineOption snapshotOption("snapshot", "Save in-memory state to this file and warm-start from it.", "path");
+    QCommandLineOption snapshotIntervalOption("snapshot-interval", "Seconds between snapshots.", "seconds", "300");
+    QCommandLineOption storageThreadsOption("storage-threads", "Threads running handlers' database calls.", "count", "4");
+    parser.addOptions({portOption, handoffOption, takeoverOption, sessionsOption, certOption, keyOption, messageLogOption,
+                       archiveAgeOption, archiveDirOption, historyCacheOption, captureOption, ioUringOption,
+                       storageThreadsOption, groupLimitOption, snapshotOption, snapshotIntervalOption});
+    parser.process(app);
+    
+    quint16 port = parser.value(portOption).toUShort();
+    
     qDebug() << "Starting Chat Server...";
     
-    ChatServer server;
-    if (!server.startServer(12345)) {
+    ChatServer server(parser.value(messageLogOption));
+    server.setHistoryCacheSize(parser.value(historyCacheOption).toLongLong() * 1024 * 1024);
+    server.setGroupMemberLimit(qMax(0, parser.value(groupLimitOption).toInt()));
+    server.setStorageThreads(qMax(1, parser.value(storageThreadsOption).toInt()));
+    
+    if (parser.isSet(certOption)) {
+        QSslConfiguration tls;
+        if (!QSslSocket::supportsSsl() ||
+            !loadTlsConfiguration(parser.value(certOption), parser.value(keyOption), &tls)) {
+            qDebug() << "Failed to set up TLS!";
+            return 1;
+        }
+        server.setTlsConfiguration(tls);
+        qDebug() << "TLS enabled";
+    }
+    
+    if (parser.isSet(ioUringOption) && !server.enableIoUring()) {
+        qDebug() << "Failed to set up io_uring!";
+        return 1;
+    }
+    
+    if (parser.isSet(captureOption) && !server.startCapture(parser.value(captureOption))) {
+        qDebug() << "Failed to open capture file!";
+        return 1;
+    }
+    
+    if (parser.isSet(archiveAgeOption) &&
+        !server.enableRetention(parser.value(archiveDirOption), parser.value(archiveAgeOption).toInt())) {
+        qDebug() << "Failed to set up message archiving!";
+        return 1;
+    }
+    
+    if (parser.isSet(snapshotOption)) {
+        server.enableSnapshots(parser.value(snapshotOption), qMax(10, parser.value(snapshotIntervalOption).toInt()));
+    }
+    server.warmUp();
+    
+#ifdef Q_OS_UNIX
+    HandoffManager handoff(&server);
+    
+    if (parser.isSet(takeoverOption)) {
+        if (!handoff.takeOver(parser.value(takeoverOption), parser.isSet(sessionsOption))) {
+            qDebug() << "Takeover failed!";
+            return 1;
+        }
+        qDebug() << "Took over listening socket from previous server";
+    } else
+#endif
+    if (!server.startServer(port)) {
         qDebug() << "Failed to start server!";
         return 1;
+    } else {
+        qDebug() << "Server started on port" << port;
+    }
+    
+#ifdef Q_OS_UNIX
+    if (parser.isSet(handoffOption)) {
+        handoff.listen(parser.value(handoffOption));
+        QObject::connect(&handoff, &HandoffManager::handoffComplete, &app, &QCoreApplication::quit);
     }
+#endif
     
-    qDebug() << "Server started on port 12345";
     qDebug() << "Waiting for connections...";
     
     return app.exec();
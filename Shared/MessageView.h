@@ -0,0 +1,173 @@
+#ifndef MESSAGEVIEW_H
+#define MESSAGEVIEW_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QStringView>
+#include <QDataStream>
+#include <QDateTime>
+#include <QtEndian>
+#include <memory>
+#include <vector>
+#include "Protocol.h"
+
+namespace ChatProtocol {
+
+// Bump allocator for decoded string data. Blocks never move, so views stay
+// valid until reset(), which the owner calls once per batch of frames.
+class FrameArena {
+public:
+    explicit FrameArena(qsizetype blockUnits = 8192) : m_blockUnits(blockUnits), m_used(0) {}
+    
+    char16_t* allocate(qsizetype units) {
+        if (m_blocks.empty() || m_used + units > m_blocks.back().size) {
+            qsizetype size = qMax(units, m_blockUnits);
+            m_blocks.push_back({std::make_unique<char16_t[]>(size), size});
+            m_used = 0;
+        }
+        char16_t *data = m_blocks.back().data.get() + m_used;
+        m_used += units;
+        return data;
+    }
+    
+    void reset() {
+        // Keep one standard block around so steady state allocates nothing
+        while (m_blocks.size() > 1 || (!m_blocks.empty() && m_blocks.back().size != m_blockUnits)) {
+            m_blocks.pop_back();
+        }
+        m_used = 0;
+    }
+    
+private:
+    struct Block {
+        std::unique_ptr<char16_t[]> data;
+        qsizetype size;
+    };
+    
+    std::vector<Block> m_blocks;
+    qsizetype m_blockUnits;
+    qsizetype m_used;
+};
+
+// Non-owning decode of a Message frame. Strings point into a FrameArena and
+// the timestamp into the frame buffer, so both must outlive the view;
+// call toString()/timestamp()/toMessage() for anything kept past dispatch.
+struct MessageView {
+    MessageType type = MessageType::ERROR_MSG;
+    QStringView sender;
+    QStringView recipient;
+    QStringView content;
+    int messageId = 0;
+    quint32 requestId = 0;
+    
+    QDateTime timestamp() const {
+        if (m_source) return m_source->timestamp;
+        
+        QDateTime result;
+        QByteArray raw = QByteArray::fromRawData(m_timestampData.data(), m_timestampData.size());
+        QDataStream in(raw);
+        in >> result;
+        return result;
+    }
+    
+    Message toMessage() const {
+        Message msg;
+        msg.type = type;
+        msg.sender = sender.toString();
+        msg.recipient = recipient.toString();
+        msg.content = content.toString();
+        msg.timestamp = timestamp();
+        msg.messageId = messageId;
+        msg.requestId = requestId;
+        return msg;
+    }
+    
+    // Wraps an already-decoded message (the slow path)
+    static MessageView fromMessage(const Message& msg) {
+        MessageView view;
+        view.type = msg.type;
+        view.sender = msg.sender;
+        view.recipient = msg.recipient;
+        view.content = msg.content;
+        view.messageId = msg.messageId;
+        view.requestId = msg.requestId;
+        view.m_source = &msg;
+        return view;
+    }
+    
+    // Mirrors Message::serialize() for the default QDataStream version.
+    // Returns false on anything unusual so the caller can fall back to
+    // Message::deserialize().
+    static bool decode(QByteArrayView frame, FrameArena& arena, MessageView *view) {
+        const char *p = frame.data();
+        const char *end = p + frame.size();
+        
+        auto readInt = [&](qint32 *out) {
+            if (end - p < 4) return false;
+            *out = qFromBigEndian<qint32>(p);
+            p += 4;
+            return true;
+        };
+        
+        auto readString = [&](QStringView *out) {
+            if (end - p < 4) return false;
+            quint32 bytes = qFromBigEndian<quint32>(p);
+            p += 4;
+            
+            if (bytes == 0xFFFFFFFF) { // null QString
+                *out = QStringView();
+                return true;
+            }
+            if (bytes == 0) {
+                *out = QStringView(u"");
+                return true;
+            }
+            if (bytes == 0xFFFFFFFE || (bytes & 1) || end - p < qint64(bytes)) return false;
+            
+            qsizetype units = bytes / 2;
+            char16_t *data = arena.allocate(units);
+            qFromBigEndian<quint16>(p, units, data);
+            p += bytes;
+            *out = QStringView(data, units);
+            return true;
+        };
+        
+        qint32 type = 0;
+        if (!readInt(&type)) return false;
+        view->type = static_cast<MessageType>(type);
+        
+        if (!readString(&view->sender) || !readString(&view->recipient) || !readString(&view->content)) {
+            return false;
+        }
+        
+        // QDateTime: qint64 julian day, quint32 msecs, qint8 spec, then a
+        // qint32 offset for Qt::OffsetFromUTC (2) or a QTimeZone for Qt::TimeZone (3)
+        const char *timestampStart = p;
+        if (end - p < 13) return false;
+        p += 12;
+        qint8 spec = qint8(*p++);
+        if (spec == Qt::OffsetFromUTC) {
+            if (end - p < 4) return false;
+            p += 4;
+        } else if (spec < 0 || spec >= Qt::TimeZone) {
+            return false; // time zones are left to QDataStream
+        }
+        view->m_timestampData = QByteArrayView(timestampStart, p - timestampStart);
+        
+        if (!readInt(&view->messageId)) return false;
+        
+        // Frames from older peers end before the request id
+        qint32 requestId = 0;
+        if (p != end && !readInt(&requestId)) return false;
+        view->requestId = quint32(requestId);
+        return p == end; // anything left over means we misread the layout
+    }
+    
+private:
+    QByteArrayView m_timestampData;
+    const Message *m_source = nullptr;
+};
+
+} // namespace ChatProtocol
+
+#endif // MESSAGEVIEW_H
\ No newline at end of file
@@ -0,0 +1,145 @@
+#ifndef TRAFFICCAPTURE_H
+#define TRAFFICCAPTURE_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+namespace ChatProtocol {
+
+// Recording of inbound server traffic for replay against another build.
+// Each record is a connection opening, one decoded-length frame exactly as
+// the client sent it (after TLS), or a connection closing, stamped with
+// microseconds since the capture started. Frames include LOGIN and REGISTER
+// payloads, so a capture holds credentials.
+class TrafficCapture {
+public:
+    enum Event : quint8 {
+        OPEN,
+        FRAME,
+        CLOSE
+    };
+    
+    struct Record {
+        Event event = OPEN;
+        quint32 connection = 0;
+        qint64 offsetUs = 0;
+        QByteArray frame;
+    };
+    
+    ~TrafficCapture() { close(); }
+    
+    bool open(const QString& path) {
+        QMutexLocker locker(&m_mutex);
+        m_file.setFileName(path);
+        if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+        
+        m_stream.setDevice(&m_file);
+        m_stream << kMagic << kVersion;
+        m_clock.start();
+        return true;
+    }
+    
+    bool isOpen() const { return m_file.isOpen(); }
+    
+    // Safe from any thread; writes go through the file's buffer
+    void record(Event event, quint32 connection, QByteArrayView frame = QByteArrayView()) {
+        QMutexLocker locker(&m_mutex);
+        if (!m_file.isOpen()) return;
+        
+        m_stream << quint8(event) << connection << qint64(m_clock.nsecsElapsed() / 1000);
+        if (event == FRAME) {
+            m_stream << quint32(frame.size());
+            m_stream.writeRawData(frame.data(), int(frame.size()));
+        }
+    }
+    
+    void flush() {
+        QMutexLocker locker(&m_mutex);
+        if (m_file.isOpen()) m_file.flush();
+    }
+    
+    void close() {
+        QMutexLocker locker(&m_mutex);
+        if (!m_file.isOpen()) return;
+        m_stream.setDevice(nullptr);
+        m_file.close();
+    }
+    
+    static bool read(const QString& path, QList<Record> *records, QString *error) {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            *error = file.errorString();
+            return false;
+        }
+        
+        QDataStream stream(&file);
+        quint32 magic = 0;
+        quint16 version = 0;
+        stream >> magic >> version;
+        if (magic != kMagic || version != kVersion) {
+            *error = "not a traffic capture";
+            return false;
+        }
+        
+        // A capture cut short by a crash ends at its last whole record
+        while (!stream.atEnd()) {
+            Record record;
+            quint8 event = 0;
+            stream >> event >> record.connection >> record.offsetUs;
+            if (event == FRAME) {
+                quint32 size = 0;
+                stream >> size;
+                record.frame.resize(size);
+                if (stream.readRawData(record.frame.data(), int(size)) != int(size)) break;
+            }
+            if (stream.status() != QDataStream::Ok || event > CLOSE) break;
+            
+            record.event = Event(event);
+            records->append(record);
+        }
+        return true;
+    }
+    
+    // Writes records with their own offsets, e.g. a generated scenario
+    static bool write(const QString& path, const QList<Record>& records, QString *error) {
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            *error = file.errorString();
+            return false;
+        }
+        
+        QDataStream stream(&file);
+        stream << kMagic << kVersion;
+        for (const Record& record : records) {
+            stream << quint8(record.event) << record.connection << record.offsetUs;
+            if (record.event == FRAME) {
+                stream << quint32(record.frame.size());
+                stream.writeRawData(record.frame.constData(), int(record.frame.size()));
+            }
+        }
+        if (stream.status() != QDataStream::Ok || !file.flush()) {
+            *error = file.errorString();
+            return false;
+        }
+        return true;
+    }
+    
+private:
+    static constexpr quint32 kMagic = 0x43434150; // "CCAP"
+    static constexpr quint16 kVersion = 1;
+    
+    QFile m_file;
+    QDataStream m_stream;
+    QElapsedTimer m_clock;
+    QMutex m_mutex;
+};
+
+} // namespace ChatProtocol
+
+#endif // TRAFFICCAPTURE_H
\ No newline at end of file
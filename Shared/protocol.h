@@ -40,16 +40,106 @@ enum class MessageType {
     
     // Status
     ERROR_MSG,
-    SUCCESS_MSG
+    SUCCESS_MSG,
+    
+    // Connection health
+    HEARTBEAT,
+    HEARTBEAT_ACK,
+    
+    // Attachments (payload travels on the bulk channel)
+    ATTACHMENT_UPLOAD_REQUEST,
+    ATTACHMENT_UPLOAD_READY,
+    ATTACHMENT_DOWNLOAD_REQUEST,
+    ATTACHMENT_DOWNLOAD_READY,
+    
+    // Ephemeral events (forwarded, never stored)
+    TYPING,
+    GROUP_TYPING,
+    READ_RECEIPT,
+    
+    // History
+    HISTORY_SYNC_REQUEST,
+    
+    // Session resume
+    SESSION_TOKEN,
+    RESUME_SESSION,
+    RESUME_FAILURE,
+    
+    // User directory
+    DIRECTORY_SEARCH,
+    DIRECTORY_RESULT,
+    
+    // Closes every history reply, even an empty one
+    MESSAGE_HISTORY_END,
+    
+    // History page before a message id
+    HISTORY_BEFORE_REQUEST,
+    
+    // Leading parts of a long list; the last part has the list's own type
+    USERS_LIST_PART,
+    GROUPS_LIST_PART,
+    GROUP_MEMBERS_PART
 };
 
+// Either side sends HEARTBEAT after this long without traffic; the server
+// reaps a connection that stays silent for a further grace period.
+constexpr int HEARTBEAT_INTERVAL_MS = 30000;
+constexpr int HEARTBEAT_GRACE_MS = 15000;
+constexpr int AUTH_TIMEOUT_MS = 30000;
+
+// Attachment bytes use a second connection on port + BULK_PORT_OFFSET so a
+// transfer never delays chat frames. Chat messages reference the blob as
+// "ATTACHMENT:<sha256>:<size>:<filename>".
+constexpr quint16 BULK_PORT_OFFSET = 1;
+constexpr qint64 ATTACHMENT_CHUNK_SIZE = 64 * 1024;
+constexpr qint64 MAX_ATTACHMENT_SIZE = 512LL * 1024 * 1024;
+inline const char ATTACHMENT_PREFIX[] = "ATTACHMENT:";
+
+// A user who keeps typing re-announces it at most once per window; the
+// receiver hides the indicator after TYPING_DISPLAY_MS without a new one.
+// READ_RECEIPT content is the newest timestamp read (ms since epoch),
+// flushed at most once per READ_RECEIPT_FLUSH_MS.
+constexpr int TYPING_COALESCE_MS = 3000;
+constexpr int TYPING_DISPLAY_MS = 5000;
+constexpr int READ_RECEIPT_FLUSH_MS = 1000;
+
+// Stored messages carry their server id in messageId. HISTORY_BEFORE_REQUEST
+// asks for the HISTORY_PAGE_SIZE messages before the given id (0 for the
+// newest page), so scrolling back is unaffected by messages arriving
+// meanwhile. For MESSAGE_HISTORY_REQUEST it is the number of newest messages
+// to skip, kept for older clients. HISTORY_SYNC_REQUEST asks for up to
+// HISTORY_SYNC_LIMIT messages after the given id. Every history reply ends
+// with MESSAGE_HISTORY_END.
+constexpr int HISTORY_PAGE_SIZE = 100;
+constexpr int HISTORY_SYNC_LIMIT = 500;
+
+// After login the server sends SESSION_TOKEN "<token>:<privateId>:<groupId>"
+// with the newest stored ids. A reconnecting client sends RESUME_SESSION
+// from the user with "<token>:<privateId>:<groupId>" holding the newest ids
+// it received; the server replays anything newer, RESUME_REPLAY_LIMIT rows
+// of each kind per storage query until caught up, and answers with a fresh
+// SESSION_TOKEN whose ids never pass what it has sent.
+constexpr qint64 RESUME_TOKEN_LIFETIME_MS = 24LL * 60 * 60 * 1000;
+constexpr int RESUME_REPLAY_LIMIT = 1000;
+constexpr int RECONNECT_BASE_DELAY_MS = 500;
+constexpr int RECONNECT_MAX_DELAY_MS = 30000;
+
+// DIRECTORY_SEARCH: content = name prefix (case-insensitive), recipient =
+// cursor (the last name of the previous page, empty for the first),
+// messageId = page size (0 for the default). DIRECTORY_RESULT echoes the
+// prefix in sender, lists names comma-separated in content, and carries the
+// next cursor in recipient, empty once there is nothing more.
+constexpr int DIRECTORY_PAGE_SIZE = 200;
+constexpr int DIRECTORY_PAGE_MAX = 1000;
+
 struct Message {
     MessageType type;
     QString sender;
     QString recipient; // username for private, groupname for group
     QString content;
     QDateTime timestamp;
-    int messageId = 0;
+    int messageId = 0; // server id of stored messages
+    quint32 requestId = 0; // chosen by the client, echoed on every frame of the reply; 0 for pushes
     
     Message() : type(MessageType::ERROR_MSG), timestamp(QDateTime::currentDateTime()) {}
     
@@ -62,6 +152,7 @@ struct Message {
         stream << content;
         stream << timestamp;
         stream << messageId;
+        stream << requestId;
         return data;
     }
     
@@ -76,6 +167,7 @@ struct Message {
         stream >> msg.content;
         stream >> msg.timestamp;
         stream >> msg.messageId;
+        stream >> msg.requestId; // absent in frames from older peers, leaving 0
         return msg;
     }
 };